@@ -0,0 +1,850 @@
+#include "loopserver.h"
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <ws2tcpip.h>
+#else
+#include <arpa/inet.h>
+#include <netinet/in.h>
+#include <netinet/tcp.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#endif
+
+#include <algorithm>
+#include <array>
+#include <bit>
+#include <cctype>
+#include <charconv>
+#include <cstring>
+#include <deque>
+#include <iostream>
+#include <map>
+
+using namespace std::literals;
+
+#ifdef _WIN32
+static constexpr LoopServer::Socket InvalidSocket = INVALID_SOCKET;
+#else
+static constexpr int InvalidSocket = -1;
+#endif
+
+// 64 KiB of pattern plus one period, so any offset can be sent from one slice.
+static const std::array<char, 65536 + 251> s_Pattern = [] {
+  std::array<char, 65536 + 251> pattern;
+  for (size_t i = 0; i != pattern.size(); ++i) {
+    pattern[i] = LoopServer::GetByte(i);
+  }
+  return pattern;
+}();
+
+LoopServer::LoopServer()
+  : m_Listen(InvalidSocket)
+{
+#ifdef _WIN32
+  WSADATA data;
+  if (WSAStartup(MAKEWORD(2, 2), &data) != 0) {
+    std::cerr << "LoopServer Error: WSAStartup failed.\n";
+    return;
+  }
+#endif
+  m_Listen = socket(AF_INET, SOCK_STREAM, IPPROTO_TCP);
+  if (m_Listen == InvalidSocket) {
+    std::cerr << "LoopServer Error: can not create socket.\n";
+    return;
+  }
+
+  sockaddr_in address {};
+  address.sin_family = AF_INET;
+  address.sin_addr.s_addr = htonl(INADDR_LOOPBACK);
+  address.sin_port = 0;
+  socklen_t length = sizeof(address);
+  if (bind(m_Listen, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0 ||
+    listen(m_Listen, SOMAXCONN) != 0 ||
+    getsockname(m_Listen, reinterpret_cast<sockaddr*>(&address), &length) != 0)
+  {
+    std::cerr << "LoopServer Error: can not listen on 127.0.0.1.\n";
+    CloseSocket(m_Listen);
+    m_Listen = InvalidSocket;
+    return;
+  }
+
+  m_Port = ntohs(address.sin_port);
+  m_Acceptor = std::thread(&LoopServer::Accept, this);
+}
+
+LoopServer::~LoopServer()
+{
+  m_Quit = true;
+  if (m_Listen != InvalidSocket) {
+    // Wakes up accept, the same for the clients' recv below.
+#ifdef _WIN32
+    shutdown(m_Listen, SD_BOTH);
+#else
+    shutdown(m_Listen, SHUT_RDWR);
+#endif
+    CloseSocket(m_Listen);
+  }
+  if (m_Acceptor.joinable()) {
+    m_Acceptor.join();
+  }
+
+  {
+    Locker locker(m_Mutex);
+    for (auto client: m_Clients) {
+#ifdef _WIN32
+      shutdown(client, SD_BOTH);
+#else
+      shutdown(client, SHUT_RDWR);
+#endif
+    }
+  }
+  for (auto& thread: m_Threads) {
+    thread.join();
+  }
+#ifdef _WIN32
+  WSACleanup();
+#endif
+}
+
+std::u8string LoopServer::GetUrl(size_t size) const
+{
+  auto const url = "http://127.0.0.1:" + std::to_string(m_Port) + "/bytes/" + std::to_string(size);
+  return std::u8string(url.begin(), url.end());
+}
+
+std::u8string LoopServer::GetOrigin() const
+{
+  auto const origin = "127.0.0.1:" + std::to_string(m_Port);
+  return std::u8string(origin.begin(), origin.end());
+}
+
+void LoopServer::CloseSocket(Socket socket)
+{
+#ifdef _WIN32
+  closesocket(socket);
+#else
+  close(socket);
+#endif
+}
+
+void LoopServer::Accept()
+{
+  while (!m_Quit) {
+    auto const client = accept(m_Listen, nullptr, nullptr);
+    if (client == InvalidSocket) {
+      if (m_Quit) break;
+      continue;
+    }
+    // Small responses should not wait for Nagle.
+    int flag = 1;
+    setsockopt(client, IPPROTO_TCP, TCP_NODELAY, reinterpret_cast<const char*>(&flag), sizeof(flag));
+
+    Locker locker(m_Mutex);
+    if (m_Quit) {
+      CloseSocket(client);
+      break;
+    }
+    m_Clients.push_back(client);
+    m_Threads.emplace_back(&LoopServer::Serve, this, client);
+  }
+}
+
+void LoopServer::Serve(Socket client)
+{
+  std::string buffer;
+  char chunk[4096];
+  while (!m_Quit) {
+    auto const end = buffer.find("\r\n\r\n");
+    if (end == std::string::npos) {
+      auto const size = recv(client, chunk, sizeof(chunk), 0);
+      if (size <= 0) break;
+      buffer.append(chunk, static_cast<size_t>(size));
+      continue;
+    }
+    if (buffer.starts_with("PRI * HTTP/2.0\r\n")) {
+      // h2c with prior knowledge, the rest of the connection is HTTP/2.
+      ServeHttp2(client, std::move(buffer));
+      break;
+    }
+    // Requests carry no body, so the header block is the whole request.
+    auto const request = buffer.substr(0, end + 2);
+    buffer.erase(0, end + 4);
+    if (request.starts_with("GET /ws ")) {
+      // Upgraded, the rest of the connection is WebSocket frames.
+      ServeWebSocket(client, request, std::move(buffer));
+      break;
+    }
+    if (!Respond(client, request)) break;
+  }
+
+  Locker locker(m_Mutex);
+  m_Clients.erase(std::find(m_Clients.begin(), m_Clients.end(), client));
+  CloseSocket(client);
+}
+
+static std::string_view GetHeader(std::string_view request, std::string_view name)
+{
+  for (size_t pos = request.find("\r\n"); pos != std::string_view::npos; ) {
+    auto const start = pos + 2;
+    pos = request.find("\r\n", start);
+    if (pos == std::string_view::npos) break;
+    auto line = request.substr(start, pos - start);
+    auto const colon = line.find(':');
+    if (colon != name.size()) continue;
+    if (!std::equal(name.begin(), name.end(), line.begin(), [](char a, char b) {
+      return std::tolower(static_cast<unsigned char>(a)) == std::tolower(static_cast<unsigned char>(b));
+    })) continue;
+    line.remove_prefix(colon + 1);
+    while (!line.empty() && line.front() == ' ') line.remove_prefix(1);
+    return line;
+  }
+  return {};
+}
+
+template<typename Integer>
+static bool ParseNumber(std::string_view text, Integer& value)
+{
+  auto const [ptr, ec] = std::from_chars(text.data(), text.data() + text.size(), value);
+  return ec == std::errc() && ptr == text.data() + text.size();
+}
+
+bool LoopServer::Respond(Socket client, const std::string& request)
+{
+  std::string_view const line(request.data(), request.find("\r\n"));
+  auto const methodEnd = line.find(' ');
+  auto const pathEnd = line.find(' ', methodEnd + 1);
+  if (methodEnd == std::string_view::npos || pathEnd == std::string_view::npos) {
+    return false;
+  }
+  auto const method = line.substr(0, methodEnd);
+  auto path = line.substr(methodEnd + 1, pathEnd - methodEnd - 1);
+  path = path.substr(0, path.find('?'));
+  bool const head = method == "HEAD";
+  bool const keepAlive = GetHeader(request, "Connection") != "close";
+  if (method == "GET" && path == "/sse") {
+    return ServeEvents(client, request);
+  }
+  bool const flaky = path.starts_with("/flaky/"), stall = path.starts_with("/stall/");
+  if (method == "GET" && (flaky || stall)) {
+    bool first = false;
+    {
+      Locker locker(m_Mutex);
+      first = m_Seen.emplace(path).second;
+    }
+    if (first && stall) {
+      // Held open until the client goes away.
+      char chunk[256];
+      while (!m_Quit && recv(client, chunk, sizeof(chunk), 0) > 0) {}
+      return false;
+    }
+    auto const reply = first ?
+      "HTTP/1.1 503 Service Unavailable\r\nRetry-After: 0\r\nContent-Length: 0\r\n\r\n"sv :
+      "HTTP/1.1 200 OK\r\nContent-Length: 2\r\n\r\nok"sv;
+    return SendAll(client, reply.data(), reply.size()) && keepAlive;
+  }
+
+  uint64_t size = 0;
+  constexpr std::string_view prefix = "/bytes/";
+  if ((method != "GET" && !head) || !path.starts_with(prefix) ||
+    !ParseNumber(path.substr(prefix.size()), size))
+  {
+    constexpr std::string_view notFound =
+      "HTTP/1.1 404 Not Found\r\nContent-Length: 0\r\n\r\n";
+    return SendAll(client, notFound.data(), notFound.size()) && keepAlive;
+  }
+
+  // A single "bytes=first-[last]" range, as HttpDownload and resume send.
+  uint64_t first = 0, last = size ? size - 1 : 0;
+  bool partial = false;
+  if (auto range = GetHeader(request, "Range"); range.starts_with("bytes=") && size) {
+    range.remove_prefix(6);
+    auto const dash = range.find('-');
+    uint64_t rangeFirst = 0, rangeLast = size - 1;
+    if (dash != std::string_view::npos && ParseNumber(range.substr(0, dash), rangeFirst) &&
+      (dash + 1 == range.size() || ParseNumber(range.substr(dash + 1), rangeLast)))
+    {
+      if (rangeFirst >= size || rangeFirst > rangeLast) {
+        auto const reply = "HTTP/1.1 416 Range Not Satisfiable\r\nContent-Range: bytes */" +
+          std::to_string(size) + "\r\nContent-Length: 0\r\n\r\n";
+        return SendAll(client, reply.data(), reply.size()) && keepAlive;
+      }
+      first = rangeFirst;
+      last = std::min(rangeLast, size - 1);
+      partial = true;
+    }
+  }
+  auto const length = size ? last - first + 1 : 0;
+
+  std::string reply = partial ? "HTTP/1.1 206 Partial Content\r\n" : "HTTP/1.1 200 OK\r\n";
+  reply += "Content-Type: application/octet-stream\r\n";
+  reply += "Accept-Ranges: bytes\r\n";
+  reply += "ETag: \"" + std::to_string(size) + "\"\r\n";
+  if (partial) {
+    reply += "Content-Range: bytes " + std::to_string(first) + '-' + std::to_string(last) +
+      '/' + std::to_string(size) + "\r\n";
+  }
+  reply += "Content-Length: " + std::to_string(length) + "\r\n";
+  if (!keepAlive) reply += "Connection: close\r\n";
+  reply += "\r\n";
+  if (!SendAll(client, reply.data(), reply.size())) return false;
+  if (head) return keepAlive;
+
+  for (auto offset = first; offset <= last && length; ) {
+    auto const count = std::min<uint64_t>(last + 1 - offset, 65536);
+    if (!SendAll(client, s_Pattern.data() + offset % 251, static_cast<size_t>(count))) {
+      return false;
+    }
+    offset += count;
+  }
+  return keepAlive;
+}
+
+bool LoopServer::ServeEvents(Socket client, const std::string& request)
+{
+  constexpr std::string_view head = "HTTP/1.1 200 OK\r\nContent-Type: text/event-stream\r\n"
+    "Cache-Control: no-cache\r\nConnection: close\r\n\r\n";
+  if (!SendAll(client, head.data(), head.size())) return false;
+
+  auto const last = GetHeader(request, "Last-Event-ID");
+  if (last.empty()) {
+    // A BOM, both line ends, a comment, a field without a colon and an
+    // event that keeps the id before it, in pieces that split the lines.
+    constexpr std::string_view events = "\xEF\xBB\xBFretry: 100\n: keep-alive\n"
+      "id: 1\ndata: first\n\n"
+      "id: 2\r\nevent: multi\r\ndata: line one\r\ndata:line two\r\ndata\r\n\r\n"
+      "data: same id\n\n";
+    for (size_t offset = 0; offset < events.size(); offset += 7) {
+      auto const piece = events.substr(offset, 7);
+      if (!SendAll(client, piece.data(), piece.size())) return false;
+      std::this_thread::sleep_for(1ms);
+    }
+    return false;   // the client comes back with Last-Event-ID
+  }
+
+  auto const resumed = "id: 3\ndata: resumed after " + std::string(last) + "\n\n";
+  if (!SendAll(client, resumed.data(), resumed.size())) return false;
+  // Held open until the client goes away.
+  char chunk[256];
+  while (!m_Quit && recv(client, chunk, sizeof(chunk), 0) > 0) {}
+  return false;
+}
+
+// SHA-1 and Base64, for Sec-WebSocket-Accept only.
+static std::string Sha1(std::string_view text)
+{
+  uint32_t hash[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  std::string message(text);
+  message.push_back('\x80');
+  while (message.size() % 64 != 56) message.push_back('\0');
+  auto const bits = static_cast<uint64_t>(text.size()) * 8;
+  for (int i = 7; i >= 0; --i) {
+    message.push_back(static_cast<char>(bits >> (i * 8)));
+  }
+
+  for (size_t block = 0; block != message.size(); block += 64) {
+    auto const bytes = reinterpret_cast<const uint8_t*>(message.data() + block);
+    uint32_t words[80];
+    for (int i = 0; i != 16; ++i) {
+      words[i] = uint32_t(bytes[i * 4]) << 24 | uint32_t(bytes[i * 4 + 1]) << 16 |
+        uint32_t(bytes[i * 4 + 2]) << 8 | bytes[i * 4 + 3];
+    }
+    for (int i = 16; i != 80; ++i) {
+      words[i] = std::rotl(words[i - 3] ^ words[i - 8] ^ words[i - 14] ^ words[i - 16], 1);
+    }
+    auto a = hash[0], b = hash[1], c = hash[2], d = hash[3], e = hash[4];
+    for (int i = 0; i != 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d), k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d, k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d, k = 0xCA62C1D6;
+      }
+      auto const temp = std::rotl(a, 5) + f + e + k + words[i];
+      e = d, d = c, c = std::rotl(b, 30), b = a, a = temp;
+    }
+    hash[0] += a, hash[1] += b, hash[2] += c, hash[3] += d, hash[4] += e;
+  }
+
+  std::string digest;
+  for (auto word: hash) {
+    for (int i = 3; i >= 0; --i) digest.push_back(static_cast<char>(word >> (i * 8)));
+  }
+  return digest;
+}
+
+static std::string Base64(std::string_view data)
+{
+  constexpr char digits[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string result;
+  for (size_t i = 0; i < data.size(); i += 3) {
+    uint32_t group = uint32_t(static_cast<uint8_t>(data[i])) << 16;
+    if (i + 1 < data.size()) group |= uint32_t(static_cast<uint8_t>(data[i + 1])) << 8;
+    if (i + 2 < data.size()) group |= static_cast<uint8_t>(data[i + 2]);
+    result.push_back(digits[group >> 18 & 63]);
+    result.push_back(digits[group >> 12 & 63]);
+    result.push_back(i + 1 < data.size() ? digits[group >> 6 & 63] : '=');
+    result.push_back(i + 2 < data.size() ? digits[group & 63] : '=');
+  }
+  return result;
+}
+
+bool LoopServer::SendWebSocket(Socket client, uint8_t opcode, std::string_view payload, bool fin)
+{
+  // Frames of a server go unmasked.
+  std::string frame { static_cast<char>((fin ? 0x80 : 0) | opcode) };
+  auto const size = payload.size();
+  if (size < 126) {
+    frame.push_back(static_cast<char>(size));
+  } else if (size <= 0xFFFF) {
+    frame.push_back(126);
+    frame.push_back(static_cast<char>(size >> 8));
+    frame.push_back(static_cast<char>(size));
+  } else {
+    frame.push_back(127);
+    for (int i = 7; i >= 0; --i) {
+      frame.push_back(static_cast<char>(static_cast<uint64_t>(size) >> (i * 8)));
+    }
+  }
+  frame += payload;
+  return SendAll(client, frame.data(), frame.size());
+}
+
+void LoopServer::ServeWebSocket(Socket client, const std::string& request, std::string buffer)
+{
+  auto const key = GetHeader(request, "Sec-WebSocket-Key");
+  std::string reply = "HTTP/1.1 101 Switching Protocols\r\nUpgrade: websocket\r\n"
+    "Connection: Upgrade\r\nSec-WebSocket-Accept: ";
+  reply += Base64(Sha1(std::string(key) + "258EAFA5-E914-47DA-95CA-C5AB0DC85B11"));
+  reply += "\r\n\r\n";
+  // The client has to answer this one; its pong is reported back as text.
+  if (!SendAll(client, reply.data(), reply.size()) || !SendWebSocket(client, 0x9, "loop")) {
+    return;
+  }
+
+  size_t pings = 0;
+  char chunk[4096];
+  while (!m_Quit) {
+    // Frames of a client are masked, and whole: HttpWebSocket never splits them.
+    auto const bytes = reinterpret_cast<const uint8_t*>(buffer.data());
+    size_t header = 0;
+    uint64_t length = 0;
+    if (buffer.size() >= 2) {
+      length = bytes[1] & 0x7F;
+      auto const extra = length == 126 ? 2 : length == 127 ? 8 : 0;
+      if (buffer.size() >= 2u + extra) {
+        header = 2 + extra;
+        if (extra) length = 0;
+        for (size_t i = 2; i != header; ++i) {
+          length = length << 8 | bytes[i];
+        }
+      }
+    }
+    if (!header || buffer.size() < header + 4 + length) {
+      auto const size = recv(client, chunk, sizeof(chunk), 0);
+      if (size <= 0) return;
+      buffer.append(chunk, static_cast<size_t>(size));
+      continue;
+    }
+
+    auto const opcode = static_cast<uint8_t>(bytes[0] & 0x0F);
+    auto payload = buffer.substr(header + 4, static_cast<size_t>(length));
+    for (size_t i = 0; i != payload.size(); ++i) {
+      payload[i] ^= buffer[header + i % 4];
+    }
+    buffer.erase(0, header + 4 + static_cast<size_t>(length));
+
+    bool ok = true;
+    if (opcode == 0x1 && payload == "pings?") {
+      ok = SendWebSocket(client, 0x1, "pings " + std::to_string(pings));
+    } else if (opcode == 0x1 && payload == "fragments") {
+      // With a ping among the fragments, where control frames may come.
+      ok = SendWebSocket(client, 0x1, "frag", false) && SendWebSocket(client, 0x9, "mid") &&
+        SendWebSocket(client, 0x0, "ment", false) && SendWebSocket(client, 0x0, "ed");
+    } else if (opcode == 0x1 || opcode == 0x2) {
+      ok = SendWebSocket(client, opcode, payload);
+    } else if (opcode == 0x9) {
+      ++pings;
+      ok = SendWebSocket(client, 0xA, payload);
+    } else if (opcode == 0xA) {
+      ok = SendWebSocket(client, 0x1, "pong " + payload);
+    } else {
+      // A close, echoed with its code and reason, or something unknown.
+      if (opcode == 0x8) SendWebSocket(client, 0x8, payload);
+      return;
+    }
+    if (!ok) return;
+  }
+}
+
+// HPACK Huffman code lengths (RFC 7541, appendix B). The code is canonical,
+// so the codes themselves follow from the lengths.
+static constexpr uint8_t s_HuffmanLengths[257] = {
+  13, 23, 28, 28, 28, 28, 28, 28, 28, 24, 30, 28, 28, 30, 28, 28,
+  28, 28, 28, 28, 28, 28, 30, 28, 28, 28, 28, 28, 28, 28, 28, 28,
+   6, 10, 10, 12, 13,  6,  8, 11, 10, 10,  8, 11,  8,  6,  6,  6,
+   5,  5,  5,  6,  6,  6,  6,  6,  6,  6,  7,  8, 15,  6, 12, 10,
+  13,  6,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,  7,
+   7,  7,  7,  7,  7,  7,  7,  7,  8,  7,  8, 13, 19, 13, 14,  6,
+  15,  5,  6,  5,  6,  5,  6,  6,  6,  5,  7,  7,  6,  6,  6,  5,
+   6,  7,  6,  5,  5,  6,  7,  7,  7,  7,  7, 15, 11, 14, 13, 28,
+  20, 22, 20, 20, 22, 22, 22, 23, 22, 23, 23, 23, 23, 23, 24, 23,
+  24, 24, 22, 23, 24, 23, 23, 23, 23, 21, 22, 23, 22, 23, 23, 24,
+  22, 21, 20, 22, 22, 23, 23, 21, 23, 22, 22, 24, 21, 22, 23, 23,
+  21, 21, 22, 21, 23, 22, 23, 23, 20, 22, 22, 22, 23, 22, 22, 23,
+  26, 26, 20, 19, 22, 23, 22, 25, 26, 26, 26, 27, 27, 26, 24, 25,
+  19, 21, 26, 27, 27, 26, 27, 24, 21, 21, 26, 26, 28, 27, 27, 27,
+  20, 24, 20, 21, 22, 21, 21, 23, 22, 22, 25, 25, 24, 24, 26, 23,
+  26, 27, 26, 26, 27, 27, 27, 27, 27, 28, 27, 27, 27, 27, 27, 26,
+  30,
+};
+
+static bool DecodeHuffman(std::string_view input, std::string& output)
+{
+  // Per length: how many codes, the first of them and where its symbols
+  // start in the sorted list.
+  struct Table {
+    std::array<uint32_t, 31> count {}, first {}, index {};
+    std::array<uint16_t, 257> symbols {};
+  };
+  static const Table table = [] {
+    Table table;
+    for (auto length: s_HuffmanLengths) ++table.count[length];
+    uint32_t code = 0, index = 0;
+    for (size_t length = 1; length != table.count.size(); ++length) {
+      table.first[length] = code;
+      table.index[length] = index;
+      code = (code + table.count[length]) << 1;
+      index += table.count[length];
+    }
+    auto next = table.index;
+    for (uint16_t symbol = 0; symbol != 257; ++symbol) {
+      table.symbols[next[s_HuffmanLengths[symbol]]++] = symbol;
+    }
+    return table;
+  }();
+
+  uint32_t code = 0;
+  size_t length = 0;
+  for (auto const byte: input) {
+    for (int bit = 7; bit >= 0; --bit) {
+      code = code << 1 | ((static_cast<uint8_t>(byte) >> bit) & 1);
+      if (++length == table.count.size()) return false;
+      auto const offset = code - table.first[length];
+      if (code < table.first[length] || offset >= table.count[length]) continue;
+      auto const symbol = table.symbols[table.index[length] + offset];
+      if (symbol == 256) return false;
+      output.push_back(static_cast<char>(symbol));
+      code = 0;
+      length = 0;
+    }
+  }
+  // What is left must be a prefix of EOS, all ones.
+  return length < 8 && code == (1u << length) - 1;
+}
+
+// Just enough of HPACK to read a request: the dynamic table has to be kept
+// because clients index their repeated headers.
+class HpackDecoder {
+public:
+  typedef std::pair<std::string, std::string> Header;
+
+  bool Decode(std::string_view block, std::vector<Header>& headers)
+  {
+    while (!block.empty()) {
+      auto const byte = static_cast<uint8_t>(block.front());
+      uint64_t index = 0;
+      if (byte & 0x80) {
+        if (!ReadInteger(block, 7, index) || !index || index > 61 + m_Table.size()) return false;
+        headers.push_back(Lookup(index));
+        continue;
+      }
+      if ((byte & 0xE0) == 0x20) {
+        if (!ReadInteger(block, 5, index) || index > 4096) return false;
+        m_MaxSize = static_cast<size_t>(index);
+        Evict();
+        continue;
+      }
+      // Literals: with indexing (6-bit prefix), without or never (4-bit).
+      auto const indexing = (byte & 0xC0) == 0x40;
+      Header header;
+      if (!ReadInteger(block, indexing ? 6 : 4, index) || index > 61 + m_Table.size()) return false;
+      if (index) {
+        header.first = Lookup(index).first;
+      } else if (!ReadString(block, header.first)) {
+        return false;
+      }
+      if (!ReadString(block, header.second)) return false;
+      if (indexing) {
+        m_Size += header.first.size() + header.second.size() + 32;
+        m_Table.push_front(header);
+        Evict();
+      }
+      headers.push_back(std::move(header));
+    }
+    return true;
+  }
+private:
+  static bool ReadInteger(std::string_view& block, int prefix, uint64_t& value)
+  {
+    auto const mask = (1u << prefix) - 1;
+    value = static_cast<uint8_t>(block.front()) & mask;
+    block.remove_prefix(1);
+    if (value < mask) return true;
+    for (int shift = 0; shift < 56; shift += 7) {
+      if (block.empty()) return false;
+      auto const byte = static_cast<uint8_t>(block.front());
+      block.remove_prefix(1);
+      value += static_cast<uint64_t>(byte & 0x7F) << shift;
+      if (!(byte & 0x80)) return true;
+    }
+    return false;
+  }
+
+  static bool ReadString(std::string_view& block, std::string& value)
+  {
+    if (block.empty()) return false;
+    auto const huffman = static_cast<uint8_t>(block.front()) & 0x80;
+    uint64_t length = 0;
+    if (!ReadInteger(block, 7, length) || length > block.size()) return false;
+    auto const data = block.substr(0, static_cast<size_t>(length));
+    block.remove_prefix(data.size());
+    if (huffman) return DecodeHuffman(data, value);
+    value = data;
+    return true;
+  }
+
+  Header Lookup(uint64_t index) const
+  {
+    static const char* const names[61][2] = {
+      { ":authority", "" }, { ":method", "GET" }, { ":method", "POST" },
+      { ":path", "/" }, { ":path", "/index.html" }, { ":scheme", "http" },
+      { ":scheme", "https" }, { ":status", "200" }, { ":status", "204" },
+      { ":status", "206" }, { ":status", "304" }, { ":status", "400" },
+      { ":status", "404" }, { ":status", "500" }, { "accept-charset", "" },
+      { "accept-encoding", "gzip, deflate" }, { "accept-language", "" },
+      { "accept-ranges", "" }, { "accept", "" }, { "access-control-allow-origin", "" },
+      { "age", "" }, { "allow", "" }, { "authorization", "" }, { "cache-control", "" },
+      { "content-disposition", "" }, { "content-encoding", "" }, { "content-language", "" },
+      { "content-length", "" }, { "content-location", "" }, { "content-range", "" },
+      { "content-type", "" }, { "cookie", "" }, { "date", "" }, { "etag", "" },
+      { "expect", "" }, { "expires", "" }, { "from", "" }, { "host", "" },
+      { "if-match", "" }, { "if-modified-since", "" }, { "if-none-match", "" },
+      { "if-range", "" }, { "if-unmodified-since", "" }, { "last-modified", "" },
+      { "link", "" }, { "location", "" }, { "max-forwards", "" },
+      { "proxy-authenticate", "" }, { "proxy-authorization", "" }, { "range", "" },
+      { "referer", "" }, { "refresh", "" }, { "retry-after", "" }, { "server", "" },
+      { "set-cookie", "" }, { "strict-transport-security", "" },
+      { "transfer-encoding", "" }, { "user-agent", "" }, { "vary", "" }, { "via", "" },
+      { "www-authenticate", "" },
+    };
+    if (index <= 61) return { names[index - 1][0], names[index - 1][1] };
+    return m_Table[static_cast<size_t>(index - 62)];
+  }
+
+  void Evict()
+  {
+    while (m_Size > m_MaxSize) {
+      m_Size -= m_Table.back().first.size() + m_Table.back().second.size() + 32;
+      m_Table.pop_back();
+    }
+  }
+
+  std::deque<Header> m_Table;
+  size_t m_Size = 0;
+  size_t m_MaxSize = 4096;
+};
+
+bool LoopServer::SendFrame(Socket client, uint8_t type, uint8_t flags, uint32_t stream,
+  std::string_view payload)
+{
+  std::string frame {
+    static_cast<char>(payload.size() >> 16), static_cast<char>(payload.size() >> 8),
+    static_cast<char>(payload.size()), static_cast<char>(type), static_cast<char>(flags),
+    static_cast<char>(stream >> 24), static_cast<char>(stream >> 16),
+    static_cast<char>(stream >> 8), static_cast<char>(stream),
+  };
+  frame += payload;
+  return SendAll(client, frame.data(), frame.size());
+}
+
+void LoopServer::ServeHttp2(Socket client, std::string buffer)
+{
+  enum : uint8_t { Data, Headers, Priority, RstStream, Settings, PushPromise, Ping, GoAway, WindowUpdate, Continuation };
+  enum : uint8_t { Ack = 0x1, EndStream = 0x1, EndHeaders = 0x4, Padded = 0x8, HasPriority = 0x20 };
+
+  auto const read = [&](size_t size) {
+    char chunk[4096];
+    while (buffer.size() < size && !m_Quit) {
+      auto const count = recv(client, chunk, sizeof(chunk), 0);
+      if (count <= 0) return false;
+      buffer.append(chunk, static_cast<size_t>(count));
+    }
+    return buffer.size() >= size;
+  };
+  auto const readUint32 = [](const char* data) {
+    return uint32_t(uint8_t(data[0])) << 24 | uint32_t(uint8_t(data[1])) << 16 |
+      uint32_t(uint8_t(data[2])) << 8 | uint8_t(data[3]);
+  };
+
+  constexpr std::string_view preface = "PRI * HTTP/2.0\r\n\r\nSM\r\n\r\n";
+  if (!read(preface.size()) || !buffer.starts_with(preface)) return;
+  buffer.erase(0, preface.size());
+  if (!SendFrame(client, Settings, 0, 0, {})) return;
+
+  // Bodies wait for the peer's flow control windows, the connection's and
+  // their stream's.
+  struct Pending {
+    uint32_t stream;
+    uint64_t size;
+    uint64_t sent;
+  };
+  std::deque<Pending> pending;
+  std::map<uint32_t, int64_t> windows;
+  int64_t connection = 65535, initial = 65535;
+  size_t maxFrame = 16384;
+  HpackDecoder decoder;
+  std::string block;
+  uint32_t blockStream = 0;
+
+  auto const respond = [&](uint32_t stream, std::string_view block) {
+    std::vector<HpackDecoder::Header> headers;
+    if (!decoder.Decode(block, headers)) return false;
+    std::string_view method, path;
+    for (auto const& [name, value]: headers) {
+      if (name == ":method") method = value;
+      else if (name == ":path") path = value;
+    }
+    path = path.substr(0, path.find('?'));
+
+    uint64_t size = 0;
+    constexpr std::string_view prefix = "/bytes/";
+    bool const found = (method == "GET" || method == "HEAD") && path.starts_with(prefix) &&
+      ParseNumber(path.substr(prefix.size()), size);
+    if (!found) size = 0;
+    bool const body = found && method == "GET" && size;
+
+    // :status from the static table, content-length as a literal with its
+    // name from there too; nothing goes into the peer's dynamic table.
+    auto const length = std::to_string(size);
+    std::string reply = found ? "\x88" : "\x8d";
+    reply += "\x0f\x0d";
+    reply += static_cast<char>(length.size());
+    reply += length;
+    if (!SendFrame(client, Headers, EndHeaders | (body ? 0 : EndStream), stream, reply)) return false;
+    if (body) {
+      pending.push_back({ stream, size, 0 });
+      windows[stream] = initial;
+    }
+    return true;
+  };
+
+  auto const flush = [&]() {
+    for (auto iter = pending.begin(); iter != pending.end(); ) {
+      auto& window = windows[iter->stream];
+      while (iter->sent != iter->size && connection > 0 && window > 0) {
+        auto const count = static_cast<size_t>(std::min<uint64_t>({ iter->size - iter->sent,
+          maxFrame, 65536, static_cast<uint64_t>(connection), static_cast<uint64_t>(window) }));
+        auto const last = iter->sent + count == iter->size;
+        if (!SendFrame(client, Data, last ? EndStream : 0, iter->stream,
+          std::string_view(s_Pattern.data() + iter->sent % 251, count))) return false;
+        iter->sent += count;
+        connection -= static_cast<int64_t>(count);
+        window -= static_cast<int64_t>(count);
+      }
+      if (iter->sent == iter->size) {
+        windows.erase(iter->stream);
+        iter = pending.erase(iter);
+      } else {
+        ++iter;
+      }
+    }
+    return true;
+  };
+
+  while (!m_Quit && read(9)) {
+    auto const size = size_t(uint8_t(buffer[0])) << 16 | size_t(uint8_t(buffer[1])) << 8 | uint8_t(buffer[2]);
+    auto const type = static_cast<uint8_t>(buffer[3]);
+    auto const flags = static_cast<uint8_t>(buffer[4]);
+    auto const stream = readUint32(buffer.data() + 5) & 0x7FFFFFFF;
+    if (size > (1 << 20) || !read(9 + size)) break;
+    std::string_view payload(buffer.data() + 9, size);
+
+    bool ok = true;
+    if (blockStream) {
+      // A header block in pieces admits nothing but its continuation.
+      if (type != Continuation || stream != blockStream) break;
+      block += payload;
+      if (flags & EndHeaders) {
+        ok = respond(blockStream, block);
+        block.clear();
+        blockStream = 0;
+      }
+    } else if (type == Headers) {
+      if (flags & Padded) {
+        if (payload.empty() || uint8_t(payload[0]) >= payload.size()) break;
+        payload = payload.substr(1, payload.size() - 1 - uint8_t(payload[0]));
+      }
+      if (flags & HasPriority) {
+        if (payload.size() < 5) break;
+        payload.remove_prefix(5);
+      }
+      if (flags & EndHeaders) {
+        ok = respond(stream, payload);
+      } else {
+        block = payload;
+        blockStream = stream;
+      }
+    } else if (type == Settings && !(flags & Ack)) {
+      for (size_t i = 0; i + 6 <= payload.size(); i += 6) {
+        auto const id = uint16_t(uint8_t(payload[i])) << 8 | uint8_t(payload[i + 1]);
+        auto const value = readUint32(payload.data() + i + 2);
+        if (id == 0x4) {
+          // The new initial window shifts every open stream's window.
+          for (auto& [_, window]: windows) window += int64_t(value) - initial;
+          initial = value;
+        } else if (id == 0x5) {
+          maxFrame = value;
+        }
+      }
+      ok = SendFrame(client, Settings, Ack, 0, {});
+    } else if (type == Ping && !(flags & Ack)) {
+      ok = SendFrame(client, Ping, Ack, 0, payload);
+    } else if (type == WindowUpdate && payload.size() == 4) {
+      auto const increment = readUint32(payload.data()) & 0x7FFFFFFF;
+      if (!stream) {
+        connection += increment;
+      } else if (auto const iter = windows.find(stream); iter != windows.end()) {
+        iter->second += increment;
+      }
+    } else if (type == RstStream) {
+      pending.erase(std::remove_if(pending.begin(), pending.end(), [stream](auto& item) {
+        return item.stream == stream;
+      }), pending.end());
+      windows.erase(stream);
+    } else if (type == GoAway) {
+      break;
+    }
+    buffer.erase(0, 9 + size);
+    if (!ok || !flush()) break;
+  }
+}
+
+bool LoopServer::SendAll(Socket client, const char* data, size_t size)
+{
+  while (size) {
+#ifdef _WIN32
+    auto const sent = send(client, data, static_cast<int>(std::min<size_t>(size, INT_MAX)), 0);
+#else
+    auto const sent = send(client, data, size, MSG_NOSIGNAL);
+#endif
+    if (sent <= 0) return false;
+    data += sent;
+    size -= static_cast<size_t>(sent);
+  }
+  return true;
+}
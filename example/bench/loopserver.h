@@ -0,0 +1,68 @@
+#ifndef LOOPSERVER_H
+#define LOOPSERVER_H
+
+#include <atomic>
+#include <cstdint>
+#include <mutex>
+#include <set>
+#include <string>
+#include <thread>
+#include <vector>
+
+/*
+ * A small HTTP/1.1 server on 127.0.0.1 for benchmarks and the loopback
+ * tests: GET and HEAD of
+ * /bytes/<n> return n bytes of a fixed pattern, with keep-alive, an ETag
+ * and single byte ranges, which is all HttpLib and HttpDownload ask for.
+ * A connection that opens with the HTTP/2 preface is served as h2c, the
+ * same paths without ranges, to compare the two protocols on one socket.
+ * For the stream tests, /ws is a WebSocket echo that pings first and
+ * answers a few commands, and /sse sends a fixed event stream, resumed
+ * after a Last-Event-ID. For retries and hedges, the first GET of each
+ * /flaky/<key> gets a 503 and the first of each /stall/<key> no reply at
+ * all; the ones after it get a short 200.
+ * One thread per connection; it is meant for the local machine only.
+ */
+class LoopServer {
+#ifdef _WIN32
+  typedef uintptr_t Socket;
+#else
+  typedef int Socket;
+#endif
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+public:
+  LoopServer();
+  ~LoopServer();
+  LoopServer(const LoopServer&) = delete;
+  LoopServer& operator=(const LoopServer&) = delete;
+
+  bool IsListening() const { return m_Port != 0; }
+  std::u8string GetUrl(size_t size) const;
+  // 127.0.0.1:<port>, to build other urls from.
+  std::u8string GetOrigin() const;
+  // Pattern byte at the given offset, to check what came back.
+  static char GetByte(uint64_t offset) { return static_cast<char>(offset % 251); }
+private:
+  void Accept();
+  void Serve(Socket client);
+  bool Respond(Socket client, const std::string& request);
+  void ServeHttp2(Socket client, std::string buffer);
+  void ServeWebSocket(Socket client, const std::string& request, std::string buffer);
+  bool ServeEvents(Socket client, const std::string& request);
+  static bool SendAll(Socket client, const char* data, size_t size);
+  static bool SendFrame(Socket client, uint8_t type, uint8_t flags, uint32_t stream, std::string_view payload);
+  static bool SendWebSocket(Socket client, uint8_t opcode, std::string_view payload, bool fin = true);
+  static void CloseSocket(Socket socket);
+
+  Socket m_Listen;
+  uint16_t m_Port = 0;
+  std::atomic_bool m_Quit = false;
+  std::thread m_Acceptor;
+  Mutex m_Mutex;
+  std::vector<Socket> m_Clients;
+  std::vector<std::thread> m_Threads;
+  std::set<std::string, std::less<>> m_Seen;
+};
+
+#endif  // LOOPSERVER_H
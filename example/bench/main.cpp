@@ -0,0 +1,274 @@
+#include "loopserver.h"
+
+#include <neobox/coroutine.h>
+#include <neobox/httpdownload.h>
+#include <neobox/httplib.h>
+#include <neobox/httpscheduler.h>
+
+#include <algorithm>
+#include <filesystem>
+#include <fstream>
+#include <iostream>
+#include <memory>
+#include <numeric>
+#include <sstream>
+#include <string>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+namespace fs = std::filesystem;
+
+// Usage: bench_httplib [--modes sync,async,h2,file,segmented]
+//   [--sizes 1024,65536,1048576,16777216] [--concurrency 1,8,32]
+//   [--requests N] [--out result.json]
+// Everything runs against a server on 127.0.0.1, so the numbers measure
+// HttpLib itself. "h2" is "async" over h2c, all requests multiplexed on one
+// connection, against "async" on HTTP/1.1 (WinHTTP has no h2c and stays on
+// HTTP/1.1). Progress goes to stderr, the JSON report to stdout or --out.
+
+typedef std::chrono::steady_clock Clock;
+
+struct Case {
+  std::string mode;
+  size_t size;
+  size_t concurrency;
+  size_t requests;
+};
+
+struct Result {
+  Case test;
+  std::vector<double> latencies;   // milliseconds, one per finished request
+  size_t failed = 0;
+  double seconds = 0;
+};
+
+static std::vector<size_t> ParseList(const char* text)
+{
+  std::vector<size_t> result;
+  std::istringstream stream(text);
+  for (std::string item; std::getline(stream, item, ','); ) {
+    if (!item.empty()) result.push_back(std::stoull(item));
+  }
+  return result;
+}
+
+static std::vector<std::string> ParseNames(const char* text)
+{
+  std::vector<std::string> result;
+  std::istringstream stream(text);
+  for (std::string item; std::getline(stream, item, ','); ) {
+    if (!item.empty()) result.push_back(item);
+  }
+  return result;
+}
+
+static double Elapsed(Clock::time_point start)
+{
+  return std::chrono::duration<double, std::milli>(Clock::now() - start).count();
+}
+
+static bool CheckFile(const fs::path& path, size_t size)
+{
+  std::error_code error;
+  auto const ok = fs::file_size(path, error) == size && !error;
+  fs::remove(path, error);
+  return ok;
+}
+
+// Each slot owns the requests with index % concurrency == slot, and keeps
+// its own latencies so that nothing is shared while the clock runs.
+struct Slot {
+  std::vector<double> latencies;
+  size_t failed = 0;
+};
+
+static void RunSync(const LoopServer& server, const Case& test, size_t slot, Slot& out)
+{
+  const HttpUrl url(server.GetUrl(test.size));
+  for (size_t i = slot; i < test.requests; i += test.concurrency) {
+    auto const start = Clock::now();
+    HttpLib clt(url, false, 30s);
+    auto const res = clt.Get();
+    out.latencies.push_back(Elapsed(start));
+    if (!res || res->status != 200 || res->body.size() != test.size) ++out.failed;
+  }
+}
+
+static AsyncVoid RunAsync(const LoopServer& server, const Case& test, size_t slot, Slot& out)
+{
+  const HttpUrl url(server.GetUrl(test.size));
+  for (size_t i = slot; i < test.requests; i += test.concurrency) {
+    auto const start = Clock::now();
+    HttpLib clt(url, true, 30s);
+    if (test.mode == "h2") {
+      clt.SetHttp2(true, true);
+    }
+    auto const res = co_await clt.GetAsync();
+    out.latencies.push_back(Elapsed(start));
+    if (!res || res->status != 200 || res->body.size() != test.size) ++out.failed;
+  }
+}
+
+static AsyncVoid RunFile(const LoopServer& server, const Case& test, size_t slot, Slot& out)
+{
+  const HttpUrl url(server.GetUrl(test.size));
+  for (size_t i = slot; i < test.requests; i += test.concurrency) {
+    auto const path = fs::temp_directory_path() / ("bench_httplib_" + std::to_string(slot) + ".bin");
+    std::error_code error;
+    fs::remove(path, error);
+
+    auto const start = Clock::now();
+    HttpLib clt(url, true, 30s);
+    auto const res = co_await clt.GetAsync(path);
+    out.latencies.push_back(Elapsed(start));
+    if (!CheckFile(path, test.size) || !res || res->status != 200) ++out.failed;
+  }
+}
+
+static AsyncVoid RunSegmented(const LoopServer& server, const Case& test, size_t slot, Slot& out)
+{
+  for (size_t i = slot; i < test.requests; i += test.concurrency) {
+    auto const path = fs::temp_directory_path() / ("bench_httplib_seg_" + std::to_string(slot) + ".bin");
+    std::error_code error;
+    fs::remove(path, error);
+
+    auto const start = Clock::now();
+    HttpDownload download(HttpUrl(server.GetUrl(test.size)), path, 4, 30s);
+    auto const res = co_await download.GetAsync();
+    out.latencies.push_back(Elapsed(start));
+    if (!CheckFile(path, test.size) || !res || (res->status != 200 && res->status != 206)) ++out.failed;
+  }
+}
+
+static Result RunCase(const LoopServer& server, const Case& test)
+{
+  // The scheduler's per-host cap is a politeness policy, lift it so the
+  // requested concurrency is what actually reaches the server.
+  HttpScheduler::Instance().SetHostLimit(test.mode == "segmented" ? test.concurrency * 4 : test.concurrency);
+  HttpScheduler::Instance().SetGlobalLimit(std::max<size_t>(test.concurrency * 4, 16));
+
+  std::vector<Slot> slots(test.concurrency);
+  auto const start = Clock::now();
+  if (test.mode == "sync") {
+    std::vector<std::thread> threads;
+    for (size_t i = 0; i != test.concurrency; ++i) {
+      threads.emplace_back(RunSync, std::cref(server), std::cref(test), i, std::ref(slots[i]));
+    }
+    for (auto& thread: threads) thread.join();
+  } else {
+    auto const worker = test.mode == "file" ? RunFile : test.mode == "segmented" ? RunSegmented : RunAsync;
+    std::vector<std::unique_ptr<AsyncVoid>> workers;
+    for (size_t i = 0; i != test.concurrency; ++i) {
+      // AsyncVoid can not be moved, so it is built in place.
+      workers.emplace_back(new AsyncVoid(worker(server, test, i, slots[i])));
+    }
+    for (auto& item: workers) item->get();
+  }
+
+  Result result;
+  result.test = test;
+  result.seconds = Elapsed(start) / 1000;
+  for (auto& slot: slots) {
+    result.latencies.insert(result.latencies.end(), slot.latencies.begin(), slot.latencies.end());
+    result.failed += slot.failed;
+  }
+  std::sort(result.latencies.begin(), result.latencies.end());
+  return result;
+}
+
+static double Percentile(const std::vector<double>& sorted, double percentile)
+{
+  if (sorted.empty()) return 0;
+  auto const index = static_cast<size_t>(percentile * static_cast<double>(sorted.size() - 1) + 0.5);
+  return sorted[std::min(index, sorted.size() - 1)];
+}
+
+static void WriteJson(std::ostream& out, const std::vector<Result>& results)
+{
+  out << "{\n  \"server\": \"127.0.0.1\",\n  \"results\": [";
+  for (size_t i = 0; i != results.size(); ++i) {
+    auto const& item = results[i];
+    auto const& lat = item.latencies;
+    auto const ok = item.test.requests - item.failed;
+    auto const mean = lat.empty() ? 0 : std::accumulate(lat.begin(), lat.end(), 0.0) / static_cast<double>(lat.size());
+    auto const bytes = static_cast<double>(ok) * static_cast<double>(item.test.size);
+
+    out << (i ? ",\n" : "\n") << "    {"
+      << "\"mode\": \"" << item.test.mode << "\", "
+      << "\"size\": " << item.test.size << ", "
+      << "\"concurrency\": " << item.test.concurrency << ", "
+      << "\"requests\": " << item.test.requests << ", "
+      << "\"failed\": " << item.failed << ", "
+      << "\"seconds\": " << item.seconds << ", "
+      << "\"requests_per_second\": " << (item.seconds > 0 ? static_cast<double>(ok) / item.seconds : 0) << ", "
+      << "\"mb_per_second\": " << (item.seconds > 0 ? bytes / item.seconds / 1e6 : 0) << ", "
+      << "\"latency_ms\": {"
+      << "\"mean\": " << mean << ", "
+      << "\"p50\": " << Percentile(lat, 0.50) << ", "
+      << "\"p90\": " << Percentile(lat, 0.90) << ", "
+      << "\"p99\": " << Percentile(lat, 0.99) << ", "
+      << "\"max\": " << (lat.empty() ? 0 : lat.back()) << "}}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+  std::vector<std::string> modes { "sync", "async", "h2", "file", "segmented" };
+  std::vector<size_t> sizes { 1 << 10, 64 << 10, 1 << 20, 16 << 20 };
+  std::vector<size_t> concurrency { 1, 8, 32 };
+  size_t requests = 0;
+  std::string output;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string_view arg = argv[i];
+    if (arg == "--modes") modes = ParseNames(argv[i + 1]);
+    else if (arg == "--sizes") sizes = ParseList(argv[i + 1]);
+    else if (arg == "--concurrency") concurrency = ParseList(argv[i + 1]);
+    else if (arg == "--requests") requests = std::stoull(argv[i + 1]);
+    else if (arg == "--out") output = argv[i + 1];
+    else {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  LoopServer server;
+  if (!server.IsListening()) return 1;
+
+  std::vector<Result> results;
+  for (auto const& mode: modes) {
+    if (mode != "sync" && mode != "async" && mode != "h2" && mode != "file" && mode != "segmented") {
+      std::cerr << "Unknown mode: " << mode << std::endl;
+      return 1;
+    }
+    for (auto size: sizes) {
+      // Splitting only pays off for large bodies, HttpDownload falls back
+      // to one connection below two segments anyway.
+      if (mode == "segmented" && size < (2 << 20)) continue;
+      for (auto count: concurrency) {
+        if (count == 0) continue;
+        // About 256 MiB per case by default, but at least one round.
+        auto const total = requests ? requests :
+          std::max(count, std::clamp<size_t>((256 << 20) / std::max<size_t>(size, 1), 8, 2000));
+        std::cerr << mode << " size=" << size << " concurrency=" << count
+          << " requests=" << total << std::endl;
+
+        HttpLib::FlushCache();
+        results.push_back(RunCase(server, { mode, size, count, total }));
+        if (results.back().failed) {
+          std::cerr << "  failed: " << results.back().failed << std::endl;
+        }
+      }
+    }
+  }
+
+  if (output.empty()) {
+    WriteJson(std::cout, results);
+  } else {
+    std::ofstream file(output);
+    WriteJson(file, results);
+  }
+  return 0;
+}
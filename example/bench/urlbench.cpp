@@ -0,0 +1,139 @@
+#include <neobox/httplib.h>
+
+#include <chrono>
+#include <fstream>
+#include <functional>
+#include <iostream>
+#include <string>
+#include <vector>
+
+using namespace std::literals;
+
+// Usage: bench_httpurl [--rounds N] [--out result.json]
+// Times the url helpers a scraper leans on: encoding and decoding query
+// values, parsing links with and without copying them, building urls out
+// of parts, and asking a url for its string again and again, as HttpLib
+// does for every request.
+
+typedef std::chrono::steady_clock Clock;
+
+struct Result {
+  std::string name;
+  size_t operations;
+  double seconds;
+};
+
+// Keeps the optimizer from dropping the work being timed.
+static size_t g_Sink = 0;
+
+static Result Measure(std::string name, size_t operations, const std::function<void()>& body)
+{
+  body();  // warm up
+  auto const start = Clock::now();
+  body();
+  auto const seconds = std::chrono::duration<double>(Clock::now() - start).count();
+  std::cerr << name << ": " << static_cast<double>(operations) / seconds << " op/s" << std::endl;
+  return { std::move(name), operations, seconds };
+}
+
+static void WriteJson(std::ostream& out, const std::vector<Result>& results)
+{
+  out << "{\n  \"results\": [";
+  for (size_t i = 0; i != results.size(); ++i) {
+    auto const& item = results[i];
+    out << (i ? ",\n" : "\n") << "    {"
+      << "\"name\": \"" << item.name << "\", "
+      << "\"operations\": " << item.operations << ", "
+      << "\"seconds\": " << item.seconds << ", "
+      << "\"ns_per_operation\": " << item.seconds * 1e9 / static_cast<double>(item.operations) << "}";
+  }
+  out << "\n  ]\n}\n";
+}
+
+int main(int argc, char* argv[])
+{
+  size_t rounds = 200000;
+  std::string output;
+
+  for (int i = 1; i + 1 < argc; i += 2) {
+    const std::string_view arg = argv[i];
+    if (arg == "--rounds") rounds = std::stoull(argv[i + 1]);
+    else if (arg == "--out") output = argv[i + 1];
+    else {
+      std::cerr << "Unknown option: " << arg << std::endl;
+      return 1;
+    }
+  }
+
+  // Typical query values: plain ascii, ascii with separators, and CJK text
+  // where every byte needs escaping.
+  const std::vector<std::u8string> values {
+    u8"wallpaper", u8"4k nature & sky/2024?", u8"华中科技大学", u8"a-b_c.d~e",
+  };
+  std::vector<std::u8string> encoded;
+  for (auto const& value: values) {
+    encoded.emplace_back();
+    HttpUrl::UrlEncode(value, encoded.back());
+  }
+
+  std::vector<Result> results;
+  results.push_back(Measure("encode", rounds * values.size(), [&] {
+    std::u8string out;
+    for (size_t i = 0; i != rounds; ++i) {
+      for (auto const& value: values) {
+        out.clear();
+        HttpUrl::UrlEncode(value, out);
+        g_Sink += out.size();
+      }
+    }
+  }));
+  results.push_back(Measure("decode", rounds * encoded.size(), [&] {
+    std::u8string out;
+    for (size_t i = 0; i != rounds; ++i) {
+      for (auto const& value: encoded) {
+        out.clear();
+        HttpUrl::UrlDecode(value, out);
+        g_Sink += out.size();
+      }
+    }
+  }));
+  results.push_back(Measure("parse", rounds, [&] {
+    for (size_t i = 0; i != rounds; ++i) {
+      HttpUrl url(u8"https://www.example.com/search/index.php?q=%E5%8D%8E&page=2&size=24&sort=new"sv);
+      g_Sink += url.GetUrl().size();
+    }
+  }));
+  results.push_back(Measure("view", rounds, [&] {
+    for (size_t i = 0; i != rounds; ++i) {
+      HttpUrlView url(u8"https://www.example.com/search/index.php?q=%E5%8D%8E&page=2&size=24&sort=new"sv);
+      g_Sink += url.FindParameter(u8"size")->size();
+    }
+  }));
+  results.push_back(Measure("build", rounds, [&] {
+    for (size_t i = 0; i != rounds; ++i) {
+      HttpUrl url(u8"www.example.com", u8"/e/extend/downpic.php", {
+        { u8"id", u8"31415" }, { u8"t", u8"0.5926535" }, { u8"q", values[i % values.size()] },
+      }, u8"https", 443);
+      g_Sink += url.GetUrl().size();
+    }
+  }));
+  const HttpUrl url(u8"www.example.com", u8"/e/extend/downpic.php", {
+    { u8"id", u8"31415" }, { u8"t", u8"0.5926535" }, { u8"q", values[2] },
+  }, u8"https", 443);
+  results.push_back(Measure("get_url", rounds * 4, [&] {
+    for (size_t i = 0; i != rounds; ++i) {
+      g_Sink += url.GetUrl().size();
+      g_Sink += url.GetUrl(true).size();
+      g_Sink += url.GetObjectString().size();
+      g_Sink += url.GetUrl().size();
+    }
+  }));
+
+  if (output.empty()) {
+    WriteJson(std::cout, results);
+  } else {
+    std::ofstream file(output);
+    WriteJson(file, results);
+  }
+  return g_Sink == 0;
+}
@@ -0,0 +1,69 @@
+#include "loopserver.h"
+
+#include <neobox/httpeventsource.h>
+
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <mutex>
+#include <string>
+
+using namespace std::literals;
+
+// The server sends three events split across reads and drops the stream
+// after "retry: 100". The client has to come back well before its own
+// backoff would let it, and the server resumes from the Last-Event-ID.
+int main()
+{
+  LoopServer server;
+  if (!server.IsListening()) return 1;
+
+  std::mutex mutex;
+  std::condition_variable condition;
+  std::deque<std::pair<std::string, std::chrono::steady_clock::time_point>> events;
+  HttpEventSource source(HttpUrl(u8"http://" + server.GetOrigin() + u8"/sse"), {
+    .onOpen = nullptr,
+    .onEvent = [&](const HttpEvent& event) {
+      std::string line;
+      for (auto part: { &event.type, &event.data, &event.id }) {
+        if (!line.empty()) line.push_back('|');
+        line.append(part->begin(), part->end());
+      }
+      std::lock_guard<std::mutex> locker(mutex);
+      events.emplace_back(std::move(line), std::chrono::steady_clock::now());
+      condition.notify_all();
+    },
+    .onError = nullptr,
+  });
+  source.SetReconnect({ .delay = 10s });
+  source.Open();
+
+  const std::string expected[] = {
+    "message|first|1",
+    "multi|line one\nline two\n|2",
+    "message|same id|2",
+    "message|resumed after 2|3",
+  };
+  std::unique_lock<std::mutex> locker(mutex);
+  condition.wait_for(locker, 5s, [&] { return events.size() >= std::size(expected); });
+  if (events.size() != std::size(expected)) {
+    std::cerr << "got " << events.size() << " events\n";
+    return 1;
+  }
+  for (size_t i = 0; i != std::size(expected); ++i) {
+    if (events[i].first != expected[i]) {
+      std::cerr << "expected \"" << expected[i] << "\", got \"" << events[i].first << "\"\n";
+      return 1;
+    }
+  }
+  if (events[3].second - events[2].second > 1s) {
+    std::cerr << "the server's retry was ignored\n";
+    return 1;
+  }
+  locker.unlock();
+
+  source.Close();
+  std::cout << "ok\n";
+  return 0;
+}
@@ -0,0 +1,136 @@
+#include "loopserver.h"
+
+#include <neobox/httplib.h>
+#include <neobox/httpscheduler.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <string>
+#include <thread>
+
+using namespace std::literals;
+
+// Retries come back on the limiter thread and hedges are started from it,
+// while replies finish on the engine thread. Here every retried or hedged
+// request destroys another one still in flight from its callback, and the
+// engine has to take that one off while the limiter is starting more. A
+// request started under the pool lock deadlocks the two threads; a lost
+// race shows up under a sanitizer.
+
+static constexpr size_t Count = 32;
+
+static std::u8string MakeUrl(const LoopServer& server, std::string_view path)
+{
+  return u8"http://" + server.GetOrigin() + std::u8string(path.begin(), path.end());
+}
+
+// Held open by the server until the client goes away.
+static HttpLib* Hold(const LoopServer& server, std::atomic_int& finished)
+{
+  auto const clt = new HttpLib(HttpUrl(MakeUrl(server, "/sse")), true, 30s);
+  clt->SetHeader(u8"Last-Event-ID", u8"0");
+  clt->SetLongLived(true);
+  clt->GetAsync({ .onFinish = [&finished](auto, auto) { ++finished; } });
+  return clt;
+}
+
+static bool DestroyFromCallbacks(const LoopServer& server, std::string_view kind,
+  int round, const HttpLib::RetryPolicy& policy)
+{
+  std::array<std::atomic<HttpLib*>, Count> held {};
+  std::array<std::atomic_int, Count> dropped {};
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t finished = 0, failed = 0;
+  // Last, so that requests still running are gone before what they use.
+  std::array<std::unique_ptr<HttpLib>, Count> clients;
+
+  for (size_t i = 0; i != Count; ++i) {
+    held[i] = Hold(server, dropped[i]);
+  }
+  for (size_t i = 0; i != Count; ++i) {
+    auto const path = '/' + std::string(kind) + '/' + std::to_string(round) + '-' + std::to_string(i);
+    auto& clt = clients[i] = std::make_unique<HttpLib>(HttpUrl(MakeUrl(server, path)), true, 10s);
+    clt->SetRetry(policy);
+    clt->GetAsync({ .onFinish = [&, i](std::string message, const HttpLib::Response* response) {
+      delete held[i].exchange(nullptr);
+      std::lock_guard<std::mutex> locker(mutex);
+      if (!message.empty() || response->status != 200) ++failed;
+      if (++finished == Count) condition.notify_one();
+    } });
+  }
+  {
+    std::unique_lock<std::mutex> locker(mutex);
+    if (!condition.wait_for(locker, 10s, [&] { return finished == Count; })) {
+      std::cerr << kind << ": requests did not finish\n";
+      return false;
+    }
+  }
+  clients = {};
+
+  for (size_t i = 0; i != Count; ++i) {
+    if (held[i] || dropped[i] != 1) {
+      std::cerr << kind << ": a held request was not dropped exactly once\n";
+      return false;
+    }
+  }
+  if (failed) {
+    std::cerr << kind << ": " << failed << " requests failed\n";
+    return false;
+  }
+  return true;
+}
+
+// Hedging waits for enough replies from the host to know its latency.
+static bool WarmUp(const LoopServer& server)
+{
+  std::atomic_int succeeded = 0;
+  for (int i = 0; i != 16; ++i) {
+    std::atomic_bool finished = false;
+    HttpLib clt(HttpUrl(server.GetUrl(16)), true, 10s);
+    clt.GetAsync({ .onFinish = [&](std::string message, const HttpLib::Response* response) {
+      if (message.empty() && response->status == 200) ++succeeded;
+      finished = true;
+    } });
+    while (!finished) std::this_thread::sleep_for(1ms);
+  }
+  return succeeded == 16;
+}
+
+int main()
+{
+  LoopServer server;
+  if (!server.IsListening()) return 1;
+
+  // Hedges queue behind the requests they stand in for, so all of them
+  // must fit.
+  HttpScheduler::Instance().SetHostLimit(2 * Count);
+  HttpScheduler::Instance().SetGlobalLimit(2 * Count);
+
+  for (int round = 0; round != 20; ++round) {
+    if (!DestroyFromCallbacks(server, "flaky", round, { .retries = 2, .backoff = 1ms })) {
+      return 1;
+    }
+  }
+
+  if (!WarmUp(server)) {
+    std::cerr << "warm up failed\n";
+    return 1;
+  }
+  for (int round = 0; round != 20; ++round) {
+    if (!DestroyFromCallbacks(server, "stall", round, { .hedgePercentile = 0.5 })) {
+      return 1;
+    }
+  }
+
+  if (HttpScheduler::Instance().GetQueued()) {
+    std::cerr << "requests left in the queue\n";
+    return 1;
+  }
+  std::cout << "ok\n";
+  return 0;
+}
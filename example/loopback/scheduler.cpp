@@ -0,0 +1,129 @@
+#include "loopserver.h"
+
+#include <neobox/httplib.h>
+#include <neobox/httpscheduler.h>
+
+#include <array>
+#include <atomic>
+#include <condition_variable>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <thread>
+#include <vector>
+
+using namespace std::literals;
+
+// Requests queue far past the per-host limit while several threads submit
+// and destroy them. A Submit runs Dispatch on its caller's thread, which
+// may start requests that belong to another thread; each must still finish
+// exactly once and none may be started after it is gone. A lost race shows
+// up under a sanitizer, or as a crash without one.
+
+static constexpr size_t Count = 64;
+
+static bool DestroyWhileDispatching(const HttpUrl& url, int round)
+{
+  constexpr size_t threads = 4, batch = Count / threads;
+  std::array<std::atomic_int, Count> finished {};
+  std::vector<std::thread> workers;
+  for (size_t t = 0; t != threads; ++t) {
+    workers.emplace_back([&, t] {
+      std::vector<std::unique_ptr<HttpLib>> clients;
+      for (size_t i = t * batch; i != (t + 1) * batch; ++i) {
+        auto& clt = clients.emplace_back(std::make_unique<HttpLib>(url, true, 10s));
+        clt->GetAsync({ .onFinish = [&finished, i](auto, auto) { ++finished[i]; } });
+      }
+      // A little later each round, so that the drops meet dispatching at
+      // different points.
+      std::this_thread::sleep_for(std::chrono::microseconds(round % 8 * 50));
+      clients.clear();
+    });
+  }
+  for (auto& worker: workers) {
+    worker.join();
+  }
+
+  for (auto& count: finished) {
+    if (count != 1) return false;
+  }
+  return true;
+}
+
+// The same from the engine thread: each callback destroys the request
+// behind it, which may be waiting to start in the same Dispatch call.
+static bool DestroyFromCallbacks(const HttpUrl& url)
+{
+  std::array<std::atomic<HttpLib*>, Count> clients {};
+  std::array<std::atomic_int, Count> finished {};
+  for (size_t i = 0; i != Count; ++i) {
+    clients[i] = new HttpLib(url, true, 10s);
+  }
+  // Back to front, so that nothing is deleted before it is submitted.
+  for (size_t i = Count; i-- != 0; ) {
+    clients[i].load()->GetAsync({ .onFinish = [&clients, &finished, i](auto, auto) {
+      ++finished[i];
+      if (i + 1 != Count) delete clients[i + 1].exchange(nullptr);
+    } });
+  }
+  std::this_thread::sleep_for(20ms);
+  for (auto& clt: clients) {
+    delete clt.exchange(nullptr);
+  }
+
+  for (auto& count: finished) {
+    if (count != 1) return false;
+  }
+  return true;
+}
+
+static bool FinishAll(const HttpUrl& url)
+{
+  std::mutex mutex;
+  std::condition_variable condition;
+  size_t finished = 0, failed = 0;
+  std::vector<std::unique_ptr<HttpLib>> clients;
+  for (size_t i = 0; i != Count; ++i) {
+    auto& clt = clients.emplace_back(std::make_unique<HttpLib>(url, true, 10s));
+    clt->GetAsync({ .onFinish = [&](std::string message, const HttpLib::Response* response) {
+      std::lock_guard<std::mutex> locker(mutex);
+      if (!message.empty() || response->status != 200) ++failed;
+      if (++finished == Count) condition.notify_one();
+    } });
+  }
+  std::unique_lock<std::mutex> locker(mutex);
+  condition.wait(locker, [&] { return finished == Count; });
+  return !failed;
+}
+
+int main()
+{
+  LoopServer server;
+  if (!server.IsListening()) return 1;
+
+  HttpScheduler::Instance().SetHostLimit(2);
+  const HttpUrl url(server.GetUrl(1024));
+
+  for (int round = 0; round != 200; ++round) {
+    if (!DestroyWhileDispatching(url, round)) {
+      std::cerr << "destroy while dispatching: a request did not finish exactly once\n";
+      return 1;
+    }
+  }
+  for (int round = 0; round != 10; ++round) {
+    if (!DestroyFromCallbacks(url)) {
+      std::cerr << "destroy from callbacks: a request did not finish exactly once\n";
+      return 1;
+    }
+  }
+  if (HttpScheduler::Instance().GetQueued()) {
+    std::cerr << "requests left in the queue\n";
+    return 1;
+  }
+  if (!FinishAll(url)) {
+    std::cerr << "requests failed after the drops\n";
+    return 1;
+  }
+  std::cout << "ok\n";
+  return 0;
+}
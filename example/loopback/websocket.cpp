@@ -0,0 +1,129 @@
+#include "loopserver.h"
+
+#include <neobox/httpwebsocket.h>
+
+#include <condition_variable>
+#include <deque>
+#include <iostream>
+#include <memory>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+using namespace std::literals;
+
+// What the callbacks saw, one line per event, for the test to wait on.
+class Inbox {
+public:
+  void Push(std::string item)
+  {
+    std::lock_guard<std::mutex> locker(m_Mutex);
+    m_Items.push_back(std::move(item));
+    m_Condition.notify_all();
+  }
+
+  std::optional<std::string> Pop()
+  {
+    std::unique_lock<std::mutex> locker(m_Mutex);
+    if (!m_Condition.wait_for(locker, 5s, [this] { return !m_Items.empty(); })) {
+      return std::nullopt;
+    }
+    auto item = std::move(m_Items.front());
+    m_Items.pop_front();
+    return item;
+  }
+private:
+  std::mutex m_Mutex;
+  std::condition_variable m_Condition;
+  std::deque<std::string> m_Items;
+};
+
+static bool Expect(Inbox& inbox, const std::string& expected)
+{
+  auto const item = inbox.Pop();
+  if (item == expected) return true;
+  std::cerr << "expected \"" << expected.substr(0, 64) << "\", got \"" <<
+    item.value_or("nothing").substr(0, 64) << "\"\n";
+  return false;
+}
+
+static HttpWebSocket::Callback Record(Inbox& inbox)
+{
+  return {
+    .onOpen = [&inbox] { inbox.Push("open"); },
+    .onMessage = [&inbox](const HttpWebSocket::Message& message) {
+      inbox.Push(message.binary ? "binary " + message.data : message.data);
+    },
+    .onClose = [&inbox](int code, const std::string& reason) {
+      inbox.Push("close " + std::to_string(code) + ' ' + reason);
+    },
+  };
+}
+
+// Text and binary frames of each length encoding come back whole, pings
+// go both ways, fragments are joined around a ping, and Close is answered.
+static bool RoundTrip(const std::u8string& url)
+{
+  Inbox inbox;
+  HttpWebSocket socket(url, Record(inbox));
+  socket.SetPingInterval(1s);
+  socket.Open();
+  if (!Expect(inbox, "open") || !Expect(inbox, "pong loop")) return false;
+
+  std::string small(300, '\0'), large(70000, '\0');
+  for (size_t i = 0; i != large.size(); ++i) {
+    large[i] = LoopServer::GetByte(i);
+    if (i < small.size()) small[i] = large[i];
+  }
+  if (!socket.Send("hello") || !Expect(inbox, "hello")) return false;
+  if (!socket.SendBinary(small) || !Expect(inbox, "binary " + small)) return false;
+  if (!socket.SendBinary(large) || !Expect(inbox, "binary " + large)) return false;
+  if (!socket.Send("fragments") || !Expect(inbox, "fragmented") || !Expect(inbox, "pong mid")) {
+    return false;
+  }
+
+  // Past two intervals: still open only if the pings were answered.
+  std::this_thread::sleep_for(2500ms);
+  if (!socket.IsOpen() || !socket.Send("pings?")) return false;
+  auto const pings = inbox.Pop();
+  if (!pings || !pings->starts_with("pings ") || *pings == "pings 0") {
+    std::cerr << "the client sent no pings\n";
+    return false;
+  }
+
+  socket.Close(4000, "bye");
+  return Expect(inbox, "close 4000 bye");
+}
+
+// Destroyed while the engine is still creating or using the connection.
+// On the heap, so that a task left behind shows up under a sanitizer.
+static bool DestroyWhileConnecting(const std::u8string& url)
+{
+  Inbox inbox;
+  for (int round = 0; round != 100; ++round) {
+    auto socket = std::make_unique<HttpWebSocket>(url, Record(inbox));
+    socket->SetPingInterval(1s);
+    socket->Open();
+    std::this_thread::sleep_for(std::chrono::microseconds(round % 10 * 100));
+  }
+  return true;
+}
+
+int main()
+{
+  LoopServer server;
+  if (!server.IsListening()) return 1;
+
+  auto const url = u8"ws://" + server.GetOrigin() + u8"/ws";
+  if (!RoundTrip(url)) {
+    std::cerr << "round trip failed\n";
+    return 1;
+  }
+  if (!DestroyWhileConnecting(url)) {
+    std::cerr << "destroy while connecting failed\n";
+    return 1;
+  }
+  std::cout << "ok\n";
+  return 0;
+}
@@ -1,4 +1,6 @@
 #include <neobox/httplib.h>
+#include <neobox/httpbatch.h>
+#include <neobox/httplimiter.h>
 #include <neobox/unicode.h>
 
 #include <iostream>
@@ -229,13 +231,12 @@ std::u8string GetPictureUrl(const PictureDetail& detail) {
     case 4:
       break;
     case 3:
-      if (!json[u8"pic"].getValueString().empty()) {
-        std::cout << "下载过于频繁，3秒后下载。" << std::endl;
-      } else {
+      if (json[u8"pic"].getValueString().empty()) {
         std::cout << json[u8"info"] << std::endl;
         exit(1);
       }
-      std::this_thread::sleep_for(3s);
+      // Too frequent: HttpLimiter already spaces the download that follows.
+      std::cout << "下载过于频繁。" << std::endl;
       break;
     default:
       std::cerr << "Error: " << json << std::endl;
@@ -244,76 +245,25 @@ std::u8string GetPictureUrl(const PictureDetail& detail) {
   return host + json[u8"pic"].getValueString();
 }
 
-AsyncInt DownloadPicture(const fs::path folder, const PictureDetail& detail) {
-  auto filePath = folder / (detail.name + u8".jpg"s);
-  if (fs::exists(filePath)) {
-    std::cout << "File exists: " << filePath.u8string() << std::endl;
-    co_return 1;
-  }
-  HttpUrl url { GetPictureUrl(detail) };
-  std::cout << "url: " << url.GetUrl() << std::endl;
-  HttpLib clt(std::move(url), true);
-  clt.SetHeader(u8"Referer", detail.referer);
-  clt.SetHeader(u8"User-Agent", USERAGENT);
-  clt.SetHeader(u8"Cookie", COOKIE);
-
-  std::ofstream fileOut(filePath, std::ios::binary);
-  if (!fileOut.is_open()) {
-    std::cerr << "Error: can not open file: " << filePath.u8string() << std::endl;
-    co_return -1;
-  }
-
-  const float barWidth = 70.0;
-
-  HttpLib::Callback callback {
-    .onProcess = [barWidth](auto current, auto total) {
-      // std::cout << "Progress: " << current << "/" << total << std::endl;
-      auto percent = float(current) / total;
-      int pos = barWidth * percent;
-      std::cout << "[";
-      std::cout << std::setfill('=') << std::setw(pos + 1) << '>';
-      if (pos == barWidth) std::cout << "\b=";
-      std::cout << std::setfill(' ') << std::setw(barWidth - pos + 1) << ']';
-      std::cout << std::setw(4) << int(percent * 100.0) << " %\r";
-      std::cout.flush();
-    },
-    .onFinish = [](auto msg, auto res) {
-      std::cout << std::endl;
-      if (msg.empty() && res->status == 200) {
-        std::cout << "Download success" << std::endl;
-      } else {
-        std::cerr << "Error: " << msg << std::endl;
-      }
-    },
-    .onWrite = [&fileOut](auto data, auto size) {
-      fileOut.write(reinterpret_cast<const char*>(data), size);
-    },
-  };
-
-  auto res = co_await clt.GetAsync(std::move(callback));
-  fileOut.close();
-
-  if (res->status != 200) {
-    fs::remove(filePath);
-    std::cerr << "Error: " << res->status << std::endl;
-    co_return -1;
+AsyncVoid DownloadPictures(HttpBatch& batch, const std::vector<fs::path>& paths) {
+  auto results = co_await batch.WhenAll();
+  for (size_t i = 0; i != results->size(); ++i) {
+    auto const& item = (*results)[i];
+    auto const status = item.response ? item.response->status : -1;
+    if (item.error.empty() && (status == 200 || status == 206)) {
+      std::cout << "Download success: " << paths[i].filename().u8string() << std::endl;
+    } else {
+      std::cerr << "Error: " << status << ' ' << item.error << std::endl;
+      std::error_code error;
+      fs::remove(paths[i], error);
+    }
   }
-
-  co_return 0;
 }
 
-void SleepRandom() {
-  static auto engine = std::default_random_engine();
-  static std::uniform_int_distribution<int> distribution(0, 500);
-  const auto sleepTime = 3s + 2ms * distribution(engine);
-  std::cout << "Begin sleep: " << sleepTime.count() << "ms. " << std::flush;
-  std::this_thread::sleep_for(sleepTime);
-  std::cout << "End sleep." << std::endl;
-}
-
-
 int main(int argc, char** argv) {
   ::SetLocale();
+  // Be polite: one request every two seconds, without sleeping a thread.
+  HttpLimiter::Instance().SetHostLimit(domain, 0.5);
 
   auto indexPages = GetIndexPages();
   if (indexPages.empty()) {
@@ -365,14 +315,27 @@ int main(int argc, char** argv) {
     std::cout << std::setfill('*') << std::setw(16) << ' '
       << "Page " << std::setfill('0') << std::setw(3) << i << ' '
       << std::setfill('*') << std::setw(16) << ' ' << std::endl;
-    SleepRandom();
+    // The links come one by one (HttpLimiter spaces them anyway), the
+    // pictures of the page then download together.
+    HttpBatch batch(60s);
+    std::vector<fs::path> paths;
     for (auto const& picture : pictures) {
       std::cout << picture.dataId  << ": " << picture.name << std::endl;
-      auto res = DownloadPicture(folder, picture).get();
-      if (res == 1) continue;
-      // get random integer from 0 to 500
-      SleepRandom();
+      auto filePath = folder / (picture.name + u8".jpg"s);
+      if (fs::exists(filePath)) {
+        std::cout << "File exists: " << filePath.u8string() << std::endl;
+        continue;
+      }
+      auto const url = GetPictureUrl(picture);
+      if (url.empty()) continue;
+      std::cout << "url: " << url << std::endl;
+      auto& clt = batch.Add(HttpUrl(url), filePath);
+      clt.SetHeader(u8"Referer", picture.referer);
+      clt.SetHeader(u8"User-Agent", USERAGENT);
+      clt.SetHeader(u8"Cookie", COOKIE);
+      paths.push_back(std::move(filePath));
     }
+    DownloadPictures(batch, paths).get();
   }
   return 0;
 }
\ No newline at end of file
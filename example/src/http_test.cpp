@@ -8,7 +8,7 @@
 
 using namespace std::literals;
 
-std::ostream& operator<<(std::ostream& out, const std::u8string& str) {
+std::ostream& operator<<(std::ostream& out, std::u8string_view str) {
   return out.write(reinterpret_cast<const char*>(str.data()), str.length());
 }
 
@@ -22,7 +22,7 @@ int main()
   static bool done = false;
 #if 0
   HttpUrl url(u8"https://w.wallhaven.cc/full/o5/wallhaven-o59gvl.jpg"sv);
-  std::cout << url.host << std::endl;
+  std::cout << url.GetHost() << std::endl;
   std::cout << url.GetObjectString() << std::endl;
   HttpLib clt(url, true);
   std::ofstream file("wallhaven-o59gvl.jpg", std::ios::out | std::ios::binary);
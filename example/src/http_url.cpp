@@ -19,7 +19,7 @@ int main() {
   std::cout << url2.GetUrl() << std::endl;
 
   std::cout << "----------------\n";
-  for (auto& [i, j]: url2.parameters) {
+  for (auto& [i, j]: url2.GetParameters()) {
     std::cout << i << ": " << j << std::endl;
   }
   std::cout << "----------------\n";
@@ -28,7 +28,7 @@ int main() {
     {u8"key", u8"首都师范大学"},
   });
 
-  std::cout << url3.scheme + u8"://" + url3.host << std::endl;
+  std::cout << url3.GetScheme() + u8"://" + url3.GetHost() << std::endl;
   std::cout << url3.GetObjectString() << std::endl;
   std::cout << url3.GetUrl() << std::endl;
 }
@@ -143,14 +143,13 @@ SYSTEMTIME WorldTimeApiCb(const HttpLib::Response& res) {
 #define BEIJING_TIME_URL u8"https://beijing-time.org/"sv
 
 SYSTEMTIME* GetBeijingTimeCb(const HttpLib::Response& res) {
-  const auto& headers = res.headers;
-  auto date = headers.find(u8"Date");
-  if (date == headers.end()) {
+  auto const date = res.headers.Find(u8"Date");
+  if (!date) {
     throw std::runtime_error("can't find 'Date' in header.");
   }
   std::smatch result;
   std::regex pattern("(\\w{3}), {1,2}(\\d{1,2}) (\\w{3}) (\\d{4}) (\\d{2})\\:(\\d{2})\\:(\\d{2}) GMT");
-  auto dateString = std::string(date->second.begin(), date->second.end());
+  auto dateString = std::string(date->begin(), date->end());
   if (!std::regex_match(dateString, result, pattern)) {
     throw std::runtime_error("can't match string!");
   }
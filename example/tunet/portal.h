@@ -19,6 +19,7 @@ struct Portal {
   {
     userInfo.username = username;
     userInfo.password = password;
+    client.SetRetry({ .retries = 2 });
     init().get();
   }
 
@@ -239,12 +239,14 @@ class AsyncAwaiter {
 public:
   bool await_ready() const { return !m_Object; }
   void await_suspend(std::coroutine_handle<> handle) {
+    // The object may resume the coroutine before returning, which ends the
+    // lifetime of this awaiter, so nothing may touch it afterwards.
+    m_Finished = true;
     if (m_Object) {
       m_Object->DoSuspend(handle);
     } else {
       handle.resume();
     }
-    m_Finished = true;
   }
 
   auto await_resume() {
@@ -0,0 +1,69 @@
+#ifndef HTTPBATCH_H
+#define HTTPBATCH_H
+
+#include <neobox/httplib.h>
+
+#include <functional>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+struct HttpBatchItem {
+  std::string error;                       // empty on success
+  const HttpResponse* response = nullptr;  // owned by the batch
+  bool finished = false;
+};
+
+/*
+ * Fans a set of requests out at once through the shared scheduler and
+ * engine, and resumes the awaiting coroutine when all of them are done
+ * (WhenAll) or once the first few succeeded (WhenAny), in which case the
+ * rest are cancelled. Results keep the order the requests were added in.
+ */
+class HttpBatch: public AsyncAwaiterObject<std::vector<HttpBatchItem>> {
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+public:
+  typedef HttpBatchItem Item;
+  typedef std::vector<Item> Results;
+  typedef AsyncAwaiter<Results> Awaiter;
+  typedef std::function<void(const Results&)> FinishCallback;
+
+  explicit HttpBatch(std::chrono::seconds timeout = 30s);
+  explicit HttpBatch(const std::vector<HttpUrl>& urls, std::chrono::seconds timeout = 30s);
+  ~HttpBatch();
+public:
+  // The request is set up through the returned object; with a path the
+  // body goes to that file.
+  HttpLib& Add(HttpUrl url, std::filesystem::path path = {});
+  Awaiter WhenAll(FinishCallback callback = nullptr);
+  // Done once count requests succeeded, or once that can not happen any
+  // more because too many failed.
+  Awaiter WhenAny(size_t count = 1, FinishCallback callback = nullptr);
+  void ExitAsync();
+  size_t GetSize() const { return m_Requests.size(); }
+  bool IsFinished() const;
+private:
+  void DoSuspend(std::coroutine_handle<> handle) override;
+  Results* GetResult() override { return &m_Results; }
+  void OnFinish(size_t index, std::string message, const HttpResponse* response);
+  bool IsDone() const;
+  std::vector<HttpLib*> TakeRunning();
+  void EmitFinish(const std::vector<HttpLib*>& running);
+private:
+  std::chrono::seconds m_TimeOut;
+  std::vector<std::unique_ptr<HttpLib>> m_Requests;
+  std::vector<std::filesystem::path> m_Paths;
+  Results m_Results;
+  FinishCallback m_Callback;
+  std::coroutine_handle<> m_Waiting;
+  mutable Mutex m_Mutex;
+  size_t m_Need = 0;             // 0 waits for all of them
+  size_t m_Started = 0;
+  size_t m_Finished = 0;
+  size_t m_Succeeded = 0;
+  bool m_Starting = false;
+  bool m_Running = false;
+};
+
+#endif  // HTTPBATCH_H
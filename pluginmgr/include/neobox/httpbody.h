@@ -0,0 +1,87 @@
+#ifndef HTTPBODY_H
+#define HTTPBODY_H
+
+#include <cstdint>
+#include <filesystem>
+#include <fstream>
+#include <functional>
+#include <string>
+#include <vector>
+
+/*
+ * A request body sent piece by piece instead of from one buffer. It is a
+ * list of pieces (owned strings, caller-owned memory, files, read callbacks)
+ * whose total size is known up front, so HttpLib can announce a
+ * Content-Length and pull the bytes while the request goes out.
+ */
+class HttpBody {
+public:
+  // Fills up to size bytes into buffer and returns how many, 0 at the end.
+  typedef std::function<size_t(void* buffer, size_t size)> Reader;
+  static constexpr size_t ReadError = static_cast<size_t>(-1);
+
+  HttpBody() = default;
+  HttpBody(HttpBody&&) = default;
+  HttpBody& operator=(HttpBody&&) = default;
+
+  void Append(std::string data);
+  // The memory must stay alive until the request is finished.
+  void AppendView(const void* data, size_t size);
+  // False if the file can not be opened; nothing is appended then.
+  bool AppendFile(std::filesystem::path path);
+  // The reader has to deliver exactly size bytes. Such a body can not be
+  // sent twice, so retries and redirects that resend it are given up.
+  void AppendReader(Reader reader, uint64_t size);
+  // Moves the pieces of another body, not yet read from, to the end.
+  void AppendBody(HttpBody body);
+
+  uint64_t GetSize() const { return m_Size; }
+  bool IsRewindable() const { return m_Rewindable; }
+  // Starts over from the first byte, false if that is not possible.
+  bool Rewind();
+  size_t Read(void* buffer, size_t size);
+private:
+  struct Piece {
+    enum class Type { String, View, File, Reader } type;
+    std::string data {};
+    const char* view = nullptr;
+    std::filesystem::path path {};
+    Reader reader {};
+    uint64_t size = 0;
+  };
+  std::vector<Piece> m_Pieces;
+  uint64_t m_Size = 0;
+  bool m_Rewindable = true;
+  bool m_Started = false;
+  // Read position: the current piece and the offset in it.
+  size_t m_Index = 0;
+  uint64_t m_Offset = 0;
+  std::ifstream m_File;
+};
+
+/*
+ * Assembles a multipart/form-data body out of HttpBody pieces: the part
+ * headers are small strings, files and buffers are referenced, not copied.
+ */
+class HttpMultipart {
+public:
+  HttpMultipart();
+
+  void AddField(std::u8string_view name, std::u8string_view value);
+  bool AddFile(std::u8string_view name, std::filesystem::path path,
+    std::u8string_view contentType = u8"application/octet-stream");
+  // The memory must stay alive until the request is finished.
+  void AddData(std::u8string_view name, std::u8string_view fileName,
+    const void* data, size_t size, std::u8string_view contentType = u8"application/octet-stream");
+
+  std::u8string GetContentType() const;
+  // Closes the form; add nothing to it afterwards.
+  HttpBody Finish();
+private:
+  void AddHeader(std::u8string_view name, const std::u8string* fileName, std::u8string_view contentType);
+
+  std::string m_Boundary;
+  HttpBody m_Body;
+};
+
+#endif  // HTTPBODY_H
@@ -0,0 +1,39 @@
+#ifndef HTTPCACHE_H
+#define HTTPCACHE_H
+
+#include <filesystem>
+#include <string>
+
+struct HttpResponse;
+
+/*
+ * On-disk store of response bodies and their validators, one entry per
+ * url. HttpLib turns a stored entry into a conditional request and serves
+ * a 304 from here; in StaleWhileRevalidate mode the stored body is handed
+ * out at once while a background request refreshes the entry.
+ */
+class HttpCache {
+public:
+  enum class Mode { Revalidate, StaleWhileRevalidate };
+
+  explicit HttpCache(std::filesystem::path directory, Mode mode = Mode::Revalidate)
+    : m_Directory(std::move(directory))
+    , m_Mode(mode)
+  {}
+  const std::filesystem::path& GetDirectory() const { return m_Directory; }
+  Mode GetMode() const { return m_Mode; }
+
+  bool Load(std::u8string_view url, HttpResponse& response) const;
+  bool Store(std::u8string_view url, const HttpResponse& response) const;
+  void Remove(std::u8string_view url) const;
+  // One background refresh per entry: false while another one is running.
+  bool BeginRevalidate(std::u8string_view url) const;
+  void EndRevalidate(std::u8string_view url) const;
+private:
+  std::filesystem::path GetPath(std::u8string_view url, const char* extension) const;
+
+  std::filesystem::path m_Directory;
+  Mode m_Mode;
+};
+
+#endif  // HTTPCACHE_H
@@ -0,0 +1,92 @@
+#ifndef HTTPDOWNLOAD_H
+#define HTTPDOWNLOAD_H
+
+#include <neobox/httplib.h>
+
+#include <atomic>
+#include <memory>
+#include <mutex>
+#include <vector>
+
+/*
+ * Fetches one large resource over several connections at once. A HEAD probe
+ * checks Accept-Ranges and Content-Length; the file is then preallocated and
+ * every byte range is written at its own offset as it arrives. Servers that
+ * can not serve ranges fall back to a single, resumable HttpLib download.
+ */
+class HttpDownload: public AsyncAwaiterObject<HttpResponse> {
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+public:
+  typedef HttpLib::Response Response;
+  typedef HttpLib::Callback Callback;
+  typedef HttpLib::Awaiter Awaiter;
+
+  explicit HttpDownload(HttpUrl url, std::filesystem::path path,
+    size_t segments = 4, std::chrono::seconds timeout = 30s);
+  ~HttpDownload();
+public:
+  void SetHeader(std::u8string key, std::u8string value) {
+    m_Headers[key] = value;
+  }
+  void SetHttp2(bool on) { m_Http2 = on; }
+  void SetRedirect(long redirect) { m_Redirect = redirect; }
+  void SetPriority(HttpScheduler::Priority priority) { m_Priority = priority; }
+  // Resources smaller than two segments of this size use one connection.
+  void SetMinSegmentSize(size_t size) { m_MinSegment = size; }
+  // Hashed on the file writer's thread as it is written. Ranges land out of
+  // order, so past the first one a split file is read back there once the
+  // last has arrived, mostly from the page cache.
+  void SetSha256(std::optional<HttpHashSink::Digest> digest) { m_Sha256 = digest; }
+  // onWrite is ignored, the data always goes to the file.
+  Awaiter GetAsync(Callback callback = Callback { nullptr, nullptr, nullptr });
+  void ExitAsync();
+  bool IsFinished() const { return m_Finished; }
+  size_t GetSegmentCount() const { return m_Ranges.size(); }
+private:
+  struct Range {
+    uint64_t first;
+    uint64_t last;
+    uint64_t written;
+  };
+  void DoSuspend(std::coroutine_handle<> handle) override;
+  Response* GetResult() override { return &m_Response; }
+  std::unique_ptr<HttpLib> NewRequest() const;
+  void OnProbe(std::string message, const Response* response);
+  void StartParts(std::vector<std::unique_ptr<HttpLib>> parts);
+  void OnWrite(size_t index, const void* data, size_t size);
+  void OnPartFinish(size_t index, std::string message, const Response* response);
+  void EmitProcess();
+  void EmitFinish(std::string message);
+private:
+  HttpUrl m_Url;
+  std::filesystem::path m_FilePath;
+  HttpLib::Headers m_Headers;
+  std::chrono::seconds m_TimeOut;
+  std::optional<bool> m_Http2;
+  long m_Redirect = 0;
+  HttpScheduler::Priority m_Priority = HttpScheduler::Priority::Normal;
+  size_t m_Segments;
+  size_t m_MinSegment = 1 << 20;
+  std::optional<HttpHashSink::Digest> m_Sha256;
+  Callback m_Callback;
+  Response m_Response;
+
+  Mutex m_Mutex;
+  Mutex m_ProcessMutex;
+  std::atomic_bool m_Finished = false;
+  bool m_Closing = false;
+  bool m_Failed = false;
+  std::string m_Message;
+  size_t m_PartsLeft = 0;
+  std::vector<Range> m_Ranges;
+  std::atomic<uint64_t> m_RecieveSize = 0;
+  uint64_t m_ConnectLength = 0;
+  HttpFileSink m_File;
+  HttpHashSink m_Hash;
+
+  std::unique_ptr<HttpLib> m_Probe;
+  std::vector<std::unique_ptr<HttpLib>> m_Parts;
+};
+
+#endif  // HTTPDOWNLOAD_H
@@ -0,0 +1,103 @@
+#ifndef HTTPENGINE_H
+#define HTTPENGINE_H
+
+#ifdef __linux__
+
+#include <mutex>
+#include <thread>
+#include <deque>
+#include <set>
+#include <map>
+#include <chrono>
+#include <optional>
+#include <atomic>
+#include <condition_variable>
+#include <functional>
+
+class HttpLib;
+
+/*
+ * One background reactor (curl_multi + epoll) drives every async HttpLib.
+ * Callbacks (onWrite/onProcess/onFinish) are delivered on the reactor thread,
+ * one transfer at a time but interleaved, so no process-wide lock is taken.
+ */
+class HttpEngine {
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+  typedef std::unique_lock<Mutex> LockerEx;
+  typedef std::chrono::steady_clock Clock;
+public:
+  static HttpEngine& Instance();
+
+  void Submit(HttpLib* clt);
+  void Remove(HttpLib* clt);
+  bool IsEngineThread() const;
+  // Reactor thread only, from a write callback that returned PAUSE.
+  void Pause(HttpLib* clt, Clock::time_point until);
+  // Runs the task on the reactor thread, at once when called from there;
+  // with wait set the caller blocks until it has run.
+  void Post(std::function<void()> task, bool wait = false);
+
+  // Raw connections, for protocols curl does not speak (WebSocket). The
+  // handle connects with CURLOPT_CONNECT_ONLY and stays in the multi, as
+  // curl_easy_send/recv need; the socket is then watched here, and onReady
+  // gets the EPOLL* events. Reactor thread only, through Post.
+  typedef std::function<void(int code)> ConnectCallback;
+  typedef std::function<void(int events)> ReadyCallback;
+  void Connect(void* handle, ConnectCallback onConnect, ReadyCallback onReady);
+  void SetWritable(void* handle, bool on);
+  void Disconnect(void* handle);
+private:
+  HttpEngine();
+  ~HttpEngine();
+  HttpEngine(const HttpEngine&) = delete;
+  HttpEngine& operator=(const HttpEngine&) = delete;
+
+  enum class Action { Add, Remove, Call };
+  struct Command {
+    Action action;
+    HttpLib* clt;
+    bool* done;
+    std::function<void()> task = nullptr;
+  };
+  struct Connection {
+    ConnectCallback onConnect;
+    ReadyCallback onReady;
+    int socket = -1;
+  };
+
+  void Run();
+  void Wakeup();
+  void ProcessCommands();
+  void CheckMultiInfo();
+  void AddHandle(HttpLib* clt);
+  void RemoveHandle(HttpLib* clt);
+  void SocketAction(int socket, int flags);
+  void ResumePaused();
+  void FinishConnect(void* handle, int code);
+  void WatchSocket(int socket, uint32_t events);
+
+  static int SocketCallback(void* easy, int socket, int what, void* userp, void* socketp);
+  static int TimerCallback(void* multi, long timeoutMs, void* userp);
+private:
+  void* m_hMulti = nullptr;
+  int m_Epoll = -1;
+  int m_Event = -1;
+  int m_Running = 0;
+  std::optional<Clock::time_point> m_Deadline;
+  std::set<HttpLib*> m_Transfers;
+  std::multimap<Clock::time_point, HttpLib*> m_Paused;
+  std::map<void*, Connection> m_Connections;
+  std::map<int, void*> m_Sockets;   // of the connected ones
+
+  Mutex m_Mutex;
+  std::condition_variable m_Condition;
+  std::deque<Command> m_Commands;
+  std::atomic_bool m_Quit = false;
+  bool m_Stopped = false;
+  std::thread m_Thread;
+};
+
+#endif  // __linux__
+
+#endif  // HTTPENGINE_H
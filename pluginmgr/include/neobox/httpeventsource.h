@@ -0,0 +1,76 @@
+#ifndef HTTPEVENTSOURCE_H
+#define HTTPEVENTSOURCE_H
+
+#include <neobox/httplib.h>
+#include <neobox/httpstream.h>
+
+#include <memory>
+#include <string>
+
+struct HttpEvent {
+  std::u8string type;   // "message" unless the server named it
+  std::u8string data;
+  std::u8string id;     // the last event id as of this event
+};
+
+/*
+ * Server-Sent Events (text/event-stream) over one long-lived async HttpLib
+ * request, parsed as the bytes arrive. A dropped connection is opened again
+ * after the server's "retry:" delay or the backoff, with Last-Event-ID so
+ * that the server can resume. The request does not take a scheduler slot.
+ * Callbacks run on the thread that delivers the response bytes.
+ */
+class HttpEventSource: public HttpStream<HttpEvent> {
+public:
+  typedef HttpEvent Event;
+  typedef std::function<void()> OpenCallback;
+  typedef std::function<void(const Event&)> EventCallback;
+  // The connection failed or dropped; a reconnect follows unless closed.
+  typedef std::function<void(const std::string&)> ErrorCallback;
+  struct Callback {
+    OpenCallback onOpen;
+    EventCallback onEvent;              // none: events queue for Next
+    ErrorCallback onError;
+  };
+
+  explicit HttpEventSource(HttpUrl url, Callback callback = {});
+  ~HttpEventSource();
+
+  void SetHeader(std::u8string key, std::u8string value);
+  // A connection that stays silent this long, not even a comment line, is
+  // dropped and opened again; 0 waits forever.
+  void SetIdleTimeout(std::chrono::seconds timeout) { m_IdleTimeout = timeout; }
+  void Open();
+  void Close();
+  bool IsOpen() const { return m_Connected; }
+  std::u8string GetLastEventId() const;
+private:
+  void Connect();
+  void Disconnect();
+  void OnWrite(uint64_t attempt, const char* data, size_t size);
+  void OnFinish(uint64_t attempt, const std::string& message, const HttpResponse* response);
+  void CheckIdle(uint64_t attempt);
+  void ParseLine(std::string_view line);
+  void DispatchEvent();
+private:
+  HttpUrl m_Url;
+  HttpLib::Headers m_Headers;
+  const Callback m_Callback;
+  std::chrono::seconds m_IdleTimeout { 0 };
+  std::unique_ptr<HttpLib> m_Request;     // on the limiter thread only
+  std::atomic_uint64_t m_Attempt = 0;     // callbacks of older ones are ignored
+  std::atomic_bool m_Running = false;     // between Open and Close
+  std::atomic_bool m_Connected = false;
+  std::atomic<Clock::rep> m_LastActivity = 0;
+  // The parser, touched only by the callbacks of the current attempt.
+  std::string m_Line;
+  bool m_SkipLf = false;                  // the line ended with '\r'
+  bool m_Started = false;                 // the BOM is checked once
+  std::u8string m_Type;
+  std::u8string m_Data;
+  std::optional<std::chrono::milliseconds> m_ServerRetry;
+  mutable Mutex m_IdMutex;
+  std::u8string m_LastEventId;
+};
+
+#endif  // HTTPEVENTSOURCE_H
@@ -0,0 +1,76 @@
+#ifndef HTTPFILESINK_H
+#define HTTPFILESINK_H
+
+#include <condition_variable>
+#include <cstdint>
+#include <filesystem>
+#include <mutex>
+#include <string>
+#include <vector>
+
+class HttpHashSink;
+
+/*
+ * Writes downloads to disk behind the network thread. Chunks are gathered
+ * into 1 MiB runs that end on block boundaries, and a shared I/O thread
+ * writes each run at its offset; the blocks are reserved from the expected
+ * size up front and the file is synced once, when it is closed. Only a
+ * backlog of many megabytes makes the network thread wait for the disk.
+ * A hash, if given, is fed on the same thread, in file order.
+ */
+class HttpFileSink {
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+  typedef std::unique_lock<Mutex> LockerEx;
+public:
+  HttpFileSink() = default;
+  ~HttpFileSink();
+  HttpFileSink(const HttpFileSink&) = delete;
+  HttpFileSink& operator=(const HttpFileSink&) = delete;
+
+  // Writes start at offset, what is before it is kept. A known final size
+  // reserves the blocks without growing the file; resize sets the size as
+  // well, for writers that fill the file out of order. A hash is reset and
+  // fed what is kept before offset, then each run written at its end; the
+  // runs written out of order are read back by Close(true).
+  bool Open(const std::filesystem::path& path, uint64_t offset, uint64_t size,
+    bool resize = false, HttpHashSink* hash = nullptr);
+  bool IsOpen() const;
+  // Appends after the last write.
+  bool Write(const void* data, size_t size);
+  bool WriteAt(const void* data, size_t size, uint64_t offset);
+  // Waits until everything is written, synced and hashed if asked, and the
+  // file is closed. False if any write or read back failed.
+  bool Close(bool sync);
+private:
+  struct Run {
+    uint64_t offset;
+    std::string data;
+  };
+  bool Append(const char* data, size_t size, uint64_t offset, std::vector<Run>& full);
+  void Post(std::vector<Run> runs);
+  bool WriteRun(const Run& run) const;
+  void PostHash(uint64_t end);
+  bool HashRange(uint64_t end);
+
+  static constexpr size_t BlockSize = 1 << 20;
+  static constexpr size_t MaxRuns = 8;
+
+  mutable Mutex m_Mutex;
+  std::condition_variable m_Condition;
+  std::vector<Run> m_Runs;
+  uint64_t m_Position = 0;
+  size_t m_Pending = 0;
+  bool m_Failed = false;
+  uint64_t m_End = 0;             // past the furthest byte written
+  // Only the writer thread touches these while the file is open.
+  HttpHashSink* m_Hash = nullptr;
+  uint64_t m_Hashed = 0;
+#ifdef _WIN32
+  void* m_hFile = nullptr;
+#else
+  int m_hFile = -1;
+#endif
+};
+
+#endif  // HTTPFILESINK_H
@@ -0,0 +1,37 @@
+#ifndef HTTPHASHSINK_H
+#define HTTPHASHSINK_H
+
+#include <array>
+#include <cstdint>
+#include <optional>
+#include <string>
+#include <string_view>
+
+/*
+ * SHA-256 of a body as it is written, so that a download is checked without
+ * reading the file back. The SHA extensions of x86 CPUs are used where the
+ * CPU has them, plain C++ elsewhere.
+ */
+class HttpHashSink {
+public:
+  typedef std::array<uint8_t, 32> Digest;
+
+  HttpHashSink() { Reset(); }
+
+  void Reset();
+  void Write(const void* data, size_t size);
+  // Pads the message; Reset before hashing anything else.
+  Digest Finish();
+  uint64_t GetSize() const { return m_Size; }
+
+  static std::u8string ToHex(const Digest& digest);
+  // 64 hex digits, after an optional "sha256:" as GitHub writes them.
+  static std::optional<Digest> FromHex(std::u8string_view text);
+private:
+  std::array<uint32_t, 8> m_State;
+  std::array<uint8_t, 64> m_Block;
+  size_t m_BlockSize;
+  uint64_t m_Size;
+};
+
+#endif  // HTTPHASHSINK_H
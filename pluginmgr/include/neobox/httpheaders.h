@@ -0,0 +1,75 @@
+#ifndef HTTPHEADERS_H
+#define HTTPHEADERS_H
+
+#include <cstdint>
+#include <iterator>
+#include <optional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+/*
+ * The header fields of a response, kept flat: names and values sit in one
+ * buffer, and each field is a few offsets plus a case-insensitive hash of
+ * its name. Lookups compare hashes before any bytes, so they ignore case
+ * without lowercasing a copy. Repeated fields (Set-Cookie) are all kept,
+ * in the order they came.
+ */
+class HttpHeaders {
+  typedef std::u8string_view StringView;
+  struct Entry {
+    uint32_t name;
+    uint32_t nameSize;
+    uint32_t value;
+    uint32_t valueSize;
+    uint32_t hash;
+  };
+public:
+  struct Field {
+    StringView name;
+    StringView value;
+  };
+
+  class Iterator {
+  public:
+    typedef std::forward_iterator_tag iterator_category;
+    typedef Field value_type;
+    typedef std::ptrdiff_t difference_type;
+    typedef void pointer;
+    typedef Field reference;
+
+    Iterator() = default;
+    Iterator(const HttpHeaders* headers, size_t index): m_Headers(headers), m_Index(index) {}
+    Field operator*() const { return m_Headers->GetField(m_Headers->m_Entries[m_Index]); }
+    Iterator& operator++() { ++m_Index; return *this; }
+    Iterator operator++(int) { auto copy = *this; ++m_Index; return copy; }
+    bool operator==(const Iterator& other) const { return m_Index == other.m_Index; }
+  private:
+    const HttpHeaders* m_Headers = nullptr;
+    size_t m_Index = 0;
+  };
+
+  // Appends a field; one that is already there stays.
+  void Add(StringView name, StringView value);
+  // Replaces every field of that name with this one.
+  void Set(StringView name, StringView value);
+  void Erase(StringView name);
+  void Clear();
+  // The value of the first field with that name, case ignored.
+  std::optional<StringView> Find(StringView name) const;
+  bool Contains(StringView name) const { return Find(name).has_value(); }
+  size_t GetSize() const { return m_Entries.size(); }
+  bool IsEmpty() const { return m_Entries.empty(); }
+  Iterator begin() const { return { this, 0 }; }
+  Iterator end() const { return { this, m_Entries.size() }; }
+
+  static uint32_t Hash(StringView name);
+  static bool Equals(StringView a, StringView b);
+private:
+  Field GetField(const Entry& entry) const;
+
+  std::u8string m_Buffer;
+  std::vector<Entry> m_Entries;
+};
+
+#endif  // HTTPHEADERS_H
@@ -0,0 +1,111 @@
+#ifndef HTTPJSONSINK_H
+#define HTTPJSONSINK_H
+
+#include <cstdint>
+#include <functional>
+#include <string>
+#include <string_view>
+#include <vector>
+
+struct HttpJsonValue {
+  enum class Type { Null, Boolean, Number, String, Object, Array };
+
+  Type type = Type::Null;
+  // Strings unescaped, numbers and literals as written, objects and
+  // arrays as their JSON text, ready for YJson.
+  std::u8string text;
+};
+
+/*
+ * A push parser for JSON bodies, fed chunk by chunk from HttpLib's onWrite
+ * while they download, which hands out only the values at selected paths:
+ *
+ *   sink.Select(u8"assets[].browser_download_url", [](auto path, auto& value) {});
+ *
+ * A path is keys joined by '.', with "[]" for any element of an array,
+ * "[n]" for one of them and "*" for any key or element; "" is the whole
+ * document. Everything not selected is checked and dropped as it passes,
+ * so memory is bounded by the selected values and the nesting depth, not
+ * by the size of the body. Callbacks run inside Write.
+ */
+class HttpJsonSink {
+public:
+  typedef HttpJsonValue Value;
+  // The path is the concrete one, e.g. "assets[2].browser_download_url".
+  typedef std::function<void(std::u8string_view path, const Value& value)> Callback;
+
+  HttpJsonSink() = default;
+  HttpJsonSink(const HttpJsonSink&) = delete;
+  HttpJsonSink& operator=(const HttpJsonSink&) = delete;
+
+  void Select(std::u8string_view path, Callback callback);
+  // False once the text is not JSON; the rest is ignored from then on.
+  bool Write(const void* data, size_t size);
+  // After the last chunk: whether exactly one whole value came.
+  bool Finish();
+  // For another document; the selections stay.
+  void Reset();
+  const std::string& GetError() const { return m_Error; }
+private:
+  enum class State {
+    Value, FirstValue, FirstKey, Key, Colon, Next,
+    String, Escape, Unicode, Number, Literal, Done, Failed,
+  };
+  struct Segment {
+    enum class Kind { Key, Index, AnyIndex, Any } kind;
+    std::u8string key;
+    size_t index = 0;
+  };
+  struct Selector {
+    std::vector<Segment> path;
+    Callback callback;
+  };
+  struct Frame {
+    bool array;
+    bool relevant;          // a selection may lie inside
+    size_t index = 0;       // of the element, in an array
+    std::u8string key;      // of the member, in a relevant object
+  };
+  struct Capture {
+    size_t selector;
+    size_t depth;           // of the frame it is the text of
+    size_t from;            // where it begins in the current chunk
+    std::u8string path;
+    std::u8string text;
+  };
+
+  bool Fail(const char* message);
+  bool BeginValue(const char8_t* text, size_t i);
+  void EndString();
+  bool EndNumber();
+  void EndValue(Value::Type type);
+  bool EndContainer(const char8_t* text, size_t i, bool array);
+  // The selectors of the value that begins here, into m_Matches.
+  void Match();
+  // Whether a selector goes below the value that begins here.
+  bool IsRelevant() const;
+  static bool MatchSegment(const Segment& segment, const Frame& frame);
+  std::u8string GetPath() const;
+  void AppendUnicode(uint32_t code);
+  void FlushSurrogate();
+
+  static constexpr size_t MaxDepth = 512;
+  static constexpr size_t MaxNumber = 1024;
+
+  std::vector<Selector> m_Selectors;
+  size_t m_MaxPath = 0;
+  State m_State = State::Value;
+  std::vector<Frame> m_Frames;
+  std::vector<Capture> m_Captures;
+  std::vector<size_t> m_Matches;    // of the scalar being read
+  std::u8string m_Token;
+  bool m_Keep = false;              // m_Token is needed
+  bool m_IsKey = false;
+  std::u8string_view m_Literal;     // the one being read
+  uint32_t m_Hex = 0;
+  int m_HexCount = 0;
+  uint32_t m_Surrogate = 0;         // a high one, waiting for its pair
+  std::string m_Error;
+};
+
+#endif  // HTTPJSONSINK_H
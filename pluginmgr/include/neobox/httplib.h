@@ -3,16 +3,57 @@
 
 #include <coroutine>
 #include <filesystem>
+#include <fstream>
 #include <string>
 #include <map>
 #include <neobox/httpproxy.h>
+#include <neobox/httpcache.h>
+#include <neobox/httpbody.h>
+#include <neobox/httpfilesink.h>
+#include <neobox/httphashsink.h>
+#include <neobox/httpheaders.h>
+#include <neobox/httpscheduler.h>
 #include <neobox/coroutine.h>
 #include <atomic>
 #include <chrono>
+#include <memory>
+#include <optional>
 
+/*
+ * An http(s) url parsed in place: the parts are views into the text, which
+ * has to outlive them, and nothing is decoded or allocated. It suits links
+ * that are only looked at, or handed once to HttpLib; HttpUrl(view) makes
+ * an owning copy when one is needed. A fragment is dropped.
+ */
+class HttpUrlView {
+  friend class HttpUrl;
+  typedef std::u8string_view StringView;
+public:
+  explicit HttpUrlView(StringView url);
+  bool IsHttps() const { return scheme.back() == u8's'; }
+  // The first value of key in the query, still percent-encoded.
+  std::optional<StringView> FindParameter(StringView key) const;
+public:
+  StringView scheme = u8"http";
+  StringView host;
+  StringView path = u8"/";
+  StringView query;  // without the '?'
+  uint16_t port = 80;
+private:
+  HttpUrlView() = default;
+  void ParseScheme(StringView& rest);
+  void ParseAuthority(StringView& rest, uint16_t defaultPort);
+  void ParseTarget(StringView rest);
+};
+
+/*
+ * An http(s) url split into its parts. The serialized form is kept next to
+ * them and rebuilt only when they change, so the url of a request can be
+ * asked for many times without encoding the query again. The parts are
+ * only changed through the setters, which rebuild it, so it never goes stale.
+ */
 class HttpUrl {
   friend class HttpLib;
-  typedef std::u8string_view::const_iterator Iterator;
   typedef std::u8string String;
   typedef std::u8string_view StringView;
   typedef String::value_type Char;
@@ -26,56 +67,50 @@ public:
     uint16_t port=80
   );
   HttpUrl(StringView url, Params params);
+  explicit HttpUrl(const HttpUrlView& url);
   HttpUrl(HttpUrl&& url) noexcept;
   HttpUrl(const HttpUrl& url);
   String GetUrl(bool showPort=false) const;
+  // Replaces the whole url, parameters included.
   void SetUrl(StringView url);
-  String GetObjectString() const;
-  bool IsHttps() const { return scheme.back() == u8's'; }
+  void SetPath(StringView path);
+  void SetParameter(String key, String value);
+  void EraseParameter(const String& key);
+  const String& GetObjectString() const { return m_Object; }
+  const String& GetScheme() const { return m_Scheme; }
+  const String& GetHost() const { return m_Host; }
+  const String& GetPath() const { return m_Path; }
+  uint16_t GetPort() const { return m_Port; }
+  const Params& GetParameters() const { return m_Parameters; }
+  bool IsHttps() const { return m_Scheme.back() == u8's'; }
   HttpUrl& operator=(HttpUrl&& url) noexcept {
-    scheme = std::move(url.scheme);
-    host = std::move(url.host);
-    path = std::move(url.path);
-    port = url.port;
-    parameters = std::move(url.parameters);
+    m_Scheme = std::move(url.m_Scheme);
+    m_Host = std::move(url.m_Host);
+    m_Path = std::move(url.m_Path);
+    m_Port = url.m_Port;
+    m_Parameters = std::move(url.m_Parameters);
+    m_Object = std::move(url.m_Object);
+    m_Url = std::move(url.m_Url);
     return *this;
   }
-public:
-  String scheme = u8"http";
-  String host;
-  String path = u8"/";
-  uint16_t port = 80;
-  Params parameters;
 private:
-  void ParseScheme(Iterator& first, Iterator last);
-  void ParseHost(Iterator& first, Iterator last);
-  void ParsePort(Iterator& first, Iterator last);
-  void ParseParams(Iterator& first, Iterator last);
-  void ParsePath(Iterator& first, Iterator last);
-  inline static Char ToHex(Char c) {
-    constexpr Char A = u8'A' - 10;
-    return c > 9 ? c + A : c + u8'0';
-  }
-  inline static Char FromHex(Char c) {
-    constexpr Char A = u8'A' - 10;
-    constexpr Char a = u8'a' - 10;
-    
-    if (std::isupper(c))
-      return c - A;
-    if (std::islower(c))
-      return c - a;
-    if (std::isdigit(c))
-      return c - '0';
-
-    return c;
-  }
+  String m_Scheme = u8"http";
+  String m_Host;
+  String m_Path = u8"/";
+  uint16_t m_Port = 80;
+  Params m_Parameters;
+  void Assign(const HttpUrlView& url);
+  void ParseParams(StringView query);
+  void Serialize();
+  String m_Object;  // path and query
+  String m_Url;     // without the port
 public:
   static void UrlEncode(StringView text, String& out);
   static void UrlDecode(StringView text, String& out);
 };
 
 struct HttpResponse {
-  typedef std::map<std::u8string, std::u8string> Headers;
+  typedef HttpHeaders Headers;
 
   std::u8string version;
   long status = -1;
@@ -83,9 +118,27 @@ struct HttpResponse {
   Headers headers;
   std::string body;
   std::u8string location; // Redirect location
+
+  // Filled when the reply came from the network. The phases are how long
+  // each step took, firstByte and total count from the start of the request.
+  struct Timing {
+    std::chrono::microseconds dns {};
+    std::chrono::microseconds connect {};
+    std::chrono::microseconds tls {};
+    std::chrono::microseconds firstByte {};
+    std::chrono::microseconds total {};
+    bool reused = false;        // ran on a connection opened before
+    size_t wireBytes = 0;       // body as received, before decoding
+    size_t decodedBytes = 0;
+  } timing;
+
+  std::u8string FindHeader(std::u8string_view name) const;
 };
 
 class HttpLib: public AsyncAwaiterObject<HttpResponse> {
+  friend class HttpEngine;
+  friend class HttpScheduler;
+  friend class HttpWebSocket;
 public:
   typedef std::recursive_mutex Mutex;
 private:
@@ -93,7 +146,7 @@ private:
   typedef std::unique_lock<Mutex> LockerEx;
 public:
   typedef HttpResponse Response;
-  typedef Response::Headers Headers;
+  typedef std::map<std::u8string, std::u8string> Headers;
   typedef uint64_t HttpId;
   typedef size_t( CallbackFunction )(void*, size_t, size_t, void*);
   typedef AsyncAwaiter<HttpResponse> Awaiter;
@@ -108,6 +161,15 @@ public:
     FinishCallback onFinish = nullptr;
     WriteCallback onWrite = nullptr;
   };
+  // Async requests only. Timeouts, dropped connections, 408/429/5xx are
+  // retried with jittered exponential backoff, or after Retry-After.
+  struct RetryPolicy {
+    int retries = 0;                               // attempts after the first
+    std::chrono::milliseconds backoff = 200ms;     // doubled per attempt
+    std::chrono::milliseconds maxDelay = 10s;      // a longer Retry-After gives up
+    bool idempotent = false;                       // also retry POST requests
+    double hedgePercentile = 0;                    // e.g. 0.95, 0 disables hedging
+  };
 
   explicit HttpLib(HttpUrl url, bool async = false, std::chrono::seconds timeout=30s)
     : m_Url(std::move(url))
@@ -120,6 +182,10 @@ public:
     HttpPrepare();
     HttpInitialize();
   }
+  explicit HttpLib(const HttpUrlView& url, bool async = false, std::chrono::seconds timeout=30s)
+    : HttpLib(HttpUrl(url), async, timeout)
+  {
+  }
   ~HttpLib();
 public:
   void SetUrl(HttpUrl::StringView url) {
@@ -132,6 +198,9 @@ public:
     HttpUninitialize();
     HttpInitialize();
   }
+  void SetUrl(const HttpUrlView& url) {
+    SetUrl(HttpUrl(url));
+  }
   void SetHeader(std::u8string key, std::u8string value) {
     m_Headers[key] = value;
   }
@@ -143,14 +212,44 @@ public:
   }
   void SetRedirect(long redirect);
   void SetPostData(void* data, size_t size);
+  // Streams the body out while sending, with Content-Length set from it.
+  void SetBody(HttpBody body);
+  void SetMultipart(HttpMultipart form);
+  // Wait for the server's 100 Continue before sending the body, so that a
+  // rejected upload costs nothing. Unset leaves it to curl (bodies over
+  // 1 MiB); WinHTTP has no support for it and ignores the setting.
+  void SetExpectContinue(bool on) { m_ExpectContinue = on; }
   Response* Get();
   Response* Get(const std::filesystem::path& path);
   Response* Get(CallbackFunction* callback, void* userData);
+  Response* Head();
   void SetTimeOut(std::chrono::seconds timeOut);
+  // priorKnowledge speaks h2 on plain http without asking first (h2c), for
+  // servers known to have it; WinHTTP has no h2c and ignores it.
+  void SetHttp2(bool on, bool priorKnowledge = false);
+  void SetPriority(HttpScheduler::Priority priority) { m_Priority = priority; }
+  // For streams that stay open and idle (SSE): they start at once instead
+  // of holding one of the scheduler's slots for hours.
+  void SetLongLived(bool on) { m_LongLived = on; }
+  // A hedged copy of the request is sent once it runs longer than the
+  // given percentile of the host's recent latencies; the first reply wins.
+  void SetRetry(RetryPolicy policy) { m_Retry = policy; }
+  // Files are not cached. A body streamed through onWrite is, and a reply
+  // from the cache is streamed through onWrite the same way.
+  void SetCache(std::filesystem::path directory, HttpCache::Mode mode = HttpCache::Mode::Revalidate);
+  // Downloads into a file only: the file is hashed as it is written, and
+  // one whose SHA-256 differs fails the request and is deleted.
+  void SetSha256(std::optional<HttpHashSink::Digest> digest) { m_Sha256 = digest; }
   Awaiter GetAsync(Callback callback = Callback { nullptr, nullptr, nullptr });
+  Awaiter GetAsync(std::filesystem::path path, Callback callback = Callback { nullptr, nullptr, nullptr });
+  Awaiter HeadAsync(Callback callback = Callback { nullptr, nullptr, nullptr });
   void ExitAsync();
   bool IsFinished() const { return m_Finished; }
+  // Body bytes received from the network, and after content decoding.
+  size_t GetRecieveSize() const { return m_RecieveSize; }
+  size_t GetDecodedSize() const { return m_DecodedSize; }
   static bool IsOnline();
+  static void FlushCache();
 public:
   static std::optional<HttpProxy> m_Proxy;
 private:
@@ -161,14 +260,30 @@ private:
 #ifdef _WIN32
   void* m_hConnect = nullptr;
   void* m_hRequest = nullptr;
+#else
+  std::u8string m_PoolKey;
+  void* m_hShare = nullptr;
 #endif
   std::chrono::seconds m_TimeOut { 30s };
   int m_RedirectDepth = 0;
+  long m_RedirectLimit = 0;
   bool m_ProxySet;
   bool m_AsyncSet;
+  HttpProxyResolver::Route m_Route;   // of the current attempt
+  std::optional<bool> m_Http2;
+  bool m_Http2PriorKnowledge = false;
+  bool m_HeadOnly = false;
+  HttpScheduler::Priority m_Priority = HttpScheduler::Priority::Normal;
+  bool m_LongLived = false;
   std::atomic_bool m_Finished;
   size_t m_RecieveSize = 0;
+  size_t m_DecodedSize = 0;
   size_t m_ConnectLength = 0;
+  size_t m_ThrottledSize = 0;   // wire bytes already charged to HttpLimiter
+  std::chrono::steady_clock::time_point m_StartTime;
+#ifdef _WIN32
+  std::chrono::steady_clock::time_point m_FirstByteTime;
+#endif
 private:
   // void StartAsync(std::coroutine_handle<> handle);
   void DoSuspend(std::coroutine_handle<> handle) override;
@@ -177,29 +292,93 @@ private:
   void HttpInitialize();
   void HttpUninitialize();
   void HttpPrepare();
-  void HttpPerform();
+  bool HttpPerform();
+#ifdef __linux__
+  std::u8string GetPoolKey() const;
+#endif
   void ResetData();
   bool SendHeaders();
+  void ResolveProxy();
+  static HttpProxyResolver::Route ResolveRoute(const HttpUrl& url);
   void SetProxyBefore();
   bool SetProxyAfter();
+  // Marks a transport error (CURLcode or WinHTTP error) that the proxy is
+  // to blame for, and tells HttpProxyResolver how the proxy did.
+  void MarkProxyError(long code);
+  void ReportProxy();
   void SetAsyncCallback();
   bool SendRequest();
   bool RecvResponse();
+  bool HasBody() const { return m_PostData.data || m_Body; }
+#ifdef _WIN32
+  bool WriteBody();
+#endif
+  std::unique_ptr<HttpBody> m_Body;
+  std::optional<bool> m_ExpectContinue;
+#ifdef _WIN32
+  std::string m_UploadBuffer;
+#endif
 private:
   bool ReadStatusCode();
   void ParseHeaders(const std::u8string&);
   bool ReadHeaders();
 #ifdef _WIN32
   bool ReadBody();
+#endif
+  void AddRecieveSize(size_t size);
+  void ReadTiming();
+#ifdef _WIN32
+  static void QueryDataThrottled(HttpId id, size_t size);
+#else
+  bool Throttle();
 #endif
   void EmitProcess();
   void EmitFinish(std::string message="");
+private:
+  // Downloads into a file resume from where the last attempt stopped, as
+  // long as the validator (ETag/Last-Modified) kept next to it still holds.
+  void PrepareResume(std::filesystem::path path);
+  bool OpenResume();
+  // An error message, if the file could not be written or is corrupt.
+  std::string CloseResume(bool success);
+  bool WriteToFile(const void* data, size_t size);
+  std::filesystem::path m_FilePath;
+  HttpFileSink m_File;
+  size_t m_ResumeFrom = 0;
+  std::optional<HttpHashSink::Digest> m_Sha256;
+  HttpHashSink m_Hash;
+private:
+  // Conditional requests against the opt-in cache; true when served stale.
+  bool PrepareCache();
+  void FinishCache(bool success);
+  void ReplayBody();
+  std::optional<HttpCache> m_Cache;
+  bool m_CacheUsed = false;
+private:
+  // Backoff timers and hedges find the request again through its async id,
+  // so a request destroyed in the meantime is simply skipped.
+  bool RetryLater();
+  void StartHedge();
+  void DropHedge();
+  static void ResumeRetry(HttpId id);
+  static void ResumeHedge(HttpId id, unsigned attempt);
+  static void OnHedgeFinish(HttpId id, const HttpLib* hedge, std::string message);
+  RetryPolicy m_Retry;
+  int m_RetryLeft = 0;
+  unsigned m_Attempt = 0;
+  bool m_Retryable = false;     // the transport failure is worth another try
+  bool m_ProxyFailed = false;   // the proxy itself could not be reached
+  bool m_Replayable = true;     // nothing was streamed out to the caller yet
+  bool m_RetryPending = false;
+  std::unique_ptr<HttpLib> m_Hedge;
 private:
   static CallbackFunction WriteFile;
   static CallbackFunction WriteString;
 #ifdef __linux__
   static CallbackFunction WriteHeader;
   static CallbackFunction WriteFunction;
+  static CallbackFunction ReadFunction;
+  static int SeekFunction(void* userData, int64_t offset, int origin);
 #endif
 #ifdef _WIN32
   static void RequestStatusCallback(void* hInternet, unsigned long long dwContext, unsigned long dwInternetStatus, void* lpvStatusInformation, unsigned long dwInternetInformationLength);
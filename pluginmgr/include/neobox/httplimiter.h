@@ -0,0 +1,80 @@
+#ifndef HTTPLIMITER_H
+#define HTTPLIMITER_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+/*
+ * Token buckets for politeness and bandwidth: requests per second and bytes
+ * per second for each configured host, a global download cap and a tighter
+ * one for background work. Nothing here sleeps on behalf of async requests;
+ * callers get the time to wait and come back later, HttpScheduler through
+ * Post and the curl reactor by pausing the transfer.
+ */
+class HttpLimiter {
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+  typedef std::unique_lock<Mutex> LockerEx;
+public:
+  typedef std::chrono::steady_clock Clock;
+  typedef Clock::duration Duration;
+
+  static HttpLimiter& Instance();
+
+  // A rate of 0 lifts that limit.
+  void SetHostLimit(std::u8string host, double requestsPerSecond, size_t bytesPerSecond = 0);
+  void SetGlobalBandwidth(size_t bytesPerSecond);
+  void SetBackgroundBandwidth(size_t bytesPerSecond);
+
+  // Zero when the request or the bytes may go now (the tokens are taken),
+  // otherwise how long to wait before asking again.
+  Duration AcquireRequest(const std::u8string& host);
+  Duration AcquireBytes(const std::u8string& host, size_t size, bool background);
+
+  // Runs task on the limiter thread once the time has come. The task must
+  // check for itself that whatever it touches is still alive.
+  void Post(Clock::time_point when, std::function<void()> task);
+private:
+  HttpLimiter() = default;
+  ~HttpLimiter();
+  HttpLimiter(const HttpLimiter&) = delete;
+  HttpLimiter& operator=(const HttpLimiter&) = delete;
+
+  struct Bucket {
+    double rate = 0;      // tokens per second, 0 means unlimited
+    double burst = 0;
+    double tokens = 0;
+    Clock::time_point last;
+
+    void Reset(double rate, double burst);
+    Duration Wait(double count, Clock::time_point now);
+    void Take(double count) { tokens -= count; }
+  };
+  struct HostLimit {
+    Bucket requests;
+    Bucket bytes;
+  };
+
+  void UpdateActive();
+  void Run();
+
+  Mutex m_Mutex;
+  std::map<std::u8string, HostLimit> m_Hosts;
+  Bucket m_Global;
+  Bucket m_Background;
+  std::atomic_bool m_Active = false;
+
+  std::condition_variable m_Condition;
+  std::multimap<Clock::time_point, std::function<void()>> m_Tasks;
+  bool m_Quit = false;
+  std::thread m_Thread;
+};
+
+#endif  // HTTPLIMITER_H
@@ -0,0 +1,61 @@
+#ifndef HTTPMONITOR_H
+#define HTTPMONITOR_H
+
+#include <atomic>
+#include <chrono>
+#include <condition_variable>
+#include <memory>
+#include <mutex>
+#include <thread>
+
+/*
+ * Keeps a cached answer to "are we online" so that IsOnline is a plain
+ * load. A background thread probes the internet on a schedule, and link or
+ * address changes (netlink on Linux, NotifyIpInterfaceChange on Windows)
+ * mark us offline at once when no interface is left and bring the next
+ * probe forward otherwise.
+ */
+class HttpMonitor {
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+  typedef std::unique_lock<Mutex> LockerEx;
+  typedef std::chrono::steady_clock Clock;
+public:
+  static HttpMonitor& Instance();
+
+  bool IsOnline() const { return m_Online; }
+  // Probe soon, e.g. after the proxy settings changed.
+  void Refresh();
+  void SetProbeInterval(std::chrono::seconds interval);
+private:
+  HttpMonitor();
+  ~HttpMonitor();
+  HttpMonitor(const HttpMonitor&) = delete;
+  HttpMonitor& operator=(const HttpMonitor&) = delete;
+
+  static bool HasInterface();
+  bool Probe();
+  void OnNetworkChange();
+  void Run();
+#ifdef _WIN32
+  void* m_hNotify = nullptr;
+#else
+  void Watch();
+  int m_Netlink = -1;
+  int m_Event = -1;
+  std::thread m_Watcher;
+#endif
+
+  // Created before the threads, so the http singletons outlive them.
+  std::unique_ptr<class HttpLib> m_Probe;
+  std::atomic_bool m_Online;
+  Mutex m_Mutex;
+  std::condition_variable m_Condition;
+  Clock::time_point m_NextProbe;
+  unsigned m_Changes = 0;
+  std::chrono::seconds m_Interval { 60 };
+  bool m_Quit = false;
+  std::thread m_Thread;
+};
+
+#endif  // HTTPMONITOR_H
@@ -0,0 +1,62 @@
+#ifndef HTTPPOOL_H
+#define HTTPPOOL_H
+
+#ifdef __linux__
+
+#include <map>
+#include <mutex>
+#include <string>
+#include <vector>
+#include <chrono>
+
+/*
+ * Keeps finished curl easy handles alive, keyed by scheme/host/port/proxy.
+ * An easy handle owns its connection cache, so handing it to the next
+ * HttpLib for the same origin reuses the warm TCP/TLS connection.
+ */
+class HttpPool {
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+  typedef std::chrono::steady_clock Clock;
+public:
+  struct Stats {
+    size_t hits = 0;        // handle taken from the pool
+    size_t misses = 0;      // handle created by curl_easy_init
+    size_t evictions = 0;   // idle handle closed by timeout or capacity
+    size_t reused = 0;      // transfers that ran on an existing connection
+    size_t connects = 0;    // transfers that opened a new connection
+  };
+
+  static HttpPool& Instance();
+
+  void* Acquire(const std::u8string& key);
+  void Release(const std::u8string& key, void* handle);
+  void Record(void* handle);
+  void Clear();
+
+  Stats GetStats() const;
+  void SetIdleTimeout(std::chrono::seconds timeout);
+  std::chrono::seconds GetIdleTimeout() const;
+  void SetMaxIdle(size_t count);
+private:
+  HttpPool() = default;
+  ~HttpPool();
+  HttpPool(const HttpPool&) = delete;
+  HttpPool& operator=(const HttpPool&) = delete;
+
+  struct Entry {
+    void* handle;
+    Clock::time_point since;
+  };
+  void Evict(Clock::time_point now);
+
+  mutable Mutex m_Mutex;
+  std::map<std::u8string, std::vector<Entry>> m_Idle;
+  std::chrono::seconds m_IdleTimeout { 60 };
+  size_t m_MaxIdle = 4;
+  Stats m_Stats;
+};
+
+#endif  // __linux__
+
+#endif  // HTTPPOOL_H
@@ -2,6 +2,7 @@
 #define HTTPPROXY_H
 
 #include <neobox/neoconfig.h>
+#include <neobox/httpproxyresolver.h>
 #include <string>
 
 class HttpProxy: public NeoConfig
@@ -12,15 +13,20 @@ public:
   explicit HttpProxy(YJson& settings);
 
   static std::u8string GetSystemProxy();
+  static std::u8string GetSystemBypass();
+  static std::u8string GetSystemPacUrl();
   static bool IsSystemProxy();
   bool IsUserEmpty();
   void UpdateSystemProxy();
+  // What HttpProxyResolver should route by, for the chosen type.
+  HttpProxyResolver::Config GetResolverConfig() const;
 private:
   static YJson& InitSettings(YJson&);
   CfgInt(Type)
   CfgString(Proxy)
   CfgString(Username)
   CfgString(Password)
+  CfgString(Bypass)
 };
 
 #endif
\ No newline at end of file
@@ -0,0 +1,90 @@
+#ifndef HTTPPROXYRESOLVER_H
+#define HTTPPROXYRESOLVER_H
+
+#include <chrono>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <string>
+#include <string_view>
+#include <unordered_map>
+#include <vector>
+
+/*
+ * Picks the route of each request: direct, or through which proxy. The
+ * settings come from a source function and are read again only after
+ * Invalidate or once they are a minute old, never per request. Hosts in
+ * the bypass list (NO_PROXY style) and loopback addresses go direct. The
+ * decision per host is cached for a few minutes. Proxies that fail are
+ * kept out for a growing while, and the next candidate of the list is
+ * used meanwhile.
+ */
+class HttpProxyResolver {
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct Config {
+    bool enabled = false;       // false: everything goes direct
+    // "host:port", a list of them split by ';' or ',', or PAC style
+    // "PROXY a:8080; SOCKS5 b:1080; DIRECT". Urls with a scheme, such as
+    // "socks5h://b:1080", are taken as they are.
+    std::u8string proxies;
+    // "localhost, .lan, *.corp.com, 10.0.0.0/8, <local>"; <local> stands
+    // for host names without a dot, "*" for every host.
+    std::u8string bypass;
+    std::u8string pacUrl;       // evaluated through WinHTTP on Windows
+    std::u8string username;
+    std::u8string password;
+  };
+
+  struct Route {
+    std::u8string proxy;        // empty: direct
+    std::u8string username;
+    std::u8string password;
+    bool IsDirect() const { return proxy.empty(); }
+  };
+
+  static HttpProxyResolver& Instance();
+
+  void SetSource(std::function<Config()> source);
+  // Reads the settings again on the next request and forgets every
+  // decision; for when the proxy settings have changed.
+  void Invalidate();
+  Route Resolve(std::u8string_view scheme, std::u8string_view host);
+  // Requests report how their proxy did, that is all the health check.
+  void ReportFailure(std::u8string_view proxy);
+  void ReportSuccess(std::u8string_view proxy);
+
+  static std::vector<std::u8string> ParseProxies(std::u8string_view text);
+  static bool IsBypassed(std::u8string_view bypass, std::u8string_view host);
+private:
+  HttpProxyResolver() = default;
+  struct Decision {
+    std::vector<std::u8string> candidates;  // an empty one is direct
+    Clock::time_point expiry;
+  };
+  struct Health {
+    Clock::time_point until;
+    unsigned failures = 0;
+  };
+  void Refresh(Clock::time_point now);
+  Route Pick(const std::vector<std::u8string>& candidates, Clock::time_point now) const;
+  static std::vector<std::u8string> Decide(const Config& config, const std::vector<std::u8string>& proxies,
+    std::u8string_view scheme, std::u8string_view host);
+
+  static constexpr auto ConfigTtl = std::chrono::seconds(60);
+  static constexpr auto DecisionTtl = std::chrono::minutes(5);
+  static constexpr size_t MaxDecisions = 1024;
+
+  Mutex m_Mutex;
+  std::function<Config()> m_Source;
+  Config m_Config;
+  std::vector<std::u8string> m_Proxies;
+  Clock::time_point m_ConfigExpiry {};
+  std::unordered_map<std::u8string, Decision> m_Decisions;
+  std::map<std::u8string, Health, std::less<>> m_Health;
+};
+
+#endif  // HTTPPROXYRESOLVER_H
@@ -0,0 +1,81 @@
+#ifndef HTTPSCHEDULER_H
+#define HTTPSCHEDULER_H
+
+#include <array>
+#include <chrono>
+#include <condition_variable>
+#include <deque>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <string>
+#include <thread>
+
+class HttpLib;
+
+/*
+ * Admission control in front of every async HttpLib request. A request
+ * starts only while its host and the whole process stay under their
+ * in-flight limits; the rest wait in one FIFO per priority class, and the
+ * higher classes are always served first. Background work may fill at most
+ * half of the global slots, so interactive requests never queue behind it.
+ * Hosts over their HttpLimiter request rate are passed over until a timer
+ * brings the queue back. Recent latencies per host are kept for hedging.
+ */
+class HttpScheduler {
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+  typedef std::chrono::steady_clock Clock;
+public:
+  enum class Priority { Interactive, Normal, Background, Count };
+
+  static HttpScheduler& Instance();
+
+  void Submit(HttpLib* clt);
+  // Submit in two steps, for a caller holding a lock that the request's
+  // callbacks may need: queued under it, started once it is released.
+  void Enqueue(HttpLib* clt);
+  void Dispatch();
+  // True if the request never started. One being started by another
+  // thread is waited for, so that the caller can take it off the engine.
+  bool Cancel(HttpLib* clt);
+  // Only successful requests feed the latency statistics.
+  void Finish(HttpLib* clt, bool success = false);
+  // Empty until the host has enough samples to make a guess.
+  std::optional<Clock::duration> GetLatency(const HttpLib* clt, double percentile) const;
+
+  void SetHostLimit(size_t count);
+  void SetGlobalLimit(size_t count);
+  size_t GetQueued() const;
+private:
+  HttpScheduler() = default;
+  HttpScheduler(const HttpScheduler&) = delete;
+  HttpScheduler& operator=(const HttpScheduler&) = delete;
+
+  static std::u8string GetHostKey(const HttpLib* clt);
+  bool CanStart(const HttpLib* clt, size_t index) const;
+
+  mutable Mutex m_Mutex;
+  std::array<std::deque<HttpLib*>, static_cast<size_t>(Priority::Count)> m_Queues;
+  struct Running {
+    size_t index;         // priority class
+    Clock::time_point start;
+  };
+  std::map<HttpLib*, Running> m_Running;
+  // Off the queue but not yet known to the engine: Dispatch starts them
+  // outside the lock.
+  struct Dispatching {
+    std::thread::id thread;
+    bool started;
+  };
+  std::map<HttpLib*, Dispatching> m_Dispatching;
+  std::condition_variable m_Dispatched;
+  std::map<std::u8string, std::deque<Clock::duration>> m_Latency;
+  std::map<std::u8string, size_t> m_HostRunning;
+  size_t m_BackgroundRunning = 0;
+  size_t m_HostLimit = 6;
+  size_t m_GlobalLimit = 16;
+  std::optional<Clock::time_point> m_WakeUp;
+};
+
+#endif  // HTTPSCHEDULER_H
@@ -0,0 +1,43 @@
+#ifndef HTTPSHARE_H
+#define HTTPSHARE_H
+
+#ifdef __linux__
+
+#include <mutex>
+#include <chrono>
+
+/*
+ * Process-wide curl share object: every HttpLib handle sees the same DNS
+ * cache and TLS session tickets. Flush() starts a fresh generation; the old
+ * one is released when the last handle still using it detaches.
+ */
+class HttpShare {
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+public:
+  static HttpShare& Instance();
+
+  void* Attach(void* handle);
+  void Detach(void* handle, void* share);
+  void Flush();
+
+  void SetDnsTimeout(std::chrono::seconds timeout);
+  std::chrono::seconds GetDnsTimeout() const;
+private:
+  HttpShare();
+  ~HttpShare();
+  HttpShare(const HttpShare&) = delete;
+  HttpShare& operator=(const HttpShare&) = delete;
+
+  struct Share;
+  static Share* NewShare();
+  static void FreeShare(Share* share);
+
+  mutable Mutex m_Mutex;
+  Share* m_Current = nullptr;
+  std::chrono::seconds m_DnsTimeout { 300 };
+};
+
+#endif  // __linux__
+
+#endif  // HTTPSHARE_H
@@ -0,0 +1,142 @@
+#ifndef HTTPSTREAM_H
+#define HTTPSTREAM_H
+
+#include <neobox/coroutine.h>
+
+#include <atomic>
+#include <chrono>
+#include <deque>
+#include <functional>
+#include <map>
+#include <mutex>
+#include <optional>
+#include <utility>
+
+/*
+ * What long-lived streams (HttpEventSource, HttpWebSocket) share: a policy
+ * for reconnecting with backoff, and timers that run on the HttpLimiter
+ * thread. Streams change their state only in such tasks, one at a time, so
+ * Open and Close may be called from any thread, callbacks included. The
+ * destructor drops the tasks still pending; it must not run inside one of
+ * the stream's own callbacks.
+ */
+class HttpStreamBase {
+protected:
+  typedef std::mutex Mutex;
+  typedef std::lock_guard<Mutex> Locker;
+  typedef std::unique_lock<Mutex> LockerEx;
+public:
+  typedef std::chrono::steady_clock Clock;
+
+  struct ReconnectPolicy {
+    std::chrono::milliseconds delay = std::chrono::seconds(3);   // doubled per failure in a row
+    std::chrono::milliseconds maxDelay = std::chrono::minutes(1);
+    int attempts = -1;                    // failures in a row, -1 never gives up
+  };
+
+  void SetReconnect(ReconnectPolicy policy) { m_Reconnect = policy; }
+protected:
+  HttpStreamBase();
+  ~HttpStreamBase();
+  HttpStreamBase(const HttpStreamBase&) = delete;
+  HttpStreamBase& operator=(const HttpStreamBase&) = delete;
+
+  void Schedule(Clock::time_point when, std::function<void()> task);
+  // Tasks posted to other threads keep the id rather than the stream, and
+  // look it up when they run. Only safe on a thread that the destructor
+  // waits for after Unregister, such as the HttpEngine thread.
+  uint64_t GetStreamId() const { return m_StreamId; }
+  static HttpStreamBase* FindStream(uint64_t id);
+  // Derived destructors call it first; no task runs after it returns.
+  void Unregister();
+  // When to connect again after a failure, nothing once the attempts are
+  // used up. The server may suggest the delay (SSE "retry:").
+  std::optional<Clock::time_point> NextAttempt(std::optional<std::chrono::milliseconds> delay = std::nullopt);
+  void ResetBackoff() { m_Failures = 0; }
+
+  ReconnectPolicy m_Reconnect;
+private:
+  uint64_t m_StreamId;
+  std::atomic_int m_Failures = 0;
+  static Mutex m_StreamMutex;
+  static std::map<uint64_t, HttpStreamBase*> m_StreamPool;
+  static uint64_t m_StreamCount;
+};
+
+/*
+ * Messages go to a callback as they arrive, or when there is none, queue up
+ * for a coroutine that takes them one at a time, like an async generator:
+ *
+ *   while (auto message = co_await stream.Next()) { ... }
+ *
+ * Next yields nullptr once the stream is closed. The pointer stays valid
+ * until Next is called again. A reader that falls behind by MaxQueued
+ * messages loses the oldest ones.
+ */
+template<typename Message>
+class HttpStream: public HttpStreamBase, public AsyncAwaiterObject<Message> {
+public:
+  typedef AsyncAwaiter<Message> Awaiter;
+
+  Awaiter Next() { return Awaiter { this }; }
+protected:
+  void Deliver(Message message) {
+    LockerEx locker(m_QueueMutex);
+    if (m_Waiting) {
+      m_Current = std::move(message);
+      auto const handle = std::exchange(m_Waiting, nullptr);
+      locker.unlock();
+      handle.resume();
+      return;
+    }
+    if (m_Queue.size() == MaxQueued) {
+      m_Queue.pop_front();
+    }
+    m_Queue.push_back(std::move(message));
+  }
+
+  // Wakes a waiting Next with nullptr, and any Next from now on.
+  void EndStream() {
+    LockerEx locker(m_QueueMutex);
+    m_Ended = true;
+    if (!m_Waiting) return;
+    m_Current.reset();
+    auto const handle = std::exchange(m_Waiting, nullptr);
+    locker.unlock();
+    handle.resume();
+  }
+
+  void BeginStream() {
+    Locker locker(m_QueueMutex);
+    m_Ended = false;
+  }
+
+  static constexpr size_t MaxQueued = 1024;
+private:
+  void DoSuspend(std::coroutine_handle<> handle) override {
+    if (!handle) return;    // Next was called but never awaited
+    LockerEx locker(m_QueueMutex);
+    if (m_Queue.empty() && !m_Ended) {
+      m_Waiting = handle;
+      return;
+    }
+    if (m_Queue.empty()) {
+      m_Current.reset();
+    } else {
+      m_Current = std::move(m_Queue.front());
+      m_Queue.pop_front();
+    }
+    locker.unlock();
+    handle.resume();
+  }
+
+  Message* GetResult() override { return m_Current ? &*m_Current : nullptr; }
+
+  Mutex m_QueueMutex;
+  std::deque<Message> m_Queue;
+  std::optional<Message> m_Current;
+  std::coroutine_handle<> m_Waiting;
+  bool m_Ended = false;
+};
+
+#endif  // HTTPSTREAM_H
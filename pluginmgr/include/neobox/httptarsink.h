@@ -0,0 +1,80 @@
+#ifndef HTTPTARSINK_H
+#define HTTPTARSINK_H
+
+#ifdef __linux__
+#include <array>
+#include <cstdint>
+#include <filesystem>
+#include <memory>
+#include <optional>
+#include <string>
+#include <vector>
+
+struct z_stream_s;
+
+/*
+ * Unpacks a .tar.gz while it downloads, fed from HttpLib's onWrite, so that
+ * neither the archive nor a tar process is needed. Entries land in a
+ * staging directory next to the destination, which takes its place in one
+ * rename once the archive turned out whole; until then, and after any
+ * failure, the destination is left as it was.
+ *
+ * Absolute names, names that climb out with "..", links that could point
+ * outside, and devices or fifos are refused.
+ */
+class HttpTarSink {
+public:
+  explicit HttpTarSink(std::filesystem::path destination);
+  ~HttpTarSink();
+  HttpTarSink(const HttpTarSink&) = delete;
+  HttpTarSink& operator=(const HttpTarSink&) = delete;
+
+  // False once the archive is broken; the rest is ignored from then on.
+  bool Write(const void* data, size_t size);
+  // After the last chunk: checks that the archive is complete and moves
+  // it into place.
+  bool Finish();
+  const std::string& GetError() const { return m_Error; }
+private:
+  enum class State { Header, Data, Padding, Done, Failed };
+
+  bool Fail(std::string message);
+  bool Consume(const uint8_t* data, size_t size);
+  bool ReadHeader();
+  bool BeginEntry();
+  bool EndEntry();
+  bool ParsePax();
+  std::optional<std::filesystem::path> GetSafePath(std::string_view name) const;
+
+  static constexpr size_t MaxExtended = 1 << 16;
+
+  std::filesystem::path m_Destination;
+  std::filesystem::path m_Staging;        // empty once moved into place
+  std::unique_ptr<z_stream_s> m_Stream;
+  bool m_StreamEnd = false;
+  std::vector<uint8_t> m_Buffer;
+  State m_State = State::Header;
+  std::array<uint8_t, 512> m_Header;
+  size_t m_HeaderSize = 0;
+  int m_ZeroBlocks = 0;
+
+  // The entry being read.
+  char m_Type = 0;
+  uint32_t m_Mode = 0;
+  uint64_t m_Left = 0;
+  uint64_t m_Padding = 0;
+  std::string m_Name;
+  std::string m_LinkName;
+  int m_File = -1;
+  std::string m_Extended;                 // a long name or pax header
+
+  // Set by GNU long names and pax headers, for the entry that follows.
+  std::string m_NextName;
+  std::string m_NextLinkName;
+  std::optional<uint64_t> m_NextSize;
+
+  std::string m_Error;
+};
+#endif
+
+#endif  // HTTPTARSINK_H
@@ -0,0 +1,140 @@
+#ifndef HTTPWEBSOCKET_H
+#define HTTPWEBSOCKET_H
+
+#include <neobox/httplib.h>
+#include <neobox/httpstream.h>
+
+#include <string>
+#include <vector>
+#ifdef _WIN32
+#include <condition_variable>
+#include <thread>
+#endif
+
+struct HttpWebSocketMessage {
+  std::string data;
+  bool binary = false;  // false: text, valid UTF-8
+};
+
+/*
+ * An RFC 6455 WebSocket client (ws:// and wss://, through the proxy that
+ * HttpProxyResolver picks). Frames are parsed as the bytes arrive; pings
+ * are answered and fragments joined, so callers only see whole messages.
+ * A connection that ends without a Close of ours is opened again with
+ * backoff, whatever the close code; Close from onClose to stop that.
+ *
+ * On Linux the socket is driven by HttpEngine and every callback runs on
+ * its reactor thread. On Windows WinHTTP does the framing, and callbacks
+ * run on one receive thread per socket.
+ */
+class HttpWebSocket: public HttpStream<HttpWebSocketMessage> {
+public:
+  typedef HttpWebSocketMessage Message;
+  typedef std::function<void()> OpenCallback;
+  typedef std::function<void(const Message&)> MessageCallback;
+  // Each time a connection ends or fails: the close code, 1006 when there
+  // was no closing handshake, and the reason.
+  typedef std::function<void(int code, const std::string& reason)> CloseCallback;
+  struct Callback {
+    OpenCallback onOpen;
+    MessageCallback onMessage;          // none: messages queue for Next
+    CloseCallback onClose;
+  };
+
+  explicit HttpWebSocket(std::u8string_view url, Callback callback = {});
+  ~HttpWebSocket();
+
+  // Before Open; they go with every handshake.
+  void SetHeader(std::u8string key, std::u8string value);
+  void SetProtocols(std::vector<std::u8string> protocols);
+  // Sends a ping this often and drops a connection that answers nothing
+  // for two rounds; 0 turns it off.
+  void SetPingInterval(std::chrono::seconds interval) { m_PingInterval = interval; }
+  void SetMaxMessageSize(size_t size) { m_MaxMessageSize = size; }
+
+  void Open();
+  // False when there is no open connection, or the text is not UTF-8;
+  // the message is then dropped.
+  bool Send(std::string_view text);
+  bool SendBinary(std::string_view data);
+  void Close(uint16_t code = 1000, std::string reason = {});
+  bool IsOpen() const { return m_Connected; }
+  // The subprotocol the server chose, if any.
+  std::u8string GetProtocol() const;
+private:
+  bool Send(std::string_view data, bool binary);
+  void Dispatch(Message message);
+  void Finish(int code, const std::string& reason);
+
+  HttpUrl m_Url;
+  HttpLib::Headers m_Headers;
+  std::vector<std::u8string> m_Protocols;
+  const Callback m_Callback;
+  std::chrono::seconds m_PingInterval { 0 };
+  size_t m_MaxMessageSize = 16 << 20;
+  std::atomic_uint64_t m_Attempt = 0;     // events of older ones are ignored
+  std::atomic_bool m_Running = false;     // between Open and Close
+  std::atomic_bool m_Connected = false;
+  mutable Mutex m_ProtocolMutex;
+  std::u8string m_Protocol;
+#ifdef _WIN32
+  void Run();
+  bool Connect();
+  void Receive();
+  void Disconnect();
+
+  void* m_hSession = nullptr;
+  void* m_hConnect = nullptr;
+  void* m_hWebSocket = nullptr;           // the request during the handshake
+  Mutex m_SocketMutex;                    // the handles, against Close
+  std::condition_variable m_Condition;    // wakes the backoff wait
+  std::thread m_Thread;
+#elif defined (__linux__)
+  enum class State { Idle, Connecting, Handshake, Open, Closing };
+  enum class Opcode: uint8_t {
+    Continuation = 0x0, Text = 0x1, Binary = 0x2,
+    Close = 0x8, Ping = 0x9, Pong = 0xA,
+  };
+
+  typedef std::function<void(HttpWebSocket&)> Task;
+
+  // Runs the task on the HttpEngine thread, unless the socket is gone by
+  // then; it is looked up by id, the task never holds on to it.
+  void Post(Task task);
+  // All of these run on the HttpEngine thread.
+  void Connect();
+  void OnConnect(int code);
+  void OnReady(int events);
+  void Flush();
+  void Receive();
+  bool ReadHandshake();
+  void ReadFrames();
+  bool ReadFrame(Opcode opcode, bool fin, std::string_view payload);
+  void SendFrame(Opcode opcode, std::string_view payload);
+  void SendClose(uint16_t code, std::string_view reason);
+  void Ping(uint64_t attempt);
+  // Fails the connection over a protocol error.
+  void Fail(uint16_t code, const std::string& reason);
+  // Ends the connection and reconnects, unless closed.
+  void Drop(int code, std::string reason, bool retry = true);
+  void Teardown();
+  // A timer that runs the task on the engine thread, unless the connection
+  // of that attempt is gone by then.
+  void Later(Clock::time_point when, uint64_t attempt, Task task);
+
+  void* m_hSession = nullptr;
+  State m_State = State::Idle;
+  std::string m_Key;                      // Sec-WebSocket-Key of this handshake
+  std::string m_Input;
+  std::string m_Output;
+  std::string m_Message;                  // the fragments so far
+  bool m_MessageBinary = false;
+  bool m_Fragmented = false;
+  bool m_CloseReceived = false;
+  int m_CloseCode = 1005;
+  std::string m_CloseReason;
+  Clock::time_point m_LastActivity;
+#endif
+};
+
+#endif  // HTTPWEBSOCKET_H
@@ -3,6 +3,8 @@
 
 #include <memory>
 #include <functional>
+#include <optional>
+#include <vector>
 #include <yjson/yjson.h>
 #include <neobox/neoconfig.h>
 #include <neobox/coroutine.h>
@@ -42,10 +44,20 @@ private:
   void CopyExecutable() const;
 #ifdef _WIN32
 #endif
+  // What CheckUpdate reads out of the release manifest.
+  struct Release {
+    struct Asset {
+      std::u8string url;
+      std::u8string digest;     // "sha256:<hex>", when GitHub has one
+    };
+    std::u8string tagName;
+    std::vector<Asset> assets;
+  };
+
   std::u8string m_ZipUrl;
-  std::unique_ptr<YJson> m_LatestData;
+  std::optional<Release> m_LatestRelease;
   std::unique_ptr<class HttpLib> m_DataRequest;
-  std::ofstream m_File;
+  std::unique_ptr<class HttpDownload> m_Download;
 signals:
   void AskInstall();
   void QuitApp(QString exe, QStringList arg) const;
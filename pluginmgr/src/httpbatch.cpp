@@ -0,0 +1,151 @@
+#include <neobox/httpbatch.h>
+
+#include <algorithm>
+#include <utility>
+
+HttpBatch::HttpBatch(std::chrono::seconds timeout)
+  : m_TimeOut(timeout)
+{
+}
+
+HttpBatch::HttpBatch(const std::vector<HttpUrl>& urls, std::chrono::seconds timeout)
+  : m_TimeOut(timeout)
+{
+  for (auto const& url: urls) {
+    Add(url);
+  }
+}
+
+HttpBatch::~HttpBatch()
+{
+  ExitAsync();
+  m_Requests.clear();
+}
+
+HttpLib& HttpBatch::Add(HttpUrl url, std::filesystem::path path)
+{
+  m_Paths.push_back(std::move(path));
+  return *m_Requests.emplace_back(std::make_unique<HttpLib>(std::move(url), true, m_TimeOut));
+}
+
+HttpBatch::Awaiter HttpBatch::WhenAll(FinishCallback callback)
+{
+  return WhenAny(0, std::move(callback));
+}
+
+HttpBatch::Awaiter HttpBatch::WhenAny(size_t count, FinishCallback callback)
+{
+  Locker locker(m_Mutex);
+  m_Need = std::min(count, m_Requests.size());
+  m_Callback = std::move(callback);
+  m_Results.assign(m_Requests.size(), Item {});
+  m_Started = m_Finished = m_Succeeded = 0;
+  m_Running = true;
+  return Awaiter { this };
+}
+
+bool HttpBatch::IsFinished() const
+{
+  Locker locker(m_Mutex);
+  return !m_Running;
+}
+
+bool HttpBatch::IsDone() const
+{
+  auto const total = m_Requests.size();
+  if (m_Finished == total) return true;
+  if (m_Need == 0) return false;
+  return m_Succeeded >= m_Need || total - m_Finished + m_Succeeded < m_Need;
+}
+
+void HttpBatch::DoSuspend(std::coroutine_handle<> handle)
+{
+  {
+    Locker locker(m_Mutex);
+    m_Waiting = handle;
+    m_Starting = true;
+  }
+
+  for (size_t i = 0; i != m_Requests.size(); ++i) {
+    {
+      // Requests finishing right away, e.g. from the cache, may already
+      // have settled a WhenAny.
+      Locker locker(m_Mutex);
+      if (IsDone()) break;
+      m_Started = i + 1;
+    }
+    HttpLib::Callback callback {
+      .onFinish = [this, i](std::string message, const HttpResponse* response) {
+        OnFinish(i, std::move(message), response);
+      },
+    };
+    if (m_Paths[i].empty()) {
+      m_Requests[i]->GetAsync(std::move(callback));
+    } else {
+      m_Requests[i]->GetAsync(m_Paths[i], std::move(callback));
+    }
+  }
+
+  std::vector<HttpLib*> running;
+  {
+    Locker locker(m_Mutex);
+    m_Starting = false;
+    if (!m_Running || !IsDone()) return;
+    running = TakeRunning();
+  }
+  EmitFinish(running);
+}
+
+void HttpBatch::OnFinish(size_t index, std::string message, const HttpResponse* response)
+{
+  std::vector<HttpLib*> running;
+  {
+    Locker locker(m_Mutex);
+    // Late replies of cancelled requests must not touch handed out results.
+    if (!m_Running) return;
+    auto& item = m_Results[index];
+    item.finished = true;
+    item.error = std::move(message);
+    item.response = response;
+    ++m_Finished;
+    if (item.error.empty()) ++m_Succeeded;
+    // While starting, DoSuspend finishes up once every request is out.
+    if (m_Starting || !IsDone()) return;
+    running = TakeRunning();
+  }
+  EmitFinish(running);
+}
+
+std::vector<HttpLib*> HttpBatch::TakeRunning()
+{
+  m_Running = false;
+  std::vector<HttpLib*> running;
+  for (size_t i = 0; i != m_Started; ++i) {
+    if (!m_Results[i].finished) running.push_back(m_Requests[i].get());
+  }
+  return running;
+}
+
+void HttpBatch::ExitAsync()
+{
+  std::vector<HttpLib*> running;
+  {
+    Locker locker(m_Mutex);
+    if (!m_Running) return;
+    running = TakeRunning();
+  }
+  EmitFinish(running);
+}
+
+void HttpBatch::EmitFinish(const std::vector<HttpLib*>& running)
+{
+  // The rest are not wanted any more; their callbacks may run right here.
+  for (auto clt: running) {
+    clt->ExitAsync();
+  }
+
+  auto callback = std::move(m_Callback);
+  auto handle = std::exchange(m_Waiting, nullptr);
+  if (callback) callback(m_Results);
+  if (handle) handle.resume();
+}
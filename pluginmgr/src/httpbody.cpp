@@ -0,0 +1,202 @@
+#include <neobox/httpbody.h>
+
+#include <algorithm>
+#include <cstring>
+#include <iostream>
+#include <iterator>
+#include <random>
+
+namespace fs = std::filesystem;
+
+void HttpBody::Append(std::string data)
+{
+  m_Size += data.size();
+  // Part headers and separators come in small strings, keep them together.
+  if (!m_Pieces.empty() && m_Pieces.back().type == Piece::Type::String) {
+    auto& last = m_Pieces.back();
+    last.data += data;
+    last.size = last.data.size();
+    return;
+  }
+  auto const size = data.size();
+  m_Pieces.push_back({ .type = Piece::Type::String, .data = std::move(data), .size = size });
+}
+
+void HttpBody::AppendView(const void* data, size_t size)
+{
+  m_Size += size;
+  m_Pieces.push_back({ .type = Piece::Type::View, .view = static_cast<const char*>(data), .size = size });
+}
+
+bool HttpBody::AppendFile(fs::path path)
+{
+  std::error_code error;
+  auto const size = fs::file_size(path, error);
+  if (!error && !std::ifstream(path, std::ios::binary | std::ios::in).is_open()) {
+    error = std::make_error_code(std::errc::permission_denied);
+  }
+  if (error) {
+    std::cerr << "HttpBody Error: can not read " << path.string() << ": " << error.message() << ".\n";
+    return false;
+  }
+  m_Size += size;
+  m_Pieces.push_back({ .type = Piece::Type::File, .path = std::move(path), .size = size });
+  return true;
+}
+
+void HttpBody::AppendReader(Reader reader, uint64_t size)
+{
+  m_Size += size;
+  m_Rewindable = false;
+  m_Pieces.push_back({ .type = Piece::Type::Reader, .reader = std::move(reader), .size = size });
+}
+
+void HttpBody::AppendBody(HttpBody body)
+{
+  m_Size += body.m_Size;
+  m_Rewindable = m_Rewindable && body.m_Rewindable;
+  std::move(body.m_Pieces.begin(), body.m_Pieces.end(), std::back_inserter(m_Pieces));
+}
+
+bool HttpBody::Rewind()
+{
+  if (!m_Started) return true;
+  if (!m_Rewindable) return false;
+
+  m_Started = false;
+  m_Index = 0;
+  m_Offset = 0;
+  m_File.close();
+  return true;
+}
+
+size_t HttpBody::Read(void* buffer, size_t size)
+{
+  m_Started = true;
+  auto const out = static_cast<char*>(buffer);
+  size_t done = 0;
+  while (done != size && m_Index != m_Pieces.size()) {
+    auto& piece = m_Pieces[m_Index];
+    auto const want = static_cast<size_t>(std::min<uint64_t>(size - done, piece.size - m_Offset));
+    size_t got = want;
+    switch (piece.type) {
+    case Piece::Type::String:
+      std::memcpy(out + done, piece.data.data() + m_Offset, want);
+      break;
+    case Piece::Type::View:
+      std::memcpy(out + done, piece.view + m_Offset, want);
+      break;
+    case Piece::Type::File:
+      if (!want) break;
+      if (!m_File.is_open()) {
+        m_File.open(piece.path, std::ios::in | std::ios::binary);
+      }
+      m_File.read(out + done, static_cast<std::streamsize>(want));
+      got = static_cast<size_t>(m_File.gcount());
+      if (got != want) {
+        // Content-Length is already out, a file that shrank can not be sent.
+        std::cerr << "HttpBody Error: " << piece.path.string() << " changed while sending.\n";
+        return ReadError;
+      }
+      break;
+    case Piece::Type::Reader:
+      if (!want) break;
+      got = piece.reader(out + done, want);
+      if (got == ReadError || got == 0 || got > want) {
+        std::cerr << "HttpBody Error: reader ended before its announced size.\n";
+        return ReadError;
+      }
+      break;
+    }
+    done += got;
+    m_Offset += got;
+    if (m_Offset == piece.size) {
+      ++m_Index;
+      m_Offset = 0;
+      m_File.close();
+    }
+  }
+  return done;
+}
+
+HttpMultipart::HttpMultipart()
+{
+  static thread_local std::mt19937_64 engine(std::random_device{}());
+  constexpr char digits[] = "0123456789abcdef";
+  m_Boundary = "----NeoboxFormBoundary";
+  for (auto value = engine(); value; value >>= 4) {
+    m_Boundary.push_back(digits[value & 15]);
+  }
+}
+
+// Quotes in names are percent-encoded, as browsers do.
+static void AppendQuoted(std::string& out, std::u8string_view text)
+{
+  out.push_back('"');
+  for (auto c: text) {
+    if (c == u8'"') out += "%22";
+    else if (c == u8'\r') out += "%0D";
+    else if (c == u8'\n') out += "%0A";
+    else out.push_back(static_cast<char>(c));
+  }
+  out.push_back('"');
+}
+
+void HttpMultipart::AddHeader(std::u8string_view name, const std::u8string* fileName, std::u8string_view contentType)
+{
+  std::string header = "--" + m_Boundary + "\r\nContent-Disposition: form-data; name=";
+  AppendQuoted(header, name);
+  if (fileName) {
+    header += "; filename=";
+    AppendQuoted(header, *fileName);
+    header += "\r\nContent-Type: ";
+    header.append(contentType.begin(), contentType.end());
+  }
+  header += "\r\n\r\n";
+  m_Body.Append(std::move(header));
+}
+
+void HttpMultipart::AddField(std::u8string_view name, std::u8string_view value)
+{
+  AddHeader(name, nullptr, {});
+  m_Body.Append(std::string(value.begin(), value.end()) + "\r\n");
+}
+
+bool HttpMultipart::AddFile(std::u8string_view name, fs::path path, std::u8string_view contentType)
+{
+  std::error_code error;
+  if (!fs::is_regular_file(path, error)) {
+    std::cerr << "HttpMultipart Error: " << path.string() << " is not a file.\n";
+    return false;
+  }
+  // Opened before its part header goes out, so a failure leaves no half part.
+  auto const fileName = path.filename().u8string();
+  HttpBody file;
+  if (!file.AppendFile(std::move(path))) return false;
+  AddHeader(name, &fileName, contentType);
+  m_Body.AppendBody(std::move(file));
+  m_Body.Append("\r\n");
+  return true;
+}
+
+void HttpMultipart::AddData(std::u8string_view name, std::u8string_view fileName,
+  const void* data, size_t size, std::u8string_view contentType)
+{
+  const std::u8string file(fileName);
+  AddHeader(name, &file, contentType);
+  m_Body.AppendView(data, size);
+  m_Body.Append("\r\n");
+}
+
+std::u8string HttpMultipart::GetContentType() const
+{
+  std::u8string result = u8"multipart/form-data; boundary=";
+  result.append(m_Boundary.begin(), m_Boundary.end());
+  return result;
+}
+
+HttpBody HttpMultipart::Finish()
+{
+  m_Body.Append("--" + m_Boundary + "--\r\n");
+  return std::move(m_Body);
+}
@@ -0,0 +1,149 @@
+#include <neobox/httpcache.h>
+#include <neobox/httplib.h>
+
+#include <algorithm>
+#include <chrono>
+#include <fstream>
+#include <iterator>
+#include <mutex>
+#include <random>
+#include <unordered_set>
+
+namespace fs = std::filesystem;
+
+/*
+ * Entry layout, both files named after a hash of the url:
+ *   <hash>.head  the url on the first line, a stamp on the second, then one
+ *                "key: value" per header
+ *   <hash>.body  the same stamp on the first line, then the raw body
+ * Each file is renamed into place whole, but not both at once: a head and
+ * a body whose stamps differ come from different stores and are ignored.
+ */
+
+static std::mutex s_RevalidateMutex;
+static std::unordered_set<std::string> s_Revalidating;
+
+fs::path HttpCache::GetPath(std::u8string_view url, const char* extension) const
+{
+  // FNV-1a, stable between runs and platforms unlike std::hash.
+  uint64_t hash = 0xcbf29ce484222325;
+  for (auto c: url) {
+    hash = (hash ^ static_cast<uint8_t>(c)) * 0x100000001b3;
+  }
+
+  char name[17];
+  for (int i = 15; i >= 0; --i, hash >>= 4) {
+    name[i] = "0123456789abcdef"[hash & 0xf];
+  }
+  name[16] = '\0';
+  return m_Directory / (std::string(name) + extension);
+}
+
+bool HttpCache::Load(std::u8string_view url, HttpResponse& response) const
+{
+  std::ifstream head(GetPath(url, ".head"), std::ios::binary | std::ios::in);
+  if (!head.is_open()) return false;
+
+  std::string line;
+  if (!std::getline(head, line) || line.size() != url.size() ||
+    !std::equal(line.begin(), line.end(), url.begin()))
+    return false;   // hash collision or broken entry
+
+  std::string stamp;
+  std::ifstream body(GetPath(url, ".body"), std::ios::binary | std::ios::in);
+  if (!std::getline(head, stamp) || !body.is_open() ||
+    !std::getline(body, line) || line != stamp)
+    return false;
+
+  response.headers.Clear();
+  while (std::getline(head, line)) {
+    auto const pos = line.find(": ");
+    if (pos == line.npos) continue;
+    const std::u8string_view text(reinterpret_cast<const char8_t*>(line.data()), line.size());
+    response.headers.Add(text.substr(0, pos), text.substr(pos + 2));
+  }
+  response.body.assign(std::istreambuf_iterator<char>(body), {});
+  response.status = 200;
+  response.reason = u8"OK";
+  response.location.clear();
+  return true;
+}
+
+bool HttpCache::Store(std::u8string_view url, const HttpResponse& response) const
+{
+  if (response.FindHeader(u8"cache-control").find(u8"no-store") != std::u8string::npos) {
+    Remove(url);
+    return false;
+  }
+
+  std::error_code error;
+  fs::create_directories(m_Directory, error);
+
+  static std::mutex mutex;
+  static std::mt19937_64 engine(std::random_device {}() ^
+    static_cast<uint64_t>(std::chrono::steady_clock::now().time_since_epoch().count()));
+  uint64_t stamp;
+  {
+    std::lock_guard<std::mutex> locker(mutex);
+    stamp = engine();
+  }
+
+  // Temporary names of this store alone: two stores of one url at once
+  // must not write into the same files.
+  auto const headPath = GetPath(url, ".head");
+  auto const bodyPath = GetPath(url, ".body");
+  auto const suffix = "." + std::to_string(stamp) + ".tmp";
+  auto headTemp = headPath, bodyTemp = bodyPath;
+  headTemp += suffix;
+  bodyTemp += suffix;
+  auto const fail = [&] {
+    fs::remove(headTemp, error);
+    fs::remove(bodyTemp, error);
+    return false;
+  };
+
+  std::ofstream body(bodyTemp, std::ios::binary | std::ios::out);
+  std::ofstream head(headTemp, std::ios::binary | std::ios::out);
+  if (!body.is_open() || !head.is_open()) {
+    body.close();
+    head.close();
+    return fail();
+  }
+
+  body << stamp << '\n';
+  body.write(response.body.data(), response.body.size());
+  head.write(reinterpret_cast<const char*>(url.data()), url.size()) << '\n';
+  head << stamp << '\n';
+  for (auto const& [key, value]: response.headers) {
+    head.write(reinterpret_cast<const char*>(key.data()), key.size()) << ": ";
+    head.write(reinterpret_cast<const char*>(value.data()), value.size()) << '\n';
+  }
+  body.close();
+  head.close();
+  if (!body || !head) return fail();
+
+  fs::rename(bodyTemp, bodyPath, error);
+  if (!error) fs::rename(headTemp, headPath, error);
+  // A body without its head has a stamp no head matches, and is ignored.
+  if (error) return fail();
+  return true;
+}
+
+bool HttpCache::BeginRevalidate(std::u8string_view url) const
+{
+  std::lock_guard<std::mutex> locker(s_RevalidateMutex);
+  return s_Revalidating.insert(GetPath(url, ".head").string()).second;
+}
+
+void HttpCache::EndRevalidate(std::u8string_view url) const
+{
+  std::lock_guard<std::mutex> locker(s_RevalidateMutex);
+  s_Revalidating.erase(GetPath(url, ".head").string());
+}
+
+void HttpCache::Remove(std::u8string_view url) const
+{
+  std::error_code error;
+  fs::remove(GetPath(url, ".head"), error);
+  fs::remove(GetPath(url, ".body"), error);
+}
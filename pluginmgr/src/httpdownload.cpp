@@ -0,0 +1,290 @@
+#include <neobox/httpdownload.h>
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+
+namespace fs = std::filesystem;
+
+static uint64_t ParseNumber(std::u8string_view text)
+{
+  uint64_t value = 0;
+  auto const first = reinterpret_cast<const char*>(text.data());
+  std::from_chars(first, first + text.size(), value);
+  return value;
+}
+
+HttpDownload::HttpDownload(HttpUrl url, fs::path path, size_t segments, std::chrono::seconds timeout)
+  : m_Url(std::move(url))
+  , m_FilePath(std::move(path))
+  , m_TimeOut(timeout)
+  , m_Segments(std::max<size_t>(segments, 1))
+{
+}
+
+HttpDownload::~HttpDownload()
+{
+  ExitAsync();
+  // Destroying a request waits for its callbacks to return, so the probe
+  // goes first: it is the only one that may still be adding parts.
+  m_Probe.reset();
+  m_Parts.clear();
+  m_File.Close(false);
+}
+
+HttpDownload::Awaiter HttpDownload::GetAsync(Callback callback)
+{
+  m_Callback = std::move(callback);
+  m_Callback.onWrite = nullptr;
+  m_Finished = false;
+  return Awaiter { this };
+}
+
+void HttpDownload::DoSuspend(std::coroutine_handle<> handle)
+{
+  if (handle != nullptr) {
+    auto finish = std::move(m_Callback.onFinish);
+    m_Callback.onFinish = [finish, handle](auto message, auto response) {
+      if (finish) finish(message, response);
+      handle.resume();
+    };
+  }
+
+  m_Probe = NewRequest();
+  // Ranges are served from the identity encoding, so measure that one.
+  m_Probe->SetHeader(u8"Accept-Encoding", u8"identity");
+  m_Probe->HeadAsync({
+    .onFinish = [this](std::string message, const Response* response) {
+      OnProbe(std::move(message), response);
+    },
+  });
+}
+
+std::unique_ptr<HttpLib> HttpDownload::NewRequest() const
+{
+  auto clt = std::make_unique<HttpLib>(m_Url, true, m_TimeOut);
+  for (auto& [key, value]: m_Headers) {
+    clt->SetHeader(key, value);
+  }
+  if (m_Http2) {
+    clt->SetHttp2(*m_Http2);
+  }
+  if (m_Redirect) {
+    clt->SetRedirect(m_Redirect);
+  }
+  clt->SetPriority(m_Priority);
+  return clt;
+}
+
+void HttpDownload::OnProbe(std::string message, const Response* response)
+{
+  if (m_Finished) return;
+
+  uint64_t size = 0;
+  bool ranges = false;
+  if (message.empty() && response->status == 200) {
+    ranges = response->FindHeader(u8"accept-ranges") == u8"bytes";
+    size = ParseNumber(response->FindHeader(u8"content-length"));
+    m_Response.headers = response->headers;
+  }
+
+  auto const count = ranges && m_MinSegment ?
+    static_cast<size_t>(std::min<uint64_t>(m_Segments, size / m_MinSegment)) : 1;
+
+  std::vector<std::unique_ptr<HttpLib>> parts;
+  if (count < 2) {
+    // Nothing to split (or HEAD was refused), fall back to one stream.
+    parts.push_back(NewRequest());
+    parts.back()->SetSha256(m_Sha256);
+    StartParts(std::move(parts));
+    return;
+  }
+
+  // Ranges land out of order, so the file gets its full size right away.
+  if (!m_File.Open(m_FilePath, 0, size, true, m_Sha256 ? &m_Hash : nullptr)) {
+    m_Response.status = -1;
+    EmitFinish("HttpDownload Error: can not open file.");
+    return;
+  }
+
+  m_ConnectLength = size;
+  auto const step = size / count;
+  for (size_t i = 0; i != count; ++i) {
+    auto const first = i * step;
+    auto const last = (i + 1 == count ? size : first + step) - 1;
+    m_Ranges.push_back({ first, last, 0 });
+
+    auto const range = "bytes=" + std::to_string(first) + "-" + std::to_string(last);
+    auto& clt = parts.emplace_back(NewRequest());
+    clt->SetHeader(u8"Range", std::u8string(range.begin(), range.end()));
+  }
+  StartParts(std::move(parts));
+}
+
+void HttpDownload::StartParts(std::vector<std::unique_ptr<HttpLib>> parts)
+{
+  {
+    Locker locker(m_Mutex);
+    if (m_Closing) return;
+    m_PartsLeft = parts.size();
+    for (auto& clt: parts) {
+      m_Parts.push_back(std::move(clt));
+    }
+  }
+
+  for (size_t i = 0; i != m_Parts.size() && !m_Finished; ++i) {
+    Callback callback {
+      .onFinish = [this, i](std::string message, const Response* response) {
+        OnPartFinish(i, std::move(message), response);
+      },
+    };
+    if (m_Ranges.empty()) {
+      callback.onProcess = [this](size_t count, size_t size) {
+        m_RecieveSize = count;
+        m_ConnectLength = size;
+        EmitProcess();
+      };
+      m_Parts[i]->GetAsync(m_FilePath, std::move(callback));
+    } else {
+      callback.onWrite = [this, i](const void* data, size_t size) {
+        OnWrite(i, data, size);
+      };
+      m_Parts[i]->GetAsync(std::move(callback));
+    }
+  }
+}
+
+void HttpDownload::OnWrite(size_t index, const void* data, size_t size)
+{
+  if (m_Finished) return;
+
+  // Each range is only ever touched by the callbacks of its own request.
+  auto& range = m_Ranges[index];
+  size = static_cast<size_t>(std::min<uint64_t>(size, range.last + 1 - range.first - range.written));
+  if (!size || !m_File.WriteAt(data, size, range.first + range.written))
+    return;
+
+  range.written += size;
+  m_RecieveSize += size;
+  EmitProcess();
+}
+
+void HttpDownload::OnPartFinish(size_t index, std::string message, const Response* response)
+{
+  if (message.empty() && !m_Ranges.empty()) {
+    auto& range = m_Ranges[index];
+    auto const bytes = response->FindHeader(u8"content-range");
+    auto const first = bytes.find_first_of(u8"0123456789");
+    if (response->status != 206 || first == bytes.npos ||
+      ParseNumber(std::u8string_view(bytes).substr(first)) != range.first) {
+      message = "HttpDownload Error: server ignored the range request.";
+    } else if (range.written != range.last + 1 - range.first) {
+      message = "HttpDownload Error: can not write file.";
+    }
+  } else if (message.empty() && response->status != 200 && response->status != 206) {
+    message = "HttpDownload Error: status " + std::to_string(response->status) + ".";
+  }
+
+  std::vector<HttpLib*> siblings;
+  bool last = false;
+  {
+    Locker locker(m_Mutex);
+    if (m_Ranges.empty()) {
+      m_Response = *response;
+      // A body that arrived but could not be kept, or did not hash right.
+      if (!message.empty() && (m_Response.status == 200 || m_Response.status == 206)) {
+        m_Response.status = -1;
+      }
+    } else if (!message.empty() && !m_Failed) {
+      m_Response.status = response->status;
+    }
+    if (!message.empty() && !m_Failed && !m_Closing) {
+      m_Failed = true;
+      m_Message = message;
+      for (auto& clt: m_Parts) {
+        siblings.push_back(clt.get());
+      }
+    }
+    // Whoever closes first, the last part or ExitAsync, owns the file.
+    if (--m_PartsLeft == 0 && !m_Closing) {
+      last = m_Closing = true;
+    }
+  }
+
+  // The other ranges are useless now; their callbacks may run right here.
+  for (auto clt: siblings) {
+    if (clt != m_Parts[index].get()) clt->ExitAsync();
+  }
+
+  if (!last) return;
+
+  if (m_Ranges.empty()) {
+    EmitFinish(m_Message);
+    return;
+  }
+
+  // Writes go to the disk behind the parts, a late failure shows up here.
+  if (!m_File.Close(!m_Failed) && !m_Failed) {
+    m_Failed = true;
+    m_Message = "HttpDownload Error: can not write file.";
+    m_Response.status = -1;
+  }
+  if (!m_Failed && m_Sha256 && m_Hash.Finish() != *m_Sha256) {
+    m_Failed = true;
+    m_Message = "HttpDownload Error: SHA-256 mismatch.";
+    m_Response.status = -1;
+  }
+  if (m_Failed) {
+    std::error_code error;
+    fs::remove(m_FilePath, error);
+  } else {
+    m_Response.status = 200;
+  }
+  EmitFinish(m_Message);
+}
+
+void HttpDownload::ExitAsync()
+{
+  std::vector<HttpLib*> requests;
+  {
+    Locker locker(m_Mutex);
+    if (m_Finished || m_Closing) return;
+    m_Closing = true;
+    if (m_Probe) requests.push_back(m_Probe.get());
+    for (auto& clt: m_Parts) {
+      requests.push_back(clt.get());
+    }
+  }
+
+  for (auto clt: requests) {
+    clt->ExitAsync();
+  }
+
+  // A single stream keeps its partial file for resuming, split ones can not.
+  if (!m_Ranges.empty()) {
+    m_File.Close(false);
+    std::error_code error;
+    fs::remove(m_FilePath, error);
+  }
+  m_Response.status = -1;
+  EmitFinish("HttpDownload Error: User terminate.");
+}
+
+void HttpDownload::EmitProcess()
+{
+  auto const& callback = m_Callback.onProcess;
+  if (callback) {
+    Locker locker(m_ProcessMutex);
+    callback(m_RecieveSize, m_ConnectLength);
+  }
+}
+
+void HttpDownload::EmitFinish(std::string message)
+{
+  if (m_Finished.exchange(true)) return;
+
+  auto callback = std::move(m_Callback.onFinish);
+  if (callback) {
+    callback(message, &m_Response);
+  }
+}
@@ -0,0 +1,434 @@
+#ifdef __linux__
+
+#include <neobox/httpengine.h>
+#include <neobox/httplib.h>
+#include <neobox/httplimiter.h>
+#include <neobox/httppool.h>
+
+#include <curl/curl.h>
+#include <sys/epoll.h>
+#include <sys/eventfd.h>
+#include <unistd.h>
+
+#include <algorithm>
+#include <iostream>
+#include <iterator>
+#include <cerrno>
+#include <stdexcept>
+#include <vector>
+
+using namespace std::literals;
+
+HttpEngine& HttpEngine::Instance()
+{
+  static HttpEngine engine;
+  return engine;
+}
+
+HttpEngine::HttpEngine()
+  : m_hMulti(curl_multi_init())
+  , m_Epoll(epoll_create1(EPOLL_CLOEXEC))
+  , m_Event(eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC))
+{
+  if (!m_hMulti || m_Epoll < 0 || m_Event < 0) {
+    throw std::runtime_error("HttpEngine Error: can not create curl multi reactor.");
+  }
+
+  epoll_event event { .events = EPOLLIN, .data = { .fd = m_Event } };
+  epoll_ctl(m_Epoll, EPOLL_CTL_ADD, m_Event, &event);
+
+  // Write callbacks ask the limiter, so it has to outlive this reactor.
+  HttpLimiter::Instance();
+
+  curl_multi_setopt(m_hMulti, CURLMOPT_SOCKETFUNCTION, &SocketCallback);
+  curl_multi_setopt(m_hMulti, CURLMOPT_SOCKETDATA, this);
+  curl_multi_setopt(m_hMulti, CURLMOPT_TIMERFUNCTION, &TimerCallback);
+  curl_multi_setopt(m_hMulti, CURLMOPT_TIMERDATA, this);
+  curl_multi_setopt(m_hMulti, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+
+  m_Thread = std::thread(&HttpEngine::Run, this);
+}
+
+HttpEngine::~HttpEngine()
+{
+  m_Quit = true;
+  Wakeup();
+  if (m_Thread.joinable()) {
+    m_Thread.join();
+  }
+
+  for (auto clt: m_Transfers) {
+    curl_multi_remove_handle(m_hMulti, clt->m_hSession);
+  }
+  m_Transfers.clear();
+  for (auto& [handle, connection]: m_Connections) {
+    curl_multi_remove_handle(m_hMulti, handle);
+  }
+  m_Connections.clear();
+
+  curl_multi_cleanup(m_hMulti);
+  close(m_Event);
+  close(m_Epoll);
+}
+
+bool HttpEngine::IsEngineThread() const
+{
+  return std::this_thread::get_id() == m_Thread.get_id();
+}
+
+void HttpEngine::Wakeup()
+{
+  const uint64_t value = 1;
+  [[maybe_unused]] auto ret = write(m_Event, &value, sizeof(value));
+}
+
+void HttpEngine::Submit(HttpLib* clt)
+{
+  if (IsEngineThread()) {
+    AddHandle(clt);
+    return;
+  }
+  m_Mutex.lock();
+  m_Commands.push_back({ Action::Add, clt, nullptr });
+  m_Mutex.unlock();
+  Wakeup();
+}
+
+void HttpEngine::Remove(HttpLib* clt)
+{
+  if (IsEngineThread()) {
+    RemoveHandle(clt);
+    return;
+  }
+
+  // Block until the reactor has detached the handle, so that the caller may
+  // safely destroy or reuse the HttpLib once this function returns.
+  bool done = false;
+  LockerEx locker(m_Mutex);
+  if (m_Stopped) {
+    RemoveHandle(clt);
+    return;
+  }
+  m_Commands.push_back({ Action::Remove, clt, &done });
+  Wakeup();
+  m_Condition.wait(locker, [&done] { return done; });
+}
+
+void HttpEngine::AddHandle(HttpLib* clt)
+{
+  if (m_Transfers.contains(clt)) return;
+
+  curl_easy_setopt(clt->m_hSession, CURLOPT_PRIVATE, clt);
+  auto const code = curl_multi_add_handle(m_hMulti, clt->m_hSession);
+  if (code != CURLM_OK) {
+    clt->EmitFinish(std::string("HttpEngine Error: ") + curl_multi_strerror(code));
+    return;
+  }
+  m_Transfers.insert(clt);
+}
+
+void HttpEngine::RemoveHandle(HttpLib* clt)
+{
+  auto const iter = m_Transfers.find(clt);
+  if (iter == m_Transfers.end()) return;
+
+  curl_multi_remove_handle(m_hMulti, clt->m_hSession);
+  m_Transfers.erase(iter);
+  std::erase_if(m_Paused, [clt](auto const& item) { return item.second == clt; });
+}
+
+void HttpEngine::Pause(HttpLib* clt, Clock::time_point until)
+{
+  m_Paused.emplace(until, clt);
+}
+
+void HttpEngine::Post(std::function<void()> task, bool wait)
+{
+  if (IsEngineThread()) {
+    task();
+    return;
+  }
+  if (!wait) {
+    m_Mutex.lock();
+    m_Commands.push_back({ Action::Call, nullptr, nullptr, std::move(task) });
+    m_Mutex.unlock();
+    Wakeup();
+    return;
+  }
+
+  bool done = false;
+  LockerEx locker(m_Mutex);
+  if (m_Stopped) {
+    task();
+    return;
+  }
+  m_Commands.push_back({ Action::Call, nullptr, &done, std::move(task) });
+  Wakeup();
+  m_Condition.wait(locker, [&done] { return done; });
+}
+
+void HttpEngine::Connect(void* handle, ConnectCallback onConnect, ReadyCallback onReady)
+{
+  curl_easy_setopt(handle, CURLOPT_PRIVATE, nullptr);
+  curl_easy_setopt(handle, CURLOPT_CONNECT_ONLY, 1L);
+  auto const code = curl_multi_add_handle(m_hMulti, handle);
+  if (code != CURLM_OK) {
+    std::cerr << "HttpEngine Error: " << curl_multi_strerror(code) << '\n';
+    onConnect(CURLE_FAILED_INIT);
+    return;
+  }
+  m_Connections[handle] = { std::move(onConnect), std::move(onReady) };
+}
+
+void HttpEngine::FinishConnect(void* handle, int code)
+{
+  auto const iter = m_Connections.find(handle);
+  if (iter == m_Connections.end()) return;
+
+  auto& connection = iter->second;
+  curl_socket_t socket = CURL_SOCKET_BAD;
+  if (code == CURLE_OK) {
+    curl_easy_getinfo(handle, CURLINFO_ACTIVESOCKET, &socket);
+  }
+  if (socket == CURL_SOCKET_BAD) {
+    auto callback = std::move(connection.onConnect);
+    Disconnect(handle);
+    callback(code == CURLE_OK ? CURLE_COULDNT_CONNECT : code);
+    return;
+  }
+
+  // curl is done with the socket; from now on it is ours to watch.
+  connection.socket = socket;
+  m_Sockets[socket] = handle;
+  WatchSocket(socket, EPOLLIN);
+  auto callback = std::move(connection.onConnect);
+  callback(CURLE_OK);
+}
+
+void HttpEngine::WatchSocket(int socket, uint32_t events)
+{
+  epoll_event event { .events = events, .data = { .fd = socket } };
+  if (epoll_ctl(m_Epoll, EPOLL_CTL_MOD, socket, &event) != 0 && errno == ENOENT) {
+    epoll_ctl(m_Epoll, EPOLL_CTL_ADD, socket, &event);
+  }
+}
+
+void HttpEngine::SetWritable(void* handle, bool on)
+{
+  auto const iter = m_Connections.find(handle);
+  if (iter == m_Connections.end() || iter->second.socket < 0) return;
+  WatchSocket(iter->second.socket, on ? EPOLLIN | EPOLLOUT : EPOLLIN);
+}
+
+void HttpEngine::Disconnect(void* handle)
+{
+  auto const iter = m_Connections.find(handle);
+  if (iter == m_Connections.end()) return;
+
+  if (iter->second.socket >= 0) {
+    epoll_ctl(m_Epoll, EPOLL_CTL_DEL, iter->second.socket, nullptr);
+    m_Sockets.erase(iter->second.socket);
+  }
+  m_Connections.erase(iter);
+  curl_multi_remove_handle(m_hMulti, handle);
+}
+
+void HttpEngine::ResumePaused()
+{
+  std::vector<HttpLib*> due;
+  auto const now = Clock::now();
+  while (!m_Paused.empty() && m_Paused.begin()->first <= now) {
+    due.push_back(m_Paused.begin()->second);
+    m_Paused.erase(m_Paused.begin());
+  }
+
+  // Unpausing delivers the held data at once, which may pause it again or
+  // even finish and detach the transfer.
+  for (auto clt: due) {
+    if (m_Transfers.contains(clt)) {
+      curl_easy_pause(clt->m_hSession, CURLPAUSE_CONT);
+    }
+  }
+}
+
+void HttpEngine::ProcessCommands()
+{
+  uint64_t value;
+  while (read(m_Event, &value, sizeof(value)) > 0);
+
+  std::deque<Command> commands;
+  m_Mutex.lock();
+  commands.swap(m_Commands);
+  m_Mutex.unlock();
+
+  bool notify = false;
+  for (auto& command: commands) {
+    switch (command.action) {
+    case Action::Add:
+      AddHandle(command.clt);
+      break;
+    case Action::Remove:
+      RemoveHandle(command.clt);
+      break;
+    case Action::Call:
+      command.task();
+      break;
+    }
+    if (command.done) {
+      m_Mutex.lock();
+      *command.done = true;
+      m_Mutex.unlock();
+      notify = true;
+    }
+  }
+
+  if (notify) {
+    m_Condition.notify_all();
+  }
+}
+
+void HttpEngine::SocketAction(int socket, int flags)
+{
+  curl_multi_socket_action(m_hMulti, socket, flags, &m_Running);
+}
+
+static bool IsTransient(CURLcode code)
+{
+  switch (code) {
+  case CURLE_COULDNT_RESOLVE_HOST:
+  case CURLE_COULDNT_CONNECT:
+  case CURLE_OPERATION_TIMEDOUT:
+  case CURLE_SSL_CONNECT_ERROR:
+  case CURLE_SEND_ERROR:
+  case CURLE_RECV_ERROR:
+  case CURLE_GOT_NOTHING:
+  case CURLE_PARTIAL_FILE:
+  case CURLE_HTTP2:
+  case CURLE_HTTP2_STREAM:
+    return true;
+  default:
+    return false;
+  }
+}
+
+void HttpEngine::CheckMultiInfo()
+{
+  int pending = 0;
+  while (auto const message = curl_multi_info_read(m_hMulti, &pending)) {
+    if (message->msg != CURLMSG_DONE) continue;
+
+    HttpLib* clt = nullptr;
+    curl_easy_getinfo(message->easy_handle, CURLINFO_PRIVATE, &clt);
+    auto const result = message->data.result;
+    if (!clt) {
+      FinishConnect(message->easy_handle, result);
+      continue;
+    }
+
+    // Detach first: the finish callback may destroy the object.
+    HttpPool::Instance().Record(message->easy_handle);
+    RemoveHandle(clt);
+    if (result == CURLE_OK) {
+      clt->EmitFinish();
+    } else {
+      clt->m_Retryable = IsTransient(result);
+      clt->MarkProxyError(result);
+      clt->EmitFinish(std::string("HttpPerform Faield: ") + curl_easy_strerror(result));
+    }
+  }
+}
+
+void HttpEngine::Run()
+{
+  epoll_event events[64];
+
+  while (!m_Quit) {
+    int timeout = -1;
+    auto deadline = m_Deadline;
+    if (!m_Paused.empty() && (!deadline || m_Paused.begin()->first < *deadline)) {
+      deadline = m_Paused.begin()->first;
+    }
+    if (deadline) {
+      auto const rest = std::chrono::ceil<std::chrono::milliseconds>(*deadline - Clock::now());
+      timeout = static_cast<int>(std::max(rest.count(), 0L));
+    }
+
+    auto const count = epoll_wait(m_Epoll, events, std::size(events), timeout);
+    if (count < 0 && errno != EINTR) {
+      std::cerr << "HttpEngine Error: epoll_wait failed.\n";
+      break;
+    }
+
+    for (int i = 0; i < count; ++i) {
+      auto const& event = events[i];
+      if (event.data.fd == m_Event) {
+        ProcessCommands();
+        continue;
+      }
+      if (auto const iter = m_Sockets.find(event.data.fd); iter != m_Sockets.end()) {
+        // The callback may disconnect, so it must not run from the map.
+        auto const callback = m_Connections[iter->second].onReady;
+        callback(static_cast<int>(event.events));
+        continue;
+      }
+      int flags = 0;
+      if (event.events & EPOLLIN) flags |= CURL_CSELECT_IN;
+      if (event.events & EPOLLOUT) flags |= CURL_CSELECT_OUT;
+      if (event.events & (EPOLLERR | EPOLLHUP)) flags |= CURL_CSELECT_ERR;
+      SocketAction(event.data.fd, flags);
+    }
+
+    if (m_Deadline && *m_Deadline <= Clock::now()) {
+      m_Deadline.reset();
+      SocketAction(CURL_SOCKET_TIMEOUT, 0);
+    }
+
+    ResumePaused();
+    CheckMultiInfo();
+  }
+
+  // Release anybody still waiting in Remove.
+  LockerEx locker(m_Mutex);
+  m_Stopped = true;
+  for (auto& command: m_Commands) {
+    if (command.action == Action::Remove) RemoveHandle(command.clt);
+    if (command.action == Action::Call && command.done) command.task();
+    if (command.done) *command.done = true;
+  }
+  m_Commands.clear();
+  locker.unlock();
+  m_Condition.notify_all();
+}
+
+int HttpEngine::SocketCallback(void*, int socket, int what, void* userp, void*)
+{
+  auto& engine = *reinterpret_cast<HttpEngine*>(userp);
+
+  if (what == CURL_POLL_REMOVE) {
+    epoll_ctl(engine.m_Epoll, EPOLL_CTL_DEL, socket, nullptr);
+    return 0;
+  }
+
+  epoll_event event { .events = 0, .data = { .fd = socket } };
+  if (what & CURL_POLL_IN) event.events |= EPOLLIN;
+  if (what & CURL_POLL_OUT) event.events |= EPOLLOUT;
+
+  if (epoll_ctl(engine.m_Epoll, EPOLL_CTL_MOD, socket, &event) != 0 && errno == ENOENT) {
+    epoll_ctl(engine.m_Epoll, EPOLL_CTL_ADD, socket, &event);
+  }
+  return 0;
+}
+
+int HttpEngine::TimerCallback(void*, long timeoutMs, void* userp)
+{
+  auto& engine = *reinterpret_cast<HttpEngine*>(userp);
+
+  if (timeoutMs < 0) {
+    engine.m_Deadline.reset();
+  } else {
+    engine.m_Deadline = Clock::now() + std::chrono::milliseconds(timeoutMs);
+  }
+  return 0;
+}
+
+#endif  // __linux__
@@ -0,0 +1,245 @@
+#include <neobox/httpeventsource.h>
+
+#include <algorithm>
+#include <charconv>
+
+using namespace std::literals;
+
+static std::u8string_view ToU8(std::string_view text)
+{
+  return { reinterpret_cast<const char8_t*>(text.data()), text.size() };
+}
+
+HttpEventSource::HttpEventSource(HttpUrl url, Callback callback)
+  : m_Url(std::move(url))
+  , m_Callback(std::move(callback))
+{
+}
+
+HttpEventSource::~HttpEventSource()
+{
+  Unregister();
+  m_Running = false;
+  ++m_Attempt;
+  m_Connected = false;
+  // Its finish callback sees an old attempt and leaves the stream alone.
+  m_Request.reset();
+  EndStream();
+}
+
+void HttpEventSource::SetHeader(std::u8string key, std::u8string value)
+{
+  m_Headers[std::move(key)] = std::move(value);
+}
+
+std::u8string HttpEventSource::GetLastEventId() const
+{
+  Locker locker(m_IdMutex);
+  return m_LastEventId;
+}
+
+void HttpEventSource::Open()
+{
+  if (m_Running.exchange(true)) return;
+  BeginStream();
+  ResetBackoff();
+  Schedule(Clock::now(), [this, attempt = m_Attempt.load()] {
+    if (attempt == m_Attempt) Connect();
+  });
+}
+
+void HttpEventSource::Close()
+{
+  if (!m_Running.exchange(false)) return;
+  // From here on the callbacks of the running request deliver nothing.
+  ++m_Attempt;
+  m_Connected = false;
+  Schedule(Clock::now(), [this] { Disconnect(); });
+  EndStream();
+}
+
+void HttpEventSource::Disconnect()
+{
+  if (!m_Running) m_Request.reset();
+}
+
+void HttpEventSource::Connect()
+{
+  if (!m_Running) return;
+  auto const attempt = ++m_Attempt;
+  m_Request.reset();
+
+  m_Line.clear();
+  m_SkipLf = false;
+  m_Started = false;
+  m_Type.clear();
+  m_Data.clear();
+  m_Connected = false;
+
+  auto request = std::make_unique<HttpLib>(m_Url, true, 0s);
+  request->SetLongLived(true);
+  for (auto const& [key, value]: m_Headers) {
+    request->SetHeader(key, value);
+  }
+  request->SetHeader(u8"Accept", u8"text/event-stream");
+  request->SetHeader(u8"Cache-Control", u8"no-cache");
+  if (auto id = GetLastEventId(); !id.empty()) {
+    request->SetHeader(u8"Last-Event-ID", std::move(id));
+  }
+
+  auto const now = Clock::now();
+  m_LastActivity = now.time_since_epoch().count();
+  if (m_IdleTimeout > 0s) {
+    Schedule(now + m_IdleTimeout, [this, attempt] { CheckIdle(attempt); });
+  }
+
+  m_Request = std::move(request);
+  m_Request->GetAsync(HttpLib::Callback {
+    nullptr,
+    [this, attempt](std::string message, const HttpResponse* response) {
+      OnFinish(attempt, message, response);
+    },
+    [this, attempt](const void* data, size_t size) {
+      OnWrite(attempt, static_cast<const char*>(data), size);
+    },
+  });
+}
+
+void HttpEventSource::CheckIdle(uint64_t attempt)
+{
+  if (attempt != m_Attempt) return;
+
+  auto const last = Clock::time_point(Clock::duration(m_LastActivity.load()));
+  if (auto const deadline = last + m_IdleTimeout; deadline > Clock::now()) {
+    Schedule(deadline, [this, attempt] { CheckIdle(attempt); });
+    return;
+  }
+
+  // Most likely a dead connection nobody told us about.
+  ++m_Attempt;
+  m_Connected = false;
+  m_Request.reset();
+  if (m_Callback.onError) {
+    m_Callback.onError("HttpEventSource Error: the stream stayed silent too long.");
+  }
+  Connect();
+}
+
+void HttpEventSource::OnWrite(uint64_t attempt, const char* data, size_t size)
+{
+  if (attempt != m_Attempt) return;
+  m_LastActivity = Clock::now().time_since_epoch().count();
+  if (!m_Connected.exchange(true)) {
+    ResetBackoff();
+    if (m_Callback.onOpen) m_Callback.onOpen();
+  }
+
+  // Lines end with "\r\n", "\n" or "\r", and may be split across chunks.
+  std::string_view chunk(data, size);
+  while (!chunk.empty() && attempt == m_Attempt) {
+    if (m_SkipLf) {
+      m_SkipLf = false;
+      if (chunk.front() == '\n') {
+        chunk.remove_prefix(1);
+        continue;
+      }
+    }
+    auto const end = chunk.find_first_of("\r\n");
+    if (end == chunk.npos) {
+      m_Line.append(chunk);
+      break;
+    }
+    m_SkipLf = chunk[end] == '\r';
+    if (m_Line.empty()) {
+      ParseLine(chunk.substr(0, end));
+    } else {
+      m_Line.append(chunk.substr(0, end));
+      ParseLine(m_Line);
+      m_Line.clear();
+    }
+    chunk.remove_prefix(end + 1);
+  }
+}
+
+void HttpEventSource::ParseLine(std::string_view line)
+{
+  if (!m_Started) {
+    m_Started = true;
+    if (line.starts_with("\xEF\xBB\xBF")) line.remove_prefix(3);
+  }
+  if (line.empty()) {
+    DispatchEvent();
+    return;
+  }
+  if (line.front() == ':') return;    // a comment, often a keep-alive
+
+  auto const colon = line.find(':');
+  auto const field = line.substr(0, colon);
+  auto value = colon == line.npos ? std::string_view() : line.substr(colon + 1);
+  if (value.starts_with(' ')) value.remove_prefix(1);
+
+  if (field == "data") {
+    m_Data.append(ToU8(value)).push_back(u8'\n');
+  } else if (field == "event") {
+    m_Type = ToU8(value);
+  } else if (field == "id") {
+    if (value.find('\0') == value.npos) {
+      Locker locker(m_IdMutex);
+      m_LastEventId = ToU8(value);
+    }
+  } else if (field == "retry") {
+    uint64_t milliseconds = 0;
+    auto const [last, error] = std::from_chars(value.data(), value.data() + value.size(), milliseconds);
+    if (error == std::errc() && last == value.data() + value.size() && !value.empty()) {
+      m_ServerRetry = std::chrono::milliseconds(milliseconds);
+    }
+  }
+}
+
+void HttpEventSource::DispatchEvent()
+{
+  if (m_Data.empty()) {
+    m_Type.clear();
+    return;
+  }
+  m_Data.pop_back();
+
+  Event event {
+    m_Type.empty() ? std::u8string(u8"message") : std::move(m_Type),
+    std::move(m_Data),
+    GetLastEventId(),
+  };
+  m_Type.clear();
+  m_Data.clear();
+  if (m_Callback.onEvent) {
+    m_Callback.onEvent(event);
+  } else {
+    Deliver(std::move(event));
+  }
+}
+
+void HttpEventSource::OnFinish(uint64_t attempt, const std::string& message, const HttpResponse* response)
+{
+  if (attempt != m_Attempt) return;
+  m_Connected = false;
+
+  auto const status = response ? response->status : -1;
+  if (m_Callback.onError) {
+    m_Callback.onError(message.empty() ? "HttpEventSource Error: the server closed the stream." : message);
+  }
+  if (attempt != m_Attempt) return;   // closed from the callback
+
+  // 204 is how a server says there is nothing more; other client errors
+  // would only repeat themselves.
+  auto const fatal = status == 204 ||
+    (status >= 400 && status < 500 && status != 408 && status != 429);
+  auto const when = fatal ? std::nullopt : NextAttempt(m_ServerRetry);
+  if (!when) {
+    m_Running = false;
+    EndStream();
+    return;
+  }
+  Schedule(*when, [this, attempt] {
+    if (attempt == m_Attempt) Connect();
+  });
+}
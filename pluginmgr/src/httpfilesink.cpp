@@ -0,0 +1,400 @@
+#include <neobox/httpfilesink.h>
+#include <neobox/httphashsink.h>
+
+#ifdef _WIN32
+#include <windows.h>
+#else
+#include <fcntl.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <algorithm>
+#include <deque>
+#include <functional>
+#include <iostream>
+#include <thread>
+
+namespace fs = std::filesystem;
+
+// The one thread all sinks write through. Its queue is bounded, so that a
+// disk far slower than the network holds the download back instead of
+// filling the memory.
+class HttpFileWriter {
+  typedef std::mutex Mutex;
+  typedef std::unique_lock<Mutex> LockerEx;
+public:
+  static HttpFileWriter& Instance()
+  {
+    static HttpFileWriter writer;
+    return writer;
+  }
+
+  void Post(size_t size, std::function<void()> task)
+  {
+    LockerEx locker(m_Mutex);
+    m_Condition.wait(locker, [this] { return m_Queued < MaxQueued || m_Quit; });
+    m_Queued += size;
+    m_Tasks.emplace_back(size, std::move(task));
+    m_Condition.notify_all();
+  }
+private:
+  HttpFileWriter() : m_Thread(&HttpFileWriter::Run, this) {}
+  ~HttpFileWriter()
+  {
+    {
+      LockerEx locker(m_Mutex);
+      m_Quit = true;
+    }
+    m_Condition.notify_all();
+    m_Thread.join();
+  }
+
+  void Run()
+  {
+    LockerEx locker(m_Mutex);
+    for (;;) {
+      m_Condition.wait(locker, [this] { return !m_Tasks.empty() || m_Quit; });
+      // Whatever is queued is still written, its sinks are waiting for it.
+      if (m_Tasks.empty()) break;
+      auto [size, task] = std::move(m_Tasks.front());
+      m_Tasks.pop_front();
+      locker.unlock();
+      task();
+      locker.lock();
+      m_Queued -= size;
+      m_Condition.notify_all();
+    }
+  }
+
+  static constexpr size_t MaxQueued = 64 << 20;
+
+  Mutex m_Mutex;
+  std::condition_variable m_Condition;
+  std::deque<std::pair<size_t, std::function<void()>>> m_Tasks;
+  size_t m_Queued = 0;
+  bool m_Quit = false;
+  std::thread m_Thread;
+};
+
+HttpFileSink::~HttpFileSink()
+{
+  Close(false);
+}
+
+bool HttpFileSink::Open(const fs::path& path, uint64_t offset, uint64_t size, bool resize, HttpHashSink* hash)
+{
+  Close(false);
+  // Touch it here, so that it outlives every sink.
+  HttpFileWriter::Instance();
+
+#ifdef _WIN32
+  auto const file = CreateFileW(path.c_str(), GENERIC_WRITE | (hash ? GENERIC_READ : 0), FILE_SHARE_READ, nullptr,
+    offset ? OPEN_ALWAYS : CREATE_ALWAYS, FILE_ATTRIBUTE_NORMAL, nullptr);
+  if (file == INVALID_HANDLE_VALUE) {
+    std::cerr << "HttpFileSink Error: " << GetLastError() << " in CreateFileW.\n";
+    return false;
+  }
+  if (resize) {
+    LARGE_INTEGER end;
+    end.QuadPart = static_cast<LONGLONG>(size);
+    if (!SetFilePointerEx(file, end, nullptr, FILE_BEGIN) || !SetEndOfFile(file)) {
+      std::cerr << "HttpFileSink Error: " << GetLastError() << " in SetEndOfFile.\n";
+      CloseHandle(file);
+      return false;
+    }
+  } else if (size > offset) {
+    // Reserves the clusters, the end of file stays where it is.
+    FILE_ALLOCATION_INFO allocation {};
+    allocation.AllocationSize.QuadPart = static_cast<LONGLONG>(size);
+    SetFileInformationByHandle(file, FileAllocationInfo, &allocation, sizeof(allocation));
+  }
+#else
+  auto const file = open(path.c_str(), (hash ? O_RDWR : O_WRONLY) | O_CREAT | O_CLOEXEC | (offset ? 0 : O_TRUNC), 0644);
+  if (file < 0) {
+    std::cerr << "HttpFileSink Error: " << errno << " in open.\n";
+    return false;
+  }
+  if (resize) {
+    if (posix_fallocate(file, 0, static_cast<off_t>(size)) != 0 &&
+      ftruncate(file, static_cast<off_t>(size)) != 0)
+    {
+      std::cerr << "HttpFileSink Error: " << errno << " in ftruncate.\n";
+      close(file);
+      return false;
+    }
+  } else if (size > offset) {
+    // Keep the size, a partial file must show how much of it is real for
+    // the next attempt to resume from. Not every file system can do this.
+    [[maybe_unused]] auto const ret = fallocate(file, FALLOC_FL_KEEP_SIZE,
+      static_cast<off_t>(offset), static_cast<off_t>(size - offset));
+  }
+#endif
+
+  {
+    Locker locker(m_Mutex);
+    m_hFile = file;
+    m_Position = offset;
+    m_End = offset;
+    m_Failed = false;
+    m_Hash = hash;
+    m_Hashed = 0;
+  }
+  if (hash) {
+    hash->Reset();
+    // What earlier attempts left is read on the writer thread, not here.
+    if (offset) PostHash(offset);
+  }
+  return true;
+}
+
+bool HttpFileSink::IsOpen() const
+{
+  Locker locker(m_Mutex);
+#ifdef _WIN32
+  return m_hFile != nullptr;
+#else
+  return m_hFile >= 0;
+#endif
+}
+
+bool HttpFileSink::Write(const void* data, size_t size)
+{
+  std::vector<Run> full;
+  {
+    Locker locker(m_Mutex);
+    if (!Append(static_cast<const char*>(data), size, m_Position, full)) return false;
+  }
+  Post(std::move(full));
+  return true;
+}
+
+bool HttpFileSink::WriteAt(const void* data, size_t size, uint64_t offset)
+{
+  std::vector<Run> full;
+  {
+    Locker locker(m_Mutex);
+    if (!Append(static_cast<const char*>(data), size, offset, full)) return false;
+  }
+  Post(std::move(full));
+  return true;
+}
+
+bool HttpFileSink::Append(const char* data, size_t size, uint64_t offset, std::vector<Run>& full)
+{
+#ifdef _WIN32
+  if (!m_hFile || m_Failed) return false;
+#else
+  if (m_hFile < 0 || m_Failed) return false;
+#endif
+
+  while (size) {
+    // Each range of a segmented download grows its own run.
+    auto iter = std::find_if(m_Runs.begin(), m_Runs.end(), [offset](const Run& run) {
+      return run.offset + run.data.size() == offset;
+    });
+    if (iter == m_Runs.end()) {
+      if (m_Runs.size() == MaxRuns) {
+        full.push_back(std::move(m_Runs.front()));
+        m_Runs.erase(m_Runs.begin());
+      }
+      iter = m_Runs.insert(m_Runs.end(), Run { offset, {} });
+      iter->data.reserve(BlockSize);
+    }
+
+    // Runs end on a block boundary, so all but the first write whole blocks.
+    auto const end = (iter->offset / BlockSize + 1) * BlockSize;
+    auto const room = static_cast<size_t>(end - offset);
+    auto const count = std::min(room, size);
+    iter->data.append(data, count);
+    data += count;
+    size -= count;
+    offset += count;
+    if (count == room) {
+      full.push_back(std::move(*iter));
+      m_Runs.erase(iter);
+    }
+  }
+  m_Position = offset;
+  m_End = std::max(m_End, offset);
+  m_Pending += full.size();
+  return true;
+}
+
+void HttpFileSink::Post(std::vector<Run> runs)
+{
+  // Outside of m_Mutex: Post may wait for the writer, which needs it.
+  for (auto& run: runs) {
+    auto const size = run.data.size();
+    HttpFileWriter::Instance().Post(size, [this, run = std::move(run)]() {
+      bool failed;
+      {
+        Locker locker(m_Mutex);
+        failed = m_Failed;
+      }
+      // After a failure nothing more is written, no later run lands past a hole.
+      auto const ok = !failed && WriteRun(run);
+      if (ok && m_Hash && run.offset == m_Hashed) {
+        m_Hash->Write(run.data.data(), run.data.size());
+        m_Hashed += run.data.size();
+      }
+      Locker locker(m_Mutex);
+      if (!ok) m_Failed = true;
+      --m_Pending;
+      m_Condition.notify_all();
+    });
+  }
+}
+
+bool HttpFileSink::WriteRun(const Run& run) const
+{
+  // Only the writer thread gets here, and Close waits for it before the
+  // handle goes away.
+  auto buffer = run.data.data();
+  auto size = run.data.size();
+  auto offset = run.offset;
+  while (size) {
+#ifdef _WIN32
+    OVERLAPPED overlapped {};
+    overlapped.Offset = static_cast<DWORD>(offset);
+    overlapped.OffsetHigh = static_cast<DWORD>(offset >> 32);
+    DWORD written = 0;
+    if (!::WriteFile(m_hFile, buffer, static_cast<DWORD>(std::min<size_t>(size, 1u << 30)), &written, &overlapped)) {
+      std::cerr << "HttpFileSink Error: " << GetLastError() << " in WriteFile.\n";
+      return false;
+    }
+#else
+    auto const written = pwrite(m_hFile, buffer, size, static_cast<off_t>(offset));
+    if (written < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "HttpFileSink Error: " << errno << " in pwrite.\n";
+      return false;
+    }
+#endif
+    buffer += written;
+    offset += written;
+    size -= written;
+  }
+  return true;
+}
+
+void HttpFileSink::PostHash(uint64_t end)
+{
+  {
+    Locker locker(m_Mutex);
+    ++m_Pending;
+  }
+  HttpFileWriter::Instance().Post(0, [this, end]() {
+    bool failed;
+    {
+      Locker locker(m_Mutex);
+      failed = m_Failed;
+    }
+    auto const ok = failed || HashRange(end);
+    Locker locker(m_Mutex);
+    if (!ok) m_Failed = true;
+    --m_Pending;
+    m_Condition.notify_all();
+  });
+}
+
+bool HttpFileSink::HashRange(uint64_t end)
+{
+  // Reads back from where the hash stopped, mostly from the page cache.
+  std::string buffer(BlockSize, '\0');
+  while (m_Hashed < end) {
+    auto const size = static_cast<size_t>(std::min<uint64_t>(end - m_Hashed, buffer.size()));
+#ifdef _WIN32
+    OVERLAPPED overlapped {};
+    overlapped.Offset = static_cast<DWORD>(m_Hashed);
+    overlapped.OffsetHigh = static_cast<DWORD>(m_Hashed >> 32);
+    DWORD read = 0;
+    if (!::ReadFile(m_hFile, buffer.data(), static_cast<DWORD>(size), &read, &overlapped)) {
+      std::cerr << "HttpFileSink Error: " << GetLastError() << " in ReadFile.\n";
+      return false;
+    }
+#else
+    auto const read = pread(m_hFile, buffer.data(), size, static_cast<off_t>(m_Hashed));
+    if (read < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "HttpFileSink Error: " << errno << " in pread.\n";
+      return false;
+    }
+#endif
+    if (read == 0) {
+      std::cerr << "HttpFileSink Error: the file is shorter than expected.\n";
+      return false;
+    }
+    m_Hash->Write(buffer.data(), static_cast<size_t>(read));
+    m_Hashed += static_cast<uint64_t>(read);
+  }
+  return true;
+}
+
+bool HttpFileSink::Close(bool sync)
+{
+  std::vector<Run> rest;
+  bool hash;
+  uint64_t end;
+  {
+    Locker locker(m_Mutex);
+#ifdef _WIN32
+    if (!m_hFile) return !m_Failed;
+#else
+    if (m_hFile < 0) return !m_Failed;
+#endif
+    rest = std::move(m_Runs);
+    m_Runs.clear();
+    m_Pending += rest.size();
+    hash = sync && m_Hash;
+    end = m_End;
+  }
+  Post(std::move(rest));
+  // Behind the last run, for whatever was not written at the hash's end.
+  if (hash) PostHash(end);
+
+  LockerEx locker(m_Mutex);
+  m_Condition.wait(locker, [this] { return m_Pending == 0; });
+  auto const file = m_hFile;
+  auto const failed = m_Failed;
+  m_Hash = nullptr;
+#ifdef _WIN32
+  m_hFile = nullptr;
+#else
+  m_hFile = -1;
+#endif
+  locker.unlock();
+
+  // The sync runs on the writer thread, in line with the writes, but Close
+  // still returns only after the handle is gone: callers rename or remove
+  // the file next, which Windows refuses while it is open.
+  auto const finish = [file, sync = sync && !failed]() {
+#ifdef _WIN32
+    if (sync && !FlushFileBuffers(file)) {
+      std::cerr << "HttpFileSink Error: " << GetLastError() << " in FlushFileBuffers.\n";
+    }
+    CloseHandle(file);
+#else
+    if (sync && fdatasync(file) != 0) {
+      std::cerr << "HttpFileSink Error: " << errno << " in fdatasync.\n";
+    }
+    close(file);
+#endif
+  };
+  if (sync && !failed) {
+    locker.lock();
+    ++m_Pending;
+    locker.unlock();
+    HttpFileWriter::Instance().Post(0, [this, &finish]() {
+      finish();
+      Locker locker(m_Mutex);
+      --m_Pending;
+      m_Condition.notify_all();
+    });
+    locker.lock();
+    m_Condition.wait(locker, [this] { return m_Pending == 0; });
+  } else {
+    finish();
+  }
+  return !failed;
+}
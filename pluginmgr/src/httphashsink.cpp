@@ -0,0 +1,216 @@
+#include <neobox/httphashsink.h>
+
+#include <algorithm>
+#include <cstring>
+
+#if defined (__x86_64__) || defined (_M_X64)
+#include <immintrin.h>
+#ifdef _MSC_VER
+#include <intrin.h>
+#define SHA_TARGET
+#else
+#include <cpuid.h>
+#define SHA_TARGET __attribute__((target("sha,sse4.1,ssse3")))
+#endif
+#endif
+
+alignas(16) static const uint32_t K[64] = {
+  0x428a2f98, 0x71374491, 0xb5c0fbcf, 0xe9b5dba5, 0x3956c25b, 0x59f111f1, 0x923f82a4, 0xab1c5ed5,
+  0xd807aa98, 0x12835b01, 0x243185be, 0x550c7dc3, 0x72be5d74, 0x80deb1fe, 0x9bdc06a7, 0xc19bf174,
+  0xe49b69c1, 0xefbe4786, 0x0fc19dc6, 0x240ca1cc, 0x2de92c6f, 0x4a7484aa, 0x5cb0a9dc, 0x76f988da,
+  0x983e5152, 0xa831c66d, 0xb00327c8, 0xbf597fc7, 0xc6e00bf3, 0xd5a79147, 0x06ca6351, 0x14292967,
+  0x27b70a85, 0x2e1b2138, 0x4d2c6dfc, 0x53380d13, 0x650a7354, 0x766a0abb, 0x81c2c92e, 0x92722c85,
+  0xa2bfe8a1, 0xa81a664b, 0xc24b8b70, 0xc76c51a3, 0xd192e819, 0xd6990624, 0xf40e3585, 0x106aa070,
+  0x19a4c116, 0x1e376c08, 0x2748774c, 0x34b0bcb5, 0x391c0cb3, 0x4ed8aa4a, 0x5b9cca4f, 0x682e6ff3,
+  0x748f82ee, 0x78a5636f, 0x84c87814, 0x8cc70208, 0x90befffa, 0xa4506ceb, 0xbef9a3f7, 0xc67178f2,
+};
+
+static uint32_t Rotr(uint32_t x, int n)
+{
+  return x >> n | x << (32 - n);
+}
+
+static void CompressPortable(uint32_t* state, const uint8_t* data, size_t blocks)
+{
+  for (; blocks; --blocks, data += 64) {
+    uint32_t w[64];
+    for (int i = 0; i < 16; ++i) {
+      w[i] = uint32_t(data[4 * i]) << 24 | uint32_t(data[4 * i + 1]) << 16 |
+        uint32_t(data[4 * i + 2]) << 8 | data[4 * i + 3];
+    }
+    for (int i = 16; i < 64; ++i) {
+      auto const s0 = Rotr(w[i - 15], 7) ^ Rotr(w[i - 15], 18) ^ (w[i - 15] >> 3);
+      auto const s1 = Rotr(w[i - 2], 17) ^ Rotr(w[i - 2], 19) ^ (w[i - 2] >> 10);
+      w[i] = w[i - 16] + s0 + w[i - 7] + s1;
+    }
+
+    auto a = state[0], b = state[1], c = state[2], d = state[3];
+    auto e = state[4], f = state[5], g = state[6], h = state[7];
+    for (int i = 0; i < 64; ++i) {
+      auto const t1 = h + (Rotr(e, 6) ^ Rotr(e, 11) ^ Rotr(e, 25)) + ((e & f) ^ (~e & g)) + K[i] + w[i];
+      auto const t2 = (Rotr(a, 2) ^ Rotr(a, 13) ^ Rotr(a, 22)) + ((a & b) ^ (a & c) ^ (b & c));
+      h = g; g = f; f = e; e = d + t1;
+      d = c; c = b; b = a; a = t1 + t2;
+    }
+    state[0] += a; state[1] += b; state[2] += c; state[3] += d;
+    state[4] += e; state[5] += f; state[6] += g; state[7] += h;
+  }
+}
+
+#ifdef SHA_TARGET
+// The SHA-NI rounds keep the state as ABEF and CDGH halves, and run two
+// rounds per instruction.
+SHA_TARGET static void CompressSha(uint32_t* state, const uint8_t* data, size_t blocks)
+{
+  const __m128i mask = _mm_set_epi64x(0x0c0d0e0f08090a0bULL, 0x0405060700010203ULL);
+
+  auto tmp = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state)), 0xB1);
+  auto state1 = _mm_shuffle_epi32(_mm_loadu_si128(reinterpret_cast<const __m128i*>(state + 4)), 0x1B);
+  auto state0 = _mm_alignr_epi8(tmp, state1, 8);
+  state1 = _mm_blend_epi16(state1, tmp, 0xF0);
+
+  for (; blocks; --blocks, data += 64) {
+    auto const abef = state0, cdgh = state1;
+    __m128i w[4];
+    for (int i = 0; i < 16; ++i) {
+      auto& current = w[i & 3];
+      if (i < 4) {
+        current = _mm_shuffle_epi8(_mm_loadu_si128(reinterpret_cast<const __m128i*>(data + 16 * i)), mask);
+      } else {
+        // w[i-4] + s0(w[i-3]) + w[i-7], then + s1 over the last four.
+        auto next = _mm_sha256msg1_epu32(current, w[(i - 3) & 3]);
+        next = _mm_add_epi32(next, _mm_alignr_epi8(w[(i - 1) & 3], w[(i - 2) & 3], 4));
+        current = _mm_sha256msg2_epu32(next, w[(i - 1) & 3]);
+      }
+      auto message = _mm_add_epi32(current, _mm_load_si128(reinterpret_cast<const __m128i*>(K + 4 * i)));
+      state1 = _mm_sha256rnds2_epu32(state1, state0, message);
+      message = _mm_shuffle_epi32(message, 0x0E);
+      state0 = _mm_sha256rnds2_epu32(state0, state1, message);
+    }
+    state0 = _mm_add_epi32(state0, abef);
+    state1 = _mm_add_epi32(state1, cdgh);
+  }
+
+  tmp = _mm_shuffle_epi32(state0, 0x1B);
+  state1 = _mm_shuffle_epi32(state1, 0xB1);
+  state0 = _mm_blend_epi16(tmp, state1, 0xF0);
+  state1 = _mm_alignr_epi8(state1, tmp, 8);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state), state0);
+  _mm_storeu_si128(reinterpret_cast<__m128i*>(state + 4), state1);
+}
+
+static bool HasShaExtensions()
+{
+  unsigned int regs1[4] {}, regs7[4] {};
+#ifdef _MSC_VER
+  __cpuid(reinterpret_cast<int*>(regs1), 1);
+  __cpuidex(reinterpret_cast<int*>(regs7), 7, 0);
+#else
+  if (!__get_cpuid(1, &regs1[0], &regs1[1], &regs1[2], &regs1[3])) return false;
+  if (!__get_cpuid_count(7, 0, &regs7[0], &regs7[1], &regs7[2], &regs7[3])) return false;
+#endif
+  auto const ssse3 = regs1[2] & (1u << 9), sse41 = regs1[2] & (1u << 19);
+  auto const sha = regs7[1] & (1u << 29);
+  return ssse3 && sse41 && sha;
+}
+#endif
+
+typedef void Compressor(uint32_t* state, const uint8_t* data, size_t blocks);
+
+static Compressor* const Compress =
+#ifdef SHA_TARGET
+  HasShaExtensions() ? &CompressSha :
+#endif
+  &CompressPortable;
+
+void HttpHashSink::Reset()
+{
+  m_State = {
+    0x6a09e667, 0xbb67ae85, 0x3c6ef372, 0xa54ff53a,
+    0x510e527f, 0x9b05688c, 0x1f83d9ab, 0x5be0cd19,
+  };
+  m_BlockSize = 0;
+  m_Size = 0;
+}
+
+void HttpHashSink::Write(const void* data, size_t size)
+{
+  auto bytes = static_cast<const uint8_t*>(data);
+  m_Size += size;
+
+  if (m_BlockSize) {
+    auto const count = std::min(size, m_Block.size() - m_BlockSize);
+    std::memcpy(m_Block.data() + m_BlockSize, bytes, count);
+    m_BlockSize += count;
+    bytes += count;
+    size -= count;
+    if (m_BlockSize < m_Block.size()) return;
+    Compress(m_State.data(), m_Block.data(), 1);
+    m_BlockSize = 0;
+  }
+
+  // Whole blocks straight from the caller's buffer.
+  if (auto const blocks = size / 64) {
+    Compress(m_State.data(), bytes, blocks);
+    bytes += blocks * 64;
+    size -= blocks * 64;
+  }
+
+  std::memcpy(m_Block.data(), bytes, size);
+  m_BlockSize = size;
+}
+
+HttpHashSink::Digest HttpHashSink::Finish()
+{
+  auto const bits = m_Size * 8;
+  uint8_t padding[72] { 0x80 };
+  // A 0x80, zeros up to 56 mod 64, then the length in bits.
+  auto const length = (m_BlockSize < 56 ? 56 : 120) - m_BlockSize;
+  for (int i = 0; i < 8; ++i) {
+    padding[length + i] = static_cast<uint8_t>(bits >> (56 - 8 * i));
+  }
+  Write(padding, length + 8);
+
+  Digest digest;
+  for (size_t i = 0; i < m_State.size(); ++i) {
+    digest[4 * i] = static_cast<uint8_t>(m_State[i] >> 24);
+    digest[4 * i + 1] = static_cast<uint8_t>(m_State[i] >> 16);
+    digest[4 * i + 2] = static_cast<uint8_t>(m_State[i] >> 8);
+    digest[4 * i + 3] = static_cast<uint8_t>(m_State[i]);
+  }
+  return digest;
+}
+
+std::u8string HttpHashSink::ToHex(const Digest& digest)
+{
+  static constexpr char8_t digits[] = u8"0123456789abcdef";
+  std::u8string hex;
+  hex.reserve(digest.size() * 2);
+  for (auto const byte: digest) {
+    hex.push_back(digits[byte >> 4]);
+    hex.push_back(digits[byte & 0xF]);
+  }
+  return hex;
+}
+
+std::optional<HttpHashSink::Digest> HttpHashSink::FromHex(std::u8string_view text)
+{
+  if (text.starts_with(u8"sha256:")) {
+    text.remove_prefix(7);
+  }
+  if (text.size() != 64) return std::nullopt;
+
+  auto const value = [](char8_t c) {
+    if (c >= '0' && c <= '9') return c - '0';
+    if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+    if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+    return -1;
+  };
+  Digest digest;
+  for (size_t i = 0; i < digest.size(); ++i) {
+    auto const high = value(text[2 * i]), low = value(text[2 * i + 1]);
+    if (high < 0 || low < 0) return std::nullopt;
+    digest[i] = static_cast<uint8_t>(high << 4 | low);
+  }
+  return digest;
+}
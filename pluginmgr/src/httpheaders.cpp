@@ -0,0 +1,81 @@
+#include <neobox/httpheaders.h>
+
+#include <algorithm>
+
+static constexpr char8_t ToLower(char8_t c)
+{
+  return u8'A' <= c && c <= u8'Z' ? c + (u8'a' - u8'A') : c;
+}
+
+uint32_t HttpHeaders::Hash(StringView name)
+{
+  // FNV-1a over the lowercase bytes.
+  uint32_t hash = 2166136261u;
+  for (auto c: name) {
+    hash = (hash ^ ToLower(c)) * 16777619u;
+  }
+  return hash;
+}
+
+bool HttpHeaders::Equals(StringView a, StringView b)
+{
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+    [](char8_t x, char8_t y) { return ToLower(x) == ToLower(y); });
+}
+
+void HttpHeaders::Add(StringView name, StringView value)
+{
+  if (m_Entries.empty()) {
+    // Enough for a typical reply, so that it is the only allocation.
+    m_Buffer.reserve(1024);
+    m_Entries.reserve(16);
+  }
+  auto const offset = static_cast<uint32_t>(m_Buffer.size());
+  m_Buffer.append(name).append(value);
+  m_Entries.push_back({
+    offset, static_cast<uint32_t>(name.size()),
+    static_cast<uint32_t>(offset + name.size()), static_cast<uint32_t>(value.size()),
+    Hash(name),
+  });
+}
+
+void HttpHeaders::Set(StringView name, StringView value)
+{
+  Erase(name);
+  Add(name, value);
+}
+
+void HttpHeaders::Erase(StringView name)
+{
+  // The bytes stay in the buffer until Clear, fields are seldom removed.
+  auto const hash = Hash(name);
+  std::erase_if(m_Entries, [&](const Entry& entry) {
+    return entry.hash == hash && Equals(GetField(entry).name, name);
+  });
+}
+
+void HttpHeaders::Clear()
+{
+  m_Buffer.clear();
+  m_Entries.clear();
+}
+
+std::optional<HttpHeaders::StringView> HttpHeaders::Find(StringView name) const
+{
+  auto const hash = Hash(name);
+  for (auto const& entry: m_Entries) {
+    if (entry.hash != hash) continue;
+    auto const field = GetField(entry);
+    if (Equals(field.name, name)) return field.value;
+  }
+  return std::nullopt;
+}
+
+HttpHeaders::Field HttpHeaders::GetField(const Entry& entry) const
+{
+  StringView const buffer = m_Buffer;
+  return {
+    buffer.substr(entry.name, entry.nameSize),
+    buffer.substr(entry.value, entry.valueSize),
+  };
+}
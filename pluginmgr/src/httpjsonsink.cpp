@@ -0,0 +1,467 @@
+#include <neobox/httpjsonsink.h>
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+
+static bool IsSpace(char8_t c)
+{
+  return c == ' ' || c == '\t' || c == '\n' || c == '\r';
+}
+
+static bool IsDigit(char8_t c)
+{
+  return c >= '0' && c <= '9';
+}
+
+static int HexDigit(char8_t c)
+{
+  if (IsDigit(c)) return c - '0';
+  if (c >= 'a' && c <= 'f') return c - 'a' + 10;
+  if (c >= 'A' && c <= 'F') return c - 'A' + 10;
+  return -1;
+}
+
+static char8_t Unescape(char8_t c)
+{
+  switch (c) {
+  case '"': case '\\': case '/': return c;
+  case 'b': return '\b';
+  case 'f': return '\f';
+  case 'n': return '\n';
+  case 'r': return '\r';
+  case 't': return '\t';
+  default: return 0;
+  }
+}
+
+// -?(0|[1-9][0-9]*)(.[0-9]+)?([eE][+-]?[0-9]+)?
+static bool IsNumber(std::u8string_view text)
+{
+  size_t i = 0;
+  auto const digits = [&text, &i]() {
+    auto const from = i;
+    while (i < text.size() && IsDigit(text[i])) ++i;
+    return i != from;
+  };
+  auto const accept = [&text, &i](char8_t c) {
+    if (i == text.size() || text[i] != c) return false;
+    ++i;
+    return true;
+  };
+
+  accept('-');
+  if (!accept('0') && !digits()) return false;
+  if (accept('.') && !digits()) return false;
+  if (accept('e') || accept('E')) {
+    accept('+') || accept('-');
+    if (!digits()) return false;
+  }
+  return i == text.size();
+}
+
+void HttpJsonSink::Select(std::u8string_view path, Callback callback)
+{
+  Selector selector { {}, std::move(callback) };
+  auto const pattern = path;
+  while (!path.empty()) {
+    Segment segment { Segment::Kind::Key, {} };
+    if (path.front() == '[') {
+      auto const end = path.find(']');
+      if (end == path.npos) {
+        std::cerr << "HttpJsonSink Error: unclosed '[' in <"
+          << reinterpret_cast<const std::string_view&>(pattern) << ">.\n";
+        return;
+      }
+      auto const index = path.substr(1, end - 1);
+      if (index.empty()) {
+        segment.kind = Segment::Kind::AnyIndex;
+      } else if (index == u8"*") {
+        segment.kind = Segment::Kind::Any;
+      } else {
+        auto const first = reinterpret_cast<const char*>(index.data());
+        auto const last = first + index.size();
+        auto const [ptr, ec] = std::from_chars(first, last, segment.index);
+        if (ec != std::errc() || ptr != last) {
+          std::cerr << "HttpJsonSink Error: bad index in <"
+            << reinterpret_cast<const std::string_view&>(pattern) << ">.\n";
+          return;
+        }
+        segment.kind = Segment::Kind::Index;
+      }
+      path.remove_prefix(end + 1);
+    } else {
+      auto const end = std::min(path.find_first_of(u8".["), path.size());
+      auto const key = path.substr(0, end);
+      if (key == u8"*") {
+        segment.kind = Segment::Kind::Any;
+      } else {
+        segment.key = key;
+      }
+      path.remove_prefix(end);
+    }
+    if (!path.empty() && path.front() == '.') {
+      path.remove_prefix(1);
+    }
+    selector.path.push_back(std::move(segment));
+  }
+
+  m_MaxPath = std::max(m_MaxPath, selector.path.size());
+  m_Selectors.push_back(std::move(selector));
+}
+
+void HttpJsonSink::Reset()
+{
+  m_State = State::Value;
+  m_Frames.clear();
+  m_Captures.clear();
+  m_Matches.clear();
+  m_Token.clear();
+  m_Keep = false;
+  m_Surrogate = 0;
+  m_Error.clear();
+}
+
+bool HttpJsonSink::Fail(const char* message)
+{
+  m_Error = "HttpJsonSink Error: ";
+  m_Error += message;
+  m_State = State::Failed;
+  m_Frames.clear();
+  m_Captures.clear();
+  return false;
+}
+
+bool HttpJsonSink::Write(const void* data, size_t size)
+{
+  if (m_State == State::Failed) return false;
+
+  auto const text = static_cast<const char8_t*>(data);
+  for (size_t i = 0; i < size; ++i) {
+    auto const c = text[i];
+    switch (m_State) {
+    case State::FirstValue:
+      if (c == ']') {
+        if (!EndContainer(text, i, true)) return false;
+        break;
+      }
+      [[fallthrough]];
+    case State::Value:
+      if (IsSpace(c)) break;
+      if (!BeginValue(text, i)) return false;
+      break;
+    case State::FirstKey:
+      if (c == '}') {
+        if (!EndContainer(text, i, false)) return false;
+        break;
+      }
+      [[fallthrough]];
+    case State::Key:
+      if (IsSpace(c)) break;
+      if (c != '"') return Fail("a key was expected.");
+      // Keys matter only where a selection may lie below.
+      m_Keep = m_Frames.back().relevant;
+      m_IsKey = true;
+      m_Token.clear();
+      m_State = State::String;
+      break;
+    case State::Colon:
+      if (IsSpace(c)) break;
+      if (c != ':') return Fail("':' was expected.");
+      m_State = State::Value;
+      break;
+    case State::Next:
+      if (IsSpace(c)) break;
+      if (c == ',') {
+        auto& frame = m_Frames.back();
+        if (frame.array) {
+          ++frame.index;
+          m_State = State::Value;
+        } else {
+          m_State = State::Key;
+        }
+      } else if (c == ']' || c == '}') {
+        if (!EndContainer(text, i, c == ']')) return false;
+      } else {
+        return Fail("',' or the end of a container was expected.");
+      }
+      break;
+    case State::String: {
+      // Plain runs go in one piece.
+      auto const end = std::find_if(text + i, text + size, [](char8_t ch) {
+        return ch == '"' || ch == '\\' || ch < 0x20;
+      });
+      if (m_Keep && end != text + i) {
+        FlushSurrogate();
+        m_Token.append(text + i, end);
+      }
+      i = end - text;
+      if (i == size) break;
+      if (*end == '"') {
+        EndString();
+      } else if (*end == '\\') {
+        m_State = State::Escape;
+      } else {
+        return Fail("a control character in a string.");
+      }
+      break;
+    }
+    case State::Escape:
+      if (c == 'u') {
+        m_Hex = 0;
+        m_HexCount = 0;
+        m_State = State::Unicode;
+      } else if (auto const escaped = Unescape(c)) {
+        if (m_Keep) {
+          FlushSurrogate();
+          m_Token.push_back(escaped);
+        }
+        m_State = State::String;
+      } else {
+        return Fail("a bad escape in a string.");
+      }
+      break;
+    case State::Unicode: {
+      auto const digit = HexDigit(c);
+      if (digit < 0) return Fail("a bad \\u escape in a string.");
+      m_Hex = m_Hex << 4 | digit;
+      if (++m_HexCount < 4) break;
+      if (m_Keep) {
+        AppendUnicode(m_Hex);
+      }
+      m_State = State::String;
+      break;
+    }
+    case State::Number:
+      if (IsDigit(c) || c == '-' || c == '+' || c == '.' || c == 'e' || c == 'E') {
+        if (m_Token.size() == MaxNumber) return Fail("a number is too long.");
+        m_Token.push_back(c);
+        break;
+      }
+      if (!EndNumber()) return false;
+      // The character after a number belongs to the next state.
+      --i;
+      break;
+    case State::Literal:
+      if (c != m_Literal[m_Token.size()]) return Fail("a bad literal.");
+      m_Token.push_back(c);
+      if (m_Token.size() == m_Literal.size()) {
+        EndValue(m_Literal[0] == 'n' ? Value::Type::Null : Value::Type::Boolean);
+      }
+      break;
+    case State::Done:
+      if (!IsSpace(c)) return Fail("text after the value.");
+      break;
+    case State::Failed:
+      return false;
+    }
+  }
+
+  // Open captures take the rest of the chunk, which is gone after this.
+  for (auto& capture: m_Captures) {
+    capture.text.append(text + capture.from, text + size);
+    capture.from = 0;
+  }
+  return true;
+}
+
+bool HttpJsonSink::Finish()
+{
+  // A number at the top level ends only with the text.
+  if (m_State == State::Number && !EndNumber()) return false;
+  if (m_State == State::Failed) return false;
+  if (m_State != State::Done) return Fail("the text ended early.");
+  return true;
+}
+
+bool HttpJsonSink::BeginValue(const char8_t* text, size_t i)
+{
+  auto const c = text[i];
+  Match();
+
+  if (c == '{' || c == '[') {
+    if (m_Frames.size() == MaxDepth) return Fail("too deeply nested.");
+    if (!m_Matches.empty()) {
+      auto const path = GetPath();
+      for (auto const selector: m_Matches) {
+        m_Captures.push_back({ selector, m_Frames.size() + 1, i, path, {} });
+      }
+      m_Matches.clear();
+    }
+    auto const array = c == '[';
+    auto const relevant = IsRelevant();
+    m_Frames.push_back({ array, relevant, 0, {} });
+    m_State = array ? State::FirstValue : State::FirstKey;
+    return true;
+  }
+
+  m_Token.clear();
+  if (c == '"') {
+    m_Keep = !m_Matches.empty();
+    m_IsKey = false;
+    m_State = State::String;
+  } else if (c == '-' || IsDigit(c)) {
+    m_Token.push_back(c);
+    m_State = State::Number;
+  } else if (c == 't' || c == 'f' || c == 'n') {
+    m_Literal = c == 't' ? u8"true" : c == 'f' ? u8"false" : u8"null";
+    m_Token.push_back(c);
+    m_State = State::Literal;
+  } else {
+    return Fail("a value was expected.");
+  }
+  return true;
+}
+
+void HttpJsonSink::EndString()
+{
+  if (m_Keep) {
+    FlushSurrogate();
+  }
+  if (m_IsKey) {
+    if (m_Keep) {
+      m_Frames.back().key.swap(m_Token);
+    }
+    m_State = State::Colon;
+  } else {
+    EndValue(Value::Type::String);
+  }
+}
+
+bool HttpJsonSink::EndNumber()
+{
+  if (!IsNumber(m_Token)) return Fail("a bad number.");
+  EndValue(Value::Type::Number);
+  return true;
+}
+
+void HttpJsonSink::EndValue(Value::Type type)
+{
+  if (!m_Matches.empty()) {
+    Value const value { type, std::move(m_Token) };
+    auto const path = GetPath();
+    for (auto const selector: m_Matches) {
+      m_Selectors[selector].callback(path, value);
+    }
+    m_Matches.clear();
+  }
+  m_Token.clear();
+  m_State = m_Frames.empty() ? State::Done : State::Next;
+}
+
+bool HttpJsonSink::EndContainer(const char8_t* text, size_t i, bool array)
+{
+  if (m_Frames.back().array != array) return Fail("mismatched brackets.");
+
+  auto const depth = m_Frames.size();
+  auto const first = std::find_if(m_Captures.begin(), m_Captures.end(),
+    [depth](const Capture& capture) { return capture.depth == depth; });
+  if (first != m_Captures.end()) {
+    std::vector<Capture> done(std::make_move_iterator(first), std::make_move_iterator(m_Captures.end()));
+    m_Captures.erase(first, m_Captures.end());
+    for (auto& capture: done) {
+      capture.text.append(text + capture.from, text + i + 1);
+      Value const value { array ? Value::Type::Array : Value::Type::Object, std::move(capture.text) };
+      m_Selectors[capture.selector].callback(capture.path, value);
+    }
+  }
+
+  m_Frames.pop_back();
+  m_State = m_Frames.empty() ? State::Done : State::Next;
+  return true;
+}
+
+bool HttpJsonSink::MatchSegment(const Segment& segment, const Frame& frame)
+{
+  switch (segment.kind) {
+  case Segment::Kind::Key: return !frame.array && segment.key == frame.key;
+  case Segment::Kind::Index: return frame.array && segment.index == frame.index;
+  case Segment::Kind::AnyIndex: return frame.array;
+  case Segment::Kind::Any: return true;
+  }
+  return false;
+}
+
+void HttpJsonSink::Match()
+{
+  m_Matches.clear();
+  auto const depth = m_Frames.size();
+  if (depth > m_MaxPath || (depth != 0 && !m_Frames.back().relevant)) return;
+
+  for (size_t i = 0; i != m_Selectors.size(); ++i) {
+    auto const& path = m_Selectors[i].path;
+    if (path.size() == depth && std::equal(path.begin(), path.end(), m_Frames.begin(), MatchSegment)) {
+      m_Matches.push_back(i);
+    }
+  }
+}
+
+bool HttpJsonSink::IsRelevant() const
+{
+  auto const depth = m_Frames.size();
+  if (depth >= m_MaxPath || (depth != 0 && !m_Frames.back().relevant)) return false;
+
+  return std::any_of(m_Selectors.begin(), m_Selectors.end(), [this, depth](const Selector& selector) {
+    auto const& path = selector.path;
+    return path.size() > depth && std::equal(path.begin(), path.begin() + depth, m_Frames.begin(), MatchSegment);
+  });
+}
+
+std::u8string HttpJsonSink::GetPath() const
+{
+  std::u8string path;
+  for (auto const& frame: m_Frames) {
+    if (frame.array) {
+      auto const index = std::to_string(frame.index);
+      path.push_back('[');
+      path.append(index.begin(), index.end());
+      path.push_back(']');
+    } else {
+      if (!path.empty()) path.push_back('.');
+      path += frame.key;
+    }
+  }
+  return path;
+}
+
+void HttpJsonSink::AppendUnicode(uint32_t code)
+{
+  if (m_Surrogate && code >= 0xDC00 && code <= 0xDFFF) {
+    code = 0x10000 + ((m_Surrogate - 0xD800) << 10) + (code - 0xDC00);
+    m_Surrogate = 0;
+  } else {
+    FlushSurrogate();
+    if (code >= 0xD800 && code <= 0xDBFF) {
+      m_Surrogate = code;
+      return;
+    }
+    if (code >= 0xDC00 && code <= 0xDFFF) {
+      code = 0xFFFD;
+    }
+  }
+
+  if (code < 0x80) {
+    m_Token.push_back(static_cast<char8_t>(code));
+  } else if (code < 0x800) {
+    m_Token.push_back(static_cast<char8_t>(0xC0 | code >> 6));
+    m_Token.push_back(static_cast<char8_t>(0x80 | (code & 0x3F)));
+  } else if (code < 0x10000) {
+    m_Token.push_back(static_cast<char8_t>(0xE0 | code >> 12));
+    m_Token.push_back(static_cast<char8_t>(0x80 | (code >> 6 & 0x3F)));
+    m_Token.push_back(static_cast<char8_t>(0x80 | (code & 0x3F)));
+  } else {
+    m_Token.push_back(static_cast<char8_t>(0xF0 | code >> 18));
+    m_Token.push_back(static_cast<char8_t>(0x80 | (code >> 12 & 0x3F)));
+    m_Token.push_back(static_cast<char8_t>(0x80 | (code >> 6 & 0x3F)));
+    m_Token.push_back(static_cast<char8_t>(0x80 | (code & 0x3F)));
+  }
+}
+
+void HttpJsonSink::FlushSurrogate()
+{
+  // A high surrogate with no low one after it.
+  if (m_Surrogate) {
+    m_Surrogate = 0;
+    AppendUnicode(0xFFFD);
+  }
+}
@@ -7,18 +7,32 @@
 #else
 #include <curl/curl.h>
 #include <curl/easy.h>
+#include <neobox/httpengine.h>
+#include <neobox/httppool.h>
+#include <neobox/httpshare.h>
 #ifndef CURL_WRITEFUNC_ERROR
 #define CURL_WRITEFUNC_ERROR -1
 #endif
 #endif  // _WIN32
 
 #include <neobox/httplib.h>
+#include <neobox/httplimiter.h>
+#include <neobox/httpmonitor.h>
 
 #include <filesystem>
 #include <stdexcept>
 #include <iostream>
 #include <fstream>
-// #include <thread>
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <ctime>
+#include <iomanip>
+#include <mutex>
+#include <random>
+#include <sstream>
+#include <thread>
 
 using namespace std::literals;
 namespace fs = std::filesystem;
@@ -63,8 +77,14 @@ void HttpLib::RequestStatusCallback(HINTERNET hInternet, DWORD_PTR dwContext, DW
       break;
 
   case WINHTTP_CALLBACK_STATUS_SENDREQUEST_COMPLETE: 
+  case WINHTTP_CALLBACK_STATUS_WRITE_COMPLETE:
     locker.unlock();
-    WinHttpReceiveResponse(hInternet, nullptr);
+    if (!object.m_Body) {
+      WinHttpReceiveResponse(hInternet, nullptr);
+    } else if (!object.WriteBody()) {
+      locker.lock();
+      object.EmitFinish("HttpLib Error: sending the request body failed.");
+    }
     break;
  
   case WINHTTP_CALLBACK_STATUS_HEADERS_AVAILABLE: {
@@ -79,6 +99,8 @@ void HttpLib::RequestStatusCallback(HINTERNET hInternet, DWORD_PTR dwContext, DW
     if (bResults) {
       bResults = object.ReadHeaders();
     } else {
+      // Keep Retry-After and friends for the retry policy.
+      object.ReadHeaders();
       object.EmitFinish("HttpLib StatusCode Error.");
       break;
     }
@@ -118,8 +140,10 @@ void HttpLib::RequestStatusCallback(HINTERNET hInternet, DWORD_PTR dwContext, DW
     if (dwInternetInformationLength) {
       if (object.m_WriteCallback(lpvStatusInformation, dwInternetInformationLength)) {
         locker.unlock();
-        WinHttpQueryDataAvailable(object.m_hRequest, nullptr);
-      } else {
+        QueryDataThrottled(object.m_AsyncId, dwInternetInformationLength);
+      } else if (!object.m_Finished) {
+        // The file could not take the data; nothing more is read.
+        object.EmitFinish("HttpLib Error: can not write file.");
       }
     } else {
       object.EmitFinish();
@@ -131,11 +155,40 @@ void HttpLib::RequestStatusCallback(HINTERNET hInternet, DWORD_PTR dwContext, DW
     auto const* pAsyncResult = (WINHTTP_ASYNC_RESULT*)lpvStatusInformation;
     auto dwError = pAsyncResult->dwError; // The error code
     auto dwResult = pAsyncResult->dwResult; // The ID of the called function
+    object.m_Retryable = dwError == ERROR_WINHTTP_TIMEOUT ||
+      dwError == ERROR_WINHTTP_CONNECTION_ERROR ||
+      dwError == ERROR_WINHTTP_CANNOT_CONNECT ||
+      dwError == ERROR_WINHTTP_NAME_NOT_RESOLVED;
+    object.MarkProxyError(dwError);
     object.EmitFinish(std::format("Winhttp status error. Error code: {}, error id: {}.", dwError, dwResult));
     break;
   }
   }
 }
+
+void HttpLib::QueryDataThrottled(HttpId id, size_t size)
+{
+  LockerEx locker(m_AsyncMutex);
+  auto const iter = m_AsyncPool.find(id);
+  if (iter == m_AsyncPool.end() || iter->second->m_Finished)
+    return;
+  auto& object = *iter->second;
+
+  // Ask for the next chunk later instead of parking a thread pool thread.
+  auto& limiter = HttpLimiter::Instance();
+  auto const wait = limiter.AcquireBytes(object.m_Url.GetHost(), size,
+    object.m_Priority == HttpScheduler::Priority::Background);
+  if (wait != HttpLimiter::Duration::zero()) {
+    limiter.Post(HttpLimiter::Clock::now() + wait, [id, size]() {
+      QueryDataThrottled(id, size);
+    });
+    return;
+  }
+
+  auto const request = object.m_hRequest;
+  locker.unlock();
+  WinHttpQueryDataAvailable(request, nullptr);
+}
 #elif defined (__linux__)
 struct CurlGlobal {
   CurlGlobal() {
@@ -147,8 +200,99 @@ struct CurlGlobal {
 };
 #endif
 
+// Header numbers; what does not parse reads as 0.
+static uint64_t ParseNumber(std::u8string_view text)
+{
+  uint64_t value = 0;
+  auto const first = reinterpret_cast<const char*>(text.data());
+  std::from_chars(first, first + text.size(), value);
+  return value;
+}
+
+HttpUrlView::HttpUrlView(StringView url)
+{
+  ParseScheme(url);
+  ParseAuthority(url, IsHttps() ? 443 : 80);
+  ParseTarget(url);
+}
+
+void HttpUrlView::ParseScheme(StringView& rest)
+{
+  if (rest.starts_with(u8"https")) {
+    scheme = rest.substr(0, 5);
+  } else if (rest.starts_with(u8"http")) {
+    scheme = rest.substr(0, 4);
+  } else {
+    throw std::logic_error("HttpUrl Error: Url scheme doesn't start with 'http(s)://'.");
+  }
+  rest.remove_prefix(scheme.size());
+  if (!rest.starts_with(u8"://")) {
+    throw std::logic_error("HttpUrl Error: Url scheme doesn't end with '://'.");
+  }
+  rest.remove_prefix(3);
+}
+
+void HttpUrlView::ParseAuthority(StringView& rest, uint16_t defaultPort)
+{
+  auto const authority = rest.substr(0, rest.find_first_of(u8"/?#"));
+  rest.remove_prefix(authority.size());
+
+  // The colons of an IPv6 address are inside the brackets.
+  auto const colon = authority.rfind(u8':');
+  auto const bracket = authority.rfind(u8']');
+  port = defaultPort;
+  host = authority;
+  if (colon != authority.npos && (bracket == authority.npos || colon > bracket)) {
+    host = authority.substr(0, colon);
+    auto const digits = authority.substr(colon + 1);
+    if (!digits.empty()) {
+      auto const first = reinterpret_cast<const char*>(digits.data());
+      auto const [last, error] = std::from_chars(first, first + digits.size(), port);
+      if (error != std::errc() || last != first + digits.size()) {
+        throw std::logic_error("HttpUrl Error: Url is invalid!");
+      }
+    }
+  }
+  if (host.empty()) {
+    throw std::logic_error("HttpUrl Error: Url host doesn't exist!");
+  }
+}
+
+void HttpUrlView::ParseTarget(StringView rest)
+{
+  rest = rest.substr(0, rest.find(u8'#'));
+  path = u8"/";
+  query = {};
+  if (rest.empty()) return;
+  if (rest.front() != u8'/' && rest.front() != u8'?') {
+    throw std::logic_error("HttpUrl Error: Url path doesn't start with '/'.");
+  }
+
+  auto const mark = rest.find(u8'?');
+  if (mark != 0) {
+    path = rest.substr(0, mark);
+  }
+  if (mark != rest.npos) {
+    query = rest.substr(mark + 1);
+  }
+}
+
+std::optional<HttpUrlView::StringView> HttpUrlView::FindParameter(StringView key) const
+{
+  for (auto rest = query; !rest.empty(); ) {
+    auto const end = rest.find(u8'&');
+    auto const item = rest.substr(0, end);
+    auto const equal = item.find(u8'=');
+    if (equal != item.npos && item.substr(0, equal) == key) {
+      return item.substr(equal + 1);
+    }
+    rest.remove_prefix(end == rest.npos ? rest.size() : end + 1);
+  }
+  return std::nullopt;
+}
+
 HttpUrl::HttpUrl(std::u8string_view url) {
-  SetUrl(url);
+  Assign(HttpUrlView(url));
 }
 
 HttpUrl::HttpUrl(StringView host,
@@ -157,165 +301,141 @@ HttpUrl::HttpUrl(StringView host,
   StringView scheme,
   uint16_t port
 )
-  : scheme(scheme)
-  , host(host)
-  , path(path)
-  , port(port)
-  , parameters(std::move(params))
+  : m_Scheme(scheme)
+  , m_Parameters(std::move(params))
 {
-  auto iter = host.cbegin();
-  ParseHost(iter, host.end());
-  if (iter != host.end()) {
-    ParsePort(iter, host.end());
-  }
-  iter = path.cbegin();
-  ParsePath(iter, path.cend());
+  HttpUrlView view;
+  view.scheme = m_Scheme;
+  view.ParseAuthority(host, port);
+  view.ParseTarget(path);
+  Assign(view);
+}
+
+HttpUrl::HttpUrl(const HttpUrlView& url)
+{
+  Assign(url);
 }
 
 HttpUrl::HttpUrl(HttpUrl&& url) noexcept
-  : scheme(std::move(url.scheme))
-  , host(std::move(url.host))
-  , path(std::move(url.path))
-  , port(url.port)
-  , parameters(std::move(url.parameters))
+  : m_Scheme(std::move(url.m_Scheme))
+  , m_Host(std::move(url.m_Host))
+  , m_Path(std::move(url.m_Path))
+  , m_Port(url.m_Port)
+  , m_Parameters(std::move(url.m_Parameters))
+  , m_Object(std::move(url.m_Object))
+  , m_Url(std::move(url.m_Url))
 {
 }
 
 HttpUrl::HttpUrl(const HttpUrl& url)
-  : scheme(url.scheme)
-  , host(url.host)
-  , path(url.path)
-  , port(url.port)
-  , parameters(url.parameters)
+  : m_Scheme(url.m_Scheme)
+  , m_Host(url.m_Host)
+  , m_Path(url.m_Path)
+  , m_Port(url.m_Port)
+  , m_Parameters(url.m_Parameters)
+  , m_Object(url.m_Object)
+  , m_Url(url.m_Url)
 {
 }
 
 HttpUrl::HttpUrl(StringView url, Params params)
-  : parameters(std::move(params))
+  : m_Parameters(std::move(params))
 {
-  SetUrl(url);
+  // The query in the url is merged into params.
+  Assign(HttpUrlView(url));
 }
 
-void HttpUrl::ParseScheme(Iterator& first, Iterator last)
+void HttpUrl::Assign(const HttpUrlView& url)
 {
-  scheme = u8"https";
-  if (last - first > 7 && std::equal(first, first + 4, u8"http")) {
-    first += 4;
-    if (*first == u8's') {
-      ++first;
-    } else {
-      scheme.pop_back();
-    }
-    if (std::equal(first, first + 3, u8"://")) {
-      first += 3;
-    } else {
-      throw std::logic_error("HttpUrl Error: Url scheme doesn't end with '://'.");
-    }
-  } else {
-    throw std::logic_error("HttpUrl Error: Url scheme doesn't start with 'http(s)://'.");
-  }
+  m_Scheme = url.scheme;
+  m_Host = url.host;
+  m_Path = url.path;
+  m_Port = url.port;
+  ParseParams(url.query);
+  Serialize();
 }
 
-void HttpUrl::ParseHost(Iterator& first, Iterator last)
+void HttpUrl::ParseParams(StringView query)
 {
-  auto iter = std::find(first, last, u8'/');
-  if (first == iter || *first == u8':') {
-    throw std::logic_error("HttpUrl Error: Url host doesn't exist!");
-  }
-  host.assign(first, iter);
-
-  auto i = host.rfind(u8':');
-  if (i == host.npos) {
-    first = iter;
-    return;
+  while (!query.empty()) {
+    auto const end = query.find(u8'&');
+    auto const item = query.substr(0, end);
+    auto const equal = item.find(u8'=');
+    if (equal != item.npos) {
+      String key;
+      UrlDecode(item.substr(0, equal), key);
+      UrlDecode(item.substr(equal + 1), m_Parameters[key]);
+    }
+    query.remove_prefix(end == query.npos ? query.size() : end + 1);
   }
-  first += i;
-  host.erase(i, host.size() - i);
 }
 
-void HttpUrl::ParsePort(Iterator& first, Iterator last)
+// Bit 0x80 marks the characters that are sent as they are, bit 0x40 the hex
+// digits, whose value is in the low bits. Neither depends on the locale.
+static constexpr auto UrlTable = [] {
+  std::array<uint8_t, 256> table {};
+  for (int c = '0'; c <= '9'; ++c) table[c] = 0xC0 | (c - '0');
+  for (int c = 'A'; c <= 'Z'; ++c) table[c] = 0x80;
+  for (int c = 'a'; c <= 'z'; ++c) table[c] = 0x80;
+  for (int c = 'A'; c <= 'F'; ++c) table[c] = 0xC0 | (c - 'A' + 10);
+  for (int c = 'a'; c <= 'f'; ++c) table[c] = 0xC0 | (c - 'a' + 10);
+  for (int c: { '-', '_', '.', '~' }) table[c] = 0x80;
+  return table;
+}();
+
+static constexpr bool IsUnreserved(char8_t c)
 {
-  if (scheme.back() == u8's') {
-    port = 443;
-  } else {
-    port = 80;
-  }
-  if (first == last) return;
-
-  switch (*first) {
-    case ':':{
-      port = 0;
-      while (++first != last && u8'0' <= *first && *first <= u8'9') {
-        port *= 10;
-        port += *first - u8'0';
-      }
-      break;
-    }
-    case '/':
-      return;
-    default:
-      throw std::logic_error("HttpUrl Error: Url is invalid!");
-  }
+  return UrlTable[static_cast<uint8_t>(c)] & 0x80;
 }
 
-void HttpUrl::ParsePath(Iterator& first, Iterator last)
+static constexpr int FromHex(char8_t c)
 {
-  if (first == last) {
-    path = u8"/";
-    return;
-  }
-  if (*first != u8'/') {
-    throw std::logic_error("HttpUrl Error: Url path doesn't start with '/'.");
-  }
-
-  std::u8string_view str(first, last);
-  auto i = str.find(u8'?');
-  if (i == str.npos) {
-    path = str;
-    first = last;
-    return;
-  }
-  path = str.substr(0, ++i);
-  first += i;
+  auto const value = UrlTable[static_cast<uint8_t>(c)];
+  return value & 0x40 ? value & 0x0F : -1;
 }
 
-void HttpUrl::ParseParams(Iterator& first, Iterator last)
+static size_t EncodedSize(std::u8string_view text)
 {
-  while (first != last) {
-    auto e = std::find(first, last, u8'&');
-    auto i = std::find(first, e, u8'=');
-    if (i != e) {
-      String key;
-      UrlDecode(StringView(first, i), key);
-      UrlDecode(StringView(i + 1, e), parameters[key]);
-    }
-    first = e != last ? ++e: e;
-  };
+  size_t size = text.size();
+  for (auto c: text) {
+    if (!IsUnreserved(c)) size += 2;
+  }
+  return size;
 }
 
 void HttpUrl::UrlEncode(StringView text, String& out)
 {
-  for (auto i: text) {
-    if (std::isalnum(i) || u8"-_.~"s.find(i) != std::u8string_view::npos) {
-      out.push_back(i);
+  constexpr char8_t digits[] = u8"0123456789ABCDEF";
+  auto pos = out.size();
+  out.resize(pos + EncodedSize(text));
+  auto const buffer = out.data();
+  for (auto c: text) {
+    if (IsUnreserved(c)) {
+      buffer[pos++] = c;
     } else {
-      out.push_back('%');
-      out.push_back(ToHex(i >> 4));
-      out.push_back(ToHex(i & 0xF));
+      buffer[pos++] = u8'%';
+      buffer[pos++] = digits[static_cast<uint8_t>(c) >> 4];
+      buffer[pos++] = digits[c & 0xF];
     }
   }
 }
 
 void HttpUrl::UrlDecode(StringView text, String& out)
 {
+  // The result is never longer than the input.
+  out.reserve(out.size() + text.size());
   for (auto i = text.cbegin(); i != text.cend(); ++i) {
     switch (*i) {
       case u8'%':{
-        if (text.cend() - i < 2) {
+        if (text.cend() - i < 3) {
+          throw std::logic_error("HttpUrl Error: Url decode error.");
+        }
+        auto const high = FromHex(i[1]), low = FromHex(i[2]);
+        if (high < 0 || low < 0) {
           throw std::logic_error("HttpUrl Error: Url decode error.");
         }
-        StringView::value_type const c = FromHex(*++i) << 4;
-        out.push_back(c | FromHex(*++i));
+        out.push_back(static_cast<Char>(high << 4 | low));
+        i += 2;
         break;
       }
       case u8'+':
@@ -330,86 +450,79 @@ void HttpUrl::UrlDecode(StringView text, String& out)
 
 HttpUrl::String HttpUrl::GetUrl(bool showPort) const
 {
-  auto url = scheme + u8"://" + host;
-  if (showPort) {
-    url.push_back(u8':');
-    auto str = std::to_string(port);
-    url.append(str.begin(), str.end());
-  }
-  url += GetObjectString();
-
+  if (!showPort) return m_Url;
+
+  auto const number = std::to_string(m_Port);
+  String url;
+  url.reserve(m_Scheme.size() + 3 + m_Host.size() + 1 + number.size() + m_Object.size());
+  url.append(m_Scheme).append(u8"://").append(m_Host).push_back(u8':');
+  url.append(number.begin(), number.end());
+  url.append(m_Object);
   return url;
 }
 
 void HttpUrl::SetUrl(StringView url)
 {
-  auto iter = url.cbegin();
+  m_Parameters.clear();
+  Assign(HttpUrlView(url));
+}
 
-  ParseScheme(iter, url.cend());
-  ParseHost(iter, url.cend());
-  ParsePort(iter, url.cend());
-  ParsePath(iter, url.cend());
-  ParseParams(iter, url.cend());
+void HttpUrl::SetPath(StringView path)
+{
+  HttpUrlView view;
+  view.ParseTarget(path);
+  m_Path = view.path;
+  ParseParams(view.query);
+  Serialize();
 }
 
-HttpUrl::String HttpUrl::GetObjectString() const
+void HttpUrl::SetParameter(String key, String value)
 {
-  auto object = path;
-  if (!parameters.empty()) {
-    if (!object.ends_with(u8'?')) {
-      object.push_back(u8'?');
-    }
-  }
-  for (auto& [key, value]: parameters) {
-    UrlEncode(key, object);
-    object.push_back(u8'=');
-    UrlEncode(value, object);
-    object.push_back(u8'&');
-  }
+  m_Parameters[std::move(key)] = std::move(value);
+  Serialize();
+}
+
+void HttpUrl::EraseParameter(const String& key)
+{
+  if (m_Parameters.erase(key)) Serialize();
+}
 
-  if (!parameters.empty()) {
-    object.pop_back();
+void HttpUrl::Serialize()
+{
+  auto size = m_Path.size() + 1;
+  for (auto& [key, value]: m_Parameters) {
+    size += EncodedSize(key) + EncodedSize(value) + 2;
+  }
+
+  m_Object.reserve(size);
+  m_Object.assign(m_Path);
+  if (!m_Parameters.empty()) {
+    m_Object.push_back(u8'?');
+    for (auto& [key, value]: m_Parameters) {
+      UrlEncode(key, m_Object);
+      m_Object.push_back(u8'=');
+      UrlEncode(value, m_Object);
+      m_Object.push_back(u8'&');
+    }
+    m_Object.pop_back();
   }
 
-  return object;
+  m_Url.clear();
+  m_Url.reserve(m_Scheme.size() + 3 + m_Host.size() + m_Object.size());
+  m_Url.append(m_Scheme).append(u8"://").append(m_Host).append(m_Object);
 }
 
 bool HttpLib::IsOnline() {
-#ifdef _WIN32
-  BOOL bResult = FALSE;
-  DWORD flags;
-  typedef BOOL(* pInternetGetConnectedState)(LPDWORD, DWORD*);
-  
-  HMODULE hWininet = LoadLibraryW(L"Wininet.dll");
-  if (hWininet) {
-    void* const pTemp = reinterpret_cast<void*>(GetProcAddress(hWininet, "InternetGetConnectedState"));
+  return HttpMonitor::Instance().IsOnline();
+}
 
-    auto const InternetGetConnectedState = reinterpret_cast<pInternetGetConnectedState>(pTemp);
-    if (InternetGetConnectedState) {
-      bResult = InternetGetConnectedState(&flags, 0);
-    }
-    FreeLibrary(hWininet);
-  } else {
-    throw std::runtime_error("Can't find Wininet library!");
-  }
-  return bResult;
-#elif 0
-  std::vector<std::string> result;
-  GetCmdOutput<char>("ping www.baidu.com -c 2", result);
-  if (result.size() < 2)
-    return false;
-  auto& data = result.end()[-2];
-  auto first = data.find("received");
-  if (first == std::string::npos)
-    return false;
-  first += 10;
-  auto last = data.find("%", first);
-  auto&& lostPacket = data.substr(first, last - first);
-  return !std::atoi(lostPacket.c_str());
-#else
-  HttpLib clt(HttpUrl(u8"https://www.baidu.com"sv), false, 1s);
-  auto res = clt.Get();
-  return res && res->status == 200;
+void HttpLib::FlushCache()
+{
+  HttpProxyResolver::Instance().Invalidate();
+#ifdef __linux__
+  // Cached DNS answers and parked connections may belong to the old proxy.
+  HttpShare::Instance().Flush();
+  HttpPool::Instance().Clear();
 #endif
 }
 
@@ -417,9 +530,9 @@ size_t HttpLib::WriteFile(void* buffer,
                         size_t size,
                         size_t nmemb,
                         void* userdata) {
-  std::ofstream& stream = *reinterpret_cast<std::ofstream*>(userdata);
-  stream.write(reinterpret_cast<const char*>(buffer), (size *= nmemb));
-  return size;
+  auto& clt = *reinterpret_cast<HttpLib*>(userdata);
+  // A short count makes the transfer fail.
+  return clt.WriteToFile(buffer, size *= nmemb) ? size : 0;
 }
 
 size_t HttpLib::WriteString(void* buffer,
@@ -444,47 +557,84 @@ size_t HttpLib::WriteHeader(void* buffer, size_t size, size_t nmemb, void* userd
   if (res.version.empty()) {
     auto pos = outBuffer.find(u8' ');
     res.version = outBuffer.substr(0, pos);
-    auto code = outBuffer.substr(pos + 1, pos + 4);
-    res.status = std::stol(std::string(code.begin(), code.end()));
+    res.status = static_cast<long>(ParseNumber(outBuffer.substr(pos + 1, 3)));
   } else if (size != 2) {
     auto mid = outBuffer.find(u8':');
-    // if (mid == outBuffer.npos) return size;
+    if (mid == outBuffer.npos) return size;
 
-    std::u8string key(outBuffer.substr(0, mid));
+    auto const key = outBuffer.substr(0, mid);
     mid = outBuffer.find_first_not_of(u8' ', ++mid);
-    auto value = outBuffer.substr(mid, size - 2 - mid);
-
-    res.headers[std::u8string(key)] = value;
+    auto const value = outBuffer.substr(mid, size - 2 - mid);
+    res.headers.Add(key, value);
 
-    for (auto& c: key) {
-      if (std::isupper(c)) {
-        c += 32;
-      }
-    }
-    if (key == u8"location") {
+    if (HttpHeaders::Equals(key, u8"location")) {
       res.location = value;
-    } else if (key == u8"content-length") {
-      clt.m_ConnectLength = std::stoull(std::string(value.begin(), value.end()));
+    } else if (HttpHeaders::Equals(key, u8"content-length")) {
+      clt.m_ConnectLength = ParseNumber(value);
       clt.EmitProcess();
     }
   } else if (outBuffer == u8"\r\n"sv) {
-    if (res.status / 100 == 3 && clt.m_RedirectDepth) {
+    if (res.status / 100 == 1) {
+      // 100 Continue and friends, the real reply follows.
+      res.version.clear();
+      res.headers.Clear();
+    } else if (res.status / 100 == 3 && res.status != 304 && clt.m_RedirectDepth) {
       if (clt.m_RedirectDepth > 0) {
         --clt.m_RedirectDepth;
       }
       res.version.clear();
-      res.headers.clear();
+      res.headers.Clear();
+    } else if (!clt.m_FilePath.empty() && !clt.OpenResume()) {
+      return CURL_WRITEFUNC_ERROR;
     }
   }
   return size;
 }
 
 size_t HttpLib::WriteFunction(void* buffer, size_t size, size_t nmemb, void* userdata) {
+  auto& clt = *reinterpret_cast<HttpLib*>(userdata);
+  if (!clt.Throttle())
+    return CURL_WRITEFUNC_PAUSE;
   auto data = reinterpret_cast<const char*>(buffer);
-  if ((*reinterpret_cast<decltype(m_WriteCallback)*>(userdata))(data, size *= nmemb))
+  if (clt.m_WriteCallback(data, size *= nmemb))
     return size;
   return CURL_WRITEFUNC_ERROR;
 }
+
+size_t HttpLib::ReadFunction(void* buffer, size_t size, size_t nmemb, void* userdata) {
+  auto& clt = *reinterpret_cast<HttpLib*>(userdata);
+  if (clt.m_Finished || !clt.m_Body)
+    return CURL_READFUNC_ABORT;
+  auto const count = clt.m_Body->Read(buffer, size * nmemb);
+  return count == HttpBody::ReadError ? CURL_READFUNC_ABORT : count;
+}
+
+int HttpLib::SeekFunction(void* userdata, int64_t offset, int origin) {
+  // curl only seeks to resend the body from the start, on a redirect or an
+  // authentication round.
+  auto& clt = *reinterpret_cast<HttpLib*>(userdata);
+  if (offset != 0 || origin != SEEK_SET || !clt.m_Body)
+    return CURL_SEEKFUNC_CANTSEEK;
+  return clt.m_Body->Rewind() ? CURL_SEEKFUNC_OK : CURL_SEEKFUNC_CANTSEEK;
+}
+
+bool HttpLib::Throttle()
+{
+  // Charge the bytes as they came off the wire; curl hands the same chunk
+  // over again once the transfer is unpaused.
+  curl_off_t wire = 0;
+  if (curl_easy_getinfo(m_hSession, CURLINFO_SIZE_DOWNLOAD_T, &wire) != CURLE_OK)
+    return true;
+  auto const size = static_cast<size_t>(wire) - std::min(m_ThrottledSize, static_cast<size_t>(wire));
+  auto const wait = HttpLimiter::Instance().AcquireBytes(m_Url.GetHost(), size,
+    m_Priority == HttpScheduler::Priority::Background);
+  if (wait == HttpLimiter::Duration::zero()) {
+    m_ThrottledSize = static_cast<size_t>(wire);
+    return true;
+  }
+  HttpEngine::Instance().Pause(this, HttpLimiter::Clock::now() + wait);
+  return false;
+}
 #endif
 
 HttpLib::~HttpLib() {
@@ -537,7 +687,9 @@ void HttpLib::HttpPrepare()
 void HttpLib::ResetData() {
   m_PostData.data = nullptr;
   m_PostData.size = 0;
+  m_Body.reset();
   m_RecieveSize = 0;
+  m_DecodedSize = 0;
   m_ConnectLength = 0;
   m_Finished = false;
 }
@@ -559,34 +711,44 @@ void HttpLib::HttpInitialize()
   if (m_AsyncSet) {
     SetAsyncCallback();
   }
-  auto url = Utf82Wide(m_Url.host);
+  if (m_Http2) {
+    SetHttp2(*m_Http2, m_Http2PriorKnowledge);
+  }
+  auto url = Utf82Wide(m_Url.GetHost());
 
   SetTimeOut(m_TimeOut);
-  m_hConnect = WinHttpConnect(m_hSession, url.c_str(), m_Url.port, 0);
-  if (m_hConnect) {
-    SetProxyBefore();
-  } else {
+  m_hConnect = WinHttpConnect(m_hSession, url.c_str(), m_Url.GetPort(), 0);
+  if (!m_hConnect) {
     std::cerr << "HttpLib Error: " << GetLastError() << " in WinHttpConnect.\n";
   }
 
 #elif defined (__linux__)
   static volatile CurlGlobal _;
 
-  SetProxyBefore();
+  auto& pool = HttpPool::Instance();
+  ResolveProxy();
+  m_PoolKey = GetPoolKey();
+  m_hSession = pool.Acquire(m_PoolKey);
+  m_hShare = HttpShare::Instance().Attach(m_hSession);
   auto url = m_Url.GetUrl();
-  m_hSession = curl_easy_init();
   // curl_easy_setopt(m_hSession, CURLOPT_HEADER, false);
   curl_easy_setopt(m_hSession, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(m_hSession, CURLOPT_PORT, static_cast<long>(m_Url.GetPort()));
   curl_easy_setopt(m_hSession, CURLOPT_SSL_VERIFYPEER, false);
   curl_easy_setopt(m_hSession, CURLOPT_SSL_VERIFYHOST, false);
   curl_easy_setopt(m_hSession, CURLOPT_READFUNCTION, NULL);
+  curl_easy_setopt(m_hSession, CURLOPT_SEEKFUNCTION, NULL);
   curl_easy_setopt(m_hSession, CURLOPT_NOSIGNAL, 1L);
   curl_easy_setopt(m_hSession, CURLOPT_POST, 0L);
   curl_easy_setopt(m_hSession, CURLOPT_FAILONERROR, 1L);
+  curl_easy_setopt(m_hSession, CURLOPT_MAXAGE_CONN, static_cast<long>(pool.GetIdleTimeout().count()));
   if (m_TimeOut > 0s) {
     curl_easy_setopt(m_hSession, CURLOPT_TIMEOUT, m_TimeOut.count());
     curl_easy_setopt(m_hSession, CURLOPT_CONNECTTIMEOUT, m_TimeOut.count());
   }
+  if (m_Http2) {
+    SetHttp2(*m_Http2, m_Http2PriorKnowledge);
+  }
   SetAsyncCallback();
 #endif
 }
@@ -608,66 +770,96 @@ void HttpLib::HttpUninitialize() {
   }
 #else
   if (m_hSession) {
-    curl_easy_cleanup(m_hSession);
+    HttpShare::Instance().Detach(m_hSession, m_hShare);
+    m_hShare = nullptr;
+    HttpPool::Instance().Release(m_PoolKey, m_hSession);
     m_hSession = nullptr;
   }
 #endif
 }
 
+#ifdef __linux__
+std::u8string HttpLib::GetPoolKey() const
+{
+  auto key = m_Url.GetScheme() + u8"://" + m_Url.GetHost() + u8":";
+  auto const port = std::to_string(m_Url.GetPort());
+  key.append(port.begin(), port.end());
+  if (!m_Route.IsDirect()) {
+    key.push_back(u8'|');
+    key += m_Route.proxy;
+  }
+  return key;
+}
+#endif
+
+void HttpLib::ResolveProxy()
+{
+  m_Route = ResolveRoute(m_Url);
+}
+
+HttpProxyResolver::Route HttpLib::ResolveRoute(const HttpUrl& url)
+{
+  if (!m_Proxy) return {};
+  static std::once_flag once;
+  std::call_once(once, [] {
+    HttpProxyResolver::Instance().SetSource([] {
+      return m_Proxy ? m_Proxy->GetResolverConfig() : HttpProxyResolver::Config {};
+    });
+  });
+  return HttpProxyResolver::Instance().Resolve(url.GetScheme(), url.GetHost());
+}
+
 void HttpLib::SetProxyBefore()
 {
+  // Without settings the platform defaults stay in charge.
   if (!m_Proxy) return;
 
-  using Type = HttpProxy::Type;
-  auto const type = static_cast<Type>(m_Proxy->GetType());
+  // Per attempt, so that a retry can move on to the next proxy.
+  ResolveProxy();
 #ifdef _DEBUG
-  std::cout << "Httplib proxy type: " << (int)type << std::endl;
+  std::cout << "Httplib proxy: <" << std::string(m_Route.proxy.begin(), m_Route.proxy.end()) << ">\n";
 #endif
-  if (type == Type::User) return;
 
 #ifdef _WIN32
-  if (type == Type::System) {
-    if (!m_Proxy->IsSystemProxy()) return;
-    m_Proxy->UpdateSystemProxy();
-  }
-  auto proxyString = Utf82Wide(m_Proxy->GetProxy());
-  proxyString.push_back(L'\0');
-  // if (proxyString.starts_with(L"http://")) {
-  //   proxyString = L"http://" + proxyString;
-  // }
-
-  WINHTTP_PROXY_INFO proxy { 
-    WINHTTP_ACCESS_TYPE_NAMED_PROXY,
-    proxyString.data(), nullptr
+  // The request handle opened next takes it from the session.
+  auto proxyString = Utf82Wide(m_Route.proxy);
+  WINHTTP_PROXY_INFO proxy {
+    m_Route.IsDirect() ? WINHTTP_ACCESS_TYPE_NO_PROXY : WINHTTP_ACCESS_TYPE_NAMED_PROXY,
+    m_Route.IsDirect() ? WINHTTP_NO_PROXY_NAME : proxyString.data(),
+    WINHTTP_NO_PROXY_BYPASS
   };
 
-  if (WinHttpSetOption(m_hSession, WINHTTP_OPTION_PROXY, &proxy, sizeof(proxy)))
-  {
-    if (m_Proxy->IsUserEmpty()) return;
-    m_ProxySet = true;
+  m_ProxySet = false;
+  if (WinHttpSetOption(m_hSession, WINHTTP_OPTION_PROXY, &proxy, sizeof(proxy))) {
+    m_ProxySet = !m_Route.IsDirect() && !m_Route.username.empty();
+  } else {
+    std::cerr << "HttpLib Error: " << GetLastError() << " in WinHttpSetOption.\n";
   }
 #else
   // https://curl.se/libcurl/c/CURLOPT_PROXY.html
   // https://curl.se/libcurl/c/CURLOPT_PROXYAUTH.html
-  auto pwd = m_Proxy->GetUsername() + u8":" + m_Proxy->GetPassword();
-  auto proxy = m_Proxy->GetProxy();
-  curl_easy_setopt(m_hSession, CURLOPT_PROXY, proxy.c_str());
+  // An empty string turns off the proxy, environment variables included.
+  curl_easy_setopt(m_hSession, CURLOPT_PROXY, m_Route.proxy.c_str());
   /* allow whatever auth the proxy speaks */
   curl_easy_setopt(m_hSession, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
   /* set the proxy credentials */
-  if (pwd.length() > 3)
+  if (m_Route.IsDirect() || m_Route.username.empty()) {
+    curl_easy_setopt(m_hSession, CURLOPT_PROXYUSERPWD, nullptr);
+  } else {
+    auto const pwd = m_Route.username + u8":" + m_Route.password;
     curl_easy_setopt(m_hSession, CURLOPT_PROXYUSERPWD, pwd.c_str());
+  }
 #endif
 }
 
 bool HttpLib::SetProxyAfter()
 {
   bool bResult = true;
-  if (!m_ProxySet || !m_Proxy) return true;
+  if (!m_ProxySet) return true;
 
 #ifdef _WIN32
-  auto username = Utf82Wide(m_Proxy->GetUsername());
-  auto password = Utf82Wide(m_Proxy->GetPassword());
+  auto username = Utf82Wide(m_Route.username);
+  auto password = Utf82Wide(m_Route.password);
 
   bResult = WinHttpSetOption(m_hRequest,
     WINHTTP_OPTION_PROXY_USERNAME,
@@ -686,9 +878,41 @@ bool HttpLib::SetProxyAfter()
   return bResult;
 }
 
+void HttpLib::MarkProxyError(long code)
+{
+  if (m_Route.IsDirect()) return;
+#ifdef _WIN32
+  // Whatever could not be reached is the proxy, not the target.
+  m_ProxyFailed = code == ERROR_WINHTTP_CANNOT_CONNECT ||
+    code == ERROR_WINHTTP_NAME_NOT_RESOLVED;
+#else
+  switch (code) {
+  case CURLE_COULDNT_RESOLVE_PROXY:
+  case CURLE_COULDNT_CONNECT:
+  case CURLE_PROXY:
+    m_ProxyFailed = true;
+    break;
+  default:
+    break;
+  }
+#endif
+}
+
+void HttpLib::ReportProxy()
+{
+  if (m_Route.IsDirect()) return;
+  auto& resolver = HttpProxyResolver::Instance();
+  if (m_ProxyFailed) {
+    resolver.ReportFailure(m_Route.proxy);
+  } else if (m_Response.status != 0) {
+    resolver.ReportSuccess(m_Route.proxy);
+  }
+}
+
 void HttpLib::SetRedirect(long redirect)
 {
   m_RedirectDepth = redirect;
+  m_RedirectLimit = redirect;
 #ifdef _WIN32
   ULONGLONG flag = redirect ?
     WINHTTP_OPTION_REDIRECT_POLICY_DISALLOW_HTTPS_TO_HTTP : WINHTTP_OPTION_REDIRECT_POLICY_NEVER;
@@ -699,16 +923,85 @@ void HttpLib::SetRedirect(long redirect)
 #endif
 }
 
+void HttpLib::SetHttp2(bool on, bool priorKnowledge)
+{
+  m_Http2 = on;
+  m_Http2PriorKnowledge = on && priorKnowledge;
+#ifdef _WIN32
+#ifdef WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL
+  DWORD flag = on ? WINHTTP_PROTOCOL_FLAG_HTTP2 : 0;
+  WinHttpSetOption(m_hSession, WINHTTP_OPTION_ENABLE_HTTP_PROTOCOL, &flag, sizeof(flag));
+#endif
+#else
+  // h2 is negotiated through ALPN, plain http stays on HTTP/1.1 unless the
+  // caller knows better. PIPEWAIT makes concurrent requests wait for a
+  // connection they can multiplex on instead of opening a new socket each.
+  curl_easy_setopt(m_hSession, CURLOPT_HTTP_VERSION, !on ? CURL_HTTP_VERSION_1_1 :
+    m_Http2PriorKnowledge ? CURL_HTTP_VERSION_2_PRIOR_KNOWLEDGE : CURL_HTTP_VERSION_2TLS);
+  curl_easy_setopt(m_hSession, CURLOPT_PIPEWAIT, on ? 1L : 0L);
+#endif
+}
+
 void HttpLib::SetPostData(void *data, size_t size)
 {
+  m_Body.reset();
   m_PostData.data = data;
   m_PostData.size = size;
 }
 
+void HttpLib::SetBody(HttpBody body)
+{
+  m_PostData.data = nullptr;
+  m_PostData.size = 0;
+  m_Body = std::make_unique<HttpBody>(std::move(body));
+}
+
+void HttpLib::SetMultipart(HttpMultipart form)
+{
+  m_Headers[u8"Content-Type"] = form.GetContentType();
+  SetBody(form.Finish());
+}
+
 // https://blog.csdn.net/kaola518/article/details/84065621
 bool HttpLib::SendRequest()
 {
-  if (m_PostData.data) {
+  if (m_Body) {
+    // A retry sends the body again from the start.
+    if (!m_Body->Rewind()) {
+      std::cerr << "HttpLib Error: the request body can not be sent again.\n";
+      return false;
+    }
+#ifdef _WIN32
+    auto const size = static_cast<DWORD>(m_Body->GetSize());
+    if (!WinHttpSendRequest(m_hRequest,
+      WINHTTP_NO_ADDITIONAL_HEADERS, 0,
+      WINHTTP_NO_REQUEST_DATA, 0, size,
+      static_cast<DWORD_PTR>(m_AsyncId)))
+    {
+      return false;
+    }
+    // Async requests go on from SENDREQUEST_COMPLETE.
+    return m_AsyncSet || WriteBody();
+#else
+    auto status = curl_easy_setopt(m_hSession, CURLOPT_POST, 1L);
+    if (status == CURLE_OK)
+      status = curl_easy_setopt(m_hSession, CURLOPT_POSTFIELDS, nullptr);
+    if (status == CURLE_OK)
+      status = curl_easy_setopt(m_hSession, CURLOPT_POSTFIELDSIZE_LARGE,
+        static_cast<curl_off_t>(m_Body->GetSize()));
+    if (status == CURLE_OK)
+      status = curl_easy_setopt(m_hSession, CURLOPT_READFUNCTION, &ReadFunction);
+    if (status == CURLE_OK)
+      status = curl_easy_setopt(m_hSession, CURLOPT_READDATA, this);
+    if (status == CURLE_OK)
+      status = curl_easy_setopt(m_hSession, CURLOPT_SEEKFUNCTION, &SeekFunction);
+    if (status == CURLE_OK)
+      status = curl_easy_setopt(m_hSession, CURLOPT_SEEKDATA, this);
+    if (status != CURLE_OK)
+      throw std::logic_error("Http Error: CURL set the request body failed.");
+    return true;
+#endif
+  } else if (m_PostData.data) {
 #ifdef _WIN32
     return WinHttpSendRequest(m_hRequest,
       WINHTTP_NO_ADDITIONAL_HEADERS, 0,
@@ -739,11 +1032,36 @@ bool HttpLib::SendRequest()
       static_cast<DWORD_PTR>(m_AsyncId)
     );
 #else
+    curl_easy_setopt(m_hSession, CURLOPT_NOBODY, m_HeadOnly ? 1L : 0L);
     return true;
 #endif
   }
 }
 
+#ifdef _WIN32
+bool HttpLib::WriteBody()
+{
+  // Sync requests send it all here. Async ones send a chunk per call and
+  // come back from WRITE_COMPLETE until the body is out.
+  m_UploadBuffer.resize(64 << 10);
+  do {
+    auto const size = m_Body->Read(m_UploadBuffer.data(), m_UploadBuffer.size());
+    if (size == HttpBody::ReadError) return false;
+    if (size == 0) {
+      return !m_AsyncSet || WinHttpReceiveResponse(m_hRequest, nullptr);
+    }
+    DWORD written = 0;
+    if (!WinHttpWriteData(m_hRequest, m_UploadBuffer.data(), static_cast<DWORD>(size),
+      m_AsyncSet ? nullptr : &written))
+    {
+      std::cerr << "HttpLib Error: " << GetLastError() << " in WinHttpWriteData.\n";
+      return false;
+    }
+  } while (!m_AsyncSet);
+  return true;
+}
+#endif
+
 bool HttpLib::RecvResponse() {
 #ifdef _WIN32
   bool bResults = false;
@@ -751,6 +1069,7 @@ bool HttpLib::RecvResponse() {
   return bResults;
 #else
   auto lStatus = curl_easy_perform(m_hSession);
+  if (lStatus != CURLE_OK) MarkProxyError(lStatus);
   return lStatus == CURLE_OK;
 #endif
 
@@ -763,7 +1082,7 @@ bool HttpLib::SendHeaders()
   auto path = Utf82Wide(m_Url.GetObjectString());
   m_hRequest = WinHttpOpenRequest(
     m_hConnect,
-    m_PostData.data ? L"POST": L"GET",
+    HasBody() ? L"POST": m_HeadOnly ? L"HEAD" : L"GET",
     path.c_str(),
     nullptr,
     WINHTTP_NO_REFERER,
@@ -771,6 +1090,11 @@ bool HttpLib::SendHeaders()
     m_Url.IsHttps() ? WINHTTP_FLAG_SECURE : 0
   );
   if (m_hRequest) {
+#ifdef WINHTTP_OPTION_DECOMPRESSION
+    // Range offsets count encoded bytes, so those requests stay on identity.
+    DWORD decompression = m_Headers.contains(u8"Range") ? 0 : WINHTTP_DECOMPRESSION_FLAG_ALL;
+    WinHttpSetOption(m_hRequest, WINHTTP_OPTION_DECOMPRESSION, &decompression, sizeof(decompression));
+#endif
     bResults = SetProxyAfter();
   } else {
     std::cerr << "WinHttp openRequest failed!" << std::endl;
@@ -804,14 +1128,21 @@ bool HttpLib::SendHeaders()
 
   if (status == CURLE_OK) {
     if (m_AsyncSet) {
-      status = curl_easy_setopt(m_hSession, CURLOPT_WRITEDATA, &m_WriteCallback);
+      status = curl_easy_setopt(m_hSession, CURLOPT_WRITEDATA, this);
     } else {
       status = curl_easy_setopt(m_hSession, CURLOPT_WRITEDATA, m_DataBuffer);
     }
   } else
     throw std::logic_error("Http Error: CURL set CURLOPT_WRITEFUNCTION failed.");
 
-  if (status == CURLE_OK && !m_Headers.empty()) {
+  if (status == CURLE_OK) {
+    // Offer every encoding curl was built with and decode on the fly. Range
+    // offsets count encoded bytes, so those requests stay on identity.
+    status = curl_easy_setopt(m_hSession, CURLOPT_ACCEPT_ENCODING,
+      m_Headers.contains(u8"Range") ? nullptr : "");
+  }
+
+  if (status == CURLE_OK && (!m_Headers.empty() || m_ExpectContinue)) {
     struct curl_slist *headers = nullptr;
     std::u8string buffer;
     for (const auto& [key, value]: m_Headers) {
@@ -819,6 +1150,10 @@ bool HttpLib::SendHeaders()
       buffer.push_back('\0');
       headers = curl_slist_append(headers, reinterpret_cast<const char*>(buffer.data()));
     }
+    if (m_ExpectContinue) {
+      // An empty "Expect:" keeps curl from adding one on its own.
+      headers = curl_slist_append(headers, *m_ExpectContinue ? "Expect: 100-continue" : "Expect:");
+    }
     status = curl_easy_setopt(m_hSession, CURLOPT_HTTPHEADER, headers);
   }
   return status == CURLE_OK;
@@ -829,6 +1164,7 @@ bool HttpLib::SendHeaders()
 bool HttpLib::ReadStatusCode() 
 {
 #ifdef _WIN32
+  m_FirstByteTime = std::chrono::steady_clock::now();
   bool bResults = false;
   DWORD dwSize = sizeof(m_Response.status);
   bResults = WinHttpQueryHeaders(m_hRequest, 
@@ -865,19 +1201,14 @@ void HttpLib::ParseHeaders(const std::u8string& outBuffer)
     if (mid == outBuffer.npos || cursor == outBuffer.npos) {
       break;
     }
-    auto key = outBuffer.substr(left, mid - left);
+    auto const key = std::u8string_view(outBuffer).substr(left, mid - left);
     mid = outBuffer.find_first_not_of(u8' ', ++mid);
-    auto value = outBuffer.substr(mid, cursor - mid);
-    m_Response.headers[key] = value;
-    
-    for (auto& c: key) {
-      if (std::isupper(c)) {
-        c += 32;
-      }
-    }
-    if (key == u8"content-length") {
-      m_ConnectLength = std::stoull(std::string(value.begin(), value.end()));
-    } else if (key == u8"location") {
+    auto const value = std::u8string_view(outBuffer).substr(mid, cursor - mid);
+    m_Response.headers.Add(key, value);
+
+    if (HttpHeaders::Equals(key, u8"content-length")) {
+      m_ConnectLength = ParseNumber(value);
+    } else if (HttpHeaders::Equals(key, u8"location")) {
       m_Response.location = value;
     }
   }
@@ -904,6 +1235,13 @@ bool HttpLib::ReadHeaders()
     if (bResults) { // regex expr: '/^([^:]+):([^\n]+)/'
       // std::istringstream strstream(Wide2AnsiString(lpOutBuffer));
       ParseHeaders(Wide2Utf8(lpOutBuffer));
+      // WinHTTP only hands out decoded bytes, which Content-Length does not count.
+      if (m_Response.headers.Contains(u8"content-encoding")) {
+        m_ConnectLength = 0;
+      }
+      if (!m_FilePath.empty()) {
+        bResults = OpenResume();
+      }
     }
 
     delete[] lpOutBuffer;
@@ -943,13 +1281,31 @@ bool HttpLib::ReadBody()
 }
 #endif
 
-void HttpLib::HttpPerform()
+bool HttpLib::HttpPerform()
 {
-#ifdef __linux__
-  if (m_AsyncSet) {
-    m_AsyncMutex.lock();
+  if (!m_AsyncSet) {
+    // Synchronous callers block anyway, so they simply wait for a token.
+    auto& limiter = HttpLimiter::Instance();
+    for (auto wait = limiter.AcquireRequest(m_Url.GetHost()); wait != HttpLimiter::Duration::zero();
+      wait = limiter.AcquireRequest(m_Url.GetHost()))
+    {
+      std::this_thread::sleep_for(wait);
+    }
   }
-#endif
+
+  // A reused HttpLib must not parse the new reply on top of the old one.
+  m_Response = Response {};
+  m_RecieveSize = 0;
+  m_DecodedSize = 0;
+  m_ConnectLength = 0;
+  m_ThrottledSize = 0;
+  m_RedirectDepth = m_RedirectLimit;
+  m_Retryable = false;
+  m_ProxyFailed = false;
+  ++m_Attempt;
+  m_StartTime = std::chrono::steady_clock::now();
+
+  SetProxyBefore();
   bool bResults = SendHeaders();
 
   if (bResults) {
@@ -959,16 +1315,37 @@ void HttpLib::HttpPerform()
   }
 #ifdef _WIN32
   if (m_AsyncSet) {
-    if (!bResults) ExitAsync();
-    return;
+    if (bResults) {
+      StartHedge();
+    } else {
+      ExitAsync();
+    }
+    return bResults;
+  }
+#elif defined (__linux__)
+  if (m_AsyncSet) {
+    if (bResults) {
+      StartHedge();
+      HttpEngine::Instance().Submit(this);
+    } else {
+      EmitFinish("HttpPerform Faield.");
+    }
+    return bResults;
   }
 #endif
 
+#ifdef _WIN32
+  if (!bResults) MarkProxyError(GetLastError());
+#endif
   if (bResults) {
     bResults = RecvResponse();
   } else {
     std::cerr << "WinHttpSendRequest failed." << std::endl;
   }
+#ifdef __linux__
+  HttpPool::Instance().Record(m_hSession);
+  ReadTiming();
+#endif
   
 #ifdef _WIN32
   if (bResults) {
@@ -978,7 +1355,8 @@ void HttpLib::HttpPerform()
   }
 
   if (bResults) {
-    bResults = m_Response.status == 200 || m_Response.status == 302;
+    bResults = m_Response.status == 200 || m_Response.status == 206 ||
+      m_Response.status == 302 || m_Response.status == 304;
   } else {
     std::cerr << "WinHttp read status code failed." << std::endl;
   }
@@ -994,14 +1372,76 @@ void HttpLib::HttpPerform()
   } else {
     std::cerr << "WinHttp ReadHeaders Failed." << std::endl;
   }
-#elif defined (__linux__)
-  if (!m_AsyncSet) return;
-  if (bResults) {
-    EmitFinish();
-  } else {
-    EmitFinish("HttpPerform Faield.");
+  ReadTiming();
+#endif
+  ReportProxy();
+  return bResults;
+}
+
+void HttpLib::AddRecieveSize(size_t size)
+{
+  m_DecodedSize += size;
+#ifdef __linux__
+  // curl counts body bytes as they come off the wire, before decoding.
+  curl_off_t wire = 0;
+  if (curl_easy_getinfo(m_hSession, CURLINFO_SIZE_DOWNLOAD_T, &wire) == CURLE_OK) {
+    m_RecieveSize = m_ResumeFrom + static_cast<size_t>(wire);
+    return;
+  }
+#endif
+  m_RecieveSize += size;
+}
+
+void HttpLib::ReadTiming()
+{
+  // Nothing went out for this reply, e.g. it was served from the cache.
+  if (m_StartTime == std::chrono::steady_clock::time_point {}) return;
+
+  using std::chrono::microseconds;
+  auto& timing = m_Response.timing;
+  timing.decodedBytes = m_AsyncSet ? m_DecodedSize - std::min(m_DecodedSize, m_ResumeFrom) :
+    m_DataBuffer == &m_Response.body ? m_Response.body.size() : 0;
+#ifdef _WIN32
+  // WinHTTP hands out decoded data only.
+  timing.wireBytes = m_RecieveSize - std::min(m_RecieveSize, m_ResumeFrom);
+#ifdef WINHTTP_OPTION_REQUEST_TIMES
+  WINHTTP_REQUEST_TIMES times {};
+  DWORD size = sizeof(times);
+  if (m_hRequest && WinHttpQueryOption(m_hRequest, WINHTTP_OPTION_REQUEST_TIMES, &times, &size)) {
+    // In 100 ns units; an unset entry means the step did not happen.
+    auto const span = [&times](int first, int last) {
+      auto const begin = times.rgullTimes[first], end = times.rgullTimes[last];
+      return microseconds(begin && end > begin ? (end - begin) / 10 : 0);
+    };
+    timing.dns = span(WinHttpNameResolutionStart, WinHttpNameResolutionEnd);
+    timing.connect = span(WinHttpConnectionEstablishmentStart, WinHttpConnectionEstablishmentEnd);
+    timing.tls = span(WinHttpTlsHandshakeClientLeg1Start, WinHttpTlsHandshakeClientLeg3End);
+    timing.reused = m_Response.status > 0 && !times.rgullTimes[WinHttpConnectionEstablishmentStart];
+  }
+#endif
+  if (m_FirstByteTime > m_StartTime) {
+    timing.firstByte = std::chrono::duration_cast<microseconds>(m_FirstByteTime - m_StartTime);
   }
-  m_AsyncMutex.unlock();
+  timing.total = std::chrono::duration_cast<microseconds>(std::chrono::steady_clock::now() - m_StartTime);
+#else
+  // curl reports every step as time since the start.
+  curl_off_t dns = 0, connect = 0, tls = 0, first = 0, total = 0, wire = 0;
+  long connects = 0;
+  curl_easy_getinfo(m_hSession, CURLINFO_NAMELOOKUP_TIME_T, &dns);
+  curl_easy_getinfo(m_hSession, CURLINFO_CONNECT_TIME_T, &connect);
+  curl_easy_getinfo(m_hSession, CURLINFO_APPCONNECT_TIME_T, &tls);
+  curl_easy_getinfo(m_hSession, CURLINFO_STARTTRANSFER_TIME_T, &first);
+  curl_easy_getinfo(m_hSession, CURLINFO_TOTAL_TIME_T, &total);
+  curl_easy_getinfo(m_hSession, CURLINFO_SIZE_DOWNLOAD_T, &wire);
+  curl_easy_getinfo(m_hSession, CURLINFO_NUM_CONNECTS, &connects);
+
+  timing.dns = microseconds(dns);
+  timing.connect = microseconds(std::max<curl_off_t>(connect - dns, 0));
+  timing.tls = microseconds(tls ? std::max<curl_off_t>(tls - connect, 0) : 0);
+  timing.firstByte = microseconds(first);
+  timing.total = microseconds(total);
+  timing.reused = connects == 0 && m_Response.status > 0;
+  timing.wireBytes = static_cast<size_t>(wire);
 #endif
 }
 
@@ -1015,11 +1455,24 @@ void HttpLib::EmitProcess()
 
 void HttpLib::EmitFinish(std::string message)
 {
+  ReportProxy();
+  if (RetryLater()) return;
+  ReadTiming();
 #ifdef _DEBUG
   std::cerr << "Httplib finished with meassage: <"
     << message << ">\n";
 #endif
   m_Finished = true;
+  m_HeadOnly = false;
+  HttpScheduler::Instance().Finish(this, message.empty() &&
+    m_Response.status >= 200 && m_Response.status < 400);
+  DropHedge();
+  if (auto error = CloseResume(message.empty() && (m_Response.status == 200 || m_Response.status == 206));
+    !error.empty() && message.empty())
+  {
+    message = std::move(error);
+  }
+  FinishCache(message.empty());
 #ifdef _WIN32
   if (m_hSession) {
     WinHttpSetStatusCallback(
@@ -1053,21 +1506,34 @@ HttpLib::Response* HttpLib::Get()
   m_Callback = &HttpLib::WriteString;
   m_DataBuffer = &m_Response.body;
 
-  HttpPerform();
+  m_CacheUsed = m_Cache.has_value();
+  if (!PrepareCache()) {
+    FinishCache(HttpPerform());
+  }
+  return &m_Response;
+}
+
+HttpLib::Response* HttpLib::Head()
+{
+  m_HeadOnly = true;
+  Get();
+  m_HeadOnly = false;
   return &m_Response;
 }
 
 HttpLib::Response* HttpLib::Get(const fs::path& path)
 {
-  std::ofstream stream(path, std::ios::binary | std::ios::out);
   m_Response.body.clear();
   m_Callback = &HttpLib::WriteFile;
-  if (!stream.is_open())
-    return 0;
-  m_DataBuffer = &stream;
+  m_DataBuffer = this;
+  PrepareResume(path);
 
-  HttpPerform();
-  stream.close();
+  auto const bResults = HttpPerform();
+  if (auto const error = CloseResume(bResults && (m_Response.status == 200 || m_Response.status == 206));
+    !error.empty())
+  {
+    std::cerr << error << '\n';
+  }
 
   return &m_Response;
 }
@@ -1108,23 +1574,32 @@ HttpLib::Awaiter HttpLib::GetAsync(Callback callback)
   m_Finished = false;
 
   m_Response.body.clear();
+  m_StartTime = {};
+  m_CacheUsed = m_Cache.has_value();
+  m_Replayable = !callback.onWrite;
+  m_RetryLeft = m_Retry.retries;
   m_AsyncCallback = std::move(callback);
   m_DataBuffer = new std::string;
 
   if (!m_AsyncCallback.onWrite) {
     m_WriteCallback = [this](const void* data, auto size){
       if (m_Finished) return false;
-      m_RecieveSize += size;
+      AddRecieveSize(size);
       m_Response.body.append((const char*)data, size);
       EmitProcess();
       return true;
     };
   } else {
-    auto cb = std::move(m_AsyncCallback.onWrite);
-    m_WriteCallback = [this, cb = std::move(cb)](auto data, auto size) {
+    // The callback stays in m_AsyncCallback, so that a reply from the cache
+    // can be played through it as well.
+    m_WriteCallback = [this](auto data, auto size) {
       if (m_Finished) return false;
-      m_RecieveSize += size;
-      cb(data, size);
+      AddRecieveSize(size);
+      if (m_CacheUsed) {
+        // Kept for the cache to store as well.
+        m_Response.body.append((const char*)data, size);
+      }
+      m_AsyncCallback.onWrite(data, size);
       EmitProcess();
       return true;
     };
@@ -1145,6 +1620,233 @@ HttpLib::Awaiter HttpLib::GetAsync(Callback callback)
   return Awaiter {this};
 }
 
+HttpLib::Awaiter HttpLib::GetAsync(fs::path path, Callback callback)
+{
+  if (!m_AsyncSet) {
+    return GetAsync(std::move(callback));
+  }
+
+  PrepareResume(std::move(path));
+  auto onWrite = std::move(callback.onWrite);
+  auto const replayable = !onWrite;
+  callback.onWrite = [onWrite = std::move(onWrite)](const void* data, size_t size) {
+    if (onWrite) onWrite(data, size);
+  };
+  auto awaiter = GetAsync(std::move(callback));
+  // The file before the caller; a failed write ends the transfer, as in Get.
+  m_WriteCallback = [this, write = std::move(m_WriteCallback)](const void* data, size_t size) {
+    return !m_Finished && WriteToFile(data, size) && write(data, size);
+  };
+  // A retry resumes from the disk, unless the caller has seen the bytes.
+  m_Replayable = replayable;
+  // Files are not cached; the ranges of a resume would not be whole bodies.
+  m_CacheUsed = false;
+  return awaiter;
+}
+
+HttpLib::Awaiter HttpLib::HeadAsync(Callback callback)
+{
+  m_HeadOnly = m_AsyncSet;
+  return GetAsync(std::move(callback));
+}
+
+static fs::path GetValidatorPath(fs::path path)
+{
+  path += ".etag";
+  return path;
+}
+
+void HttpLib::PrepareResume(fs::path path)
+{
+  m_FilePath = std::move(path);
+  m_ResumeFrom = 0;
+  m_Headers.erase(u8"Range");
+  m_Headers.erase(u8"If-Range");
+
+  std::error_code error;
+  auto const size = fs::file_size(m_FilePath, error);
+  if (error || size == 0) return;
+
+  std::ifstream file(GetValidatorPath(m_FilePath), std::ios::binary | std::ios::in);
+  std::string validator;
+  if (!file.is_open() || !std::getline(file, validator) || validator.empty()) return;
+
+  m_ResumeFrom = size;
+  auto const range = "bytes=" + std::to_string(size) + "-";
+  m_Headers[u8"Range"] = std::u8string(range.begin(), range.end());
+  m_Headers[u8"If-Range"] = std::u8string(validator.begin(), validator.end());
+}
+
+bool HttpLib::OpenResume()
+{
+  // Error responses must not clobber the partial file.
+  auto const status = m_Response.status;
+  if (status != 200 && status != 206) return true;
+
+  if (status == 206) {
+    // Content-Range: bytes <first>-<last>/<total>
+    auto const range = m_Response.FindHeader(u8"content-range");
+    auto const first = range.find_first_of(u8"0123456789");
+    size_t start = 0;
+    for (auto i = first; i < range.size() && u8'0' <= range[i] && range[i] <= u8'9'; ++i) {
+      start = start * 10 + (range[i] - u8'0');
+    }
+    if (!m_ResumeFrom || first == range.npos || start != m_ResumeFrom) {
+      std::cerr << "HttpLib Error: unexpected Content-Range.\n";
+      return false;
+    }
+  } else {
+    // The resource changed (If-Range failed) or the server ignores ranges.
+    m_ResumeFrom = 0;
+  }
+
+  // The size is reserved up front, but a partial file keeps its real length.
+  // The sink hashes on its own thread, the part from earlier attempts first.
+  if (!m_File.Open(m_FilePath, m_ResumeFrom, m_ConnectLength ? m_ResumeFrom + m_ConnectLength : 0,
+    false, m_Sha256 ? &m_Hash : nullptr))
+  {
+    std::cerr << "HttpLib Error: can not open file.\n";
+    return false;
+  }
+
+  // Only strong validators may be used with If-Range.
+  auto validator = m_Response.FindHeader(u8"etag");
+  if (validator.empty() || validator.starts_with(u8"W/")) {
+    validator = m_Response.FindHeader(u8"last-modified");
+  }
+  std::error_code error;
+  if (validator.empty()) {
+    fs::remove(GetValidatorPath(m_FilePath), error);
+  } else {
+    std::ofstream file(GetValidatorPath(m_FilePath), std::ios::binary | std::ios::out);
+    file.write(reinterpret_cast<const char*>(validator.data()), validator.size());
+  }
+
+  m_RecieveSize = m_ResumeFrom;
+  m_DecodedSize = m_ResumeFrom;
+  if (m_ConnectLength) {
+    m_ConnectLength += m_ResumeFrom;
+  }
+  return true;
+}
+
+bool HttpLib::WriteToFile(const void* data, size_t size)
+{
+  return m_File.Write(data, size);
+}
+
+std::string HttpLib::CloseResume(bool success)
+{
+  if (m_FilePath.empty()) return {};
+
+  // Sync only what is complete; a failed write may leave a hole.
+  auto const written = m_File.Close(success);
+  auto const corrupt = written && success && m_Sha256 && m_Hash.Finish() != *m_Sha256;
+  std::error_code error;
+  if (!written) {
+    fs::remove(GetValidatorPath(m_FilePath), error);
+  } else if (corrupt) {
+    // Nothing may read it, and the next attempt must not resume from it.
+    fs::remove(GetValidatorPath(m_FilePath), error);
+    fs::remove(m_FilePath, error);
+  } else if (success) {
+    fs::remove(GetValidatorPath(m_FilePath), error);
+  } else if (m_Response.status == 416) {
+    // Our partial file no longer matches the resource; start over next time.
+    fs::remove(GetValidatorPath(m_FilePath), error);
+    fs::remove(m_FilePath, error);
+  }
+  m_Headers.erase(u8"Range");
+  m_Headers.erase(u8"If-Range");
+  m_FilePath.clear();
+  m_ResumeFrom = 0;
+  if (!written) return "HttpLib Error: can not write file.";
+  if (corrupt) return "HttpLib Error: SHA-256 mismatch.";
+  return {};
+}
+
+void HttpLib::SetCache(fs::path directory, HttpCache::Mode mode)
+{
+  m_Cache.emplace(std::move(directory), mode);
+}
+
+bool HttpLib::PrepareCache()
+{
+  if (!m_CacheUsed) return false;
+  m_Headers.erase(u8"If-None-Match");
+  m_Headers.erase(u8"If-Modified-Since");
+
+  auto const url = m_Url.GetUrl(true);
+  Response cached;
+  if (!m_Cache->Load(url, cached)) return false;
+
+  if (m_Cache->GetMode() == HttpCache::Mode::StaleWhileRevalidate) {
+    // Hand out what we have and let a detached request refresh the entry
+    // for the next caller; it deletes itself when done. A hot entry gets
+    // one refresh at a time, not one per hit.
+    if (m_Cache->BeginRevalidate(url)) {
+      auto const clt = new HttpLib(m_Url, true, m_TimeOut);
+      clt->m_Headers = m_Headers;
+      clt->SetPriority(HttpScheduler::Priority::Background);
+      clt->SetCache(m_Cache->GetDirectory());
+      if (m_Http2) {
+        clt->SetHttp2(*m_Http2, m_Http2PriorKnowledge);
+      }
+      clt->GetAsync({ .onFinish = [clt, cache = *m_Cache, url](auto, auto) {
+        cache.EndRevalidate(url);
+        delete clt;
+      } });
+    }
+
+    m_CacheUsed = false;
+    m_Response = std::move(cached);
+    ReplayBody();
+    return true;
+  }
+
+  auto etag = cached.FindHeader(u8"etag");
+  if (!etag.empty()) {
+    m_Headers[u8"If-None-Match"] = std::move(etag);
+  }
+  auto modified = cached.FindHeader(u8"last-modified");
+  if (!modified.empty()) {
+    m_Headers[u8"If-Modified-Since"] = std::move(modified);
+  }
+  return false;
+}
+
+void HttpLib::ReplayBody()
+{
+  // A caller that streams the body gets the cached one the same way.
+  if (m_AsyncSet && m_AsyncCallback.onWrite && !m_Response.body.empty()) {
+    m_AsyncCallback.onWrite(m_Response.body.data(), m_Response.body.size());
+  }
+}
+
+void HttpLib::FinishCache(bool success)
+{
+  if (!m_CacheUsed) return;
+  m_CacheUsed = false;
+  m_Headers.erase(u8"If-None-Match");
+  m_Headers.erase(u8"If-Modified-Since");
+  if (!success) return;
+
+  auto const url = m_Url.GetUrl(true);
+  if (m_Response.status == 304) {
+    // Nothing was transferred, the stored entry is still current.
+    if (m_Cache->Load(url, m_Response)) {
+      ReplayBody();
+    }
+  } else if (m_Response.status == 200) {
+    m_Cache->Store(url, m_Response);
+  }
+}
+
+std::u8string HttpResponse::FindHeader(std::u8string_view name) const
+{
+  return std::u8string(headers.Find(name).value_or(std::u8string_view()));
+}
+
 void HttpLib::DoSuspend(std::coroutine_handle<> handle)
 {
   if (handle != nullptr) {
@@ -1161,6 +1863,11 @@ void HttpLib::DoSuspend(std::coroutine_handle<> handle)
     }
   }
 
+  if (PrepareCache()) {
+    EmitFinish();
+    return;
+  }
+
   bool init = m_hSession;
 #ifdef _WIN32
   init = init && m_hConnect; 
@@ -1173,15 +1880,221 @@ void HttpLib::DoSuspend(std::coroutine_handle<> handle)
     ExitAsync();
     return;
   }
-#ifdef _WIN32
-  HttpPerform();
-#elif defined (__linux__)
-  std::thread(&HttpLib::HttpPerform, this).detach();
-#endif
+  HttpScheduler::Instance().Submit(this);
 }
 
 void HttpLib::ExitAsync() {
+  {
+    // Neither a backoff timer nor a hedge may bring the request back.
+    Locker locker(m_AsyncMutex);
+    m_RetryLeft = 0;
+    m_RetryPending = false;
+    ++m_Attempt;
+  }
+  DropHedge();
+  // A request still waiting for a slot never reached the network.
+  [[maybe_unused]] auto const queued = HttpScheduler::Instance().Cancel(this);
+#ifdef _WIN32
   Locker locker(m_AsyncMutex);
+#elif defined (__linux__)
+  if (m_AsyncSet && !queued) {
+    HttpEngine::Instance().Remove(this);
+  }
+#endif
   m_Response.status = -1;
   EmitFinish("Httplib Error: User terminate.");
 }
+
+static std::optional<std::chrono::milliseconds> ParseRetryAfter(std::u8string_view value)
+{
+  if (value.empty()) return std::nullopt;
+
+  auto const first = reinterpret_cast<const char*>(value.data());
+  uint64_t seconds = 0;
+  auto const [last, error] = std::from_chars(first, first + value.size(), seconds);
+  if (error == std::errc() && last == first + value.size()) {
+    return std::chrono::seconds(std::min<uint64_t>(seconds, 24 * 3600));
+  }
+
+  // Otherwise an HTTP-date, e.g. "Wed, 21 Oct 2015 07:28:00 GMT".
+  std::tm tm {};
+  std::istringstream stream(std::string(value.begin(), value.end()));
+  stream.imbue(std::locale::classic());
+  stream >> std::get_time(&tm, "%a, %d %b %Y %H:%M:%S");
+  if (stream.fail()) return std::nullopt;
+#ifdef _WIN32
+  auto const time = _mkgmtime(&tm);
+#else
+  auto const time = timegm(&tm);
+#endif
+  auto const rest = std::chrono::system_clock::from_time_t(time) - std::chrono::system_clock::now();
+  return std::max(std::chrono::duration_cast<std::chrono::milliseconds>(rest), 0ms);
+}
+
+bool HttpLib::RetryLater()
+{
+  // Another proxy is tried at once, and that does not use up a retry.
+  auto const failover = m_ProxyFailed &&
+    HttpProxyResolver::Instance().Resolve(m_Url.GetScheme(), m_Url.GetHost()).proxy != m_Route.proxy;
+  if (!failover && m_RetryLeft <= 0) return false;
+
+  auto const status = m_Response.status;
+  auto const transient = failover || m_Retryable || status == 408 || status == 429 ||
+    status == 500 || status == 502 || status == 503 || status == 504;
+  if (!transient) return false;
+  if (HasBody() && !m_Retry.idempotent) return false;
+  if (m_Body && !m_Body->IsRewindable()) return false;
+  if (!m_Replayable && m_DecodedSize != 0) return false;
+
+  std::chrono::milliseconds delay = 0ms;
+  if (!failover) {
+    if (auto const retryAfter = ParseRetryAfter(m_Response.FindHeader(u8"retry-after"))) {
+      if (*retryAfter > m_Retry.maxDelay) return false;
+      delay = *retryAfter;
+    } else {
+      // Full jitter, so that clients failing together do not return together.
+      auto const attempt = std::min(m_Retry.retries - m_RetryLeft, 16);
+      auto const cap = std::min(m_Retry.backoff * (int64_t(1) << attempt), m_Retry.maxDelay);
+      static thread_local std::minstd_rand engine(std::random_device{}());
+      delay = std::chrono::milliseconds(
+        std::uniform_int_distribution<int64_t>(0, cap.count())(engine));
+    }
+    --m_RetryLeft;
+  }
+
+  DropHedge();
+  HttpScheduler::Instance().Finish(this);
+  if (!m_FilePath.empty()) {
+    // Carry on from whatever already reached the disk.
+    auto path = m_FilePath;
+    CloseResume(false);
+    PrepareResume(std::move(path));
+  }
+
+  Locker locker(m_AsyncMutex);
+  m_RetryPending = true;
+  HttpLimiter::Instance().Post(HttpLimiter::Clock::now() + delay, [id = m_AsyncId]() {
+    ResumeRetry(id);
+  });
+  return true;
+}
+
+void HttpLib::ResumeRetry(HttpId id)
+{
+  {
+    Locker locker(m_AsyncMutex);
+    auto const iter = m_AsyncPool.find(id);
+    if (iter == m_AsyncPool.end() || !iter->second->m_RetryPending)
+      return;
+    iter->second->m_RetryPending = false;
+    // Once queued, a request destroyed meanwhile is taken off by Cancel.
+    HttpScheduler::Instance().Enqueue(iter->second);
+  }
+  // A request failing at once runs its callbacks here, so not under the lock.
+  HttpScheduler::Instance().Dispatch();
+}
+
+void HttpLib::StartHedge()
+{
+  // Only a reply that is still entirely ours can be swapped for another.
+  // A streamed body has one read position and can not feed two requests.
+  if (m_Retry.hedgePercentile <= 0 || !m_Replayable || !m_FilePath.empty() || m_Body ||
+    (m_PostData.data && !m_Retry.idempotent))
+    return;
+
+  auto const latency = HttpScheduler::Instance().GetLatency(this, m_Retry.hedgePercentile);
+  if (!latency) return;
+
+  HttpLimiter::Instance().Post(HttpLimiter::Clock::now() + *latency,
+    [id = m_AsyncId, attempt = m_Attempt]() {
+      ResumeHedge(id, attempt);
+    });
+}
+
+void HttpLib::ResumeHedge(HttpId id, unsigned attempt)
+{
+  LockerEx locker(m_AsyncMutex);
+  auto iter = m_AsyncPool.find(id);
+  if (iter == m_AsyncPool.end()) return;
+  auto& object = *iter->second;
+  if (object.m_Finished || object.m_Attempt != attempt || object.m_Hedge) return;
+
+  auto url = object.m_Url;
+  auto headers = object.m_Headers;
+  auto const postData = object.m_PostData;
+  auto const timeOut = object.m_TimeOut;
+  auto const priority = object.m_Priority;
+  auto const redirect = object.m_RedirectLimit;
+  auto const http2 = object.m_Http2;
+  auto const priorKnowledge = object.m_Http2PriorKnowledge;
+  auto const headOnly = object.m_HeadOnly;
+  locker.unlock();
+
+  // The copy is started outside the lock, and finds the original again by
+  // id, so either one may be destroyed before the copy is handed over.
+  auto hedge = std::make_unique<HttpLib>(std::move(url), true, timeOut);
+  hedge->m_Headers = std::move(headers);
+  hedge->m_PostData = postData;
+  hedge->SetPriority(priority);
+  hedge->SetRedirect(redirect);
+  if (http2) {
+    hedge->SetHttp2(*http2, priorKnowledge);
+  }
+
+  Callback callback {
+    .onFinish = [id, clt = hedge.get()](std::string message, const Response*) {
+      OnHedgeFinish(id, clt, std::move(message));
+    },
+  };
+  if (headOnly) {
+    hedge->HeadAsync(std::move(callback));
+  } else {
+    hedge->GetAsync(std::move(callback));
+  }
+
+  // One that finished before it could be handed over has told no one.
+  locker.lock();
+  iter = m_AsyncPool.find(id);
+  if (iter != m_AsyncPool.end() && !iter->second->m_Finished &&
+    iter->second->m_Attempt == attempt && !iter->second->m_Hedge && !hedge->m_Finished)
+  {
+    iter->second->m_Hedge = std::move(hedge);
+  }
+  locker.unlock();
+  // Destroying a copy that was not handed over cancels it.
+  hedge.reset();
+}
+
+void HttpLib::OnHedgeFinish(HttpId id, const HttpLib* hedge, std::string message)
+{
+  LockerEx locker(m_AsyncMutex);
+  auto const iter = m_AsyncPool.find(id);
+  if (iter == m_AsyncPool.end()) return;
+  auto& object = *iter->second;
+  if (object.m_Finished || object.m_Hedge.get() != hedge) return;
+
+  // A failed copy changes nothing, the original is still under way.
+  auto const status = hedge->m_Response.status;
+  if (!message.empty() || status < 200 || status >= 400) return;
+  ++object.m_Attempt;
+  locker.unlock();
+
+  // The original waits for this callback before it can drop the copy.
+  if (!HttpScheduler::Instance().Cancel(&object)) {
+#ifdef __linux__
+    HttpEngine::Instance().Remove(&object);
+#endif
+  }
+  object.m_Response = std::move(object.m_Hedge->m_Response);
+  object.m_StartTime = {};   // the copy already timed its reply
+  object.EmitFinish();
+}
+
+void HttpLib::DropHedge()
+{
+  LockerEx locker(m_AsyncMutex);
+  auto hedge = std::move(m_Hedge);
+  locker.unlock();
+  // Destroying the copy cancels it and waits for its callbacks to return.
+  hedge.reset();
+}
@@ -0,0 +1,154 @@
+#include <neobox/httplimiter.h>
+
+#include <algorithm>
+
+HttpLimiter& HttpLimiter::Instance()
+{
+  static HttpLimiter limiter;
+  return limiter;
+}
+
+HttpLimiter::~HttpLimiter()
+{
+  {
+    Locker locker(m_Mutex);
+    m_Quit = true;
+    m_Tasks.clear();
+  }
+  m_Condition.notify_all();
+  if (m_Thread.joinable()) {
+    m_Thread.join();
+  }
+}
+
+void HttpLimiter::Bucket::Reset(double newRate, double newBurst)
+{
+  rate = newRate;
+  burst = newBurst;
+  tokens = newBurst;
+  last = Clock::now();
+}
+
+HttpLimiter::Duration HttpLimiter::Bucket::Wait(double count, Clock::time_point now)
+{
+  if (rate <= 0) return Duration::zero();
+
+  std::chrono::duration<double> const passed = now - last;
+  tokens = std::min(burst, tokens + passed.count() * rate);
+  last = now;
+
+  // A chunk bigger than the bucket goes once it is full and leaves a debt.
+  auto const need = std::min(count, burst);
+  if (tokens >= need) return Duration::zero();
+
+  auto const wait = std::chrono::duration<double>((need - tokens) / rate);
+  return std::max<Duration>(std::chrono::ceil<Duration>(wait), Duration(1));
+}
+
+void HttpLimiter::SetHostLimit(std::u8string host, double requestsPerSecond, size_t bytesPerSecond)
+{
+  Locker locker(m_Mutex);
+  if (requestsPerSecond <= 0 && bytesPerSecond == 0) {
+    m_Hosts.erase(host);
+  } else {
+    auto& limit = m_Hosts[std::move(host)];
+    // One request at a time: a rate is a spacing, not a burst allowance.
+    limit.requests.Reset(std::max(requestsPerSecond, 0.0), 1);
+    limit.bytes.Reset(static_cast<double>(bytesPerSecond), static_cast<double>(bytesPerSecond));
+  }
+  UpdateActive();
+}
+
+void HttpLimiter::SetGlobalBandwidth(size_t bytesPerSecond)
+{
+  Locker locker(m_Mutex);
+  m_Global.Reset(static_cast<double>(bytesPerSecond), static_cast<double>(bytesPerSecond));
+  UpdateActive();
+}
+
+void HttpLimiter::SetBackgroundBandwidth(size_t bytesPerSecond)
+{
+  Locker locker(m_Mutex);
+  m_Background.Reset(static_cast<double>(bytesPerSecond), static_cast<double>(bytesPerSecond));
+  UpdateActive();
+}
+
+void HttpLimiter::UpdateActive()
+{
+  m_Active = !m_Hosts.empty() || m_Global.rate > 0 || m_Background.rate > 0;
+}
+
+HttpLimiter::Duration HttpLimiter::AcquireRequest(const std::u8string& host)
+{
+  if (!m_Active) return Duration::zero();
+
+  Locker locker(m_Mutex);
+  auto const iter = m_Hosts.find(host);
+  if (iter == m_Hosts.end()) return Duration::zero();
+
+  auto& bucket = iter->second.requests;
+  auto const wait = bucket.Wait(1, Clock::now());
+  if (wait == Duration::zero()) {
+    bucket.Take(1);
+  }
+  return wait;
+}
+
+HttpLimiter::Duration HttpLimiter::AcquireBytes(const std::u8string& host, size_t size, bool background)
+{
+  if (!m_Active || size == 0) return Duration::zero();
+
+  Locker locker(m_Mutex);
+  auto const now = Clock::now();
+  auto const count = static_cast<double>(size);
+  auto const iter = m_Hosts.find(host);
+  auto const hostBucket = iter == m_Hosts.end() ? nullptr : &iter->second.bytes;
+
+  // Take from every bucket or from none, or a slow host would drain the
+  // global allowance while it waits.
+  auto wait = m_Global.Wait(count, now);
+  if (hostBucket) wait = std::max(wait, hostBucket->Wait(count, now));
+  if (background) wait = std::max(wait, m_Background.Wait(count, now));
+  if (wait != Duration::zero()) return wait;
+
+  m_Global.Take(count);
+  if (hostBucket) hostBucket->Take(count);
+  if (background) m_Background.Take(count);
+  return wait;
+}
+
+void HttpLimiter::Post(Clock::time_point when, std::function<void()> task)
+{
+  {
+    Locker locker(m_Mutex);
+    if (m_Quit) return;
+    m_Tasks.emplace(when, std::move(task));
+    if (!m_Thread.joinable()) {
+      m_Thread = std::thread(&HttpLimiter::Run, this);
+    }
+  }
+  m_Condition.notify_all();
+}
+
+void HttpLimiter::Run()
+{
+  LockerEx locker(m_Mutex);
+  while (!m_Quit) {
+    if (m_Tasks.empty()) {
+      m_Condition.wait(locker);
+      continue;
+    }
+    auto const first = m_Tasks.begin();
+    if (auto const when = first->first; when > Clock::now()) {
+      // A copy: the node may be gone by the time the wait looks at it again.
+      m_Condition.wait_until(locker, when);
+      continue;
+    }
+
+    auto task = std::move(first->second);
+    m_Tasks.erase(first);
+    locker.unlock();
+    task();
+    locker.lock();
+  }
+}
@@ -0,0 +1,236 @@
+#include <neobox/httpmonitor.h>
+#include <neobox/httplib.h>
+#include <neobox/httplimiter.h>
+
+#ifdef _WIN32
+#include <winsock2.h>
+#include <windows.h>
+#include <iphlpapi.h>
+#else
+#include <ifaddrs.h>
+#include <linux/netlink.h>
+#include <linux/rtnetlink.h>
+#include <net/if.h>
+#include <netinet/in.h>
+#include <poll.h>
+#include <sys/eventfd.h>
+#include <sys/socket.h>
+#include <unistd.h>
+#include <cerrno>
+#endif
+
+#include <iostream>
+
+using namespace std::literals;
+
+HttpMonitor& HttpMonitor::Instance()
+{
+  static HttpMonitor monitor;
+  return monitor;
+}
+
+HttpMonitor::HttpMonitor()
+  : m_Probe(std::make_unique<HttpLib>(HttpUrl(u8"https://www.baidu.com"sv), false, 3s))
+  , m_Online(HasInterface())
+  , m_NextProbe(Clock::now())
+{
+  HttpLimiter::Instance();
+
+#ifdef _WIN32
+  HANDLE handle = nullptr;
+  auto const error = NotifyIpInterfaceChange(AF_UNSPEC,
+    [](PVOID context, PMIB_IPINTERFACE_ROW, MIB_NOTIFICATION_TYPE) {
+      reinterpret_cast<HttpMonitor*>(context)->OnNetworkChange();
+    }, this, FALSE, &handle);
+  if (error == NO_ERROR) {
+    m_hNotify = handle;
+  } else {
+    std::cerr << "HttpMonitor Error: " << error << " in NotifyIpInterfaceChange.\n";
+  }
+#else
+  m_Netlink = socket(AF_NETLINK, SOCK_RAW | SOCK_NONBLOCK | SOCK_CLOEXEC, NETLINK_ROUTE);
+  m_Event = eventfd(0, EFD_NONBLOCK | EFD_CLOEXEC);
+
+  sockaddr_nl address {};
+  address.nl_family = AF_NETLINK;
+  address.nl_groups = RTMGRP_LINK | RTMGRP_IPV4_IFADDR | RTMGRP_IPV6_IFADDR |
+    RTMGRP_IPV4_ROUTE | RTMGRP_IPV6_ROUTE;
+  if (m_Netlink < 0 || m_Event < 0 ||
+    bind(m_Netlink, reinterpret_cast<sockaddr*>(&address), sizeof(address)) != 0)
+  {
+    // Without netlink we still probe on schedule, only later.
+    std::cerr << "HttpMonitor Error: " << errno << " in netlink bind.\n";
+  } else {
+    m_Watcher = std::thread(&HttpMonitor::Watch, this);
+  }
+#endif
+  m_Thread = std::thread(&HttpMonitor::Run, this);
+}
+
+HttpMonitor::~HttpMonitor()
+{
+#ifdef _WIN32
+  if (m_hNotify) {
+    // Returns once no callback is running any more.
+    CancelMibChangeNotify2(m_hNotify);
+  }
+#else
+  if (m_Event >= 0) {
+    const uint64_t value = 1;
+    [[maybe_unused]] auto ret = write(m_Event, &value, sizeof(value));
+  }
+  if (m_Watcher.joinable()) {
+    m_Watcher.join();
+  }
+  if (m_Netlink >= 0) close(m_Netlink);
+  if (m_Event >= 0) close(m_Event);
+#endif
+
+  {
+    Locker locker(m_Mutex);
+    m_Quit = true;
+  }
+  m_Condition.notify_all();
+  if (m_Thread.joinable()) {
+    m_Thread.join();
+  }
+}
+
+void HttpMonitor::Refresh()
+{
+  {
+    Locker locker(m_Mutex);
+    m_NextProbe = Clock::now();
+    ++m_Changes;
+  }
+  m_Condition.notify_all();
+}
+
+void HttpMonitor::SetProbeInterval(std::chrono::seconds interval)
+{
+  {
+    Locker locker(m_Mutex);
+    m_Interval = std::max(interval, 1s);
+    m_NextProbe = std::min(m_NextProbe, Clock::now() + m_Interval);
+  }
+  m_Condition.notify_all();
+}
+
+void HttpMonitor::OnNetworkChange()
+{
+  // Losing the last interface needs no probe to be believed.
+  if (!HasInterface()) {
+    m_Online = false;
+  }
+
+  {
+    // Changes come in bursts (link, address, routes), probe once they settle.
+    Locker locker(m_Mutex);
+    m_NextProbe = std::min(m_NextProbe, Clock::now() + 1s);
+    ++m_Changes;
+  }
+  m_Condition.notify_all();
+}
+
+bool HttpMonitor::HasInterface()
+{
+#ifdef _WIN32
+  BOOL bResult = FALSE;
+  DWORD flags;
+  typedef BOOL(* pInternetGetConnectedState)(LPDWORD, DWORD*);
+
+  HMODULE hWininet = LoadLibraryW(L"Wininet.dll");
+  if (hWininet) {
+    void* const pTemp = reinterpret_cast<void*>(GetProcAddress(hWininet, "InternetGetConnectedState"));
+
+    auto const InternetGetConnectedState = reinterpret_cast<pInternetGetConnectedState>(pTemp);
+    if (InternetGetConnectedState) {
+      bResult = InternetGetConnectedState(&flags, 0);
+    }
+    FreeLibrary(hWininet);
+  }
+  return bResult;
+#else
+  ifaddrs* list = nullptr;
+  if (getifaddrs(&list) != 0) return true;
+
+  bool result = false;
+  for (auto item = list; item && !result; item = item->ifa_next) {
+    if (!item->ifa_addr || (item->ifa_flags & IFF_LOOPBACK) ||
+      !(item->ifa_flags & IFF_UP) || !(item->ifa_flags & IFF_RUNNING))
+      continue;
+    auto const family = item->ifa_addr->sa_family;
+    if (family == AF_INET) {
+      result = true;
+    } else if (family == AF_INET6) {
+      // A link-local address alone does not get us anywhere.
+      auto const& address = reinterpret_cast<sockaddr_in6*>(item->ifa_addr)->sin6_addr;
+      result = !IN6_IS_ADDR_LINKLOCAL(&address);
+    }
+  }
+  freeifaddrs(list);
+  return result;
+#endif
+}
+
+bool HttpMonitor::Probe()
+{
+  // Set up again each time to pick up proxy changes; the handle pool still
+  // hands back the warm connection.
+  m_Probe->SetUrl(HttpUrl(u8"https://www.baidu.com"sv));
+  auto const res = m_Probe->Head();
+  return res && res->status >= 200 && res->status < 400;
+}
+
+void HttpMonitor::Run()
+{
+  LockerEx locker(m_Mutex);
+  while (!m_Quit) {
+    if (Clock::now() < m_NextProbe) {
+      m_Condition.wait_until(locker, m_NextProbe);
+      continue;
+    }
+
+    auto const changes = m_Changes;
+    locker.unlock();
+    auto const online = HasInterface() && Probe();
+    locker.lock();
+
+    if (changes != m_Changes) {
+      // The network moved under the probe, its answer is stale.
+      m_NextProbe = std::min(m_NextProbe, Clock::now() + 1s);
+      continue;
+    }
+    m_Online = online;
+    // Look again sooner while offline, to notice the network coming back.
+    m_NextProbe = Clock::now() + (online ? m_Interval : std::min<std::chrono::seconds>(m_Interval, 10s));
+  }
+}
+
+#ifndef _WIN32
+void HttpMonitor::Watch()
+{
+  pollfd fds[] {
+    { .fd = m_Netlink, .events = POLLIN, .revents = 0 },
+    { .fd = m_Event, .events = POLLIN, .revents = 0 },
+  };
+
+  for (char buffer[8192]; ; ) {
+    if (poll(fds, 2, -1) < 0) {
+      if (errno == EINTR) continue;
+      std::cerr << "HttpMonitor Error: " << errno << " in poll.\n";
+      break;
+    }
+    if (fds[1].revents) break;
+
+    bool changed = false;
+    while (recv(m_Netlink, buffer, sizeof(buffer), 0) > 0) {
+      changed = true;
+    }
+    // ENOBUFS means we missed some, which is a change all the same.
+    if (changed || errno == ENOBUFS) {
+      OnNetworkChange();
+    }
+  }
+}
+#endif
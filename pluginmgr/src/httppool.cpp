@@ -0,0 +1,128 @@
+#ifdef __linux__
+
+#include <neobox/httppool.h>
+
+#include <curl/curl.h>
+
+HttpPool& HttpPool::Instance()
+{
+  static HttpPool pool;
+  return pool;
+}
+
+HttpPool::~HttpPool()
+{
+  Clear();
+}
+
+void* HttpPool::Acquire(const std::u8string& key)
+{
+  Locker locker(m_Mutex);
+  Evict(Clock::now());
+
+  auto const iter = m_Idle.find(key);
+  if (iter != m_Idle.end() && !iter->second.empty()) {
+    // The most recently released handle has the freshest connection.
+    auto const handle = iter->second.back().handle;
+    iter->second.pop_back();
+    ++m_Stats.hits;
+    return handle;
+  }
+
+  ++m_Stats.misses;
+  return curl_easy_init();
+}
+
+void HttpPool::Release(const std::u8string& key, void* handle)
+{
+  if (!handle) return;
+
+  // Forget every option and callback of the previous owner, but keep the
+  // live connections, DNS and TLS session caches of the handle.
+  curl_easy_reset(handle);
+
+  Locker locker(m_Mutex);
+  auto const now = Clock::now();
+  auto& entries = m_Idle[key];
+  entries.push_back({ handle, now });
+  Evict(now);
+}
+
+void HttpPool::Record(void* handle)
+{
+  long connects = 0;
+  if (curl_easy_getinfo(handle, CURLINFO_NUM_CONNECTS, &connects) != CURLE_OK)
+    return;
+
+  Locker locker(m_Mutex);
+  if (connects) {
+    ++m_Stats.connects;
+  } else {
+    ++m_Stats.reused;
+  }
+}
+
+void HttpPool::Evict(Clock::time_point now)
+{
+  for (auto iter = m_Idle.begin(); iter != m_Idle.end(); ) {
+    auto& entries = iter->second;
+    // Entries are ordered by release time, the oldest first.
+    size_t expired = 0;
+    while (expired < entries.size() && now - entries[expired].since >= m_IdleTimeout) {
+      ++expired;
+    }
+    if (entries.size() - expired > m_MaxIdle) {
+      expired = entries.size() - m_MaxIdle;
+    }
+    for (size_t i = 0; i < expired; ++i) {
+      curl_easy_cleanup(entries[i].handle);
+    }
+    m_Stats.evictions += expired;
+    entries.erase(entries.begin(), entries.begin() + expired);
+
+    if (entries.empty()) {
+      iter = m_Idle.erase(iter);
+    } else {
+      ++iter;
+    }
+  }
+}
+
+void HttpPool::Clear()
+{
+  Locker locker(m_Mutex);
+  for (auto& [key, entries]: m_Idle) {
+    for (auto& entry: entries) {
+      curl_easy_cleanup(entry.handle);
+    }
+  }
+  m_Idle.clear();
+}
+
+HttpPool::Stats HttpPool::GetStats() const
+{
+  Locker locker(m_Mutex);
+  return m_Stats;
+}
+
+void HttpPool::SetIdleTimeout(std::chrono::seconds timeout)
+{
+  Locker locker(m_Mutex);
+  m_IdleTimeout = timeout;
+  Evict(Clock::now());
+}
+
+std::chrono::seconds HttpPool::GetIdleTimeout() const
+{
+  Locker locker(m_Mutex);
+  return m_IdleTimeout;
+}
+
+void HttpPool::SetMaxIdle(size_t count)
+{
+  Locker locker(m_Mutex);
+  m_MaxIdle = count;
+  Evict(Clock::now());
+}
+
+#endif  // __linux__
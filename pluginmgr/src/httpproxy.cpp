@@ -5,6 +5,21 @@
 #include <neobox/systemapi.h>
 #include <neobox/unicode.h>
 static const wchar_t regProxyPath[] = LR"(Software\Microsoft\Windows\CurrentVersion\Internet Settings)";
+#else
+#include <cstdlib>
+#endif
+
+// Intranet addresses never go through the proxy unless told otherwise.
+static const char8_t defaultBypass[] = u8"<local>;10.0.0.0/8;172.16.0.0/12;192.168.0.0/16";
+
+#ifdef __linux__
+static std::u8string GetEnvironment(const char* upper, const char* lower)
+{
+  auto str = std::getenv(upper);
+  if (!str || !*str) str = std::getenv(lower);
+  if (!str) return {};
+  return reinterpret_cast<const char8_t*>(str);
+}
 #endif
 
 HttpProxy::HttpProxy(YJson& settings)
@@ -25,6 +40,11 @@ YJson& HttpProxy::InitSettings(YJson& settings)
   if (!proxy.isString()) {
     proxy = GetSystemProxy();
   }
+  auto& bypass = settings[u8"Bypass"];
+  if (!bypass.isString()) {
+    auto system = GetSystemBypass();
+    bypass = system.empty() ? defaultBypass : system;
+  }
   return settings;
 }
 
@@ -33,9 +53,30 @@ std::u8string HttpProxy::GetSystemProxy()
 #ifdef _WIN32
   return Wide2Utf8(RegReadString(HKEY_CURRENT_USER, regProxyPath, L"ProxyServer"));
 #else
-  auto const str = reinterpret_cast<const char8_t*>(std::getenv("HTTP_PROXY"));
-  if (!str) return {};
-  return str;
+  auto proxy = GetEnvironment("HTTP_PROXY", "http_proxy");
+  auto secure = GetEnvironment("HTTPS_PROXY", "https_proxy");
+  if (secure.empty() || secure == proxy) return proxy;
+  if (proxy.empty()) return u8"https=" + secure;
+  // Same shape as the Windows setting, so each scheme gets its own.
+  return u8"http=" + proxy + u8";https=" + secure;
+#endif
+}
+
+std::u8string HttpProxy::GetSystemBypass()
+{
+#ifdef _WIN32
+  return Wide2Utf8(RegReadString(HKEY_CURRENT_USER, regProxyPath, L"ProxyOverride"));
+#else
+  return GetEnvironment("NO_PROXY", "no_proxy");
+#endif
+}
+
+std::u8string HttpProxy::GetSystemPacUrl()
+{
+#ifdef _WIN32
+  return Wide2Utf8(RegReadString(HKEY_CURRENT_USER, regProxyPath, L"AutoConfigURL"));
+#else
+  return {};
 #endif
 }
 
@@ -44,8 +85,7 @@ bool HttpProxy::IsSystemProxy()
 #ifdef _WIN32
   return RegReadValue(HKEY_CURRENT_USER, regProxyPath, L"ProxyEnable");
 #else
-  auto const str = reinterpret_cast<const char8_t*>(std::getenv("HTTP_PROXY"));
-  return str;
+  return !GetSystemProxy().empty();
 #endif
 }
 
@@ -61,4 +101,30 @@ void HttpProxy::UpdateSystemProxy()
   m_Username.clear();
   m_Password.clear();
   m_Proxy = GetSystemProxy();
+}
+
+HttpProxyResolver::Config HttpProxy::GetResolverConfig() const
+{
+  HttpProxyResolver::Config config;
+  switch (static_cast<Type>(GetType())) {
+  case Type::System:
+    config.proxies = GetSystemProxy();
+    config.bypass = GetSystemBypass();
+    config.pacUrl = GetSystemPacUrl();
+    config.enabled = IsSystemProxy() || !config.pacUrl.empty();
+    if (config.bypass.empty()) config.bypass = defaultBypass;
+    break;
+  case Type::User: {
+    Locker locker(m_Mutex);
+    config.proxies = m_Proxy;
+    config.bypass = m_Bypass;
+    config.username = m_Username;
+    config.password = m_Password;
+    config.enabled = !m_Proxy.empty();
+    break;
+  }
+  default:
+    break;
+  }
+  return config;
 }
\ No newline at end of file
@@ -0,0 +1,352 @@
+#include <neobox/httpproxyresolver.h>
+
+#ifdef _WIN32
+#include <neobox/unicode.h>
+#include <windows.h>
+#include <winhttp.h>
+#endif
+
+#include <algorithm>
+#include <charconv>
+#include <iostream>
+#include <optional>
+
+using namespace std::literals;
+
+static constexpr char8_t ToLower(char8_t c)
+{
+  return u8'A' <= c && c <= u8'Z' ? c + (u8'a' - u8'A') : c;
+}
+
+static bool EqualsNoCase(std::u8string_view a, std::u8string_view b)
+{
+  return a.size() == b.size() && std::equal(a.begin(), a.end(), b.begin(),
+    [](char8_t x, char8_t y) { return ToLower(x) == ToLower(y); });
+}
+
+static bool EndsWithNoCase(std::u8string_view text, std::u8string_view suffix)
+{
+  return text.size() >= suffix.size() && EqualsNoCase(text.substr(text.size() - suffix.size()), suffix);
+}
+
+static std::u8string_view Trim(std::u8string_view text)
+{
+  auto const first = text.find_first_not_of(u8" \t\r\n");
+  if (first == text.npos) return {};
+  auto const last = text.find_last_not_of(u8" \t\r\n");
+  return text.substr(first, last + 1 - first);
+}
+
+// Calls f for each item of a list split by any of the separators.
+template<typename Function>
+static void ForEachItem(std::u8string_view text, std::u8string_view separators, Function f)
+{
+  while (!text.empty()) {
+    auto const end = text.find_first_of(separators);
+    auto const item = Trim(text.substr(0, end));
+    if (!item.empty()) f(item);
+    text.remove_prefix(end == text.npos ? text.size() : end + 1);
+  }
+}
+
+static std::optional<uint32_t> ParseIpv4(std::u8string_view text)
+{
+  uint32_t address = 0;
+  auto first = reinterpret_cast<const char*>(text.data());
+  auto const last = first + text.size();
+  for (int i = 0; i != 4; ++i) {
+    unsigned octet = 256;
+    auto const [next, error] = std::from_chars(first, last, octet);
+    if (error != std::errc() || octet > 255) return std::nullopt;
+    address = address << 8 | octet;
+    first = next;
+    if (i != 3) {
+      if (first == last || *first != '.') return std::nullopt;
+      ++first;
+    }
+  }
+  if (first != last) return std::nullopt;
+  return address;
+}
+
+// "*" matches any run of characters, case is ignored.
+static bool GlobMatch(std::u8string_view pattern, std::u8string_view text)
+{
+  size_t p = 0, t = 0, star = pattern.npos, mark = 0;
+  while (t != text.size()) {
+    if (p != pattern.size() && pattern[p] == u8'*') {
+      star = p++;
+      mark = t;
+    } else if (p != pattern.size() && ToLower(pattern[p]) == ToLower(text[t])) {
+      ++p;
+      ++t;
+    } else if (star != pattern.npos) {
+      p = star + 1;
+      t = ++mark;
+    } else {
+      return false;
+    }
+  }
+  while (p != pattern.size() && pattern[p] == u8'*') ++p;
+  return p == pattern.size();
+}
+
+static bool IsLoopback(std::u8string_view host)
+{
+  if (EqualsNoCase(host, u8"localhost") || EndsWithNoCase(host, u8".localhost") || host == u8"::1")
+    return true;
+  auto const address = ParseIpv4(host);
+  return address && (*address >> 24) == 127;
+}
+
+static bool MatchBypass(std::u8string_view pattern, std::u8string_view host)
+{
+  if (pattern == u8"*") return true;
+  if (EqualsNoCase(pattern, u8"<local>")) {
+    return host.find_first_of(u8".:") == host.npos;
+  }
+  if (auto const slash = pattern.find(u8'/'); slash != pattern.npos) {
+    auto const network = ParseIpv4(pattern.substr(0, slash));
+    auto const address = ParseIpv4(host);
+    unsigned bits = 33;
+    auto const digits = pattern.substr(slash + 1);
+    auto const first = reinterpret_cast<const char*>(digits.data());
+    std::from_chars(first, first + digits.size(), bits);
+    if (!network || !address || bits > 32) return false;
+    auto const mask = bits ? ~uint32_t(0) << (32 - bits) : 0;
+    return (*network & mask) == (*address & mask);
+  }
+  if (pattern.find(u8'*') != pattern.npos) {
+    return GlobMatch(pattern, host);
+  }
+  // ".example.com" and "example.com" both cover the domain and below.
+  if (pattern.front() == u8'.') pattern.remove_prefix(1);
+  return EqualsNoCase(host, pattern) ||
+    (host.size() > pattern.size() && host[host.size() - pattern.size() - 1] == u8'.' &&
+     EndsWithNoCase(host, pattern));
+}
+
+HttpProxyResolver& HttpProxyResolver::Instance()
+{
+  static HttpProxyResolver resolver;
+  return resolver;
+}
+
+void HttpProxyResolver::SetSource(std::function<Config()> source)
+{
+  Locker locker(m_Mutex);
+  m_Source = std::move(source);
+  m_ConfigExpiry = {};
+  m_Decisions.clear();
+}
+
+void HttpProxyResolver::Invalidate()
+{
+  Locker locker(m_Mutex);
+  m_ConfigExpiry = {};
+  m_Decisions.clear();
+  m_Health.clear();
+}
+
+void HttpProxyResolver::Refresh(Clock::time_point now)
+{
+  if (now < m_ConfigExpiry) return;
+  m_ConfigExpiry = now + ConfigTtl;
+
+  auto config = m_Source ? m_Source() : Config {};
+  auto const same = config.enabled == m_Config.enabled && config.proxies == m_Config.proxies &&
+    config.bypass == m_Config.bypass && config.pacUrl == m_Config.pacUrl;
+  m_Config = std::move(config);
+  if (same) return;
+  m_Proxies = ParseProxies(m_Config.proxies);
+  m_Decisions.clear();
+}
+
+HttpProxyResolver::Route HttpProxyResolver::Resolve(std::u8string_view scheme, std::u8string_view host)
+{
+  auto const now = Clock::now();
+  std::u8string key;
+  Config config;
+  std::vector<std::u8string> proxies;
+  {
+    Locker locker(m_Mutex);
+    Refresh(now);
+    if (!m_Config.enabled) return {};
+
+    key.reserve(scheme.size() + 3 + host.size());
+    key.append(scheme).append(u8"://").append(host);
+    auto const iter = m_Decisions.find(key);
+    if (iter == m_Decisions.end() || iter->second.expiry <= now) {
+      config = m_Config;
+      proxies = m_Proxies;
+    } else {
+      return Pick(iter->second.candidates, now);
+    }
+  }
+
+  // Outside the lock: a PAC script may have to be downloaded first.
+  auto candidates = Decide(config, proxies, scheme, host);
+
+  Locker locker(m_Mutex);
+  if (m_Decisions.size() >= MaxDecisions) {
+    m_Decisions.clear();
+  }
+  auto& decision = m_Decisions[key];
+  decision.candidates = std::move(candidates);
+  decision.expiry = now + DecisionTtl;
+  return Pick(decision.candidates, now);
+}
+
+HttpProxyResolver::Route HttpProxyResolver::Pick(const std::vector<std::u8string>& candidates,
+  Clock::time_point now) const
+{
+  // The first one that is not known to be down; if all are, the first one.
+  auto iter = std::find_if(candidates.begin(), candidates.end(), [&](const std::u8string& proxy) {
+    auto const health = m_Health.find(proxy);
+    return health == m_Health.end() || health->second.until <= now;
+  });
+  if (iter == candidates.end()) iter = candidates.begin();
+  if (iter == candidates.end() || iter->empty()) return {};
+  return { *iter, m_Config.username, m_Config.password };
+}
+
+void HttpProxyResolver::ReportFailure(std::u8string_view proxy)
+{
+  if (proxy.empty()) return;
+  Locker locker(m_Mutex);
+  auto iter = m_Health.find(proxy);
+  if (iter == m_Health.end()) {
+    iter = m_Health.emplace(std::u8string(proxy), Health {}).first;
+  }
+  auto& health = iter->second;
+  health.failures = std::min(health.failures + 1, 8u);
+  // 15s, 30s, 1min, ... up to about half an hour.
+  health.until = Clock::now() + std::chrono::seconds(15) * (1 << (health.failures - 1));
+}
+
+void HttpProxyResolver::ReportSuccess(std::u8string_view proxy)
+{
+  if (proxy.empty()) return;
+  Locker locker(m_Mutex);
+  auto const iter = m_Health.find(proxy);
+  if (iter != m_Health.end()) m_Health.erase(iter);
+}
+
+std::vector<std::u8string> HttpProxyResolver::ParseProxies(std::u8string_view text)
+{
+  std::vector<std::u8string> result;
+  ForEachItem(text, u8";,", [&result](std::u8string_view item) {
+    // Windows keeps "http=host:port;https=host:port", the tag stays so
+    // that Decide can keep those of the right scheme.
+    std::u8string tag;
+    if (auto const equal = item.find(u8'='); equal != item.npos && item.find(u8"://") == item.npos) {
+      tag.assign(item.substr(0, equal + 1));
+      item = Trim(item.substr(equal + 1));
+    }
+
+    std::u8string_view address = item;
+    std::u8string_view scheme = u8"http://";
+    if (auto const space = item.find_first_of(u8" \t"); space != item.npos) {
+      auto const keyword = item.substr(0, space);
+      address = Trim(item.substr(space));
+      if (EqualsNoCase(keyword, u8"PROXY") || EqualsNoCase(keyword, u8"HTTP")) scheme = u8"http://";
+      else if (EqualsNoCase(keyword, u8"HTTPS")) scheme = u8"https://";
+      else if (EqualsNoCase(keyword, u8"SOCKS5")) scheme = u8"socks5h://";
+      else if (EqualsNoCase(keyword, u8"SOCKS") || EqualsNoCase(keyword, u8"SOCKS4")) scheme = u8"socks4a://";
+      else return;
+    } else if (EqualsNoCase(item, u8"DIRECT")) {
+      result.push_back(tag);
+      return;
+    } else if (item.find(u8"://") != item.npos) {
+      scheme = {};
+    } else if (EqualsNoCase(tag, u8"socks=")) {
+      scheme = u8"socks4a://";
+    }
+    result.push_back(tag + std::u8string(scheme) + std::u8string(address));
+  });
+  return result;
+}
+
+bool HttpProxyResolver::IsBypassed(std::u8string_view bypass, std::u8string_view host)
+{
+  if (host.size() > 2 && host.front() == u8'[' && host.back() == u8']') {
+    host = host.substr(1, host.size() - 2);
+  }
+  if (IsLoopback(host)) return true;
+
+  bool bypassed = false;
+  ForEachItem(bypass, u8",; \t", [&](std::u8string_view pattern) {
+    bypassed = bypassed || MatchBypass(pattern, host);
+  });
+  return bypassed;
+}
+
+#ifdef _WIN32
+// Asks WinHTTP to run the PAC script, which it downloads and caches.
+static std::optional<std::u8string> RunPacScript(std::u8string_view pacUrl,
+  std::u8string_view scheme, std::u8string_view host)
+{
+  static HINTERNET const session = WinHttpOpen(L"WinHTTP in Neobox/1.0",
+    WINHTTP_ACCESS_TYPE_NO_PROXY, WINHTTP_NO_PROXY_NAME, WINHTTP_NO_PROXY_BYPASS, 0);
+  if (!session) return std::nullopt;
+
+  auto const script = Utf82Wide(pacUrl);
+  std::u8string url(scheme);
+  url.append(u8"://").append(host).push_back(u8'/');
+
+  WINHTTP_AUTOPROXY_OPTIONS options {};
+  options.dwFlags = WINHTTP_AUTOPROXY_CONFIG_URL;
+  options.lpszAutoConfigUrl = script.c_str();
+  options.fAutoLogonIfChallenged = TRUE;
+  WINHTTP_PROXY_INFO info {};
+  if (!WinHttpGetProxyForUrl(session, Utf82Wide(url).c_str(), &options, &info)) {
+    std::cerr << "HttpProxyResolver Error: " << GetLastError() << " in WinHttpGetProxyForUrl.\n";
+    return std::nullopt;
+  }
+
+  std::u8string result = u8"DIRECT";
+  if (info.dwAccessType == WINHTTP_ACCESS_TYPE_NAMED_PROXY && info.lpszProxy) {
+    result = Wide2Utf8(info.lpszProxy);
+  }
+  if (info.lpszProxy) GlobalFree(info.lpszProxy);
+  if (info.lpszProxyBypass) GlobalFree(info.lpszProxyBypass);
+  return result;
+}
+#endif
+
+std::vector<std::u8string> HttpProxyResolver::Decide(const Config& config,
+  const std::vector<std::u8string>& proxies, std::u8string_view scheme, std::u8string_view host)
+{
+  if (IsBypassed(config.bypass, host)) return { {} };
+
+  auto list = proxies;
+  if (!config.pacUrl.empty()) {
+#ifdef _WIN32
+    if (auto const result = RunPacScript(config.pacUrl, scheme, host)) {
+      list = ParseProxies(*result);
+    }
+#else
+    // There is no script engine here, the PAC file is left to the system.
+    static bool const warned [[maybe_unused]] = (std::cerr <<
+      "HttpProxyResolver Error: PAC scripts are only supported on Windows.\n", true);
+#endif
+  }
+
+  std::vector<std::u8string> candidates;
+  for (auto& proxy: list) {
+    std::u8string_view address = proxy;
+    if (auto const equal = address.find(u8'='); equal != address.npos && address.find(u8"://") > equal) {
+      // Tagged by scheme; Windows "socks=" serves every scheme.
+      auto const tag = address.substr(0, equal);
+      if (!EqualsNoCase(tag, scheme) && !EqualsNoCase(tag, u8"socks")) continue;
+      address.remove_prefix(equal + 1);
+    }
+#ifdef _WIN32
+    // WinHTTP can not talk to SOCKS proxies.
+    if (address.starts_with(u8"socks")) continue;
+#endif
+    candidates.emplace_back(address);
+  }
+  if (candidates.empty()) candidates.emplace_back();
+  return candidates;
+}
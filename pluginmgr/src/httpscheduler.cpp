@@ -0,0 +1,211 @@
+#include <neobox/httpscheduler.h>
+#include <neobox/httplib.h>
+#include <neobox/httplimiter.h>
+
+#include <algorithm>
+#include <vector>
+
+HttpScheduler& HttpScheduler::Instance()
+{
+  static HttpScheduler scheduler;
+  return scheduler;
+}
+
+std::u8string HttpScheduler::GetHostKey(const HttpLib* clt)
+{
+  auto const port = std::to_string(clt->m_Url.GetPort());
+  return clt->m_Url.GetHost() + u8':' + std::u8string(port.begin(), port.end());
+}
+
+bool HttpScheduler::CanStart(const HttpLib* clt, size_t index) const
+{
+  if (m_Running.size() >= m_GlobalLimit)
+    return false;
+
+  if (index == static_cast<size_t>(Priority::Background) &&
+    m_BackgroundRunning >= std::max<size_t>(m_GlobalLimit / 2, 1))
+    return false;
+
+  auto const iter = m_HostRunning.find(GetHostKey(clt));
+  return iter == m_HostRunning.end() || iter->second < m_HostLimit;
+}
+
+void HttpScheduler::Submit(HttpLib* clt)
+{
+  Enqueue(clt);
+  Dispatch();
+}
+
+void HttpScheduler::Enqueue(HttpLib* clt)
+{
+  Locker locker(m_Mutex);
+  m_Queues[static_cast<size_t>(clt->m_Priority)].push_back(clt);
+}
+
+bool HttpScheduler::Cancel(HttpLib* clt)
+{
+  std::unique_lock<Mutex> locker(m_Mutex);
+  for (auto& queue: m_Queues) {
+    auto const iter = std::find(queue.begin(), queue.end(), clt);
+    if (iter != queue.end()) {
+      queue.erase(iter);
+      return true;
+    }
+  }
+
+  auto const iter = m_Dispatching.find(clt);
+  if (iter == m_Dispatching.end()) return false;
+  if (iter->second.thread == std::this_thread::get_id()) {
+    // From inside its own HttpPerform, which is as far as it gets.
+    if (iter->second.started) return false;
+    // From a callback of one started before it: it never starts, and its
+    // slot goes back through Finish like any other.
+    m_Dispatching.erase(iter);
+    return true;
+  }
+  m_Dispatched.wait(locker, [this, clt] { return !m_Dispatching.contains(clt); });
+  return false;
+}
+
+void HttpScheduler::Finish(HttpLib* clt, bool success)
+{
+  {
+    Locker locker(m_Mutex);
+    auto const running = m_Running.find(clt);
+    if (running == m_Running.end()) return;
+    if (running->second.index == static_cast<size_t>(Priority::Background)) {
+      --m_BackgroundRunning;
+    }
+    auto const host = GetHostKey(clt);
+    if (success) {
+      auto& samples = m_Latency[host];
+      samples.push_back(Clock::now() - running->second.start);
+      if (samples.size() > 32) samples.pop_front();
+    }
+    m_Running.erase(running);
+
+    auto const iter = m_HostRunning.find(host);
+    if (iter != m_HostRunning.end() && --iter->second == 0) {
+      m_HostRunning.erase(iter);
+    }
+  }
+  Dispatch();
+}
+
+void HttpScheduler::Dispatch()
+{
+  std::vector<HttpLib*> ready;
+  std::optional<Clock::time_point> wakeUp;
+  {
+    Locker locker(m_Mutex);
+    auto& limiter = HttpLimiter::Instance();
+    for (size_t index = 0; index != m_Queues.size(); ++index) {
+      auto& queue = m_Queues[index];
+      // A saturated host must not hold back requests to other hosts.
+      for (auto iter = queue.begin(); iter != queue.end(); ) {
+        auto const clt = *iter;
+        // Long-lived streams are neither held back nor counted.
+        if (clt->m_LongLived) {
+          iter = queue.erase(iter);
+          m_Dispatching.emplace(clt, Dispatching { std::this_thread::get_id(), false });
+          ready.push_back(clt);
+          continue;
+        }
+        if (!CanStart(clt, index)) {
+          ++iter;
+          continue;
+        }
+        // Over its request rate the host is skipped, and looked at again
+        // once a token is due instead of holding a thread.
+        auto const wait = limiter.AcquireRequest(clt->m_Url.GetHost());
+        if (wait != HttpLimiter::Duration::zero()) {
+          auto const when = Clock::now() + wait;
+          if (!wakeUp || when < *wakeUp) wakeUp = when;
+          ++iter;
+          continue;
+        }
+        iter = queue.erase(iter);
+        m_Running.emplace(clt, Running { index, Clock::now() });
+        m_Dispatching.emplace(clt, Dispatching { std::this_thread::get_id(), false });
+        ++m_HostRunning[GetHostKey(clt)];
+        if (index == static_cast<size_t>(Priority::Background)) {
+          ++m_BackgroundRunning;
+        }
+        ready.push_back(clt);
+      }
+    }
+
+    if (wakeUp && (!m_WakeUp || *wakeUp < *m_WakeUp)) {
+      m_WakeUp = wakeUp;
+    } else {
+      wakeUp.reset();
+    }
+  }
+
+  if (wakeUp) {
+    HttpLimiter::Instance().Post(*wakeUp, [this] {
+      m_Mutex.lock();
+      m_WakeUp.reset();
+      m_Mutex.unlock();
+      Dispatch();
+    });
+  }
+
+  // Started outside the lock: a request failing at once finishes right here.
+  for (auto clt: ready) {
+    {
+      Locker locker(m_Mutex);
+      auto const iter = m_Dispatching.find(clt);
+      if (iter == m_Dispatching.end()) continue;
+      iter->second.started = true;
+    }
+    clt->HttpPerform();
+    {
+      Locker locker(m_Mutex);
+      m_Dispatching.erase(clt);
+    }
+    m_Dispatched.notify_all();
+  }
+}
+
+void HttpScheduler::SetHostLimit(size_t count)
+{
+  {
+    Locker locker(m_Mutex);
+    m_HostLimit = std::max<size_t>(count, 1);
+  }
+  Dispatch();
+}
+
+void HttpScheduler::SetGlobalLimit(size_t count)
+{
+  {
+    Locker locker(m_Mutex);
+    m_GlobalLimit = std::max<size_t>(count, 1);
+  }
+  Dispatch();
+}
+
+std::optional<HttpScheduler::Clock::duration> HttpScheduler::GetLatency(const HttpLib* clt, double percentile) const
+{
+  Locker locker(m_Mutex);
+  auto const iter = m_Latency.find(GetHostKey(clt));
+  if (iter == m_Latency.end() || iter->second.size() < 8)
+    return std::nullopt;
+
+  std::vector<Clock::duration> samples(iter->second.begin(), iter->second.end());
+  auto const rank = std::min(samples.size() - 1,
+    static_cast<size_t>(std::clamp(percentile, 0.0, 1.0) * samples.size()));
+  std::nth_element(samples.begin(), samples.begin() + rank, samples.end());
+  return samples[rank];
+}
+
+size_t HttpScheduler::GetQueued() const
+{
+  Locker locker(m_Mutex);
+  size_t count = 0;
+  for (auto& queue: m_Queues) {
+    count += queue.size();
+  }
+  return count;
+}
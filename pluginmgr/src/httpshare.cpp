@@ -0,0 +1,104 @@
+#ifdef __linux__
+
+#include <neobox/httpshare.h>
+
+#include <curl/curl.h>
+
+#include <array>
+
+struct HttpShare::Share {
+  CURLSH* handle = nullptr;
+  size_t count = 0;
+  bool retired = false;
+  std::array<std::mutex, CURL_LOCK_DATA_LAST> mutexes;
+
+  static void Lock(CURL*, curl_lock_data data, curl_lock_access, void* userptr) {
+    reinterpret_cast<Share*>(userptr)->mutexes[data].lock();
+  }
+  static void Unlock(CURL*, curl_lock_data data, void* userptr) {
+    reinterpret_cast<Share*>(userptr)->mutexes[data].unlock();
+  }
+};
+
+HttpShare& HttpShare::Instance()
+{
+  static HttpShare share;
+  return share;
+}
+
+HttpShare::HttpShare()
+  : m_Current(NewShare())
+{
+}
+
+HttpShare::~HttpShare()
+{
+  // Handles still alive at exit keep their generation; it leaks with them.
+  if (m_Current && !m_Current->count) {
+    FreeShare(m_Current);
+  }
+}
+
+HttpShare::Share* HttpShare::NewShare()
+{
+  auto const share = new Share;
+  share->handle = curl_share_init();
+  curl_share_setopt(share->handle, CURLSHOPT_LOCKFUNC, &Share::Lock);
+  curl_share_setopt(share->handle, CURLSHOPT_UNLOCKFUNC, &Share::Unlock);
+  curl_share_setopt(share->handle, CURLSHOPT_USERDATA, share);
+  curl_share_setopt(share->handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_DNS);
+  curl_share_setopt(share->handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+  return share;
+}
+
+void HttpShare::FreeShare(Share* share)
+{
+  curl_share_cleanup(share->handle);
+  delete share;
+}
+
+void* HttpShare::Attach(void* handle)
+{
+  Locker locker(m_Mutex);
+  curl_easy_setopt(handle, CURLOPT_SHARE, m_Current->handle);
+  curl_easy_setopt(handle, CURLOPT_DNS_CACHE_TIMEOUT, static_cast<long>(m_DnsTimeout.count()));
+  ++m_Current->count;
+  return m_Current;
+}
+
+void HttpShare::Detach(void* handle, void* token)
+{
+  if (!token) return;
+  auto const share = reinterpret_cast<Share*>(token);
+  curl_easy_setopt(handle, CURLOPT_SHARE, nullptr);
+
+  Locker locker(m_Mutex);
+  if (--share->count == 0 && share->retired) {
+    FreeShare(share);
+  }
+}
+
+void HttpShare::Flush()
+{
+  Locker locker(m_Mutex);
+  if (m_Current->count) {
+    m_Current->retired = true;
+  } else {
+    FreeShare(m_Current);
+  }
+  m_Current = NewShare();
+}
+
+void HttpShare::SetDnsTimeout(std::chrono::seconds timeout)
+{
+  Locker locker(m_Mutex);
+  m_DnsTimeout = timeout;
+}
+
+std::chrono::seconds HttpShare::GetDnsTimeout() const
+{
+  Locker locker(m_Mutex);
+  return m_DnsTimeout;
+}
+
+#endif  // __linux__
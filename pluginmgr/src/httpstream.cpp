@@ -0,0 +1,62 @@
+#include <neobox/httpstream.h>
+#include <neobox/httplimiter.h>
+
+#include <algorithm>
+#include <random>
+
+HttpStreamBase::Mutex HttpStreamBase::m_StreamMutex;
+std::map<uint64_t, HttpStreamBase*> HttpStreamBase::m_StreamPool;
+uint64_t HttpStreamBase::m_StreamCount = 0;
+
+HttpStreamBase::HttpStreamBase()
+{
+  Locker locker(m_StreamMutex);
+  m_StreamId = ++m_StreamCount;
+  m_StreamPool.emplace(m_StreamId, this);
+}
+
+HttpStreamBase::~HttpStreamBase()
+{
+  Unregister();
+}
+
+void HttpStreamBase::Unregister()
+{
+  Locker locker(m_StreamMutex);
+  m_StreamPool.erase(m_StreamId);
+}
+
+HttpStreamBase* HttpStreamBase::FindStream(uint64_t id)
+{
+  Locker locker(m_StreamMutex);
+  auto const iter = m_StreamPool.find(id);
+  return iter == m_StreamPool.end() ? nullptr : iter->second;
+}
+
+void HttpStreamBase::Schedule(Clock::time_point when, std::function<void()> task)
+{
+  // The pool lock is held while the task runs, so that the destructor
+  // waits for it instead of pulling the stream away underneath.
+  HttpLimiter::Instance().Post(when, [id = m_StreamId, task = std::move(task)] {
+    Locker locker(m_StreamMutex);
+    if (m_StreamPool.contains(id)) task();
+  });
+}
+
+std::optional<HttpStreamBase::Clock::time_point> HttpStreamBase::NextAttempt(
+  std::optional<std::chrono::milliseconds> delay)
+{
+  auto const failures = m_Failures++;
+  if (m_Reconnect.attempts >= 0 && failures >= m_Reconnect.attempts) {
+    return std::nullopt;
+  }
+
+  auto const base = std::max(delay.value_or(m_Reconnect.delay), std::chrono::milliseconds(1));
+  auto const cap = std::min(base * (int64_t(1) << std::min(failures, 16)),
+    std::max(m_Reconnect.maxDelay, base));
+  // Half of it fixed, half random, so that clients dropped together do not
+  // all come back at the same moment.
+  static thread_local std::minstd_rand engine(std::random_device{}());
+  auto const jitter = std::uniform_int_distribution<int64_t>(0, cap.count() / 2)(engine);
+  return Clock::now() + cap / 2 + std::chrono::milliseconds(jitter);
+}
@@ -0,0 +1,404 @@
+#include <neobox/httptarsink.h>
+
+#ifdef __linux__
+#include <algorithm>
+#include <cerrno>
+#include <charconv>
+#include <cstdio>
+#include <cstring>
+
+#include <fcntl.h>
+#include <unistd.h>
+#include <zlib.h>
+
+namespace fs = std::filesystem;
+
+static std::string_view ReadField(const uint8_t* field, size_t size)
+{
+  auto const text = reinterpret_cast<const char*>(field);
+  return std::string_view(text, ::strnlen(text, size));
+}
+
+// Octal, or big-endian base-256 when the first bit is set (GNU, for sizes
+// past 8 GiB).
+static std::optional<uint64_t> ReadNumber(const uint8_t* field, size_t size)
+{
+  uint64_t value = 0;
+  if (field[0] & 0x80) {
+    if (field[0] != 0x80) return std::nullopt;
+    for (size_t i = 1; i != size; ++i) {
+      if (value >> 56) return std::nullopt;
+      value = value << 8 | field[i];
+    }
+    return value;
+  }
+
+  auto text = ReadField(field, size);
+  while (!text.empty() && text.front() == ' ') text.remove_prefix(1);
+  while (!text.empty() && text.back() == ' ') text.remove_suffix(1);
+  if (text.empty()) return 0;
+  auto const [end, error] = std::from_chars(text.data(), text.data() + text.size(), value, 8);
+  if (error != std::errc() || end != text.data() + text.size()) return std::nullopt;
+  return value;
+}
+
+// Relative, without "..", so that it can not lead out of the directory it
+// is looked up from.
+static bool IsDownward(std::string_view name)
+{
+  if (name.empty() || name.front() == '/') return false;
+  while (!name.empty()) {
+    auto const slash = name.find('/');
+    if (name.substr(0, slash) == "..") return false;
+    if (slash == name.npos) break;
+    name.remove_prefix(slash + 1);
+  }
+  return true;
+}
+
+HttpTarSink::HttpTarSink(fs::path destination)
+  : m_Destination(std::move(destination))
+  , m_Stream(std::make_unique<z_stream_s>())
+  , m_Buffer(1 << 16)
+{
+  m_Staging = m_Destination;
+  m_Staging += ".partial";
+
+  // 16 + window bits: expect a gzip wrapper.
+  if (inflateInit2(m_Stream.get(), 16 + MAX_WBITS) != Z_OK) {
+    m_Stream.reset();
+    m_Staging.clear();
+    Fail("HttpTarSink Error: can not init zlib.");
+    return;
+  }
+
+  // Left over when a previous attempt was cut short.
+  std::error_code error;
+  fs::remove_all(m_Staging, error);
+  if (!fs::create_directories(m_Staging, error)) {
+    m_Staging.clear();
+    Fail("HttpTarSink Error: can not create staging directory.");
+  }
+}
+
+HttpTarSink::~HttpTarSink()
+{
+  if (m_File != -1) {
+    ::close(m_File);
+  }
+  if (m_Stream) {
+    inflateEnd(m_Stream.get());
+  }
+  if (!m_Staging.empty()) {
+    std::error_code error;
+    fs::remove_all(m_Staging, error);
+  }
+}
+
+bool HttpTarSink::Fail(std::string message)
+{
+  if (m_State != State::Failed) {
+    m_State = State::Failed;
+    m_Error = std::move(message);
+  }
+  if (m_File != -1) {
+    ::close(m_File);
+    m_File = -1;
+  }
+  return false;
+}
+
+bool HttpTarSink::Write(const void* data, size_t size)
+{
+  if (m_State == State::Failed) return false;
+
+  auto& stream = *m_Stream;
+  stream.next_in = static_cast<Bytef*>(const_cast<void*>(data));
+  stream.avail_in = static_cast<uInt>(size);
+
+  for (;;) {
+    if (m_StreamEnd) {
+      // Whatever trails a finished archive is block padding, or junk.
+      if (!stream.avail_in || m_State == State::Done) break;
+      // Another gzip member follows.
+      inflateReset(&stream);
+      m_StreamEnd = false;
+    }
+    stream.next_out = m_Buffer.data();
+    stream.avail_out = static_cast<uInt>(m_Buffer.size());
+    auto const result = inflate(&stream, Z_NO_FLUSH);
+    if (result == Z_STREAM_END) {
+      m_StreamEnd = true;
+    } else if (result != Z_OK && result != Z_BUF_ERROR) {
+      return Fail("HttpTarSink Error: bad gzip data.");
+    }
+    if (!Consume(m_Buffer.data(), m_Buffer.size() - stream.avail_out)) return false;
+    // All input taken and nothing held back for lack of room.
+    if (!m_StreamEnd && !stream.avail_in && stream.avail_out) break;
+  }
+  return true;
+}
+
+bool HttpTarSink::Consume(const uint8_t* data, size_t size)
+{
+  while (size) {
+    switch (m_State) {
+    case State::Header: {
+      auto const count = std::min(size, m_Header.size() - m_HeaderSize);
+      std::memcpy(m_Header.data() + m_HeaderSize, data, count);
+      m_HeaderSize += count;
+      data += count;
+      size -= count;
+      if (m_HeaderSize == m_Header.size()) {
+        m_HeaderSize = 0;
+        if (!ReadHeader()) return false;
+      }
+      break;
+    }
+    case State::Data: {
+      auto const count = static_cast<size_t>(std::min<uint64_t>(size, m_Left));
+      if (m_File != -1) {
+        for (auto rest = data, end = data + count; rest != end; ) {
+          auto const written = ::write(m_File, rest, end - rest);
+          if (written < 0 && errno == EINTR) continue;
+          if (written <= 0) return Fail("HttpTarSink Error: can not write file.");
+          rest += written;
+        }
+      } else if (m_Type == 'L' || m_Type == 'K' || m_Type == 'x') {
+        m_Extended.append(reinterpret_cast<const char*>(data), count);
+      }
+      data += count;
+      size -= count;
+      m_Left -= count;
+      if (!m_Left && !EndEntry()) return false;
+      break;
+    }
+    case State::Padding: {
+      auto const count = static_cast<size_t>(std::min<uint64_t>(size, m_Padding));
+      data += count;
+      size -= count;
+      m_Padding -= count;
+      if (!m_Padding) m_State = State::Header;
+      break;
+    }
+    case State::Done:
+      return true;
+    case State::Failed:
+      return false;
+    }
+  }
+  return true;
+}
+
+bool HttpTarSink::ReadHeader()
+{
+  auto const header = m_Header.data();
+  if (std::all_of(m_Header.begin(), m_Header.end(), [](uint8_t c) { return !c; })) {
+    if (++m_ZeroBlocks == 2) {
+      m_State = State::Done;
+    }
+    return true;
+  }
+  m_ZeroBlocks = 0;
+
+  // The checksum is taken with its own field read as spaces.
+  auto const checksum = ReadNumber(header + 148, 8);
+  uint64_t sum = 8 * ' ';
+  for (size_t i = 0; i != m_Header.size(); ++i) {
+    if (i < 148 || i >= 156) sum += header[i];
+  }
+  if (checksum != sum) {
+    return Fail("HttpTarSink Error: bad tar header.");
+  }
+
+  auto const mode = ReadNumber(header + 100, 8);
+  auto const size = ReadNumber(header + 124, 12);
+  if (!mode || !size) {
+    return Fail("HttpTarSink Error: bad tar header.");
+  }
+
+  m_Type = static_cast<char>(header[156]);
+  m_Mode = static_cast<uint32_t>(*mode);
+  m_Left = m_NextSize.value_or(*size);
+
+  if (m_Type == 'L' || m_Type == 'K' || m_Type == 'x' || m_Type == 'g') {
+    // Extended headers describe the entry after them, and keep it.
+    m_Left = *size;
+    if (m_Type != 'g' && m_Left > MaxExtended) {
+      return Fail("HttpTarSink Error: tar header too long.");
+    }
+    m_Extended.clear();
+  } else {
+    if (!m_NextName.empty()) {
+      m_Name = std::move(m_NextName);
+    } else {
+      m_Name = ReadField(header, 100);
+      auto const prefix = ReadField(header + 345, 155);
+      if (ReadField(header + 257, 5) == "ustar" && !prefix.empty()) {
+        m_Name = std::string(prefix) + '/' + m_Name;
+      }
+    }
+    m_LinkName = m_NextLinkName.empty() ? std::string(ReadField(header + 157, 100)) : std::move(m_NextLinkName);
+    m_NextName.clear();
+    m_NextLinkName.clear();
+    m_NextSize.reset();
+    if (!BeginEntry()) return false;
+  }
+
+  m_Padding = (512 - m_Left % 512) % 512;
+  m_State = State::Data;
+  return m_Left ? true : EndEntry();
+}
+
+std::optional<fs::path> HttpTarSink::GetSafePath(std::string_view name) const
+{
+  while (name.starts_with("./")) name.remove_prefix(2);
+  while (name.ends_with('/')) name.remove_suffix(1);
+  if (name.empty() || name == "." || !IsDownward(name)) return std::nullopt;
+  return m_Staging / fs::path(name).lexically_normal();
+}
+
+bool HttpTarSink::BeginEntry()
+{
+  // Links and devices have no body worth keeping, regular files stream in.
+  std::error_code error;
+  switch (m_Type) {
+  case '\0': case '0': case '7': case '5': case '1': case '2':
+    break;
+  default:
+    // Devices and fifos are no business of a plugin.
+    return true;
+  }
+
+  auto const path = GetSafePath(m_Name);
+  if (!path) {
+    if (m_Type == '5' && (m_Name == "." || m_Name == "./")) return true;
+    return Fail("HttpTarSink Error: unsafe path '" + m_Name + "'.");
+  }
+
+  if (m_Type == '5') {
+    fs::create_directories(*path, error);
+    if (error) return Fail("HttpTarSink Error: can not create directory '" + m_Name + "'.");
+    return true;
+  }
+
+  fs::create_directories(path->parent_path(), error);
+  // A later entry replaces an earlier one of the same name, as tar does.
+  fs::remove(*path, error);
+
+  if (m_Type == '2') {
+    if (!IsDownward(m_LinkName)) {
+      return Fail("HttpTarSink Error: unsafe link '" + m_Name + "'.");
+    }
+    fs::create_symlink(m_LinkName, *path, error);
+  } else if (m_Type == '1') {
+    auto const target = GetSafePath(m_LinkName);
+    if (!target) {
+      return Fail("HttpTarSink Error: unsafe link '" + m_Name + "'.");
+    }
+    fs::create_hard_link(*target, *path, error);
+  } else {
+    // No following a link someone put in the way.
+    m_File = ::open(path->c_str(), O_WRONLY | O_CREAT | O_EXCL | O_NOFOLLOW | O_CLOEXEC, m_Mode & 0777);
+    if (m_File == -1) {
+      error.assign(errno, std::generic_category());
+    }
+  }
+  if (error) {
+    return Fail("HttpTarSink Error: can not create '" + m_Name + "'.");
+  }
+  return true;
+}
+
+bool HttpTarSink::EndEntry()
+{
+  m_State = m_Padding ? State::Padding : State::Header;
+
+  switch (m_Type) {
+  case 'L':
+    m_NextName = ReadField(reinterpret_cast<const uint8_t*>(m_Extended.data()), m_Extended.size());
+    break;
+  case 'K':
+    m_NextLinkName = ReadField(reinterpret_cast<const uint8_t*>(m_Extended.data()), m_Extended.size());
+    break;
+  case 'x':
+    return ParsePax();
+  default:
+    if (m_File != -1) {
+      auto const result = ::close(m_File);
+      m_File = -1;
+      if (result != 0) return Fail("HttpTarSink Error: can not write file.");
+    }
+  }
+  return true;
+}
+
+// Records of "<length> <key>=<value>\n"; path, linkpath and size matter.
+bool HttpTarSink::ParsePax()
+{
+  std::string_view text = m_Extended;
+  while (!text.empty()) {
+    size_t length = 0;
+    auto const [end, error] = std::from_chars(text.data(), text.data() + text.size(), length);
+    auto const space = static_cast<size_t>(end - text.data());
+    if (error != std::errc() || *end != ' ' || length <= space + 1 || length > text.size() || text[length - 1] != '\n') {
+      return Fail("HttpTarSink Error: bad pax header.");
+    }
+    auto const record = text.substr(space + 1, length - space - 2);
+    text.remove_prefix(length);
+
+    auto const equal = record.find('=');
+    if (equal == record.npos) {
+      return Fail("HttpTarSink Error: bad pax header.");
+    }
+    auto const key = record.substr(0, equal), value = record.substr(equal + 1);
+    if (key == "path") {
+      m_NextName = value;
+    } else if (key == "linkpath") {
+      m_NextLinkName = value;
+    } else if (key == "size") {
+      uint64_t size = 0;
+      auto const [last, failed] = std::from_chars(value.data(), value.data() + value.size(), size);
+      if (failed != std::errc() || last != value.data() + value.size()) {
+        return Fail("HttpTarSink Error: bad pax header.");
+      }
+      m_NextSize = size;
+    }
+  }
+  return true;
+}
+
+bool HttpTarSink::Finish()
+{
+  if (m_State == State::Failed) return false;
+  if (!m_StreamEnd || (m_State != State::Header && m_State != State::Done) || m_HeaderSize) {
+    return Fail("HttpTarSink Error: archive ended early.");
+  }
+
+  std::error_code error;
+  if (fs::exists(m_Destination, error)) {
+    // Swap the two in one step, so the plugin is never missing, then drop
+    // the old tree. Some filesystems can not, so move it aside instead.
+    if (::renameat2(AT_FDCWD, m_Staging.c_str(), AT_FDCWD, m_Destination.c_str(), RENAME_EXCHANGE) != 0) {
+      auto old = m_Destination;
+      old += ".old";
+      fs::remove_all(old, error);
+      fs::rename(m_Destination, old, error);
+      if (error) return Fail("HttpTarSink Error: can not replace directory.");
+      fs::rename(m_Staging, m_Destination, error);
+      if (error) {
+        fs::rename(old, m_Destination, error);
+        return Fail("HttpTarSink Error: can not replace directory.");
+      }
+      m_Staging = std::move(old);
+    }
+    fs::remove_all(m_Staging, error);
+  } else {
+    fs::rename(m_Staging, m_Destination, error);
+    if (error) return Fail("HttpTarSink Error: can not move directory.");
+  }
+  m_Staging.clear();
+  m_State = State::Done;
+  return true;
+}
+#endif
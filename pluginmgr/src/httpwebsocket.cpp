@@ -0,0 +1,994 @@
+#ifdef _WIN32
+#include <neobox/unicode.h>
+#include <windows.h>
+#include <winhttp.h>
+#else
+#include <curl/curl.h>
+#include <neobox/httpengine.h>
+#include <sys/epoll.h>
+#include <sys/random.h>
+#endif
+
+#include <neobox/httpwebsocket.h>
+
+#include <algorithm>
+#include <array>
+#include <cctype>
+#include <charconv>
+#include <iostream>
+#include <random>
+
+using namespace std::literals;
+
+static std::u8string ToHttpUrl(std::u8string_view url)
+{
+  // HttpUrl speaks http(s) only; the handshake is an http request anyway.
+  if (url.starts_with(u8"wss://")) return u8"https://" + std::u8string(url.substr(6));
+  if (url.starts_with(u8"ws://")) return u8"http://" + std::u8string(url.substr(5));
+  return std::u8string(url);
+}
+
+static bool IsValidUtf8(std::string_view text)
+{
+  auto iter = reinterpret_cast<const uint8_t*>(text.data());
+  auto const end = iter + text.size();
+  while (iter != end) {
+    auto const lead = *iter++;
+    if (lead < 0x80) continue;
+
+    size_t count = 0;
+    uint32_t min = 0, code = 0;
+    if ((lead & 0xE0) == 0xC0) {
+      count = 1, min = 0x80, code = lead & 0x1F;
+    } else if ((lead & 0xF0) == 0xE0) {
+      count = 2, min = 0x800, code = lead & 0x0F;
+    } else if ((lead & 0xF8) == 0xF0) {
+      count = 3, min = 0x10000, code = lead & 0x07;
+    } else {
+      return false;
+    }
+    if (static_cast<size_t>(end - iter) < count) return false;
+    for (; count; --count) {
+      if ((*iter & 0xC0) != 0x80) return false;
+      code = code << 6 | (*iter++ & 0x3F);
+    }
+    // No overlong forms, no surrogates, nothing past U+10FFFF.
+    if (code < min || code > 0x10FFFF || (code >= 0xD800 && code <= 0xDFFF)) {
+      return false;
+    }
+  }
+  return true;
+}
+
+HttpWebSocket::HttpWebSocket(std::u8string_view url, Callback callback)
+  : m_Url(ToHttpUrl(url))
+  , m_Callback(std::move(callback))
+{
+}
+
+void HttpWebSocket::SetHeader(std::u8string key, std::u8string value)
+{
+  m_Headers[std::move(key)] = std::move(value);
+}
+
+void HttpWebSocket::SetProtocols(std::vector<std::u8string> protocols)
+{
+  m_Protocols = std::move(protocols);
+}
+
+std::u8string HttpWebSocket::GetProtocol() const
+{
+  Locker locker(m_ProtocolMutex);
+  return m_Protocol;
+}
+
+bool HttpWebSocket::Send(std::string_view text)
+{
+  // A peer fails the whole connection over one bad text message.
+  return IsValidUtf8(text) && Send(text, false);
+}
+
+bool HttpWebSocket::SendBinary(std::string_view data)
+{
+  return Send(data, true);
+}
+
+void HttpWebSocket::Dispatch(Message message)
+{
+  if (m_Callback.onMessage) {
+    m_Callback.onMessage(message);
+  } else {
+    Deliver(std::move(message));
+  }
+}
+
+void HttpWebSocket::Finish(int code, const std::string& reason)
+{
+  m_Connected = false;
+  if (m_Callback.onClose) m_Callback.onClose(code, reason);
+}
+
+#ifdef _WIN32
+
+HttpWebSocket::~HttpWebSocket()
+{
+  m_Running = false;
+  ++m_Attempt;
+  Unregister();
+  // Closing the handles cancels a receive or a handshake in progress.
+  Disconnect();
+  m_Condition.notify_all();
+  if (m_Thread.joinable()) {
+    m_Thread.join();
+  }
+  EndStream();
+}
+
+void HttpWebSocket::Open()
+{
+  if (m_Running.exchange(true)) return;
+  BeginStream();
+  ResetBackoff();
+  // Opened again from one of its callbacks, the running loop goes on.
+  if (m_Thread.get_id() == std::this_thread::get_id()) return;
+  if (m_Thread.joinable()) {
+    m_Thread.join();
+  }
+  m_Thread = std::thread(&HttpWebSocket::Run, this);
+}
+
+void HttpWebSocket::Close(uint16_t code, std::string reason)
+{
+  if (!m_Running.exchange(false)) return;
+  m_Connected = false;
+  {
+    // The receive thread sees the answer and ends the connection.
+    Locker locker(m_SocketMutex);
+    if (m_hWebSocket) {
+      reason.resize(std::min<size_t>(reason.size(), 123));
+      WinHttpWebSocketShutdown(m_hWebSocket, code,
+        reason.empty() ? nullptr : reason.data(), static_cast<DWORD>(reason.size()));
+    }
+  }
+  m_Condition.notify_all();
+  EndStream();
+}
+
+bool HttpWebSocket::Send(std::string_view data, bool binary)
+{
+  Locker locker(m_SocketMutex);
+  if (!m_hWebSocket || !m_Connected) return false;
+
+  // One send may run next to the receive of the other thread.
+  auto const error = WinHttpWebSocketSend(m_hWebSocket,
+    binary ? WINHTTP_WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE : WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE,
+    const_cast<char*>(data.data()), static_cast<DWORD>(data.size()));
+  if (error != NO_ERROR) {
+    std::cerr << "HttpWebSocket Error: " << error << " in WinHttpWebSocketSend.\n";
+    return false;
+  }
+  return true;
+}
+
+void HttpWebSocket::Run()
+{
+  while (m_Running) {
+    if (Connect()) {
+      Receive();
+    }
+    Disconnect();
+    if (!m_Running) break;
+
+    auto const when = NextAttempt();
+    if (!when) {
+      m_Running = false;
+      break;
+    }
+    LockerEx locker(m_SocketMutex);
+    m_Condition.wait_until(locker, *when, [this] { return !m_Running; });
+  }
+  EndStream();
+}
+
+bool HttpWebSocket::Connect()
+{
+  auto const route = HttpLib::ResolveRoute(m_Url);
+  auto const proxy = Utf82Wide(route.proxy);
+  // Without proxy settings the platform defaults stay in charge, as in HttpLib.
+  DWORD access = WINHTTP_ACCESS_TYPE_DEFAULT_PROXY;
+  if (HttpLib::m_Proxy) {
+    access = route.IsDirect() ? WINHTTP_ACCESS_TYPE_NO_PROXY : WINHTTP_ACCESS_TYPE_NAMED_PROXY;
+  }
+
+  LockerEx locker(m_SocketMutex);
+  if (!m_Running) return false;
+  m_hSession = WinHttpOpen(L"WinHTTP in Neobox/1.0", access,
+    route.IsDirect() ? WINHTTP_NO_PROXY_NAME : proxy.c_str(),
+    WINHTTP_NO_PROXY_BYPASS, 0);
+  if (!m_hSession) {
+    locker.unlock();
+    Finish(1006, "HttpWebSocket Error: " + std::to_string(GetLastError()) + " in WinHttpOpen.");
+    return false;
+  }
+  if (m_PingInterval > 0s) {
+    // WinHTTP sends the pings itself, at least 15 seconds apart.
+    DWORD interval = static_cast<DWORD>(std::max<std::chrono::milliseconds>(m_PingInterval, 15s).count());
+    WinHttpSetOption(m_hSession, WINHTTP_OPTION_WEB_SOCKET_KEEPALIVE_INTERVAL, &interval, sizeof(interval));
+  }
+  m_hConnect = WinHttpConnect(m_hSession, Utf82Wide(m_Url.GetHost()).c_str(), m_Url.GetPort(), 0);
+  auto const request = m_hConnect ? WinHttpOpenRequest(m_hConnect, L"GET",
+    Utf82Wide(m_Url.GetObjectString()).c_str(), nullptr, WINHTTP_NO_REFERER,
+    WINHTTP_DEFAULT_ACCEPT_TYPES, m_Url.IsHttps() ? WINHTTP_FLAG_SECURE : 0) : nullptr;
+  if (!request) {
+    locker.unlock();
+    Finish(1006, "HttpWebSocket Error: " + std::to_string(GetLastError()) + " in WinHttpOpenRequest.");
+    return false;
+  }
+  // Closed by Disconnect if the handshake is still running then.
+  m_hWebSocket = request;
+  locker.unlock();
+
+  WinHttpSetOption(request, WINHTTP_OPTION_UPGRADE_TO_WEB_SOCKET, nullptr, 0);
+  if (!route.IsDirect() && !route.username.empty()) {
+    auto username = Utf82Wide(route.username);
+    auto password = Utf82Wide(route.password);
+    WinHttpSetOption(request, WINHTTP_OPTION_PROXY_USERNAME,
+      username.data(), static_cast<DWORD>(username.size() * sizeof(wchar_t)));
+    WinHttpSetOption(request, WINHTTP_OPTION_PROXY_PASSWORD,
+      password.data(), static_cast<DWORD>(password.size() * sizeof(wchar_t)));
+  }
+
+  std::u8string headers;
+  for (auto const& [key, value]: m_Headers) {
+    headers += key + u8": " + value + u8"\r\n";
+  }
+  if (!m_Protocols.empty()) {
+    headers += u8"Sec-WebSocket-Protocol: ";
+    for (auto const& protocol: m_Protocols) {
+      if (&protocol != &m_Protocols.front()) headers += u8", ";
+      headers += protocol;
+    }
+    headers += u8"\r\n";
+  }
+  auto const wideHeaders = Utf82Wide(headers);
+
+  DWORD status = 0, size = sizeof(status);
+  auto const sent = WinHttpSendRequest(request,
+      wideHeaders.empty() ? WINHTTP_NO_ADDITIONAL_HEADERS : wideHeaders.c_str(),
+      static_cast<DWORD>(-1), WINHTTP_NO_REQUEST_DATA, 0, 0, 0) &&
+    WinHttpReceiveResponse(request, nullptr) &&
+    WinHttpQueryHeaders(request, WINHTTP_QUERY_STATUS_CODE | WINHTTP_QUERY_FLAG_NUMBER,
+      WINHTTP_HEADER_NAME_BY_INDEX, &status, &size, WINHTTP_NO_HEADER_INDEX);
+  if (!sent) {
+    Finish(1006, "HttpWebSocket Error: " + std::to_string(GetLastError()) + " in WinHttpSendRequest.");
+    return false;
+  }
+  if (status != 101) {
+    // Other client errors would only repeat themselves.
+    if (status >= 400 && status < 500 && status != 408 && status != 429) m_Running = false;
+    Finish(1006, "HttpWebSocket Error: the server answered " + std::to_string(status) + '.');
+    return false;
+  }
+
+  wchar_t protocol[256] {};
+  DWORD protocolSize = sizeof(protocol);
+  if (WinHttpQueryHeaders(request, WINHTTP_QUERY_CUSTOM, L"Sec-WebSocket-Protocol",
+      protocol, &protocolSize, WINHTTP_NO_HEADER_INDEX)) {
+    Locker protocolLocker(m_ProtocolMutex);
+    m_Protocol = Wide2Utf8(protocol);
+  }
+
+  locker.lock();
+  auto const socket = m_Running ? WinHttpWebSocketCompleteUpgrade(request, 0) : nullptr;
+  if (m_hWebSocket == request) {
+    WinHttpCloseHandle(request);
+    m_hWebSocket = socket;
+  } else if (socket) {
+    WinHttpCloseHandle(socket);   // Disconnect came first
+    return false;
+  }
+  locker.unlock();
+  if (!socket) return false;
+
+  m_Connected = true;
+  if (m_Callback.onOpen) m_Callback.onOpen();
+  return true;
+}
+
+void HttpWebSocket::Receive()
+{
+  LockerEx locker(m_SocketMutex);
+  auto const socket = m_hWebSocket;
+  locker.unlock();
+  if (!socket) return;
+  auto const attempt = m_Attempt.load();
+
+  std::string message;
+  std::array<char, 0x4000> buffer;
+  while (true) {
+    DWORD read = 0;
+    WINHTTP_WEB_SOCKET_BUFFER_TYPE type;
+    auto const error = WinHttpWebSocketReceive(socket, buffer.data(), static_cast<DWORD>(buffer.size()), &read, &type);
+    if (error != NO_ERROR) {
+      // Not from the destructor, which cancels the receive this way.
+      if (attempt == m_Attempt) {
+        Finish(1006, "HttpWebSocket Error: " + std::to_string(error) + " in WinHttpWebSocketReceive.");
+      }
+      return;
+    }
+    if (type == WINHTTP_WEB_SOCKET_CLOSE_BUFFER_TYPE) {
+      USHORT code = 1005;
+      char reason[WINHTTP_WEB_SOCKET_MAX_CLOSE_REASON_LENGTH];
+      DWORD length = 0;
+      WinHttpWebSocketQueryCloseStatus(socket, &code, reason, sizeof(reason), &length);
+      // Answers the server, or completes a Close of ours.
+      WinHttpWebSocketClose(socket, code == 1005 ? WINHTTP_WEB_SOCKET_SUCCESS_CLOSE_STATUS : code, nullptr, 0);
+      Finish(code, std::string(reason, length));
+      return;
+    }
+
+    ResetBackoff();     // the server does talk, not just accept
+    message.append(buffer.data(), read);
+    if (message.size() > m_MaxMessageSize) {
+      WinHttpWebSocketClose(socket, WINHTTP_WEB_SOCKET_MESSAGE_TOO_BIG_CLOSE_STATUS, nullptr, 0);
+      Finish(1009, "HttpWebSocket Error: the message is too big.");
+      return;
+    }
+    if (type == WINHTTP_WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE ||
+        type == WINHTTP_WEB_SOCKET_UTF8_MESSAGE_BUFFER_TYPE) {
+      if (m_Running) {
+        Dispatch({ std::move(message), type == WINHTTP_WEB_SOCKET_BINARY_MESSAGE_BUFFER_TYPE });
+      }
+      message.clear();
+    }
+  }
+}
+
+void HttpWebSocket::Disconnect()
+{
+  m_Connected = false;
+  Locker locker(m_SocketMutex);
+  for (auto handle: { &m_hWebSocket, &m_hConnect, &m_hSession }) {
+    if (*handle) {
+      WinHttpCloseHandle(*handle);
+      *handle = nullptr;
+    }
+  }
+}
+
+#elif defined (__linux__)
+
+static const std::string_view WebSocketGuid = "258EAFA5-E914-47DA-95CA-C5AB0DC85B11";
+
+// Only for Sec-WebSocket-Accept, which needs nothing stronger.
+static std::array<uint8_t, 20> Sha1(std::string_view data)
+{
+  uint32_t state[5] = { 0x67452301, 0xEFCDAB89, 0x98BADCFE, 0x10325476, 0xC3D2E1F0 };
+  auto const rotate = [](uint32_t value, int bits) { return value << bits | value >> (32 - bits); };
+
+  std::string message(data);
+  message.push_back('\x80');
+  message.append((64 - (message.size() + 8) % 64) % 64, '\0');
+  for (int i = 7; i >= 0; --i) {
+    message.push_back(static_cast<char>(uint64_t(data.size()) * 8 >> (i * 8)));
+  }
+
+  for (size_t offset = 0; offset != message.size(); offset += 64) {
+    uint32_t w[80];
+    for (int i = 0; i != 16; ++i) {
+      auto const p = reinterpret_cast<const uint8_t*>(message.data() + offset + i * 4);
+      w[i] = uint32_t(p[0]) << 24 | uint32_t(p[1]) << 16 | uint32_t(p[2]) << 8 | p[3];
+    }
+    for (int i = 16; i != 80; ++i) {
+      w[i] = rotate(w[i - 3] ^ w[i - 8] ^ w[i - 14] ^ w[i - 16], 1);
+    }
+    auto [a, b, c, d, e] = state;
+    for (int i = 0; i != 80; ++i) {
+      uint32_t f, k;
+      if (i < 20) {
+        f = (b & c) | (~b & d), k = 0x5A827999;
+      } else if (i < 40) {
+        f = b ^ c ^ d, k = 0x6ED9EBA1;
+      } else if (i < 60) {
+        f = (b & c) | (b & d) | (c & d), k = 0x8F1BBCDC;
+      } else {
+        f = b ^ c ^ d, k = 0xCA62C1D6;
+      }
+      auto const temp = rotate(a, 5) + f + e + k + w[i];
+      e = d, d = c, c = rotate(b, 30), b = a, a = temp;
+    }
+    state[0] += a, state[1] += b, state[2] += c, state[3] += d, state[4] += e;
+  }
+
+  std::array<uint8_t, 20> digest;
+  for (int i = 0; i != 20; ++i) {
+    digest[i] = static_cast<uint8_t>(state[i / 4] >> (24 - i % 4 * 8));
+  }
+  return digest;
+}
+
+static std::string Base64(const uint8_t* data, size_t size)
+{
+  static const char table[] = "ABCDEFGHIJKLMNOPQRSTUVWXYZabcdefghijklmnopqrstuvwxyz0123456789+/";
+  std::string result;
+  result.reserve((size + 2) / 3 * 4);
+  for (size_t i = 0; i < size; i += 3) {
+    uint32_t chunk = uint32_t(data[i]) << 16;
+    if (i + 1 < size) chunk |= uint32_t(data[i + 1]) << 8;
+    if (i + 2 < size) chunk |= data[i + 2];
+    result.push_back(table[chunk >> 18 & 0x3F]);
+    result.push_back(table[chunk >> 12 & 0x3F]);
+    result.push_back(i + 1 < size ? table[chunk >> 6 & 0x3F] : '=');
+    result.push_back(i + 2 < size ? table[chunk & 0x3F] : '=');
+  }
+  return result;
+}
+
+// Masking keys must not be predictable (RFC 6455 10.3), so every one comes
+// from the kernel rather than from a seeded engine.
+static uint32_t RandomWord()
+{
+  uint32_t word;
+  if (getrandom(&word, sizeof(word), 0) == sizeof(word)) return word;
+  static thread_local std::random_device device;
+  return device();
+}
+
+static bool EqualsNoCase(std::string_view a, std::string_view b)
+{
+  return std::equal(a.begin(), a.end(), b.begin(), b.end(), [](char x, char y) {
+    return std::tolower(static_cast<unsigned char>(x)) == std::tolower(static_cast<unsigned char>(y));
+  });
+}
+
+static std::string_view Trim(std::string_view text)
+{
+  while (!text.empty() && (text.front() == ' ' || text.front() == '\t')) text.remove_prefix(1);
+  while (!text.empty() && (text.back() == ' ' || text.back() == '\t')) text.remove_suffix(1);
+  return text;
+}
+
+static bool HasToken(std::string_view list, std::string_view token)
+{
+  while (!list.empty()) {
+    auto const comma = list.find(',');
+    if (EqualsNoCase(Trim(list.substr(0, comma)), token)) return true;
+    if (comma == list.npos) break;
+    list.remove_prefix(comma + 1);
+  }
+  return false;
+}
+
+// Frames of a client are always masked, and never fragmented here.
+static std::string EncodeFrame(uint8_t opcode, std::string_view payload)
+{
+  std::string frame;
+  frame.reserve(payload.size() + 14);
+  frame.push_back(static_cast<char>(0x80 | opcode));
+  auto const size = payload.size();
+  if (size < 126) {
+    frame.push_back(static_cast<char>(0x80 | size));
+  } else if (size <= 0xFFFF) {
+    frame.push_back(static_cast<char>(0x80 | 126));
+    frame.push_back(static_cast<char>(size >> 8));
+    frame.push_back(static_cast<char>(size));
+  } else {
+    frame.push_back(static_cast<char>(0x80 | 127));
+    for (int i = 7; i >= 0; --i) {
+      frame.push_back(static_cast<char>(uint64_t(size) >> (i * 8)));
+    }
+  }
+
+  auto const word = RandomWord();
+  char const mask[4] = {
+    static_cast<char>(word >> 24), static_cast<char>(word >> 16),
+    static_cast<char>(word >> 8), static_cast<char>(word),
+  };
+  frame.append(mask, 4);
+  auto const offset = frame.size();
+  frame.append(payload);
+  for (size_t i = 0; i != size; ++i) {
+    frame[offset + i] ^= mask[i & 3];
+  }
+  return frame;
+}
+
+HttpWebSocket::~HttpWebSocket()
+{
+  m_Running = false;
+  ++m_Attempt;
+  m_Connected = false;
+  Unregister();
+  // Always, even before the session exists: Connect may be creating it on
+  // the engine right now, and tasks that looked us up must be done.
+  HttpEngine::Instance().Post([this] { Teardown(); }, true);
+  if (m_hSession) {
+    curl_easy_cleanup(m_hSession);
+  }
+  EndStream();
+}
+
+void HttpWebSocket::Open()
+{
+  if (m_Running.exchange(true)) return;
+  BeginStream();
+  ResetBackoff();
+  Post([](HttpWebSocket& self) {
+    if (self.m_State == State::Idle) self.Connect();
+  });
+}
+
+void HttpWebSocket::Close(uint16_t code, std::string reason)
+{
+  if (!m_Running.exchange(false)) return;
+  m_Connected = false;
+  Post([code, reason = std::move(reason)](HttpWebSocket& self) {
+    if (self.m_State == State::Open) {
+      // Over once the server answers, or after a while without it.
+      self.SendClose(code, reason);
+    } else if (self.m_State != State::Closing) {
+      self.Teardown();
+      ++self.m_Attempt;
+    }
+  });
+  EndStream();
+}
+
+bool HttpWebSocket::Send(std::string_view data, bool binary)
+{
+  if (!m_Connected) return false;
+  Post([attempt = m_Attempt.load(),
+      frame = EncodeFrame(static_cast<uint8_t>(binary ? Opcode::Binary : Opcode::Text), data)](HttpWebSocket& self) {
+    if (attempt != self.m_Attempt || self.m_State != State::Open) return;
+    self.m_Output += frame;
+    self.Flush();
+  });
+  return true;
+}
+
+void HttpWebSocket::Post(Task task)
+{
+  HttpEngine::Instance().Post([id = GetStreamId(), task = std::move(task)] {
+    // Ids are never reused, so the one found is still this socket.
+    if (auto const stream = FindStream(id)) task(*static_cast<HttpWebSocket*>(stream));
+  });
+}
+
+void HttpWebSocket::Later(Clock::time_point when, uint64_t attempt, Task task)
+{
+  // From the limiter thread over to the engine, where the state lives.
+  Schedule(when, [this, attempt, task = std::move(task)] {
+    Post([attempt, task](HttpWebSocket& self) {
+      if (attempt == self.m_Attempt) task(self);
+    });
+  });
+}
+
+void HttpWebSocket::Connect()
+{
+  if (!m_Running) return;
+  auto const attempt = ++m_Attempt;
+  Teardown();
+
+  if (m_hSession) {
+    curl_easy_reset(m_hSession);
+  } else {
+    m_hSession = curl_easy_init();
+  }
+  auto const route = HttpLib::ResolveRoute(m_Url);
+  auto const url = m_Url.GetUrl();
+  curl_easy_setopt(m_hSession, CURLOPT_URL, url.c_str());
+  curl_easy_setopt(m_hSession, CURLOPT_PORT, static_cast<long>(m_Url.GetPort()));
+  curl_easy_setopt(m_hSession, CURLOPT_SSL_VERIFYPEER, false);
+  curl_easy_setopt(m_hSession, CURLOPT_SSL_VERIFYHOST, false);
+  curl_easy_setopt(m_hSession, CURLOPT_NOSIGNAL, 1L);
+  curl_easy_setopt(m_hSession, CURLOPT_CONNECTTIMEOUT, 30L);
+  // A raw connection through an http proxy has to be a CONNECT tunnel.
+  curl_easy_setopt(m_hSession, CURLOPT_HTTPPROXYTUNNEL, 1L);
+  if (HttpLib::m_Proxy) {
+    curl_easy_setopt(m_hSession, CURLOPT_PROXY, route.proxy.c_str());
+    curl_easy_setopt(m_hSession, CURLOPT_PROXYAUTH, CURLAUTH_ANY);
+    if (!route.IsDirect() && !route.username.empty()) {
+      auto const pwd = route.username + u8":" + route.password;
+      curl_easy_setopt(m_hSession, CURLOPT_PROXYUSERPWD, pwd.c_str());
+    }
+  }
+
+  m_State = State::Connecting;
+  m_CloseCode = 1005;
+  m_CloseReason.clear();
+  HttpEngine::Instance().Connect(m_hSession,
+    [this, attempt](int code) {
+      if (attempt == m_Attempt) OnConnect(code);
+    },
+    [this, attempt](int events) {
+      if (attempt == m_Attempt) OnReady(events);
+    });
+}
+
+void HttpWebSocket::OnConnect(int code)
+{
+  if (code != CURLE_OK) {
+    Drop(1006, "HttpWebSocket Error: "s + curl_easy_strerror(static_cast<CURLcode>(code)));
+    return;
+  }
+
+  uint8_t nonce[16];
+  for (size_t i = 0; i != sizeof(nonce); i += 4) {
+    auto const word = RandomWord();
+    std::copy_n(reinterpret_cast<const uint8_t*>(&word), 4, nonce + i);
+  }
+  m_Key = Base64(nonce, sizeof(nonce));
+
+  auto const& object = m_Url.GetObjectString();
+  auto const& host = m_Url.GetHost();
+  std::string request = "GET ";
+  request.append(object.begin(), object.end());
+  request += " HTTP/1.1\r\nHost: ";
+  request.append(host.begin(), host.end());
+  if (m_Url.GetPort() != (m_Url.IsHttps() ? 443 : 80)) {
+    request += ':' + std::to_string(m_Url.GetPort());
+  }
+  request += "\r\nUpgrade: websocket\r\nConnection: Upgrade\r\nSec-WebSocket-Key: ";
+  request += m_Key;
+  request += "\r\nSec-WebSocket-Version: 13\r\n";
+  if (!m_Protocols.empty()) {
+    request += "Sec-WebSocket-Protocol: ";
+    for (auto const& protocol: m_Protocols) {
+      if (&protocol != &m_Protocols.front()) request += ", ";
+      request.append(protocol.begin(), protocol.end());
+    }
+    request += "\r\n";
+  }
+  for (auto const& [key, value]: m_Headers) {
+    request.append(key.begin(), key.end()).append(": ");
+    request.append(value.begin(), value.end()).append("\r\n");
+  }
+  request += "\r\n";
+
+  m_State = State::Handshake;
+  m_LastActivity = Clock::now();
+  Later(m_LastActivity + 30s, m_Attempt, [](HttpWebSocket& self) {
+    if (self.m_State == State::Handshake) self.Drop(1006, "HttpWebSocket Error: the handshake timed out.");
+  });
+  m_Output = std::move(request);
+  Flush();
+}
+
+void HttpWebSocket::OnReady(int events)
+{
+  auto const attempt = m_Attempt.load();
+  if (events & EPOLLOUT) {
+    Flush();
+  }
+  if (attempt == m_Attempt && events & (EPOLLIN | EPOLLERR | EPOLLHUP)) {
+    Receive();
+  }
+}
+
+void HttpWebSocket::Flush()
+{
+  while (!m_Output.empty()) {
+    size_t sent = 0;
+    auto const code = curl_easy_send(m_hSession, m_Output.data(), m_Output.size(), &sent);
+    if (code == CURLE_AGAIN) break;
+    if (code != CURLE_OK) {
+      Drop(1006, "HttpWebSocket Error: "s + curl_easy_strerror(code));
+      return;
+    }
+    m_Output.erase(0, sent);
+  }
+  HttpEngine::Instance().SetWritable(m_hSession, !m_Output.empty());
+
+  // Both close frames have gone by: nothing is left to wait for.
+  if (m_Output.empty() && m_State == State::Closing && m_CloseReceived) {
+    Drop(m_CloseCode, m_CloseReason);
+  }
+}
+
+void HttpWebSocket::Receive()
+{
+  auto const attempt = m_Attempt.load();
+  std::array<char, 0x4000> buffer;
+  // Until the socket runs dry: curl may hold decrypted bytes epoll knows
+  // nothing of.
+  while (attempt == m_Attempt) {
+    size_t read = 0;
+    auto const code = curl_easy_recv(m_hSession, buffer.data(), buffer.size(), &read);
+    if (code == CURLE_AGAIN) return;
+    if (code != CURLE_OK || read == 0) {
+      if (m_State == State::Closing && m_CloseReceived) {
+        Drop(m_CloseCode, m_CloseReason);
+      } else if (code != CURLE_OK) {
+        Drop(1006, "HttpWebSocket Error: "s + curl_easy_strerror(code));
+      } else {
+        Drop(1006, "HttpWebSocket Error: the connection was closed.");
+      }
+      return;
+    }
+
+    m_LastActivity = Clock::now();
+    m_Input.append(buffer.data(), read);
+    if (m_State == State::Handshake && !ReadHandshake()) continue;
+    if (m_State == State::Open || m_State == State::Closing) ReadFrames();
+  }
+}
+
+bool HttpWebSocket::ReadHandshake()
+{
+  auto const end = m_Input.find("\r\n\r\n");
+  if (end == m_Input.npos) {
+    if (m_Input.size() > 0x4000) Drop(1006, "HttpWebSocket Error: the handshake is too long.");
+    return false;
+  }
+
+  std::string_view head(m_Input.data(), end);
+  auto line = head.substr(0, head.find("\r\n"));
+  head.remove_prefix(std::min(head.size(), line.size() + 2));
+  int status = 0;
+  if (auto const space = line.find(' '); space != line.npos) {
+    line.remove_prefix(space + 1);
+    std::from_chars(line.data(), line.data() + line.size(), status);
+  }
+  if (status != 101) {
+    // Other client errors would only repeat themselves.
+    auto const fatal = status >= 400 && status < 500 && status != 408 && status != 429;
+    Drop(1006, "HttpWebSocket Error: the server answered " + std::to_string(status) + '.', !fatal);
+    return false;
+  }
+
+  bool upgrade = false, connection = false, accepted = false;
+  std::string_view protocol;
+  auto const digest = Sha1(m_Key + std::string(WebSocketGuid));
+  auto const accept = Base64(digest.data(), digest.size());
+  while (!head.empty()) {
+    auto const field = head.substr(0, head.find("\r\n"));
+    head.remove_prefix(std::min(head.size(), field.size() + 2));
+    auto const colon = field.find(':');
+    if (colon == field.npos) continue;
+    auto const name = Trim(field.substr(0, colon));
+    auto const value = Trim(field.substr(colon + 1));
+    if (EqualsNoCase(name, "Upgrade")) {
+      upgrade = EqualsNoCase(value, "websocket");
+    } else if (EqualsNoCase(name, "Connection")) {
+      connection = HasToken(value, "Upgrade");
+    } else if (EqualsNoCase(name, "Sec-WebSocket-Accept")) {
+      accepted = value == accept;
+    } else if (EqualsNoCase(name, "Sec-WebSocket-Protocol")) {
+      protocol = value;
+    }
+  }
+  auto const offered = std::any_of(m_Protocols.begin(), m_Protocols.end(), [protocol](auto const& item) {
+    return std::equal(item.begin(), item.end(), protocol.begin(), protocol.end());
+  });
+  if (!upgrade || !connection || !accepted || (!protocol.empty() && !offered)) {
+    Drop(1006, "HttpWebSocket Error: the server did not accept the upgrade.");
+    return false;
+  }
+
+  {
+    Locker locker(m_ProtocolMutex);
+    m_Protocol.assign(protocol.begin(), protocol.end());
+  }
+  m_Input.erase(0, end + 4);
+  m_State = State::Open;
+  m_Connected = true;
+
+  auto const attempt = m_Attempt.load();
+  if (m_PingInterval > 0s) {
+    Later(Clock::now() + m_PingInterval, attempt, [attempt](HttpWebSocket& self) { self.Ping(attempt); });
+  }
+  if (m_Callback.onOpen) m_Callback.onOpen();
+  return attempt == m_Attempt;
+}
+
+void HttpWebSocket::Ping(uint64_t attempt)
+{
+  if (m_State != State::Open) return;
+  auto const now = Clock::now();
+  if (now - m_LastActivity > 2 * m_PingInterval) {
+    Drop(1006, "HttpWebSocket Error: the server stopped answering pings.");
+    return;
+  }
+  SendFrame(Opcode::Ping, {});
+  Later(now + m_PingInterval, attempt, [attempt](HttpWebSocket& self) { self.Ping(attempt); });
+}
+
+void HttpWebSocket::ReadFrames()
+{
+  if (m_CloseReceived) {
+    m_Input.clear();    // nothing may follow a close frame
+    return;
+  }
+
+  auto const attempt = m_Attempt.load();
+  size_t offset = 0;
+  while (attempt == m_Attempt && !m_CloseReceived) {
+    auto const rest = std::string_view(m_Input).substr(offset);
+    if (rest.size() < 2) break;
+
+    auto const byte = reinterpret_cast<const uint8_t*>(rest.data());
+    auto const fin = (byte[0] & 0x80) != 0;
+    auto const opcode = static_cast<Opcode>(byte[0] & 0x0F);
+    auto const control = (byte[0] & 0x08) != 0;
+    uint64_t length = byte[1] & 0x7F;
+    size_t header = 2;
+    if (byte[0] & 0x70) {
+      Fail(1002, "HttpWebSocket Error: a frame uses reserved bits.");
+      return;
+    }
+    if (byte[1] & 0x80) {
+      Fail(1002, "HttpWebSocket Error: the server masked a frame.");
+      return;
+    }
+    if (length == 126) {
+      if (rest.size() < 4) break;
+      length = uint64_t(byte[2]) << 8 | byte[3];
+      header = 4;
+    } else if (length == 127) {
+      if (rest.size() < 10) break;
+      length = 0;
+      for (int i = 2; i != 10; ++i) length = length << 8 | byte[i];
+      header = 10;
+    }
+    if (control && (!fin || length > 125)) {
+      Fail(1002, "HttpWebSocket Error: a control frame is fragmented or too long.");
+      return;
+    }
+    // Before waiting for the rest, so that the buffer never grows past it.
+    if (!control && length > m_MaxMessageSize - m_Message.size()) {
+      Fail(1009, "HttpWebSocket Error: the message is too big.");
+      return;
+    }
+    if (rest.size() - header < length) break;
+
+    if (!ReadFrame(opcode, fin, rest.substr(header, length))) return;
+    offset += header + length;
+    // Not at the handshake: a server that accepts and then fails at once
+    // would be hammered without a pause.
+    ResetBackoff();
+  }
+  if (attempt == m_Attempt) {
+    m_Input.erase(0, offset);
+  }
+}
+
+bool HttpWebSocket::ReadFrame(Opcode opcode, bool fin, std::string_view payload)
+{
+  auto const attempt = m_Attempt.load();
+  switch (opcode) {
+  case Opcode::Continuation:
+    if (!m_Fragmented) {
+      Fail(1002, "HttpWebSocket Error: a continuation frame without a message.");
+      return false;
+    }
+    m_Message.append(payload);
+    break;
+  case Opcode::Text:
+  case Opcode::Binary:
+    if (m_Fragmented) {
+      Fail(1002, "HttpWebSocket Error: a new message inside a fragmented one.");
+      return false;
+    }
+    m_Fragmented = true;
+    m_MessageBinary = opcode == Opcode::Binary;
+    m_Message.assign(payload);
+    break;
+  case Opcode::Close: {
+    int code = 1005;
+    if (payload.size() >= 2) {
+      code = static_cast<uint8_t>(payload[0]) << 8 | static_cast<uint8_t>(payload[1]);
+      payload.remove_prefix(2);
+    }
+    auto const valid = (code >= 1000 && code <= 1003) || (code >= 1007 && code <= 1011) ||
+      (code >= 3000 && code <= 4999) || (code == 1005 && payload.empty());
+    if (!valid || !IsValidUtf8(payload)) {
+      Fail(1002, "HttpWebSocket Error: the close frame is malformed.");
+      return false;
+    }
+    m_CloseCode = code;
+    m_CloseReason.assign(payload);
+    m_CloseReceived = true;
+    if (m_State == State::Open) {
+      SendClose(code == 1005 ? 0 : static_cast<uint16_t>(code), {});  // the echo
+    } else {
+      Flush();
+    }
+    return false;
+  }
+  case Opcode::Ping:
+    SendFrame(Opcode::Pong, payload);
+    return attempt == m_Attempt;
+  case Opcode::Pong:
+    return true;
+  default:
+    Fail(1002, "HttpWebSocket Error: a frame with an unknown opcode.");
+    return false;
+  }
+  if (!fin) return true;
+
+  Message message { std::move(m_Message), m_MessageBinary };
+  m_Message.clear();
+  m_Fragmented = false;
+  if (!message.binary && !IsValidUtf8(message.data)) {
+    Fail(1007, "HttpWebSocket Error: a text message is not UTF-8.");
+    return false;
+  }
+  // Whatever still comes in after a Close of ours goes nowhere.
+  if (m_State == State::Open) {
+    Dispatch(std::move(message));
+  }
+  return attempt == m_Attempt;
+}
+
+void HttpWebSocket::SendFrame(Opcode opcode, std::string_view payload)
+{
+  if (m_State != State::Open) return;
+  m_Output += EncodeFrame(static_cast<uint8_t>(opcode), payload);
+  Flush();
+}
+
+void HttpWebSocket::SendClose(uint16_t code, std::string_view reason)
+{
+  // Code 0 sends a close frame without a body.
+  std::string payload;
+  if (code) {
+    payload.push_back(static_cast<char>(code >> 8));
+    payload.push_back(static_cast<char>(code));
+    payload.append(reason.substr(0, 123));
+  }
+  auto const attempt = m_Attempt.load();
+  SendFrame(Opcode::Close, payload);
+  if (attempt != m_Attempt) return;
+
+  m_State = State::Closing;
+  Later(Clock::now() + 5s, attempt, [](HttpWebSocket& self) {
+    if (self.m_CloseReceived) {
+      self.Drop(self.m_CloseCode, self.m_CloseReason);
+    } else {
+      self.Drop(1006, "HttpWebSocket Error: the server did not answer the close frame.");
+    }
+  });
+  Flush();
+}
+
+void HttpWebSocket::Fail(uint16_t code, const std::string& reason)
+{
+  SendClose(code, {});
+  if (m_State != State::Idle) {
+    Drop(code, reason);
+  }
+}
+
+void HttpWebSocket::Drop(int code, std::string reason, bool retry)
+{
+  Teardown();
+  auto const attempt = ++m_Attempt;
+  Finish(code, reason);
+  // Closed, or closed and opened again, from the callback.
+  if (attempt != m_Attempt || !m_Running) return;
+
+  auto const when = retry ? NextAttempt() : std::nullopt;
+  if (!when) {
+    m_Running = false;
+    EndStream();
+    return;
+  }
+  Later(*when, attempt, [](HttpWebSocket& self) { self.Connect(); });
+}
+
+void HttpWebSocket::Teardown()
+{
+  if (m_hSession && m_State != State::Idle) {
+    HttpEngine::Instance().Disconnect(m_hSession);
+  }
+  m_State = State::Idle;
+  m_Connected = false;
+  m_Input.clear();
+  m_Output.clear();
+  m_Message.clear();
+  m_Fragmented = false;
+  m_CloseReceived = false;
+}
+
+#endif
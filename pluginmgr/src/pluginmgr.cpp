@@ -4,6 +4,7 @@
 #include <neobox/unicode.h>
 #include <neobox/shortcut.h>
 #include <neobox/httplib.h>
+#include <neobox/httpmonitor.h>
 #include <neobox/menubase.hpp>
 #include <config.h>
 #include <neobox/neotimer.h>
@@ -80,6 +81,8 @@ YJson* PluginMgr::InitSettings()
   }
 
   HttpLib::m_Proxy.emplace(proxy);
+  // Start watching the network now, the first IsOnline() then has an answer.
+  HttpMonitor::Instance();
   return setting;
 }
 
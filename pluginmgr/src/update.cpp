@@ -1,5 +1,7 @@
 #include <neobox/update.hpp>
 #include <neobox/httplib.h>
+#include <neobox/httpdownload.h>
+#include <neobox/httpjsonsink.h>
 #include <config.h>
 #include <neobox/neotimer.h>
 #include <neobox/unicode.h>
@@ -14,6 +16,7 @@
 // #include <chrono>
 #include <utility>
 #include <array>
+#include <charconv>
 #include <regex>
 #include <filesystem>
 
@@ -131,6 +134,7 @@ PluginUpdate::~PluginUpdate()
   WinToast::instance()->clear();
 #endif
   m_DataRequest = nullptr;
+  m_Download = nullptr;
 }
 
 
@@ -163,10 +167,9 @@ std::array<int, 3> PluginUpdate::ParseVersion(const std::u8string& vStr)
 
 bool PluginUpdate::NeedUpgrade() const
 {
-  if (!m_LatestData) return false;
+  if (!m_LatestRelease) return false;
 
-  auto& versionString = (*m_LatestData)[u8"tag_name"].getValueString();
-  auto const vNew = PluginUpdate::ParseVersion(versionString);
+  auto const vNew = PluginUpdate::ParseVersion(m_LatestRelease->tagName);
   auto const vOld = PluginUpdate::ParseVersion(u8"" NEOBOX_VERSION);
 
   return vNew != vOld;
@@ -209,10 +212,9 @@ void PluginUpdate::CopyExecutable() const
 
 AsyncVoid PluginUpdate::DownloadUpgrade()
 {
-  if (!m_LatestData) co_return;
+  if (!m_LatestRelease) co_return;
 
-  for (auto& asset: (*m_LatestData)[u8"assets"].getArray()) {
-    auto& url = asset[u8"browser_download_url"].getValueString();
+  for (auto& [url, digest]: m_LatestRelease->assets) {
 #ifdef _WIN32
     if (!url.ends_with(u8".zip")) {
       continue;
@@ -222,22 +224,17 @@ AsyncVoid PluginUpdate::DownloadUpgrade()
       continue;
     }
 #endif
-  m_ZipUrl = url;
-  m_File.open(GetTempFilePath(), std::ios::out | std::ios::binary);
-  if (!m_File.is_open()) co_return;
-
-    m_DataRequest = std::make_unique<HttpLib>(HttpUrl(m_ZipUrl), true);
-
-    HttpLib::Callback callback = {
-      .onWrite = [this](auto data, auto size) {
-        m_File.write(reinterpret_cast<const char*>(data), size);
-      },
-    };
-    auto res = co_await m_DataRequest->GetAsync(std::move(callback));
-    m_File.close();
-
-    if (res->status != 200) {
-      fs::remove(GetTempFilePath());
+    m_ZipUrl = url;
+    // The package is fetched in several ranges at once when the server
+    // allows it, else as one stream resuming an interrupted attempt.
+    m_Download = std::make_unique<HttpDownload>(HttpUrl(m_ZipUrl), GetTempFilePath());
+    m_Download->SetRedirect(5);
+    m_Download->SetPriority(HttpScheduler::Priority::Background);
+    // A corrupt package fails here and is deleted, before it is unpacked.
+    m_Download->SetSha256(HttpHashSink::FromHex(digest));
+    auto res = co_await m_Download->GetAsync();
+
+    if (res->status != 200 && res->status != 206) {
       co_return;
     }
     CopyExecutable();
@@ -251,13 +248,48 @@ AsyncBool PluginUpdate::CheckUpdate()
   m_DataRequest = std::make_unique<HttpLib>(u8"" NEOBOX_LATEST_URL ""sv, true);
 
   m_DataRequest->SetHeader(u8"User-Agent", u8"Libcurl in Neobox App/1.0");
-  auto res = co_await m_DataRequest->GetAsync();
+  m_DataRequest->SetPriority(HttpScheduler::Priority::Background);
+  // An unchanged release costs a 304, which GitHub does not rate limit.
+  m_DataRequest->SetCache(mgr->GetJunkDir() / u8"httpcache");
+
+  // The manifest is parsed while it downloads, and only the fields used
+  // here are kept; the release notes and the rest are dropped as they pass.
+  Release release;
+  HttpJsonSink sink;
+  sink.Select(u8"tag_name", [&release](auto, const HttpJsonValue& value) {
+    release.tagName = value.text;
+  });
+  // The fields of an asset are matched up by its index in the array.
+  auto const asset = [&release](std::u8string_view path) -> Release::Asset& {
+    size_t index = 0;
+    auto const first = reinterpret_cast<const char*>(path.data()) + path.find(u8'[') + 1;
+    std::from_chars(first, reinterpret_cast<const char*>(path.data() + path.size()), index);
+    if (release.assets.size() <= index) {
+      release.assets.resize(index + 1);
+    }
+    return release.assets[index];
+  };
+  sink.Select(u8"assets[].browser_download_url", [&asset](auto path, const HttpJsonValue& value) {
+    asset(path).url = value.text;
+  });
+  sink.Select(u8"assets[].digest", [&asset](auto path, const HttpJsonValue& value) {
+    asset(path).digest = value.text;
+  });
+  auto res = co_await m_DataRequest->GetAsync({
+    .onWrite = [&sink](const void* data, size_t size) { sink.Write(data, size); }
+  });
 
   if (res->status != 200) {
     co_return false;
   }
 
-  m_LatestData = std::make_unique<YJson>(res->body.begin(), res->body.end());
+  if (!sink.Finish()) {
+#ifdef _DEBUG
+    std::cout << sink.GetError() << std::endl;
+#endif
+    co_return false;
+  }
+  m_LatestRelease = std::move(release);
 
   co_return true;
 }
@@ -266,7 +298,7 @@ AsyncBool PluginUpdate::CheckUpdate()
 AsyncVoid PluginUpdate::StartAutoCheck() {
   auto result = co_await CheckUpdate().awaiter();
 
-  if (!result || !*result || !m_LatestData) {
+  if (!result || !*result || !m_LatestRelease) {
 #ifdef _DEBUG
     std::cout << "fetch update detail failed." << std::endl;
 #endif
@@ -289,4 +321,7 @@ AsyncVoid PluginUpdate::StartAutoCheck() {
   }
 }
 
-bool PluginUpdate::IsBusy() const { return m_DataRequest && !m_DataRequest->IsFinished(); }
+bool PluginUpdate::IsBusy() const {
+  return (m_DataRequest && !m_DataRequest->IsFinished()) ||
+    (m_Download && !m_Download->IsFinished());
+}
@@ -7,11 +7,12 @@
 
 #include <format>
 #include <filesystem>
+#include <iostream>
 
 #ifdef _WIN32
 #include <zip.h>
 #else
-#include <QProcess>
+#include <neobox/httptarsink.h>
 #endif
 
 #include <QHBoxLayout>
@@ -109,49 +110,92 @@ bool ItemBase::PluginDownload()
 
 #ifdef _WIN32
   auto const plugin = m_PluginName + u8".zip";
+  const auto pluginTemp = mgr->GetJunkDir() / plugin;
 #else
   auto const plugin = m_PluginName + u8".tar.gz";
 #endif
-  const auto pluginTemp = mgr->GetJunkDir() / plugin;
   const auto pluginDst = mgr->GetPluginDir() / m_PluginName;
   HttpLib clt(HttpUrl(PluginCenter::m_RawUrl + plugin), true, 10s);
-
-  std::ofstream file(pluginTemp, std::ios::out | std::ios::binary);
-  if (!file.is_open()) return false;
+  clt.SetHttp2(true);
+  clt.SetPriority(HttpScheduler::Priority::Interactive);
+  // plugins.json may list the archives' digests, e.g.
+  //   "Sha256": { "neospeedboxplg.tar.gz": "<hex>", "neospeedboxplg.zip": "<hex>" }
+  // A corrupt download then fails before anything is extracted.
+  auto const digest = GetSha256(plugin);
+#ifdef _WIN32
+  clt.SetSha256(digest);
+#else
+  // Unpacked on the fly into a staging directory, which takes the place of
+  // pluginDst only once the archive is whole and its digest matches.
+  HttpTarSink archive(pluginDst);
+  HttpHashSink hash;
+#endif
 
   HttpLib::Callback callback = {
     .onProcess = [&](auto count, auto size) {
       dialog.emitProcess(count, size);
     },
     .onFinish = [&](auto msg, auto res) {
-      file.close();
-
-      result = msg.empty() && res->status == 200;
+      result = msg.empty() && (res->status == 200 || res->status == 206);
 
       if (!result) {
+        // a zip keeps its partial file, the next attempt resumes from it.
         mgr->ShowMsgbox("失败", "下载清单失败！");
       } else {
+#ifdef _WIN32
         result = ExtractZip(pluginTemp, pluginDst);
         if (!result) {
           mgr->ShowMsgbox("失败", "无法解压文件");
         }
+        fs::remove(pluginTemp);
+#else
+        if (digest && hash.Finish() != *digest) {
+          result = false;
+          mgr->ShowMsgbox("失败", "文件校验失败！");
+        } else if (!(result = archive.Finish())) {
+          std::cerr << archive.GetError() << std::endl;
+          mgr->ShowMsgbox("失败", "无法解压文件");
+        }
+#endif
       }
-      fs::remove(pluginTemp);
 
       dialog.emitFinished();
     },
-    .onWrite = [&file](auto data, auto size) {
-      file.write(reinterpret_cast<const char*>(data), size);
-    },
   };
   connect(&dialog, &DownloadingDlg::Terminate, &dialog, std::bind(&HttpLib::ExitAsync, &clt), Qt::DirectConnection);
 
+#ifdef _WIN32
+  clt.GetAsync(pluginTemp, std::move(callback));
+#else
+  callback.onWrite = [&](const void* data, size_t size) {
+    if (digest) hash.Write(data, size);
+    archive.Write(data, size);
+  };
   clt.GetAsync(std::move(callback));
+#endif
   dialog.exec();
 
   return result;
 }
 
+std::optional<HttpHashSink::Digest> ItemBase::GetSha256(const std::u8string& archive) const
+{
+  auto const data = PluginCenter::m_Instance->m_PluginData;
+  if (!data) return std::nullopt;
+
+  auto& plugins = data->find(u8"Plugins")->second;
+  auto const plugin = plugins.find(m_PluginName);
+  if (plugin == plugins.endO()) return std::nullopt;
+
+  auto const digests = plugin->second.find(u8"Sha256");
+  if (digests == plugin->second.endO() || !digests->second.isObject()) return std::nullopt;
+
+  auto const digest = digests->second.find(archive);
+  if (digest == digests->second.endO() || !digest->second.isString()) return std::nullopt;
+  return HttpHashSink::FromHex(digest->second.getValueString());
+}
+
+#ifdef _WIN32
 bool ItemBase::ExtractZip(const fs::path& zipFile, const fs::path& dstDir)
 {
   std::error_code error;
@@ -159,23 +203,13 @@ bool ItemBase::ExtractZip(const fs::path& zipFile, const fs::path& dstDir)
     mgr->ShowMsgbox("失败", std::format("创建文件夹失败，错误码：{}。", error.value()));
     return false;
   }
-#ifdef _WIN32
   // auto temp = pluginTemp.string();
   // auto dst = pluginDst.string();
   auto zip = zipFile.string();
   auto dst = dstDir.string();
   return zip_extract(zip.c_str(), dst.c_str(), nullptr, nullptr) >= 0;
-#else
-  QProcess process;
-  const auto ret = process.execute("tar", QStringList {
-    QStringLiteral("-xzf"),
-    QString::fromStdWString(zipFile.wstring()),
-    QStringLiteral("-C"),
-    QString::fromStdWString(dstDir.wstring())
-  });
-  return ret == 0;
-#endif
 }
+#endif
 
 void ItemBase::PluginInstall()
 {
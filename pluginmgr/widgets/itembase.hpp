@@ -4,6 +4,7 @@
 #include <QWidget>
 #include <array>
 #include <yjson/yjson.h>
+#include <neobox/httphashsink.h>
 
 class QLabel;
 
@@ -21,6 +22,7 @@ protected:
   static void SetVersionLabel(std::wstring_view preText,
       Version& version, class QLabel*);
   bool PluginDownload();
+  std::optional<HttpHashSink::Digest> GetSha256(const std::u8string& archive) const;
   virtual void DoFinished(FinishedType type, bool ok) = 0;
 public slots:
   void PluginUninstall();
@@ -50,7 +52,9 @@ private:
 private:
   void SetupUi();
   void UpdateUi();
+#ifdef _WIN32
   static bool ExtractZip(const std::filesystem::path& zipFile, const std::filesystem::path& dstDir);
+#endif
 };
 
 #endif // ITEMBASE_HPP
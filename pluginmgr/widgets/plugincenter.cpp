@@ -95,7 +95,8 @@ bool PluginCenter::UpdatePluginData()
 {
   if (m_PluginData) return true;
   auto const url = m_RawUrl + u8"plugins.json"s;
-  auto result = DownloadFile(url);
+  // Open from the cached list at once, it is refreshed for the next time.
+  auto result = DownloadFile(url, true);
   if (result.empty()) {
     return false;
   }
@@ -105,7 +106,7 @@ bool PluginCenter::UpdatePluginData()
   return true;
 }
 
-std::string PluginCenter::DownloadFile(std::u8string_view url)
+std::string PluginCenter::DownloadFile(std::u8string_view url, bool stale)
 {
   std::string result;
 
@@ -117,7 +118,12 @@ std::string PluginCenter::DownloadFile(std::u8string_view url)
   DownloadingDlg dialog(this);
 
   HttpLib clt(url, true, 3s);
+  clt.SetHttp2(true);
+  clt.SetPriority(HttpScheduler::Priority::Interactive);
+  clt.SetRetry({ .retries = 3, .hedgePercentile = 0.95 });
   clt.SetHeader(u8"User-Agent", u8"Libcurl in Neobox App/1.0");
+  clt.SetCache(mgr->GetJunkDir() / u8"httpcache", stale ?
+    HttpCache::Mode::StaleWhileRevalidate : HttpCache::Mode::Revalidate);
 
   HttpLib::Callback callback = {
     .onProcess = std::bind(&DownloadingDlg::emitProcess,
@@ -12,7 +12,7 @@ public:
   virtual ~PluginCenter();
 public:
   bool UpdatePluginData();
-  std::string DownloadFile(std::u8string_view url);
+  std::string DownloadFile(std::u8string_view url, bool stale = false);
 private:
   void SetupUi();
   void InitConnect();
@@ -6,6 +6,7 @@
 #include <ui_tabnetproxy.h>
 #include <neobox/pluginobject.h>
 #include <neobox/httplib.h>
+#include <neobox/httpmonitor.h>
 
 #include <QIntValidator>
 #include <QButtonGroup>
@@ -54,10 +55,13 @@ void TabNetProxy::SaveData()
   HttpLib::m_Proxy->SetProxy(toU8(ui->lineProxy->text()), false);
   HttpLib::m_Proxy->SetUsername(toU8(ui->lineUsername->text()), false);
   HttpLib::m_Proxy->SetPassword(toU8(ui->linePassword->text()), false);
+  HttpLib::m_Proxy->SetBypass(toU8(ui->lineBypass->text()), false);
   // HttpLib::m_Proxy.port = m_Port = ui->linePort->text().toInt();
 
   HttpLib::m_Proxy->SetType(m_BtnGroup->checkedId(), false);
   HttpLib::m_Proxy->SaveData();
+  HttpLib::FlushCache();
+  HttpMonitor::Instance().Refresh();
   mgr->ShowMsg("保存成功~");
 }
 
@@ -71,6 +75,7 @@ void TabNetProxy::InitData()
   ui->lineProxy->setText(toQs(HttpLib::m_Proxy->GetProxy()));
   ui->linePassword->setText(toQs(HttpLib::m_Proxy->GetPassword()));
   ui->lineUsername->setText(toQs(HttpLib::m_Proxy->GetUsername()));
+  ui->lineBypass->setText(toQs(HttpLib::m_Proxy->GetBypass()));
 
   ui->gBoxProxyInfo->setEnabled(m_BtnGroup->checkedId() == static_cast<int>(HttpProxy::Type::User));
 }